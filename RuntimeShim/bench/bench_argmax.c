@@ -0,0 +1,64 @@
+// bench_argmax.c
+//
+// Compares the dispatched argmax / top-k kernels against the scalar loops across vocab
+// sizes. Use SONIFIED_KERNELS_ISA=avx2 to time the AVX2 path on an AVX-512 host.
+
+#include "sonified_kernels.h"
+#include "sonified_platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static uint32_t g_rng = 0xC0FFEEu;
+static float rand_logit(void) {
+    g_rng ^= g_rng << 13; g_rng ^= g_rng >> 17; g_rng ^= g_rng << 5;
+    return (float)(g_rng % 200000) / 10000.0f - 10.0f;
+}
+
+// The loop llm_eval used before the kernels existed.
+static int32_t argmax_legacy(const float * logits, int32_t n) {
+    int best = 0;
+    float best_v = logits[0];
+    for (int i = 1; i < n; ++i) {
+        const float v = logits[i];
+        if (v > best_v) { best_v = v; best = i; }
+    }
+    return best;
+}
+
+static volatile int32_t g_sink;
+
+int main(void) {
+    const int32_t sizes[] = { 32000, 50257, 128256, 151936, 201088, 262144 };
+    const int32_t k = 40;
+    int32_t idx[64];
+    float val[64];
+    printf("isa: %s\n", sl_kernels_isa());
+    printf("   vocab   legacy argmax   simd argmax  speedup   scalar top%d   simd top%d  speedup\n", k, k);
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        const int32_t n = sizes[s];
+        float * x = (float *)malloc(sizeof(float) * (size_t)n);
+        for (int32_t i = 0; i < n; ++i) x[i] = rand_logit();
+        const int reps = (int)(200000000 / n) + 10;
+
+        double t0 = sl_now_ms();
+        for (int r = 0; r < reps; ++r) { x[r % n] += 1e-6f; g_sink = argmax_legacy(x, n); }
+        double t_legacy = (sl_now_ms() - t0) * 1000.0 / reps;
+
+        t0 = sl_now_ms();
+        for (int r = 0; r < reps; ++r) { x[r % n] += 1e-6f; g_sink = sl_argmax_f32(x, n); }
+        double t_simd = (sl_now_ms() - t0) * 1000.0 / reps;
+
+        t0 = sl_now_ms();
+        for (int r = 0; r < reps; ++r) { x[r % n] += 1e-6f; g_sink = sl_topk_f32_scalar(x, n, k, idx, val); }
+        double t_topk_scalar = (sl_now_ms() - t0) * 1000.0 / reps;
+
+        t0 = sl_now_ms();
+        for (int r = 0; r < reps; ++r) { x[r % n] += 1e-6f; g_sink = sl_topk_f32(x, n, k, idx, val); }
+        double t_topk_simd = (sl_now_ms() - t0) * 1000.0 / reps;
+
+        printf("%8d  %11.1f us  %9.1f us  %6.2fx  %11.1f us  %8.1f us  %6.2fx\n",
+               n, t_legacy, t_simd, t_legacy / t_simd, t_topk_scalar, t_topk_simd, t_topk_scalar / t_topk_simd);
+        free(x);
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+// bench_embed.c
+//
+// Embedding throughput against batch size: embeds the same set of short texts through
+// llm_embed in calls of 1, 2, 4, ... texts and reports embeddings per second for each.
+// Texts in one call share llama_decode calls, so throughput should climb with the batch.
+//
+//   bench_embed model.gguf [texts] [words_per_text]
+
+#include "sonified_llama.h"
+#include "sonified_platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char * make_text(int i, int words) {
+    static const char * filler[] = { "local", "models", "embed", "short", "passages", "for", "retrieval", "on", "device" };
+    const size_t cap = 32 + (size_t)words * 12;
+    char * p = (char *)malloc(cap);
+    int n = snprintf(p, cap, "passage %d:", i);
+    for (int w = 0; w < words; ++w) {
+        n += snprintf(p + n, cap - (size_t)n, " %s", filler[(i + w * 7) % 9]);
+    }
+    return p;
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s model.gguf [texts] [words_per_text]\n", argv[0]);
+        return 2;
+    }
+    const int n_texts = argc > 2 ? atoi(argv[2]) : 256;
+    const int words = argc > 3 ? atoi(argv[3]) : 24;
+
+    llm_handle_t h = llm_init(argv[1]);
+    if (!h) {
+        fprintf(stderr, "llm_init failed: %s\n", llm_last_error_message());
+        return 1;
+    }
+    const int dim = llm_embed_dim(h);
+    char ** texts = (char **)malloc(sizeof(char *) * (size_t)n_texts);
+    float * out = (float *)malloc(sizeof(float) * (size_t)n_texts * (size_t)dim);
+    for (int i = 0; i < n_texts; ++i) texts[i] = make_text(i, words);
+
+    // warm-up: creates the embedding context and faults in the weights
+    llm_embed(h, (const char **)texts, n_texts < 8 ? n_texts : 8, out, dim);
+
+    printf("dim %d, %d texts of %d words\n", dim, n_texts, words);
+    printf("batch  embeddings/s  ms/call\n");
+    for (int b = 1; b <= n_texts && b <= 256; b *= 2) {
+        const double t0 = sl_now_ms();
+        int calls = 0, failed = 0;
+        for (int i = 0; i < n_texts; i += b, ++calls) {
+            const int n = n_texts - i < b ? n_texts - i : b;
+            if (llm_embed(h, (const char **)texts + i, n, out + (size_t)i * (size_t)dim, dim) != 0) failed = 1;
+        }
+        const double ms = sl_now_ms() - t0;
+        if (failed) {
+            fprintf(stderr, "llm_embed failed at batch %d: %s\n", b, llm_last_error_message());
+            break;
+        }
+        printf("%5d  %12.1f  %7.2f\n", b, n_texts * 1000.0 / ms, ms / calls);
+    }
+
+    for (int i = 0; i < n_texts; ++i) free(texts[i]);
+    free(texts);
+    free(out);
+    llm_free(h);
+    return 0;
+}
@@ -0,0 +1,90 @@
+// bench_threads.c
+//
+// Sweeps llama.cpp thread counts on this host and reports prefill and decode throughput
+// for each, then the best setting per phase. The detected defaults are always included.
+//
+//   bench_threads model.gguf [prompt_words] [decode_tokens]
+
+#include "sonified_llama.h"
+#include "sonified_platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void noop_cb(const char * t, void * u) { (void)t; (void)u; }
+
+static int cmp_int(const void * a, const void * b) { return *(const int *)a - *(const int *)b; }
+
+// Each run starts with a distinct line so KV prefix reuse never skips the prefill.
+static char * make_prompt(int run, int words) {
+    static const char * filler[] = { "the", "quick", "brown", "fox", "jumps", "over", "the", "lazy", "dog" };
+    const size_t cap = 32 + (size_t)words * 8;
+    char * p = (char *)malloc(cap);
+    int n = snprintf(p, cap, "run %d:\n", run);
+    for (int i = 0; i < words; ++i) {
+        n += snprintf(p + n, cap - (size_t)n, "%s ", filler[i % 9]);
+    }
+    return p;
+}
+
+int main(int argc, char ** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s model.gguf [prompt_words] [decode_tokens]\n", argv[0]);
+        return 2;
+    }
+    const int words = argc > 2 ? atoi(argv[2]) : 512;
+    const int decode_tokens = argc > 3 ? atoi(argv[3]) : 64;
+    const int reps = 2;
+
+    const int avail = sl_available_cpus();
+    const int cores = sl_physical_cores();
+    int def_decode = 1, def_prefill = 1;
+    sl_default_threads(&def_decode, &def_prefill);
+    printf("cpus available %d, physical cores %d, default threads decode %d / prefill %d\n",
+           avail, cores, def_decode, def_prefill);
+
+    llm_handle_t h = llm_init(argv[1]);
+    if (!h) {
+        fprintf(stderr, "llm_init failed: %s\n", llm_last_error_message());
+        return 1;
+    }
+
+    int counts[64];
+    int n_counts = 0;
+    for (int t = 1; t <= avail && n_counts < 60; t = t < 4 ? t + 1 : t + t / 2) counts[n_counts++] = t;
+    counts[n_counts++] = avail;
+    counts[n_counts++] = cores;
+    counts[n_counts++] = def_decode;
+    qsort(counts, (size_t)n_counts, sizeof(int), cmp_int);
+
+    printf("threads  prefill tok/s  decode tok/s\n");
+    int run = 0;
+    int best_prefill_t = 0, best_decode_t = 0;
+    double best_prefill = 0.0, best_decode = 0.0;
+    for (int i = 0; i < n_counts; ++i) {
+        if (i > 0 && counts[i] == counts[i - 1]) continue;
+        const int t = counts[i];
+        llm_set_threads(h, t, t);
+        double prefill = 0.0, decode = 0.0;
+        for (int r = 0; r < reps; ++r) {
+            char * prompt = make_prompt(run++, words);
+            llm_gen_opts_t o = {0};
+            o.max_tokens = decode_tokens;
+            llm_stats_t s = {0};
+            if (llm_eval(h, prompt, &o, noop_cb, NULL) == 0 && llm_stats(h, &s) == 0) {
+                const int prefilled = s.prompt_tokens - s.prompt_tokens_reused;
+                if (s.prefill_ms > 0.0f && prefilled * 1000.0 / s.prefill_ms > prefill) prefill = prefilled * 1000.0 / s.prefill_ms;
+                if (s.tok_per_sec > decode) decode = s.tok_per_sec;
+            }
+            free(prompt);
+        }
+        printf("%7d  %13.1f  %12.1f\n", t, prefill, decode);
+        if (prefill > best_prefill) { best_prefill = prefill; best_prefill_t = t; }
+        if (decode > best_decode) { best_decode = decode; best_decode_t = t; }
+    }
+    printf("best: decode %d threads (%.1f tok/s), prefill %d threads (%.1f tok/s)\n",
+           best_decode_t, best_decode, best_prefill_t, best_prefill);
+    printf("SONIFIED_THREADS=%d SONIFIED_THREADS_BATCH=%d\n", best_decode_t, best_prefill_t);
+    llm_free(h);
+    return 0;
+}
@@ -1,7 +1,8 @@
 // sonified_llama.h
 //
 // C-compatible runtime shim API for Sonified LLM runtime.
-// This header is a scaffold; it is not currently wired into any build.
+// Built into the XCFramework by scripts/build_runtime_static.sh (macOS) and as
+// libsonified_llama via RuntimeShim/CMakeLists.txt (Linux/macOS).
 // Keep it self-contained, portable C, with minimal assumptions.
 
 #ifndef SONIFIED_LLAMA_H
@@ -17,14 +18,51 @@ typedef void* llm_handle_t;
 // Token callback: receives each generated token as UTF-8 and a user context
 typedef void (*llm_token_cb)(const char* token_utf8, void* user_ctx);
 
-// Generation options (integers/floats only)
-// TODO: Expand with Metal / llama.cpp-specific parameters (GPU layers, threads, batch size, etc.)
+// Batched token callback: n_tokens pieces back to back in one NUL-terminated UTF-8 buffer;
+// piece i spans utf8[offsets[i], offsets[i + 1]) (offsets has n_tokens + 1 entries, starting
+// at 0). Both buffers are owned by the runtime and valid only during the call.
+typedef void (*llm_token_batch_cb)(const char* utf8, const int* offsets, int n_tokens, void* user_ctx);
+
+// Added to one token's logit before sampling; -INFINITY bans the token.
+typedef struct llm_logit_bias_t {
+    int   token; // id from llm_token_id or llm_tokenize
+    float bias;
+} llm_logit_bias_t;
+
+// Generation options (scalars, plus borrowed stop strings and logit biases read during the
+// call). Load-time knobs live in llm_init_params_t.
+// Zero-initialized fields select the documented default, so callers may memset and fill selectively.
 typedef struct llm_gen_opts_t {
     int   context_length; // e.g., 4096
-    float temperature;    // e.g., 0.2
-    float top_p;          // e.g., 0.9
+    float temperature;    // e.g., 0.2; <= 0 selects greedy decoding
+    float top_p;          // e.g., 0.9; values outside (0,1) disable nucleus sampling
     int   max_tokens;     // upper bound on tokens to generate
     int   seed;           // <= 0 means random
+    // Sampler chain (applied as: repeat penalty -> top_k -> top_p -> min_p -> temperature -> draw)
+    int   top_k;          // keep the k most likely tokens; <= 0 disables
+    float min_p;          // drop tokens below min_p * p(best); <= 0 disables
+    float repeat_penalty; // > 1 penalizes tokens seen in the last penalty_last_n, (0,1) favours
+                          // them (sampled over the whole vocabulary); 0 or 1 disables
+    int   penalty_last_n; // repeat-penalty window in tokens; <= 0 means 64
+    // Prefill
+    int   prefill_chunk;  // prompt tokens per llama_decode (capped at n_batch); <= 0 sizes chunks
+                          // adaptively to ~100 ms so llm_cancel is observed within the 150 ms contract
+    // Speculation
+    int   prompt_lookup;  // 1 = draft-free speculation: propose the tokens that followed an earlier
+                          // occurrence of the last few tokens (prompt or output) and verify them in one
+                          // llama_decode. Output is unchanged. Tried before the draft model; 0 disables
+    // Constrained decoding
+    int   constraint;     // id from llm_constraint_create; 0 = none. Disables speculation
+    // Stopping: generation ends on the token that completes a condition, and text after
+    // the end of the match in that token is not emitted (llm_stats_t.stop_reason says why)
+    const char* const* stop; // n_stop literal strings (at most 16 of up to 128 bytes each)
+    int   n_stop;
+    int   stop_tool_call; // 1 = end when a {"tool":...} object closes (braces balanced outside strings)
+    // Logit bias: applied in place to each step's logits, before the sampler chain and any
+    // constraint. Biases for a repeated id add up; ids must be in the vocabulary and biases
+    // finite or -INFINITY, or the call fails with EINVAL
+    const llm_logit_bias_t* logit_bias;
+    int   n_logit_bias;
 } llm_gen_opts_t;
 
 // Runtime statistics snapshot (integers/floats only)
@@ -38,12 +76,88 @@ typedef struct llm_stats_t {
     int   prompt_tokens;      // tokens consumed by prompt/prefill
     int   completion_tokens;  // tokens generated in completion
     int   total_tokens;       // prompt + completion
+    float sample_ms;          // time spent choosing tokens (sampler chain), summed over the run
+    int   prompt_tokens_reused; // prompt tokens served from the KV cache of the previous call (not re-prefilled)
+    // Prefill timing
+    float prefill_ms;           // time spent decoding prompt chunks
+    int   prefill_chunks;       // number of prefill llama_decode calls
+    float prefill_chunk_max_ms; // slowest single chunk (bounds cancellation latency during prefill)
+    // KV cache memory
+    long long kv_cache_bytes;   // K+V allocated for the context's cells at the configured types
+    int   kv_cells_used;        // cells holding this sequence's tokens at the end of the run
+    // Speculative decoding (llm_init_params_t.draft_model_path, llm_gen_opts_t.prompt_lookup);
+    // tok_per_sec above is the effective rate including accepted proposals
+    int   spec_drafted;         // tokens proposed by the draft model or prompt lookup
+    int   spec_accepted;        // proposals the target agreed with (emitted without a target step of their own)
+    float spec_accept_rate;     // spec_accepted / spec_drafted, 0 when nothing was drafted
+    int   spec_lookup_drafted;  // the prompt-lookup share of spec_drafted
+    int   spec_lookup_accepted; // the prompt-lookup share of spec_accepted
+    // Prefix cache (llm_init_params_t.prefix_cache_mb; llm_submit sequences only): handle
+    // totals when the sequence finished. prompt_tokens_reused counts the pages it was given.
+    int   prefix_cache_hits;
+    int   prefix_cache_misses;
+    int   stop_reason;          // llm_stop_reason
 } llm_stats_t;
 
+// Why a generation ended (llm_stats_t.stop_reason).
+typedef enum llm_stop_reason {
+    LLM_STOP_EOG        = 0, // end-of-generation token (or nothing left to generate)
+    LLM_STOP_MAX_TOKENS = 1,
+    LLM_STOP_STRING     = 2, // llm_gen_opts_t.stop
+    LLM_STOP_TOOL_CALL  = 3, // llm_gen_opts_t.stop_tool_call
+    LLM_STOP_CANCELLED  = 4,
+    LLM_STOP_CONTEXT    = 5, // context window full
+    LLM_STOP_CONSTRAINT = 6  // no token could continue the constraint: the value is unfinished
+} llm_stop_reason;
+
+// KV cache element type (llm_init_params_t.type_k / type_v).
+typedef enum llm_kv_type {
+    LLM_KV_TYPE_DEFAULT = 0, // llama.cpp default (f16)
+    LLM_KV_TYPE_F16     = 1,
+    LLM_KV_TYPE_BF16    = 2,
+    LLM_KV_TYPE_F32     = 3,
+    LLM_KV_TYPE_Q8_0    = 4,
+    LLM_KV_TYPE_Q4_0    = 5
+} llm_kv_type;
+
+// Load-time parameters for llm_init_ex. Start from llm_init_params_default() and set
+// struct_size = sizeof(llm_init_params_t): fields beyond the caller's struct_size keep
+// their defaults, so callers built against an older header stay compatible.
+typedef struct llm_init_params_t {
+    int struct_size;     // sizeof(llm_init_params_t) as compiled by the caller
+    int n_ctx;           // context tokens; 0 = SONIFIED_CTX or 4096
+    int n_batch;         // max tokens per llama_decode; 0 = llama.cpp default
+    int n_ubatch;        // physical micro-batch; 0 = llama.cpp default
+    int n_threads;       // decode threads; 0 = auto (see llm_set_threads)
+    int n_threads_batch; // prefill threads; 0 = auto
+    int n_gpu_layers;    // layers to offload; -1 = all on Apple Silicon, none elsewhere
+    int use_mmap;        // map the model file instead of reading it (default 1)
+    int use_mlock;       // pin model pages in RAM (default 0)
+    int type_k;          // llm_kv_type for cached keys
+    int type_v;          // llm_kv_type for cached values; quantized V requires flash attention
+    int flash_attn;      // 1 = on, 0 = off, -1 = auto (on when type_v is quantized)
+    int n_seq_max;       // concurrent sequences for llm_submit; 0 = 4
+    // Speculative decoding for llm_eval: a small model sharing the target's vocabulary
+    // proposes n_draft tokens per step, verified in one target llama_decode. Output is
+    // unchanged; only the number of target steps drops. NULL disables it.
+    const char* draft_model_path; // loaded with the same mmap/mlock/GPU settings; read during llm_init_ex only
+    int n_draft;                  // proposals per step; 0 = 6
+    // Prefix cache for llm_submit: prompts sharing 64-token pages with an earlier one (same
+    // system prompt and tool schemas) copy those KV cells instead of prefilling them. The
+    // budget is extra KV cache, allocated with the scheduler context. 0 disables it.
+    int prefix_cache_mb;
+} llm_init_params_t;
+
+// Defaults for every field, with struct_size filled in.
+llm_init_params_t llm_init_params_default(void);
+
 // Initialize a runtime instance for the given model path.
-// Returns an opaque handle, or NULL on failure.
-// TODO: Add additional parameters for tokenizer overrides, quantization hints, device selection, etc.
-llm_handle_t llm_init(const char* model_path /*, params TBD */);
+// Returns an opaque handle, or NULL on failure. Equivalent to llm_init_ex(model_path, NULL).
+llm_handle_t llm_init(const char* model_path);
+
+// Initialize with explicit load-time parameters (NULL = defaults). Parameters are per
+// handle, so handles with different contexts can coexist in one process.
+llm_handle_t llm_init_ex(const char* model_path, const llm_init_params_t* params);
 
 // Retrieve the last error code from the most recent API call on the current thread.
 // Returns 0 if no error was recorded.
@@ -56,21 +170,293 @@ const char* llm_last_error_message(void);
 // Evaluate/generate from a prompt using the given options.
 // Returns 0 on success, non-zero on error.
 // Tokens are streamed through the provided callback.
+// The KV cache persists across calls on the same handle: the longest token prefix shared
+// with the previous call (prompt + generated tokens) is reused instead of re-prefilled, so
+// append-only multi-turn prompts only pay for the new suffix. Tokenization is incremental
+// the same way: a prompt that extends the previous one only has its tail tokenized.
 int llm_eval(llm_handle_t h,
              const char* prompt_utf8,
              const llm_gen_opts_t* opts,
              llm_token_cb cb,
              void* user_ctx);
 
-// Request cancellation of the current generation (best-effort, async-safe intent).
+// Same as llm_eval, but pieces are coalesced and delivered through cb once max_batch_tokens
+// are pending or the oldest pending piece is max_batch_us old, whichever comes first
+// (checked as pieces arrive; <= 0 selects 16 pieces / 20000 us). The first piece is
+// delivered alone so time-to-first-token is unaffected, and anything pending is delivered
+// before the call returns, including after cancellation.
+int llm_eval_batched(llm_handle_t h,
+                     const char* prompt_utf8,
+                     const llm_gen_opts_t* opts,
+                     int max_batch_tokens,
+                     int max_batch_us,
+                     llm_token_batch_cb cb,
+                     void* user_ctx);
+
+// ---- Token log-probabilities ----
+// llm_eval_logprobs reports, with each generated token, its log-probability and the most
+// likely alternatives at that position. They are taken from the model's distribution after
+// logit_bias, before temperature and the other sampler stages, in one fused log-softmax +
+// partial top-k pass over the logits row. The pass is only paid by callers that ask for it.
+// A constraint does not renormalize them: inside a constrained value, where tokens are drawn
+// from the allowed set alone, the alternatives may include tokens it would never allow.
+
+#define LLM_TOP_LOGPROBS_MAX 20
+
+typedef struct llm_token_logprob_t {
+    int   token;
+    float logprob; // natural log
+} llm_token_logprob_t;
+
+typedef struct llm_token_info_t {
+    int         token;   // generated token id; -1 for a final entry carrying bytes cut off at the end
+    const char* text;    // UTF-8 it adds to the output, NUL-terminated; may be "" while a
+                         // character split across tokens is completed by the next one
+    float       logprob; // log-probability of token
+    int         n_top;   // entries in top, most likely first
+    llm_token_logprob_t top[LLM_TOP_LOGPROBS_MAX];
+} llm_token_info_t;
+
+// info and its text are owned by the runtime and valid only during the call.
+typedef void (*llm_token_info_cb)(const llm_token_info_t* info, void* user_ctx);
+
+// Same as llm_eval, with one callback per generated token carrying top_logprobs
+// (0..LLM_TOP_LOGPROBS_MAX) alternatives. Returns -1 if top_logprobs is out of range.
+// Handles without a model report token -1 and logprob 0.
+int llm_eval_logprobs(llm_handle_t h,
+                      const char* prompt_utf8,
+                      const llm_gen_opts_t* opts,
+                      int top_logprobs,
+                      llm_token_info_cb cb,
+                      void* user_ctx);
+
+// ---- Stream ring ----
+// llm_eval_stream writes generated text into a single-producer/single-consumer byte ring
+// instead of calling back into the caller, so consumer work never runs on the decode
+// thread and consumer jitter only reaches decode through the chosen overflow policy.
+// Drain the ring from another thread with llm_stream_read while llm_eval_stream runs.
+
+typedef void* llm_stream_t;
+
+typedef enum llm_stream_overflow {
+    LLM_STREAM_BLOCK = 0, // decode waits for the reader when full (llm_cancel still interrupts it)
+    LLM_STREAM_DROP  = 1, // pieces that do not fit are discarded and counted
+    LLM_STREAM_GROW  = 2  // the ring doubles as needed; memory is bounded only by the output
+} llm_stream_overflow;
+
+// capacity_bytes <= 0 selects 64 KiB (rounded up to a power of two). Returns NULL on failure.
+llm_stream_t llm_stream_create(int capacity_bytes, int overflow);
+
+// Same as llm_eval with the pieces written to stream, which is closed when the call returns
+// (one generation per stream; a closed stream is rejected). Returns as llm_eval.
+int llm_eval_stream(llm_handle_t h,
+                    const char* prompt_utf8,
+                    const llm_gen_opts_t* opts,
+                    llm_stream_t stream);
+
+// Copy up to max_bytes of generated UTF-8 into out (no NUL; never ends inside a character
+// when max_bytes >= 4). Waits up to timeout_ms for data (0 = non-blocking, < 0 = indefinitely).
+// Returns the bytes read, 0 on timeout, or -1 once the stream is closed and drained.
+int llm_stream_read(llm_stream_t stream, char* out, int max_bytes, int timeout_ms);
+
+// Same, but first waits up to timeout_ms for min_pieces tokens written since the previous read
+// (or a full ring, or the end of the stream), then returns whatever is buffered: 0 when
+// nothing is. min_pieces <= 1 behaves as llm_stream_read.
+int llm_stream_read_batch(llm_stream_t stream, char* out, int max_bytes, int min_pieces, int timeout_ms);
+
+// Pieces discarded under LLM_STREAM_DROP so far.
+long long llm_stream_dropped(llm_stream_t stream);
+
+// Neither llm_eval_stream nor llm_stream_read may still be running on the stream. Safe with NULL.
+void llm_stream_free(llm_stream_t stream);
+
+// Request cancellation of every generation on the handle, the llm_eval* call and all
+// llm_submit sequences (best-effort, async-safe intent). Observed between prefill chunks
+// and between decode steps.
 void llm_cancel(llm_handle_t h);
 
+// Same, for the llm_eval* generation alone; llm_submit sequences keep going.
+void llm_cancel_eval(llm_handle_t h);
+
 // Free the runtime and any allocated resources. Safe to call with NULL.
 void llm_free(llm_handle_t h);
 
 // Retrieve the latest stats into out_stats. Returns 0 on success.
 int llm_stats(llm_handle_t h, llm_stats_t* out_stats);
 
+// Thread counts used by llama.cpp on this handle: n_decode for single-token decode steps,
+// n_prefill for prompt batches. Values <= 0 restore the default, detected from the
+// physical cores usable by the process (affinity mask and cgroup CPU quota honored) or
+// taken from SONIFIED_THREADS / SONIFIED_THREADS_BATCH. Takes effect from the next eval
+// (or scheduler step); do not call concurrently with llm_eval. Returns 0 on success.
+int llm_set_threads(llm_handle_t h, int n_decode, int n_prefill);
+int llm_get_threads(llm_handle_t h, int* n_decode, int* n_prefill);
+
+// ---- Continuous batching ----
+// A handle can serve many generations at once. llm_submit queues a request and returns its
+// sequence id; a scheduler thread owned by the handle admits queued requests into free
+// slots between decode steps, advances every active sequence (prefill chunks and decode
+// tokens) with a single llama_decode per step, and retires finished ones immediately.
+// It runs on its own context over the same weights, independent of llm_eval.
+
+#define LLM_SEQ_TEXT_MAX 128
+
+typedef enum llm_seq_event_kind {
+    LLM_SEQ_EVENT_TOKEN = 1, // text/text_len hold the next piece of output
+    LLM_SEQ_EVENT_DONE  = 2, // terminal; stats are final (success = 0 when cancelled)
+    LLM_SEQ_EVENT_ERROR = 3  // terminal; error_code holds the failure code
+} llm_seq_event_kind;
+
+typedef struct llm_seq_event_t {
+    int         seq;                    // id returned by llm_submit
+    int         branch;                 // index of seq among llm_submit_n's ids (0 otherwise)
+    int         kind;                   // llm_seq_event_kind
+    int         error_code;             // LLM_SEQ_EVENT_ERROR only
+    int         text_len;               // bytes in text (LLM_SEQ_EVENT_TOKEN only)
+    char        text[LLM_SEQ_TEXT_MAX]; // NUL-terminated UTF-8; long pieces span several events
+    llm_stats_t stats;                  // terminal events only
+} llm_seq_event_t;
+
+// Queue a generation. Returns a sequence id > 0, or a negative error code.
+// opts, its stop strings, logit bias and the prompt are copied.
+int llm_submit(llm_handle_t h, const char* prompt_utf8, const llm_gen_opts_t* opts);
+
+// Queue n generations of one prompt, e.g. candidates to rank: the prompt is prefilled once,
+// its KV cache forked to every branch (llama_kv_self_seq_cp), and the branches then decode
+// together, a token each per step. Branch k samples with seed opts->seed + k (independent
+// random seeds when opts->seed <= 0), so use a temperature above 0. Writes the n sequence
+// ids to out_seqs, which poll and cancel like llm_submit's; their events carry branch = k.
+// Returns 0, or a negative error code (-1 also when n is < 1 or above n_seq_max).
+int llm_submit_n(llm_handle_t h, const char* prompt_utf8, const llm_gen_opts_t* opts, int n, int* out_seqs);
+
+// Drain up to max_events events, in order, for seq (or for any sequence when seq == 0).
+// Blocks up to timeout_ms for the first event (0 = non-blocking, < 0 = wait indefinitely).
+// Returns the number of events written, or -1 if seq is unknown (e.g. already drained).
+// A sequence's storage is released once its terminal event has been returned.
+int llm_poll(llm_handle_t h, int seq, llm_seq_event_t* out_events, int max_events, int timeout_ms);
+
+// Cancel one sequence. It finishes with a DONE event (success = 0) at the next step.
+// Returns 0, or -1 if seq is unknown. llm_cancel cancels every sequence on the handle.
+int llm_cancel_seq(llm_handle_t h, int seq);
+
+// ---- Tokenizer ----
+// Tokenize text exactly as llm_eval tokenizes a prompt (the model's BOS policy, special
+// tokens parsed), so the count is what the text will cost in the context. Returns the
+// number of tokens; out_tokens holds them only when that is <= max_tokens (pass NULL / 0
+// to count). Returns -1 on error (invalid arguments, stub handle).
+int llm_tokenize(llm_handle_t h, const char* text_utf8, int* out_tokens, int max_tokens);
+
+// Id of the single token text_utf8 encodes to, special tokens such as "<|user|>" parsed and
+// no BOS added, for llm_gen_opts_t.logit_bias. Answers are cached per handle, so repeat
+// lookups skip the tokenizer. Returns the id, -2 when the text is not exactly one token, or
+// -1 on error (invalid arguments, stub handle, out of memory).
+int llm_token_id(llm_handle_t h, const char* text_utf8);
+
+// Render tokens as UTF-8 text, special tokens included, as llm_eval would stream them.
+// Returns the text length in bytes (excluding the NUL); out_buf holds the NUL-terminated
+// text only when that is < out_buf_len (pass NULL / 0 to measure). Returns -1 on error.
+int llm_detokenize(llm_handle_t h, const int* tokens, int n_tokens, char* out_buf, int out_buf_len);
+
+// ---- Incremental tokenization ----
+// A growing prompt (e.g. a conversation transcript) and its tokens. Appending tokenizes only
+// from a safe boundary near the old end: right after the last special token, or a few
+// tokens back with a check that the tokens before the boundary come out unchanged, so
+// merges across the join are redone and the result always equals tokenizing the whole text.
+typedef void* llm_tokens_t;
+
+// Tokenize text_utf8 (may be "") as llm_eval would. Returns NULL on error (invalid
+// arguments, stub handle, out of memory). Usable with any handle on the same model
+// file and load parameters; free it before the handle.
+llm_tokens_t llm_tokens_create(llm_handle_t h, const char* text_utf8);
+
+// Append suffix_utf8. Returns the new token count, or -1 on error.
+int llm_tokens_append(llm_tokens_t t, const char* suffix_utf8);
+
+// Token count, and the tokens produced by the last create/append (the rest were kept).
+int llm_tokens_count(llm_tokens_t t);
+int llm_tokens_retokenized(llm_tokens_t t);
+
+void llm_tokens_free(llm_tokens_t t);
+
+// llm_eval on a tokenized prompt: same options, callback, KV prefix reuse and return codes
+// (-1 also when t belongs to a different model).
+int llm_eval_tokens(llm_handle_t h,
+                    llm_tokens_t t,
+                    const llm_gen_opts_t* opts,
+                    llm_token_cb cb,
+                    void* user_ctx);
+
+// ---- Embeddings ----
+// Sentence embeddings from the loaded model, for retrieval without a second process.
+// Inputs are packed into as few llama_decode calls as fit (one sequence id per input) on a
+// context of their own, created on first use, so embedding does not touch the KV cache of
+// llm_eval or llm_submit and may run while they do.
+
+typedef enum llm_embed_pooling {
+    LLM_EMBED_MEAN = 0, // average of the token rows
+    LLM_EMBED_CLS  = 1, // first token (BERT-style [CLS]/BOS)
+    LLM_EMBED_LAST = 2  // last token (decoder-only embedding models)
+} llm_embed_pooling;
+
+typedef struct llm_embed_opts_t {
+    int pooling;   // llm_embed_pooling
+    int normalize; // 1 = scale each vector to unit L2 norm
+} llm_embed_opts_t;
+
+// Embedding width of the model (floats per vector), or -1 (stub handle).
+int llm_embed_dim(llm_handle_t h);
+
+// Embed texts[0..n) into out, n rows of dim floats; dim must equal llm_embed_dim. Texts are
+// tokenized as llm_eval tokenizes prompts and each must fit in n_batch tokens; one with no
+// tokens gets a zero vector. llm_embed uses mean pooling and L2 normalization; opts NULL
+// selects the same. Returns 0, or -1 invalid arguments / stub handle / no memory for the
+// embedding context, -2 tokenization failure, -3 a text longer than n_batch tokens, -4 decode
+// failure.
+int llm_embed(llm_handle_t h, const char** texts, int n, float* out, int dim);
+int llm_embed_ex(llm_handle_t h, const char** texts, int n, float* out, int dim, const llm_embed_opts_t* opts);
+
+// ---- Constrained decoding ----
+// Restrict sampling to output that matches a JSON schema, by masking the logits of every
+// token that cannot continue a valid value. A constraint is compiled once per handle and
+// referenced from llm_gen_opts_t.constraint by llm_eval, llm_eval_tokens and llm_submit.
+// Supported schema keywords: type, properties, required, items, minItems, maxItems and
+// string enum/const; properties are generated in schema order without extra keys, and any
+// other schema accepts any JSON value. When no token of the vocabulary can continue the
+// value, the generation ends there with stop_reason LLM_STOP_CONSTRAINT.
+
+typedef enum llm_constraint_kind {
+    LLM_CONSTRAINT_JSON      = 0, // spec is a JSON schema; the whole output is one value of it
+    LLM_CONSTRAINT_TOOL_CALL = 1  // spec is [{"name":...,"parameters":<schema>}, ...]; text is free until
+                                  // the model starts {"tool":, then the call must be
+                                  // {"tool":{"name":<a listed name>,"arguments":<its parameters>}}
+} llm_constraint_kind;
+
+// Compile a constraint. Returns an id > 0, or -1 invalid arguments / stub handle / too many
+// constraints (64 per handle), -2 spec is not valid JSON of the expected shape, -3 out of
+// memory. The first call also indexes the vocabulary.
+int llm_constraint_create(llm_handle_t h, int kind, const char* spec_json);
+
+// Release an id. Generations already using it finish under it. Returns 0, or -1 unknown id.
+int llm_constraint_free(llm_handle_t h, int id);
+
+// ---- Session state snapshots ----
+// Save the KV cache of the llm_eval sequence (the tokens of the last prompt and its
+// completion) to path, replacing it atomically. The file records the model fingerprint,
+// n_ctx and KV cache types. Returns the number of tokens saved, or a negative error:
+// -1 invalid arguments, stub handle, or a model file that cannot be read to fingerprint,
+// -2 I/O failure, -3 out of memory.
+// Not safe to call concurrently with llm_eval on the same handle.
+int llm_state_save(llm_handle_t h, const char* path);
+
+// Restore a snapshot written by llm_state_save into the llm_eval sequence, replacing its
+// KV cache. The file is memory-mapped, so restoring a long system prefix costs a copy into
+// the cache instead of a prefill; the next llm_eval reuses it as a shared prompt prefix.
+// Returns the number of tokens restored, or a negative error: -1 invalid arguments or stub
+// handle, -2 I/O failure or not a snapshot, -3 incompatible snapshot (different or
+// unfingerprinted model, KV cache types, or more tokens than n_ctx), -4 llama.cpp rejected the state (the cache is
+// left empty). llm_last_error_message describes the failure.
+int llm_state_load(llm_handle_t h, const char* path);
+
 // Retrieve the model's embedded chat template (read-only).
 // Copies up to out_buf_len-1 bytes into out_buf and always NUL-terminates on success.
 // Returns the number of bytes written (excluding NUL) or -1 if unavailable or on error.
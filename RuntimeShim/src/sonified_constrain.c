@@ -0,0 +1,1097 @@
+#include "sonified_constrain.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    TRIE_MAX_DEPTH  = 48, // longest piece in the trie; longer tokens are never allowed inside a value
+    JSON_DEPTH      = 24, // matcher nesting limit
+    JSON_WS_MAX     = 32, // whitespace bytes in a row between the tokens of a value
+    JSON_DIGITS_MAX = 24, // digits in one number
+    SCHEMA_ALT_MAX  = 64, // properties per object, strings per enum, tools per envelope
+    SPEC_DEPTH_MAX  = 64  // nesting limit when parsing a spec
+};
+
+// Text that opens a tool call (what ToolCallDetector looks for).
+static const char k_trigger[] = "{\"tool\":";
+enum { TRIGGER_LEN = sizeof(k_trigger) - 1 };
+
+// ---- vocabulary trie ----
+
+typedef struct tnode {
+    int32_t child;   // first child, -1 for a leaf
+    int32_t sibling;
+    int32_t tok;     // a token whose piece ends here (-1 if none); others in tok_next
+    uint8_t byte;
+} tnode;
+
+struct sl_vocab_trie {
+    tnode       * nodes;
+    int32_t       n_nodes;
+    int32_t       cap_nodes;
+    int32_t       n_vocab;
+    int32_t     * tok_next; // next token with the same piece
+    char        * blob;     // every token's piece back to back (special tokens render empty)
+    int32_t     * off;      // n_vocab + 1 offsets into blob
+    llama_token * plain;    // pieces that leave a JSON string body as it is
+    int32_t       n_plain;
+    llama_token * other;    // the remaining non-empty pieces
+    int32_t       n_other;
+    llama_token * colon;    // pieces with ':' before their last byte (may complete the trigger mid-token)
+    int32_t       n_colon;
+    llama_token * eog;
+    int32_t       n_eog;
+};
+
+static int32_t trie_child(sl_vocab_trie * t, int32_t u, uint8_t b) {
+    for (int32_t v = t->nodes[u].child; v >= 0; v = t->nodes[v].sibling) {
+        if (t->nodes[v].byte == b) return v;
+    }
+    if (t->n_nodes == t->cap_nodes) {
+        tnode * n = (tnode *)realloc(t->nodes, sizeof(tnode) * (size_t)t->cap_nodes * 2);
+        if (!n) return -1;
+        t->nodes = n;
+        t->cap_nodes *= 2;
+    }
+    const int32_t v = t->n_nodes++;
+    t->nodes[v] = (tnode){ -1, t->nodes[u].child, -1, b };
+    t->nodes[u].child = v;
+    return v;
+}
+
+sl_vocab_trie * sl_vocab_trie_build(const struct llama_vocab * vocab) {
+    sl_vocab_trie * t = (sl_vocab_trie *)calloc(1, sizeof(sl_vocab_trie));
+    if (!t) return NULL;
+    const int32_t n = llama_vocab_n_tokens(vocab);
+    size_t blob_cap = (size_t)n * 8 + 256, blob_len = 0;
+    t->n_vocab = n;
+    t->cap_nodes = 2 * n + 1;
+    t->nodes = (tnode *)malloc(sizeof(tnode) * (size_t)t->cap_nodes);
+    t->tok_next = (int32_t *)malloc(sizeof(int32_t) * (size_t)n);
+    t->off = (int32_t *)malloc(sizeof(int32_t) * ((size_t)n + 1));
+    t->blob = (char *)malloc(blob_cap);
+    t->plain = (llama_token *)malloc(sizeof(llama_token) * (size_t)n);
+    t->other = (llama_token *)malloc(sizeof(llama_token) * (size_t)n);
+    t->colon = (llama_token *)malloc(sizeof(llama_token) * (size_t)n);
+    t->eog = (llama_token *)malloc(sizeof(llama_token) * (size_t)n);
+    if (!t->nodes || !t->tok_next || !t->off || !t->blob || !t->plain || !t->other || !t->colon || !t->eog) {
+        sl_vocab_trie_free(t);
+        return NULL;
+    }
+    t->nodes[0] = (tnode){ -1, -1, -1, 0 };
+    t->n_nodes = 1;
+    char piece[256];
+    for (llama_token tok = 0; tok < n; ++tok) {
+        t->off[tok] = (int32_t)blob_len;
+        t->tok_next[tok] = -1;
+        if (llama_vocab_is_eog(vocab, tok)) t->eog[t->n_eog++] = tok;
+        const int32_t m = llama_token_to_piece(vocab, tok, piece, (int32_t)sizeof(piece), /*lstrip=*/0, /*special=*/false);
+        if (m <= 0) continue; // control tokens, or pieces too long to constrain
+        if (blob_len + (size_t)m > blob_cap) {
+            char * b = (char *)realloc(t->blob, blob_cap * 2);
+            if (!b) { sl_vocab_trie_free(t); return NULL; }
+            t->blob = b;
+            blob_cap *= 2;
+        }
+        memcpy(t->blob + blob_len, piece, (size_t)m);
+        blob_len += (size_t)m;
+        bool plain = true, colon = false;
+        for (int32_t i = 0; i < m; ++i) {
+            const unsigned char b = (unsigned char)piece[i];
+            if (b < 0x20 || b == '"' || b == '\\') plain = false;
+            if (b == ':' && i < m - 1) colon = true;
+        }
+        if (plain) t->plain[t->n_plain++] = tok;
+        else       t->other[t->n_other++] = tok;
+        if (colon) t->colon[t->n_colon++] = tok;
+        if (m > TRIE_MAX_DEPTH) continue;
+        int32_t u = 0;
+        for (int32_t i = 0; i < m && u >= 0; ++i) u = trie_child(t, u, (uint8_t)piece[i]);
+        if (u < 0) { sl_vocab_trie_free(t); return NULL; }
+        t->tok_next[tok] = t->nodes[u].tok;
+        t->nodes[u].tok = tok;
+    }
+    t->off[n] = (int32_t)blob_len;
+    return t;
+}
+
+void sl_vocab_trie_free(sl_vocab_trie * t) {
+    if (!t) return;
+    free(t->nodes);
+    free(t->tok_next);
+    free(t->off);
+    free(t->blob);
+    free(t->plain);
+    free(t->other);
+    free(t->colon);
+    free(t->eog);
+    free(t);
+}
+
+// ---- spec parsing (a small JSON DOM) ----
+
+enum { JV_NULL, JV_BOOL, JV_NUM, JV_STR, JV_ARR, JV_OBJ };
+
+typedef struct jv {
+    int         type;
+    double      num;
+    char      * str;  // JV_STR, decoded and NUL-terminated
+    int         n;    // JV_ARR / JV_OBJ entries
+    struct jv * kids;
+    char     ** keys; // JV_OBJ
+} jv;
+
+typedef struct jcur {
+    const char * p;
+    const char * end;
+} jcur;
+
+static void jv_free(jv * v) {
+    for (int i = 0; i < v->n; ++i) {
+        jv_free(&v->kids[i]);
+        if (v->keys) free(v->keys[i]);
+    }
+    free(v->kids);
+    free(v->keys);
+    free(v->str);
+    memset(v, 0, sizeof(*v));
+}
+
+static const jv * jv_get(const jv * o, const char * key) {
+    if (!o || o->type != JV_OBJ) return NULL;
+    for (int i = 0; i < o->n; ++i) {
+        if (strcmp(o->keys[i], key) == 0) return &o->kids[i];
+    }
+    return NULL;
+}
+
+static void skip_ws(jcur * c) {
+    while (c->p < c->end && (*c->p == ' ' || *c->p == '\n' || *c->p == '\t' || *c->p == '\r')) ++c->p;
+}
+
+static int hex_val(char h) {
+    if (h >= '0' && h <= '9') return h - '0';
+    if (h >= 'a' && h <= 'f') return h - 'a' + 10;
+    if (h >= 'A' && h <= 'F') return h - 'A' + 10;
+    return -1;
+}
+
+static bool read_hex4(jcur * c, uint32_t * out) {
+    if (c->end - c->p < 4) return false;
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) {
+        const int h = hex_val(c->p[i]);
+        if (h < 0) return false;
+        v = v << 4 | (uint32_t)h;
+    }
+    c->p += 4;
+    *out = v;
+    return true;
+}
+
+// Decodes a string starting at the opening quote into a malloc'd UTF-8 buffer.
+static char * parse_string(jcur * c) {
+    if (c->p >= c->end || *c->p != '"') return NULL;
+    ++c->p;
+    char * s = (char *)malloc((size_t)(c->end - c->p) + 1); // decoding never grows the text
+    if (!s) return NULL;
+    size_t n = 0;
+    while (c->p < c->end && *c->p != '"') {
+        const unsigned char ch = (unsigned char)*c->p++;
+        if (ch < 0x20) break;
+        if (ch != '\\') { s[n++] = (char)ch; continue; }
+        if (c->p >= c->end) break;
+        const char e = *c->p++;
+        uint32_t cp = 0;
+        switch (e) {
+        case '"': case '\\': case '/': s[n++] = e; continue;
+        case 'b': s[n++] = '\b'; continue;
+        case 'f': s[n++] = '\f'; continue;
+        case 'n': s[n++] = '\n'; continue;
+        case 'r': s[n++] = '\r'; continue;
+        case 't': s[n++] = '\t'; continue;
+        case 'u':
+            if (!read_hex4(c, &cp)) goto fail;
+            if (cp >= 0xD800 && cp < 0xDC00 && c->end - c->p >= 6 && c->p[0] == '\\' && c->p[1] == 'u') {
+                jcur save = *c;
+                uint32_t lo = 0;
+                c->p += 2;
+                if (read_hex4(c, &lo) && lo >= 0xDC00 && lo < 0xE000) cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                else *c = save;
+            }
+            // a \uXXXX escape takes 6 bytes and decodes to at most 4
+            if (cp < 0x80) {
+                s[n++] = (char)cp;
+            } else if (cp < 0x800) {
+                s[n++] = (char)(0xC0 | cp >> 6);
+                s[n++] = (char)(0x80 | (cp & 0x3F));
+            } else if (cp < 0x10000) {
+                s[n++] = (char)(0xE0 | cp >> 12);
+                s[n++] = (char)(0x80 | (cp >> 6 & 0x3F));
+                s[n++] = (char)(0x80 | (cp & 0x3F));
+            } else {
+                s[n++] = (char)(0xF0 | cp >> 18);
+                s[n++] = (char)(0x80 | (cp >> 12 & 0x3F));
+                s[n++] = (char)(0x80 | (cp >> 6 & 0x3F));
+                s[n++] = (char)(0x80 | (cp & 0x3F));
+            }
+            continue;
+        default:
+            goto fail;
+        }
+    }
+    if (c->p >= c->end || *c->p != '"') goto fail;
+    ++c->p;
+    s[n] = '\0';
+    return s;
+fail:
+    free(s);
+    return NULL;
+}
+
+static bool parse_value(jcur * c, jv * out, int depth);
+
+static bool parse_container(jcur * c, jv * out, int depth, bool object) {
+    ++c->p;
+    out->type = object ? JV_OBJ : JV_ARR;
+    int cap = 0;
+    skip_ws(c);
+    if (c->p < c->end && *c->p == (object ? '}' : ']')) { ++c->p; return true; }
+    for (;;) {
+        if (out->n == cap) {
+            cap = cap ? cap * 2 : 4;
+            jv * k = (jv *)realloc(out->kids, sizeof(jv) * (size_t)cap);
+            if (!k) return false;
+            out->kids = k;
+            if (object) {
+                char ** keys = (char **)realloc(out->keys, sizeof(char *) * (size_t)cap);
+                if (!keys) return false;
+                out->keys = keys;
+            }
+        }
+        jv * kid = &out->kids[out->n];
+        memset(kid, 0, sizeof(*kid));
+        if (object) {
+            skip_ws(c);
+            char * key = parse_string(c);
+            if (!key) return false;
+            out->keys[out->n] = key;
+            skip_ws(c);
+            if (c->p >= c->end || *c->p != ':') { out->n += 1; return false; }
+            ++c->p;
+        }
+        out->n += 1;
+        if (!parse_value(c, kid, depth + 1)) return false;
+        skip_ws(c);
+        if (c->p < c->end && *c->p == ',') { ++c->p; continue; }
+        if (c->p < c->end && *c->p == (object ? '}' : ']')) { ++c->p; return true; }
+        return false;
+    }
+}
+
+static bool parse_value(jcur * c, jv * out, int depth) {
+    memset(out, 0, sizeof(*out));
+    skip_ws(c);
+    if (c->p >= c->end || depth > SPEC_DEPTH_MAX) return false;
+    const char ch = *c->p;
+    if (ch == '{' || ch == '[') return parse_container(c, out, depth, ch == '{');
+    if (ch == '"') {
+        out->type = JV_STR;
+        out->str = parse_string(c);
+        return out->str != NULL;
+    }
+    static const char * const words[] = { "true", "false", "null" };
+    for (int i = 0; i < 3; ++i) {
+        const size_t len = strlen(words[i]);
+        if ((size_t)(c->end - c->p) >= len && memcmp(c->p, words[i], len) == 0) {
+            c->p += len;
+            out->type = i < 2 ? JV_BOOL : JV_NULL;
+            out->num = i == 0;
+            return true;
+        }
+    }
+    char * endp = NULL;
+    out->type = JV_NUM;
+    out->num = strtod(c->p, &endp);
+    if (endp == c->p || endp > c->end) return false;
+    c->p = endp;
+    return true;
+}
+
+static bool jv_parse(const char * text, jv * out) {
+    jcur c = { text, text + strlen(text) };
+    if (!parse_value(&c, out, 0)) {
+        jv_free(out);
+        return false;
+    }
+    skip_ws(&c);
+    if (c.p != c.end) {
+        jv_free(out);
+        return false;
+    }
+    return true;
+}
+
+// ---- schema ----
+
+enum { JN_ANY, JN_AOBJ, JN_OBJECT, JN_ARRAY, JN_STRING, JN_NUMBER, JN_INTEGER, JN_LIT, JN_SWITCH };
+enum { N_ANY = 0, N_AOBJ = 1, N_BOOL = 2, N_NULL = 3 }; // built-in nodes
+
+typedef struct jnode {
+    uint8_t kind;
+    int32_t first; // OBJECT: props; LIT: lits; SWITCH: alts
+    int32_t count;
+    int32_t item;  // ARRAY: items node
+    int32_t min;   // ARRAY: minItems
+    int32_t max;   // ARRAY: maxItems
+} jnode;
+
+typedef struct jprop {
+    char  * key;     // JSON string body as it must be generated (escaped, no quotes)
+    int32_t key_len;
+    int32_t node;
+    bool    required;
+} jprop;
+
+typedef struct jlit {
+    char  * s;       // JSON text, e.g. "\"celsius\"" or "true"
+    int32_t len;
+} jlit;
+
+typedef struct schema {
+    jnode   * nodes;
+    int32_t   n_nodes, cap_nodes;
+    jprop   * props;
+    int32_t   n_props, cap_props;
+    jlit    * lits;
+    int32_t   n_lits, cap_lits;
+    int32_t * alts;  // SWITCH alternatives, picked by the literal matched for the property before
+    int32_t   n_alts, cap_alts;
+    int32_t   root;
+} schema;
+
+// Grows *arr to hold need elements of size elem.
+static bool reserve(void ** arr, int32_t * cap, int32_t need, size_t elem) {
+    if (need <= *cap) return true;
+    int32_t c = *cap ? *cap : 16;
+    while (c < need) c *= 2;
+    void * p = realloc(*arr, elem * (size_t)c);
+    if (!p) return false;
+    *arr = p;
+    *cap = c;
+    return true;
+}
+
+static int32_t add_node(schema * sc, jnode n) {
+    if (!reserve((void **)&sc->nodes, &sc->cap_nodes, sc->n_nodes + 1, sizeof(jnode))) return -1;
+    sc->nodes[sc->n_nodes] = n;
+    return sc->n_nodes++;
+}
+
+// s as JSON string text: quote, backslash and control bytes escaped; quoted adds the quotes.
+static char * json_escape(const char * s, bool quoted, int32_t * out_len) {
+    const size_t len = strlen(s);
+    char * out = (char *)malloc(len * 6 + 3);
+    if (!out) return NULL;
+    size_t n = 0;
+    if (quoted) out[n++] = '"';
+    for (size_t i = 0; i < len; ++i) {
+        const unsigned char ch = (unsigned char)s[i];
+        const char * e = ch == '"' ? "\\\"" : ch == '\\' ? "\\\\" : ch == '\n' ? "\\n" : ch == '\r' ? "\\r"
+                       : ch == '\t' ? "\\t" : ch == '\b' ? "\\b" : ch == '\f' ? "\\f" : NULL;
+        if (e) {
+            out[n++] = e[0];
+            out[n++] = e[1];
+        } else if (ch < 0x20) {
+            static const char hex[] = "0123456789abcdef";
+            memcpy(out + n, "\\u00", 4);
+            out[n + 4] = hex[ch >> 4];
+            out[n + 5] = hex[ch & 15];
+            n += 6;
+        } else {
+            out[n++] = (char)ch;
+        }
+    }
+    if (quoted) out[n++] = '"';
+    out[n] = '\0';
+    *out_len = (int32_t)n;
+    return out;
+}
+
+static int32_t add_lits(schema * sc, const char * const * words, const jv * strs, int32_t count, bool quoted) {
+    if (!reserve((void **)&sc->lits, &sc->cap_lits, sc->n_lits + count, sizeof(jlit))) return -1;
+    const int32_t first = sc->n_lits;
+    for (int32_t i = 0; i < count; ++i) {
+        jlit * l = &sc->lits[sc->n_lits];
+        if (words) {
+            l->len = (int32_t)strlen(words[i]);
+            l->s = strdup(words[i]);
+        } else {
+            l->s = json_escape(strs[i].str, quoted, &l->len);
+        }
+        if (!l->s) return -1;
+        sc->n_lits += 1;
+    }
+    return add_node(sc, (jnode){ JN_LIT, first, count, -1, 0, 0 });
+}
+
+static bool schema_init(schema * sc) {
+    static const char * const booleans[] = { "true", "false" };
+    static const char * const null_word[] = { "null" };
+    memset(sc, 0, sizeof(*sc));
+    return add_node(sc, (jnode){ JN_ANY, 0, 0, -1, 0, 0 }) == N_ANY
+        && add_node(sc, (jnode){ JN_AOBJ, 0, 0, -1, 0, 0 }) == N_AOBJ
+        && add_lits(sc, booleans, NULL, 2, false) == N_BOOL
+        && add_lits(sc, null_word, NULL, 1, false) == N_NULL;
+}
+
+static void schema_free(schema * sc) {
+    for (int32_t i = 0; i < sc->n_props; ++i) free(sc->props[i].key);
+    for (int32_t i = 0; i < sc->n_lits; ++i) free(sc->lits[i].s);
+    free(sc->nodes);
+    free(sc->props);
+    free(sc->lits);
+    free(sc->alts);
+    memset(sc, 0, sizeof(*sc));
+}
+
+static int32_t count_value(const jv * s, const char * key, int32_t fallback) {
+    const jv * v = jv_get(s, key);
+    if (!v || v->type != JV_NUM || v->num < 0) return fallback;
+    return v->num >= (double)INT32_MAX ? INT32_MAX : (int32_t)v->num;
+}
+
+static bool is_required(const jv * required, const char * key) {
+    if (!required || required->type != JV_ARR) return false;
+    for (int i = 0; i < required->n; ++i) {
+        if (required->kids[i].type == JV_STR && strcmp(required->kids[i].str, key) == 0) return true;
+    }
+    return false;
+}
+
+// Appends an object node over count properties; the caller fills props[first..first+count).
+static int32_t add_object(schema * sc, int32_t count) {
+    if (!reserve((void **)&sc->props, &sc->cap_props, sc->n_props + count, sizeof(jprop))) return -1;
+    const int32_t first = sc->n_props;
+    if (count > 0) memset(sc->props + first, 0, sizeof(jprop) * (size_t)count);
+    sc->n_props += count;
+    return add_node(sc, (jnode){ JN_OBJECT, first, count, -1, 0, 0 });
+}
+
+static bool set_prop(schema * sc, int32_t obj, int32_t i, const char * key, int32_t node, bool required) {
+    jprop * p = &sc->props[sc->nodes[obj].first + i];
+    p->key = json_escape(key, false, &p->key_len);
+    p->node = node;
+    p->required = required;
+    return p->key != NULL && node >= 0;
+}
+
+// Node for schema s; N_ANY for anything outside the supported subset, -1 when out of memory.
+static int32_t compile(schema * sc, const jv * s, int depth) {
+    if (!s || s->type != JV_OBJ || depth > SPEC_DEPTH_MAX) return N_ANY;
+    const jv * cn = jv_get(s, "const");
+    if (cn && cn->type == JV_STR) return add_lits(sc, NULL, cn, 1, true);
+    const jv * en = jv_get(s, "enum");
+    if (en && en->type == JV_ARR && en->n > 0 && en->n <= SCHEMA_ALT_MAX) {
+        bool strings = true;
+        for (int i = 0; i < en->n; ++i) strings = strings && en->kids[i].type == JV_STR;
+        if (strings) return add_lits(sc, NULL, en->kids, en->n, true);
+    }
+    const jv * ty = jv_get(s, "type");
+    const char * type = ty && ty->type == JV_STR ? ty->str : "";
+    if (strcmp(type, "object") == 0) {
+        const jv * props = jv_get(s, "properties");
+        const jv * extra = jv_get(s, "additionalProperties");
+        if (!props || props->type != JV_OBJ || props->n > SCHEMA_ALT_MAX) return N_AOBJ;
+        if (props->n == 0 && !(extra && extra->type == JV_BOOL && extra->num == 0)) return N_AOBJ;
+        const jv * required = jv_get(s, "required");
+        const int32_t obj = add_object(sc, props->n);
+        if (obj < 0) return -1;
+        for (int i = 0; i < props->n; ++i) {
+            const int32_t kid = compile(sc, &props->kids[i], depth + 1);
+            if (!set_prop(sc, obj, i, props->keys[i], kid, is_required(required, props->keys[i]))) return -1;
+        }
+        return obj;
+    }
+    if (strcmp(type, "array") == 0) {
+        const jv * items = jv_get(s, "items");
+        const int32_t item = items ? compile(sc, items, depth + 1) : N_ANY;
+        if (item < 0) return -1;
+        return add_node(sc, (jnode){ JN_ARRAY, 0, 0, item, count_value(s, "minItems", 0), count_value(s, "maxItems", INT32_MAX) });
+    }
+    if (strcmp(type, "string") == 0)  return add_node(sc, (jnode){ JN_STRING, 0, 0, -1, 0, 0 });
+    if (strcmp(type, "number") == 0)  return add_node(sc, (jnode){ JN_NUMBER, 0, 0, -1, 0, 0 });
+    if (strcmp(type, "integer") == 0) return add_node(sc, (jnode){ JN_INTEGER, 0, 0, -1, 0, 0 });
+    if (strcmp(type, "boolean") == 0) return N_BOOL;
+    if (strcmp(type, "null") == 0)    return N_NULL;
+    return N_ANY;
+}
+
+// {"tool":{"name":<one of the names>,"arguments":<that tool's parameters>}}
+static int32_t compile_tools(schema * sc, const jv * tools, const char ** err) {
+    if (tools->type != JV_ARR || tools->n == 0 || tools->n > SCHEMA_ALT_MAX) {
+        *err = "tool-call constraint needs an array of 1 to 64 tools";
+        return -1;
+    }
+    jv names[SCHEMA_ALT_MAX];
+    for (int i = 0; i < tools->n; ++i) {
+        const jv * name = jv_get(&tools->kids[i], "name");
+        if (!name || name->type != JV_STR) {
+            *err = "every tool needs a string \"name\"";
+            return -1;
+        }
+        names[i] = *name;
+    }
+    *err = "out of memory compiling constraint";
+    const int32_t name_node = add_lits(sc, NULL, names, tools->n, true);
+    if (name_node < 0 || !reserve((void **)&sc->alts, &sc->cap_alts, sc->n_alts + tools->n, sizeof(int32_t))) return -1;
+    const int32_t first = sc->n_alts;
+    sc->n_alts += tools->n;
+    for (int i = 0; i < tools->n; ++i) {
+        const jv * params = jv_get(&tools->kids[i], "parameters");
+        int32_t node = N_AOBJ;
+        if (params && params->type == JV_STR) { // schema passed as JSON text
+            jv parsed;
+            if (jv_parse(params->str, &parsed)) {
+                node = compile(sc, &parsed, 1);
+                jv_free(&parsed);
+            }
+        } else if (params) {
+            node = compile(sc, params, 1);
+        }
+        if (node < 0) return -1;
+        sc->alts[first + i] = node;
+    }
+    const int32_t args_node = add_node(sc, (jnode){ JN_SWITCH, first, tools->n, 0, 0, 0 });
+    const int32_t call = args_node < 0 ? -1 : add_object(sc, 2);
+    if (call < 0 || !set_prop(sc, call, 0, "name", name_node, true) || !set_prop(sc, call, 1, "arguments", args_node, true)) return -1;
+    const int32_t root = add_object(sc, 1);
+    if (root < 0 || !set_prop(sc, root, 0, "tool", call, true)) return -1;
+    *err = NULL;
+    return root;
+}
+
+// ---- matcher ----
+
+enum { F_VALUE, F_OBJECT, F_AOBJ, F_ARRAY, F_STR, F_LIT, F_NUM };
+enum { OB_FIRST, OB_KEY, OB_COLON, OB_VALUE, OB_AFTER, OB_NEXT };
+enum { AR_FIRST, AR_VALUE, AR_AFTER };
+enum { ST_BODY, ST_ESC, ST_HEX };
+enum { NU_START, NU_MINUS, NU_ZERO, NU_INT, NU_DOT, NU_FRAC, NU_E, NU_ESIGN, NU_EXP };
+
+typedef struct jframe {
+    int32_t  node;
+    uint8_t  kind;  // F_*
+    uint8_t  phase;
+    uint8_t  ws;    // whitespace bytes in a row
+    int32_t  a;     // object: property index; array: items so far; literal: bytes matched; number: digits
+    int32_t  b;     // object: key bytes matched; string: hex digits left
+    int32_t  sel;   // object: literal matched for the property a SWITCH depends on
+    uint64_t mask;  // object key / literal candidates
+} jframe;
+
+typedef struct jstate {
+    int32_t depth;
+    bool    done;   // the top-level value is complete
+    uint8_t ws;
+    jframe  f[JSON_DEPTH];
+} jstate;
+
+static inline bool is_ws(unsigned char c) { return c == ' ' || c == '\n' || c == '\t' || c == '\r'; }
+static inline bool is_digit(unsigned char c) { return c >= '0' && c <= '9'; }
+
+static void copy_state(jstate * dst, const jstate * src) {
+    dst->depth = src->depth;
+    dst->done = src->done;
+    dst->ws = src->ws;
+    memcpy(dst->f, src->f, sizeof(jframe) * (size_t)src->depth);
+}
+
+static bool push_frame(jstate * st, int kind, int32_t node, int phase) {
+    if (st->depth == JSON_DEPTH) return false;
+    jframe * f = &st->f[st->depth++];
+    memset(f, 0, sizeof(*f));
+    f->node = node;
+    f->kind = (uint8_t)kind;
+    f->phase = (uint8_t)phase;
+    f->sel = -1;
+    return true;
+}
+
+static bool push_value(const schema * sc, jstate * st, int32_t node, int32_t sel) {
+    const jnode * n = &sc->nodes[node];
+    if (n->kind == JN_SWITCH) node = (sel >= 0 && sel < n->count) ? sc->alts[n->first + sel] : N_ANY;
+    return push_frame(st, F_VALUE, node, 0);
+}
+
+// The top frame's value is complete; result is the literal matched (or -1).
+static void pop(const schema * sc, jstate * st, int32_t result) {
+    st->depth -= 1;
+    if (st->depth == 0) {
+        st->done = true;
+        st->ws = 0;
+        return;
+    }
+    jframe * f = &st->f[st->depth - 1];
+    f->ws = 0;
+    if (f->kind == F_OBJECT) {
+        const jnode * n = &sc->nodes[f->node];
+        const int32_t k = f->a;
+        if (result >= 0 && k + 1 < n->count && sc->nodes[sc->props[n->first + k + 1].node].kind == JN_SWITCH) f->sel = result;
+        f->a = k + 1;
+        f->phase = OB_AFTER;
+    } else if (f->kind == F_AOBJ) {
+        f->phase = f->phase == OB_KEY ? OB_COLON : OB_AFTER;
+    } else if (f->kind == F_ARRAY) {
+        f->a += 1;
+        f->phase = AR_AFTER;
+    }
+}
+
+// Properties a key may name next: from..the first required one.
+static uint64_t key_candidates(const schema * sc, const jnode * n, int32_t from) {
+    uint64_t m = 0;
+    for (int32_t k = from; k < n->count; ++k) {
+        m |= (uint64_t)1 << k;
+        if (sc->props[n->first + k].required) break;
+    }
+    return m;
+}
+
+static bool rest_optional(const schema * sc, const jnode * n, int32_t from) {
+    for (int32_t k = from; k < n->count; ++k) {
+        if (sc->props[n->first + k].required) return false;
+    }
+    return true;
+}
+
+// Literal matching: keep the candidates that continue with c; complete when one ends.
+static bool lit_step(const schema * sc, jstate * st, jframe * f, unsigned char c) {
+    const jnode * n = &sc->nodes[f->node];
+    uint64_t m = 0;
+    for (int32_t k = 0; k < n->count; ++k) {
+        const jlit * l = &sc->lits[n->first + k];
+        if ((f->mask >> k & 1) && f->a < l->len && (unsigned char)l->s[f->a] == c) m |= (uint64_t)1 << k;
+    }
+    if (!m) return false;
+    f->mask = m;
+    f->a += 1;
+    for (int32_t k = 0; k < n->count; ++k) {
+        if ((m >> k & 1) && sc->lits[n->first + k].len == f->a) {
+            pop(sc, st, k);
+            break;
+        }
+    }
+    return true;
+}
+
+static bool start_lit(const schema * sc, jstate * st, jframe * f, int32_t node, unsigned char c) {
+    f->kind = F_LIT;
+    f->node = node;
+    f->a = 0;
+    f->mask = ~(uint64_t)0;
+    return lit_step(sc, st, f, c);
+}
+
+// 1 consumed, 0 rejected, -1 the number ended before c.
+static int num_step(jframe * f, bool integer, unsigned char c) {
+    const bool digit = is_digit(c);
+    if (digit && ++f->a > JSON_DIGITS_MAX) return 0;
+    switch (f->phase) {
+    case NU_START:
+        if (c == '-') { f->phase = NU_MINUS; return 1; }
+        // fallthrough
+    case NU_MINUS:
+        if (c == '0') { f->phase = NU_ZERO; return 1; }
+        if (digit) { f->phase = NU_INT; return 1; }
+        return 0;
+    case NU_ZERO:
+    case NU_INT:
+        if (digit) return f->phase == NU_INT ? 1 : 0;
+        if (!integer && c == '.') { f->phase = NU_DOT; return 1; }
+        if (!integer && (c == 'e' || c == 'E')) { f->phase = NU_E; return 1; }
+        return -1;
+    case NU_DOT:
+        if (digit) { f->phase = NU_FRAC; return 1; }
+        return 0;
+    case NU_FRAC:
+        if (digit) return 1;
+        if (c == 'e' || c == 'E') { f->phase = NU_E; return 1; }
+        return -1;
+    case NU_E:
+        if (c == '+' || c == '-') { f->phase = NU_ESIGN; return 1; }
+        // fallthrough
+    case NU_ESIGN:
+        if (digit) { f->phase = NU_EXP; return 1; }
+        return 0;
+    case NU_EXP:
+        return digit ? 1 : -1;
+    }
+    return 0;
+}
+
+static bool ws_step(jframe * f) {
+    return ++f->ws <= JSON_WS_MAX;
+}
+
+// Advance the matcher by one output byte. Returns false when c cannot come next.
+static bool feed(const schema * sc, jstate * st, unsigned char c) {
+    for (;;) {
+        if (st->depth == 0) return st->done && is_ws(c) && ++st->ws <= JSON_WS_MAX;
+        jframe * f = &st->f[st->depth - 1];
+        const jnode * n = &sc->nodes[f->node];
+        switch (f->kind) {
+        case F_VALUE:
+            if (is_ws(c)) return ws_step(f);
+            f->ws = 0;
+            switch (n->kind) {
+            case JN_ANY:
+                if (c == '{') { f->kind = F_AOBJ; f->node = N_AOBJ; f->phase = OB_FIRST; return true; }
+                if (c == '[') { f->kind = F_ARRAY; f->phase = AR_FIRST; return true; } // items: any value
+                if (c == '"') { f->kind = F_STR; f->phase = ST_BODY; return true; }
+                if (c == 't' || c == 'f') return start_lit(sc, st, f, N_BOOL, c);
+                if (c == 'n') return start_lit(sc, st, f, N_NULL, c);
+                f->kind = F_NUM;
+                f->phase = NU_START;
+                return num_step(f, false, c) == 1;
+            case JN_AOBJ:
+                f->kind = F_AOBJ;
+                f->phase = OB_FIRST;
+                return c == '{';
+            case JN_OBJECT:
+                f->kind = F_OBJECT;
+                f->phase = OB_FIRST;
+                return c == '{';
+            case JN_ARRAY:
+                f->kind = F_ARRAY;
+                f->phase = AR_FIRST;
+                return c == '[';
+            case JN_STRING:
+                f->kind = F_STR;
+                f->phase = ST_BODY;
+                return c == '"';
+            case JN_NUMBER:
+            case JN_INTEGER:
+                f->kind = F_NUM;
+                f->phase = NU_START;
+                return num_step(f, n->kind == JN_INTEGER, c) == 1;
+            case JN_LIT:
+                return start_lit(sc, st, f, f->node, c);
+            default:
+                return false;
+            }
+        case F_STR:
+            if (f->phase == ST_BODY) {
+                if (c == '"') { pop(sc, st, -1); return true; }
+                if (c == '\\') { f->phase = ST_ESC; return true; }
+                return c >= 0x20;
+            }
+            if (f->phase == ST_ESC) {
+                if (c == 'u') { f->phase = ST_HEX; f->b = 4; return true; }
+                if (c != 0 && strchr("\"\\/bfnrt", c)) { f->phase = ST_BODY; return true; }
+                return false;
+            }
+            if (hex_val((char)c) < 0) return false;
+            if (--f->b == 0) f->phase = ST_BODY;
+            return true;
+        case F_LIT:
+            return lit_step(sc, st, f, c);
+        case F_NUM: {
+            const int r = num_step(f, n->kind == JN_INTEGER, c);
+            if (r >= 0) return r == 1;
+            pop(sc, st, -1);
+            continue; // c belongs to the enclosing value
+        }
+        case F_OBJECT:
+            switch (f->phase) {
+            case OB_FIRST:
+            case OB_NEXT:
+                if (is_ws(c)) return ws_step(f);
+                if (c == '"') {
+                    f->mask = key_candidates(sc, n, f->a);
+                    f->phase = OB_KEY;
+                    f->b = 0;
+                    return f->mask != 0;
+                }
+                if (c == '}' && f->phase == OB_FIRST && rest_optional(sc, n, f->a)) { pop(sc, st, -1); return true; }
+                return false;
+            case OB_KEY: {
+                uint64_t m = 0;
+                for (int32_t k = 0; k < n->count; ++k) {
+                    if (!(f->mask >> k & 1)) continue;
+                    const jprop * p = &sc->props[n->first + k];
+                    if (c == '"' && p->key_len == f->b) {
+                        f->a = k;
+                        f->phase = OB_COLON;
+                        f->ws = 0;
+                        return true;
+                    }
+                    if (f->b < p->key_len && (unsigned char)p->key[f->b] == c) m |= (uint64_t)1 << k;
+                }
+                f->mask = m;
+                f->b += 1;
+                return m != 0;
+            }
+            case OB_COLON:
+                if (is_ws(c)) return ws_step(f);
+                if (c != ':') return false;
+                f->phase = OB_VALUE;
+                return push_value(sc, st, sc->props[n->first + f->a].node, f->sel);
+            case OB_AFTER:
+                if (is_ws(c)) return ws_step(f);
+                if (c == ',' && f->a < n->count) { f->phase = OB_NEXT; f->ws = 0; return true; }
+                if (c == '}' && rest_optional(sc, n, f->a)) { pop(sc, st, -1); return true; }
+                return false;
+            }
+            return false;
+        case F_AOBJ:
+            switch (f->phase) {
+            case OB_FIRST:
+            case OB_NEXT:
+                if (is_ws(c)) return ws_step(f);
+                if (c == '"') { f->phase = OB_KEY; return push_frame(st, F_STR, N_ANY, ST_BODY); }
+                if (c == '}' && f->phase == OB_FIRST) { pop(sc, st, -1); return true; }
+                return false;
+            case OB_COLON:
+                if (is_ws(c)) return ws_step(f);
+                if (c != ':') return false;
+                f->phase = OB_VALUE;
+                return push_value(sc, st, N_ANY, -1);
+            case OB_AFTER:
+                if (is_ws(c)) return ws_step(f);
+                if (c == ',') { f->phase = OB_NEXT; f->ws = 0; return true; }
+                if (c == '}') { pop(sc, st, -1); return true; }
+                return false;
+            }
+            return false;
+        case F_ARRAY: {
+            const bool typed = n->kind == JN_ARRAY;
+            const int32_t item = typed ? n->item : N_ANY;
+            const int32_t min = typed ? n->min : 0;
+            const int32_t max = typed ? n->max : INT32_MAX;
+            if (is_ws(c)) return ws_step(f);
+            if (f->phase == AR_FIRST) {
+                if (c == ']') {
+                    if (min > 0) return false;
+                    pop(sc, st, -1);
+                    return true;
+                }
+                f->phase = AR_VALUE;
+                if (max == 0 || !push_value(sc, st, item, -1)) return false;
+                continue; // c starts the first item
+            }
+            if (c == ',' && f->a < max) {
+                f->phase = AR_VALUE;
+                f->ws = 0;
+                return push_value(sc, st, item, -1);
+            }
+            if (c == ']' && f->a >= min) { pop(sc, st, -1); return true; }
+            return false;
+        }
+        }
+        return false;
+    }
+}
+
+static bool feed_piece(const schema * sc, jstate * st, const char * s, int32_t len) {
+    for (int32_t i = 0; i < len; ++i) {
+        if (!feed(sc, st, (unsigned char)s[i])) return false;
+    }
+    return true;
+}
+
+// ---- constraints ----
+
+struct sl_constraint {
+    _Atomic int           refs;
+    const sl_vocab_trie * trie;
+    int                   kind;
+    schema                sc;
+    jstate                start; // JSON: before the value; tool call: right after the trigger
+};
+
+sl_constraint * sl_constraint_create(const sl_vocab_trie * trie, int kind, const char * spec, const char ** err) {
+    if (kind != LLM_CONSTRAINT_JSON && kind != LLM_CONSTRAINT_TOOL_CALL) {
+        *err = "unknown constraint kind";
+        return NULL;
+    }
+    jv root;
+    if (!spec || !jv_parse(spec, &root)) {
+        *err = "constraint spec is not valid JSON";
+        return NULL;
+    }
+    sl_constraint * c = (sl_constraint *)calloc(1, sizeof(sl_constraint));
+    *err = "out of memory compiling constraint";
+    if (c && schema_init(&c->sc)) {
+        c->sc.root = kind == LLM_CONSTRAINT_JSON ? compile(&c->sc, &root, 0) : compile_tools(&c->sc, &root, err);
+    } else if (c) {
+        c->sc.root = -1;
+    }
+    jv_free(&root);
+    if (!c || c->sc.root < 0) {
+        if (c) schema_free(&c->sc);
+        free(c);
+        return NULL;
+    }
+    push_value(&c->sc, &c->start, c->sc.root, -1);
+    if (kind == LLM_CONSTRAINT_TOOL_CALL) feed_piece(&c->sc, &c->start, k_trigger, TRIGGER_LEN);
+    atomic_init(&c->refs, 1);
+    c->trie = trie;
+    c->kind = kind;
+    *err = NULL;
+    return c;
+}
+
+void sl_constraint_retain(sl_constraint * c) {
+    if (c) atomic_fetch_add(&c->refs, 1);
+}
+
+void sl_constraint_release(sl_constraint * c) {
+    if (!c || atomic_fetch_sub(&c->refs, 1) != 1) return;
+    schema_free(&c->sc);
+    free(c);
+}
+
+// ---- per-sequence state ----
+
+enum { CS_OFF, CS_FREE, CS_ACTIVE, CS_DONE, CS_STUCK };
+
+struct sl_constraint_state {
+    const sl_constraint * c;
+    int                   phase;   // CS_*
+    int                   trig;    // trigger bytes matched so far (CS_FREE)
+    jstate                js;
+    llama_token         * allowed;
+    int32_t               cap;
+    int32_t               n_allowed;
+    jstate                scratch[TRIE_MAX_DEPTH + 1]; // one per trie level
+};
+
+sl_constraint_state * sl_constraint_state_create(void) {
+    return (sl_constraint_state *)calloc(1, sizeof(sl_constraint_state));
+}
+
+void sl_constraint_state_free(sl_constraint_state * st) {
+    if (!st) return;
+    free(st->allowed);
+    free(st);
+}
+
+int sl_constraint_reset(sl_constraint_state * st, const sl_constraint * c) {
+    if (!st || !c) return -1;
+    if (!reserve((void **)&st->allowed, &st->cap, c->trie->n_vocab, sizeof(llama_token))) return -1;
+    st->c = c;
+    st->trig = 0;
+    st->n_allowed = 0;
+    st->phase = c->kind == LLM_CONSTRAINT_TOOL_CALL ? CS_FREE : CS_ACTIVE;
+    copy_state(&st->js, &c->start);
+    return 0;
+}
+
+static inline int trigger_step(int trig, unsigned char b) {
+    if ((unsigned char)k_trigger[trig] == b) return trig + 1;
+    return b == '{' ? 1 : 0; // '{' only opens the trigger
+}
+
+static inline const char * piece_of(const sl_vocab_trie * t, llama_token tok, int32_t * len) {
+    *len = t->off[tok + 1] - t->off[tok];
+    return t->blob + t->off[tok];
+}
+
+// Whether tok is allowed before a tool call starts: it may open one, but then it must go on
+// to a valid call.
+static bool free_piece_ok(sl_constraint_state * st, llama_token tok) {
+    int32_t len = 0;
+    const char * s = piece_of(st->c->trie, tok, &len);
+    int trig = st->trig;
+    for (int32_t i = 0; i < len; ++i) {
+        trig = trigger_step(trig, (unsigned char)s[i]);
+        if (trig == TRIGGER_LEN) {
+            copy_state(&st->scratch[0], &st->c->start);
+            return feed_piece(&st->c->sc, &st->scratch[0], s + i + 1, len - i - 1);
+        }
+    }
+    return true;
+}
+
+// Depth-first walk of the trie below node u in matcher state js; a subtree is skipped at
+// the first byte the matcher rejects.
+static void collect(sl_constraint_state * st, int32_t u, const jstate * js, int depth) {
+    const sl_vocab_trie * t = st->c->trie;
+    jstate * next = &st->scratch[depth];
+    for (int32_t v = t->nodes[u].child; v >= 0; v = t->nodes[v].sibling) {
+        copy_state(next, js);
+        if (!feed(&st->c->sc, next, t->nodes[v].byte)) continue;
+        for (int32_t tok = t->nodes[v].tok; tok >= 0; tok = t->tok_next[tok]) st->allowed[st->n_allowed++] = tok;
+        if (t->nodes[v].child >= 0 && depth < TRIE_MAX_DEPTH) collect(st, v, next, depth + 1);
+    }
+}
+
+static void collect_allowed(sl_constraint_state * st) {
+    const sl_vocab_trie * t = st->c->trie;
+    st->n_allowed = 0;
+    const jframe * top = st->js.depth > 0 ? &st->js.f[st->js.depth - 1] : NULL;
+    if (top && top->kind == F_STR && top->phase == ST_BODY) {
+        // plain pieces leave a string body as it is; only the others go through the matcher
+        memcpy(st->allowed, t->plain, sizeof(llama_token) * (size_t)t->n_plain);
+        st->n_allowed = t->n_plain;
+        for (int32_t i = 0; i < t->n_other; ++i) {
+            int32_t len = 0;
+            const char * s = piece_of(t, t->other[i], &len);
+            copy_state(&st->scratch[0], &st->js);
+            if (feed_piece(&st->c->sc, &st->scratch[0], s, len)) st->allowed[st->n_allowed++] = t->other[i];
+        }
+        return;
+    }
+    collect(st, 0, &st->js, 0);
+}
+
+llama_token sl_constraint_sample(sl_constraint_state * st, sl_sampler * smp, float * logits) {
+    if (!st || !st->c || st->phase == CS_OFF) return sl_sampler_sample(smp, logits);
+    const sl_vocab_trie * t = st->c->trie;
+    if (st->phase == CS_FREE) {
+        for (int32_t i = 0; i < t->n_colon; ++i) {
+            if (!free_piece_ok(st, t->colon[i])) logits[t->colon[i]] = -INFINITY;
+        }
+        return sl_sampler_sample(smp, logits);
+    }
+    if (st->phase == CS_DONE) {
+        return t->n_eog > 0 ? sl_sampler_sample_from(smp, logits, t->eog, t->n_eog) : LLAMA_TOKEN_NULL;
+    }
+    if (st->phase == CS_STUCK) return LLAMA_TOKEN_NULL;
+    collect_allowed(st);
+    if (st->n_allowed == 0) {
+        st->phase = CS_STUCK;
+        return LLAMA_TOKEN_NULL;
+    }
+    return sl_sampler_sample_from(smp, logits, st->allowed, st->n_allowed);
+}
+
+void sl_constraint_accept(sl_constraint_state * st, llama_token tok) {
+    if (!st || !st->c || st->phase == CS_OFF || st->phase == CS_DONE || st->phase == CS_STUCK) return;
+    const sl_vocab_trie * t = st->c->trie;
+    if (tok < 0 || tok >= t->n_vocab) return;
+    int32_t len = 0;
+    const char * s = piece_of(t, tok, &len);
+    for (int32_t i = 0; i < len; ++i) {
+        const unsigned char b = (unsigned char)s[i];
+        if (st->phase == CS_FREE) {
+            st->trig = trigger_step(st->trig, b);
+            if (st->trig == TRIGGER_LEN) {
+                copy_state(&st->js, &st->c->start);
+                st->phase = CS_ACTIVE;
+            }
+        } else if (!feed(&st->c->sc, &st->js, b)) {
+            st->phase = CS_OFF; // only reachable through tokens sampled without the mask
+            return;
+        }
+    }
+    if (st->phase == CS_ACTIVE && st->js.done) st->phase = CS_DONE;
+}
+
+bool sl_constraint_stuck(const sl_constraint_state * st) {
+    return st && st->phase == CS_STUCK;
+}
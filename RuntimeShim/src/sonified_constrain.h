@@ -0,0 +1,60 @@
+// sonified_constrain.h
+//
+// Constrained decoding for llm_gen_opts_t.constraint. A JSON schema, or for tool calls the
+// {"tool":{"name":...,"arguments":...}} envelope over a set of tool schemas, is compiled into
+// a pushdown matcher over output bytes. Each step the matcher walks a trie of the vocabulary's
+// token pieces and prunes a subtree at the first byte it rejects, so finding the allowed
+// tokens costs O(allowed) rather than O(vocab); the sampler then draws from that set alone.
+// Inside a free-form string, where nearly every token is allowed, tokens without quotes,
+// backslashes or control bytes are taken from a precomputed list instead of walking the trie.
+// Not part of the public API.
+
+#ifndef SONIFIED_CONSTRAIN_H
+#define SONIFIED_CONSTRAIN_H
+
+#include "sonified_sampling.h"
+#include "llama.h"
+
+// Token pieces of a vocabulary in a byte trie, shared by every constraint on a model.
+typedef struct sl_vocab_trie sl_vocab_trie;
+
+sl_vocab_trie * sl_vocab_trie_build(const struct llama_vocab * vocab);
+void            sl_vocab_trie_free(sl_vocab_trie * t);
+
+// Compiled constraint; reference counted so scheduler requests can outlive
+// llm_constraint_free. The trie must outlive it.
+typedef struct sl_constraint sl_constraint;
+
+// kind is an llm_constraint_kind. Supported schema keywords: type (object, array, string,
+// number, integer, boolean, null), properties, required, items, minItems, maxItems, enum and
+// const of strings. Object properties are generated in schema order without extra keys; any
+// other schema (anyOf, $ref, type lists, ...) accepts any JSON value. Returns NULL with *err
+// set when spec is not valid JSON of the expected shape or memory runs out.
+sl_constraint * sl_constraint_create(const sl_vocab_trie * trie, int kind, const char * spec, const char ** err);
+void            sl_constraint_retain(sl_constraint * c);
+void            sl_constraint_release(sl_constraint * c);
+
+// Per-sequence matcher state and scratch, reused across generations.
+typedef struct sl_constraint_state sl_constraint_state;
+
+sl_constraint_state * sl_constraint_state_create(void);
+void                  sl_constraint_state_free(sl_constraint_state * st);
+
+// Start a generation under c. Returns 0, or -1 when out of memory.
+int sl_constraint_reset(sl_constraint_state * st, const sl_constraint * c);
+
+// Sample the next token from a logits row under the constraint. Before a tool call starts
+// the few tokens that would start a malformed one are masked in logits (set to -inf); inside
+// one (or a JSON constraint) only the allowed tokens are sampled; once the value is complete
+// only end-of-generation tokens are. A matcher that has no allowed token left returns
+// LLAMA_TOKEN_NULL from then on, so the generation ends short of a complete value rather
+// than continue unchecked; sl_constraint_stuck tells that apart from a normal end.
+llama_token sl_constraint_sample(sl_constraint_state * st, sl_sampler * smp, float * logits);
+
+// Advance the matcher over an emitted token.
+void sl_constraint_accept(sl_constraint_state * st, llama_token tok);
+
+// True once sl_constraint_sample found no allowed token (LLM_STOP_CONSTRAINT).
+bool sl_constraint_stuck(const sl_constraint_state * st);
+
+#endif // SONIFIED_CONSTRAIN_H
@@ -0,0 +1,126 @@
+#include "sonified_embed.h"
+#include "sonified_tokenize.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct sl_embedder {
+    struct llama_model   * model;
+    struct llama_context * ctx;
+    struct llama_batch     batch;
+    int                    n_batch;
+    int                    n_seqs;
+    int                    n_embd;
+    sl_token_buf           toks;   // one text at a time
+    // inputs packed into the pending batch: output row, first batch row and length
+    int                    idx[SL_EMBED_SEQS];
+    int                    row0[SL_EMBED_SEQS];
+    int                    len[SL_EMBED_SEQS];
+    int                    n_pending;
+};
+
+sl_embedder * sl_embed_create(struct llama_model * model, const struct llama_context_params * cparams) {
+    struct llama_context_params ep = *cparams;
+    const uint32_t n_batch = ep.n_batch > 0 ? ep.n_batch : 2048;
+    ep.n_ctx = n_batch;
+    ep.n_batch = n_batch;
+    ep.n_ubatch = n_batch; // non-causal encoders need a whole input in one micro-batch
+    ep.n_seq_max = SL_EMBED_SEQS;
+    ep.embeddings = true;
+    ep.pooling_type = LLAMA_POOLING_TYPE_NONE; // per-token rows; pooled here so every mode shares one context
+    struct llama_context * ctx = llama_new_context_with_model(model, ep);
+    sl_embedder * e = ctx ? (sl_embedder *)calloc(1, sizeof(sl_embedder)) : NULL;
+    if (e) {
+        e->n_batch = (int)llama_n_batch(ctx);
+        e->batch = llama_batch_init(e->n_batch, 0, 1);
+    }
+    if (!e || !e->batch.token) {
+        free(e);
+        if (ctx) llama_free(ctx);
+        return NULL;
+    }
+    e->model = model;
+    e->ctx = ctx;
+    e->n_seqs = (int)llama_n_seq_max(ctx) < SL_EMBED_SEQS ? (int)llama_n_seq_max(ctx) : SL_EMBED_SEQS;
+    e->n_embd = llama_model_n_embd(model);
+    return e;
+}
+
+void sl_embed_free(sl_embedder * e) {
+    if (!e) return;
+    llama_batch_free(e->batch);
+    llama_free(e->ctx);
+    sl_token_buf_free(&e->toks);
+    free(e);
+}
+
+static void l2_normalize(float * v, int n) {
+    double ss = 0.0;
+    for (int i = 0; i < n; ++i) ss += (double)v[i] * v[i];
+    if (ss <= 0.0) return;
+    const float inv = (float)(1.0 / sqrt(ss));
+    for (int i = 0; i < n; ++i) v[i] *= inv;
+}
+
+// Decode the pending inputs and pool their rows into out.
+static int flush(sl_embedder * e, float * out, int pooling, int normalize) {
+    if (e->n_pending == 0) return 0;
+    llama_kv_self_clear(e->ctx); // inputs are independent; nothing carries over between batches
+    if (llama_decode(e->ctx, e->batch) != 0) return -4;
+    for (int s = 0; s < e->n_pending; ++s) {
+        float * v = out + (size_t)e->idx[s] * (size_t)e->n_embd;
+        const int first = pooling == LLM_EMBED_LAST ? e->row0[s] + e->len[s] - 1 : e->row0[s];
+        const int count = pooling == LLM_EMBED_MEAN ? e->len[s] : 1;
+        memset(v, 0, sizeof(float) * (size_t)e->n_embd);
+        for (int r = first; r < first + count; ++r) {
+            const float * row = llama_get_embeddings_ith(e->ctx, r);
+            if (!row) return -4;
+            for (int i = 0; i < e->n_embd; ++i) v[i] += row[i];
+        }
+        if (count > 1) {
+            const float inv = 1.0f / (float)count;
+            for (int i = 0; i < e->n_embd; ++i) v[i] *= inv;
+        }
+        if (normalize) l2_normalize(v, e->n_embd);
+    }
+    e->batch.n_tokens = 0;
+    e->n_pending = 0;
+    return 0;
+}
+
+int sl_embed_run(sl_embedder * e, const char * const * texts, int n, float * out,
+                 int pooling, int normalize, int n_threads) {
+    if (n_threads > 0) llama_set_n_threads(e->ctx, n_threads, n_threads);
+    e->batch.n_tokens = 0;
+    e->n_pending = 0;
+    for (int t = 0; t < n; ++t) {
+        const int k = sl_tokenize_into(e->model, texts[t], &e->toks);
+        if (k < 0) return -2;
+        if (k > e->n_batch) return -3;
+        if (k == 0) {
+            memset(out + (size_t)t * (size_t)e->n_embd, 0, sizeof(float) * (size_t)e->n_embd);
+            continue;
+        }
+        if (e->n_pending == e->n_seqs || e->batch.n_tokens + k > e->n_batch) {
+            const int rc = flush(e, out, pooling, normalize);
+            if (rc != 0) return rc;
+        }
+        // only the rows the pooling reads are output
+        const int s = e->n_pending++;
+        struct llama_batch * b = &e->batch;
+        e->idx[s] = t;
+        e->row0[s] = b->n_tokens;
+        e->len[s] = k;
+        for (int i = 0; i < k; ++i) {
+            const int r = b->n_tokens + i;
+            b->token[r] = e->toks.data[i];
+            b->pos[r] = i;
+            b->n_seq_id[r] = 1;
+            b->seq_id[r][0] = s;
+            b->logits[r] = pooling == LLM_EMBED_MEAN || (pooling == LLM_EMBED_CLS ? i == 0 : i == k - 1);
+        }
+        b->n_tokens += k;
+    }
+    return flush(e, out, pooling, normalize);
+}
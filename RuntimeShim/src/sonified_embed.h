@@ -0,0 +1,33 @@
+// sonified_embed.h
+//
+// Sentence embeddings for llm_embed. A dedicated llama_context with embeddings enabled
+// (created on first use, over the handle's weights) packs as many inputs as fit into one
+// llama_decode, each under its own sequence id, and pools the per-token rows into one
+// vector per input. Its KV cache is separate from llm_eval's and the scheduler's, so
+// embedding never disturbs a generation in flight. Not part of the public API.
+
+#ifndef SONIFIED_EMBED_H
+#define SONIFIED_EMBED_H
+
+#include "sonified_llama.h"
+#include "llama.h"
+
+// Inputs per llama_decode (sequence ids of the embedding context).
+enum { SL_EMBED_SEQS = 32 };
+
+typedef struct sl_embedder sl_embedder;
+
+// cparams is the handle's context shape; n_ctx, n_ubatch and n_seq_max are replaced so one
+// batch of n_batch tokens is a single micro-batch. Returns NULL on failure.
+sl_embedder * sl_embed_create(struct llama_model * model, const struct llama_context_params * cparams);
+void          sl_embed_free(sl_embedder * e);
+
+// Embed texts[0..n) into out (n rows of llama_model_n_embd floats) with the given
+// llm_embed_pooling, L2-normalizing each row when normalize. Texts are tokenized as
+// llm_eval tokenizes prompts; one that yields no tokens gets a zero row. Returns 0, or
+// -2 tokenization failure (out of memory), -3 a text longer than n_batch tokens,
+// -4 llama_decode failure.
+int sl_embed_run(sl_embedder * e, const char * const * texts, int n, float * out,
+                 int pooling, int normalize, int n_threads);
+
+#endif // SONIFIED_EMBED_H
@@ -0,0 +1,134 @@
+#include "sonified_emit.h"
+#include "sonified_platform.h"
+#include <stdlib.h>
+#include <string.h>
+
+enum { SINK_DEFAULT_TOKENS = 16, SINK_DEFAULT_US = 20000, SINK_INITIAL_BYTES = 256 };
+
+static int alloc_buf(sl_token_sink * s) {
+    s->cap = SINK_INITIAL_BYTES;
+    s->buf = (char *)malloc((size_t)s->cap);
+    return s->buf ? 0 : -1;
+}
+
+// Make room for len more bytes plus a possible carried partial code point and the NUL.
+static int reserve(sl_token_sink * s, int len) {
+    const int need = s->len + len + 4 + 1;
+    if (need <= s->cap) return 0;
+    int cap = s->cap * 2;
+    while (need > cap) cap *= 2;
+    char * buf = (char *)realloc(s->buf, (size_t)cap);
+    if (!buf) return -1;
+    s->buf = buf;
+    s->cap = cap;
+    return 0;
+}
+
+int sl_sink_init_single(sl_token_sink * s, llm_token_cb cb, void * user_ctx) {
+    memset(s, 0, sizeof(*s));
+    s->cb = cb;
+    s->user_ctx = user_ctx;
+    return alloc_buf(s);
+}
+
+int sl_sink_init_stream(sl_token_sink * s, sl_ring * ring, const _Atomic bool * abort) {
+    memset(s, 0, sizeof(*s));
+    s->ring = ring;
+    s->abort = abort;
+    return alloc_buf(s);
+}
+
+int sl_sink_init_info(sl_token_sink * s, llm_token_info_cb cb, void * user_ctx, int top_logprobs) {
+    memset(s, 0, sizeof(*s));
+    s->info_cb = cb;
+    s->user_ctx = user_ctx;
+    s->top_logprobs = top_logprobs;
+    s->info.token = -1;
+    return alloc_buf(s);
+}
+
+int sl_sink_init_batched(sl_token_sink * s, llm_token_batch_cb cb, void * user_ctx, int max_tokens, int max_us) {
+    memset(s, 0, sizeof(*s));
+    s->batch_cb = cb;
+    s->user_ctx = user_ctx;
+    s->max_tokens = max_tokens > 0 ? max_tokens : SINK_DEFAULT_TOKENS;
+    s->max_ms = (max_us > 0 ? max_us : SINK_DEFAULT_US) / 1000.0;
+    s->offsets = (int *)malloc(sizeof(int) * (size_t)(s->max_tokens + 1));
+    if (alloc_buf(s) != 0 || !s->offsets) {
+        sl_sink_free(s);
+        return -1;
+    }
+    s->offsets[0] = 0;
+    return 0;
+}
+
+void sl_sink_flush(sl_token_sink * s) {
+    if (!s->batch_cb || s->n == 0) return;
+    s->buf[s->len] = '\0';
+    s->batch_cb(s->buf, s->offsets, s->n, s->user_ctx);
+    s->n_delivered += s->n;
+    s->n = 0;
+    s->len = 0;
+}
+
+// Per-token mode: hand s->info to the caller with the len bytes at s->buf as its text,
+// then reset it for the next token (pushes that did not fill it in report token -1).
+static void deliver_info(sl_token_sink * s, int len) {
+    s->buf[len] = '\0';
+    s->info.text = s->buf;
+    s->info_cb(&s->info, s->user_ctx);
+    s->n_delivered += 1;
+    s->info.token = -1;
+    s->info.logprob = 0.0f;
+    s->info.n_top = 0;
+}
+
+// Deliver or queue bytes already on a code point boundary at s->buf + s->len.
+static void commit(sl_token_sink * s, int len) {
+    if (len <= 0) return;
+    if (s->info_cb) {
+        deliver_info(s, len);
+        return;
+    }
+    if (s->ring) {
+        sl_ring_write(s->ring, s->buf + s->len, len, s->abort); // drops are counted by the ring
+        s->n_delivered += 1;
+        return;
+    }
+    if (!s->batch_cb) {
+        s->buf[len] = '\0';
+        if (s->cb) s->cb(s->buf, s->user_ctx);
+        s->n_delivered += 1;
+        return;
+    }
+    const double now = sl_now_ms();
+    if (s->n == 0) s->t_oldest = now;
+    s->len += len;
+    s->n += 1;
+    s->offsets[s->n] = s->len;
+    // the first piece goes out on its own so batching never delays time-to-first-token
+    if (s->n_delivered == 0 || s->n >= s->max_tokens || now - s->t_oldest >= s->max_ms) sl_sink_flush(s);
+}
+
+int sl_sink_push(sl_token_sink * s, const char * piece, int len) {
+    if (len <= 0) return 0;
+    if (reserve(s, len) != 0) return -1;
+    const int n = sl_utf8_carry_feed(&s->utf8, piece, len, s->buf + s->len);
+    if (s->info_cb) deliver_info(s, n);
+    else commit(s, n);
+    return 0;
+}
+
+void sl_sink_finish(sl_token_sink * s) {
+    if (s->buf && reserve(s, 0) == 0) commit(s, sl_utf8_carry_flush(&s->utf8, s->buf + s->len));
+    sl_sink_flush(s);
+}
+
+void sl_sink_free(sl_token_sink * s) {
+    free(s->buf);
+    free(s->offsets);
+    s->buf = NULL;
+    s->offsets = NULL;
+    s->n = 0;
+    s->len = 0;
+}
@@ -0,0 +1,63 @@
+// sonified_emit.h
+//
+// Token delivery for llm_eval, llm_eval_batched, llm_eval_stream and llm_eval_logprobs.
+// Pieces are either forwarded one at a time (llm_token_cb, or llm_token_info_cb with the
+// token's log-probabilities), coalesced into one UTF-8 buffer plus offsets and
+// flushed every K pieces or T microseconds (llm_token_batch_cb), amortizing the per-call
+// cost on the caller's side, or written to an SPSC ring the caller drains. In every mode pieces pass through a UTF-8 carry, so callers only ever see
+// complete code points. Not part of the public API; free of llama.cpp types.
+
+#ifndef SONIFIED_EMIT_H
+#define SONIFIED_EMIT_H
+
+#include "sonified_llama.h"
+#include "sonified_ring.h"
+#include "sonified_utf8.h"
+
+typedef struct sl_token_sink {
+    llm_token_cb       cb;          // single-piece mode
+    llm_token_batch_cb batch_cb;    // batched mode
+    sl_ring          * ring;        // stream mode
+    llm_token_info_cb  info_cb;     // per-token mode
+    llm_token_info_t   info;        // per-token mode: filled in by the caller before each push
+    int                top_logprobs; // per-token mode: alternatives wanted in info.top
+    const _Atomic bool * abort;     // stream mode: stop waiting for the reader when set
+    void             * user_ctx;
+    int                max_tokens;  // flush once this many pieces are pending
+    double             max_ms;      // ... or once the oldest pending piece is this old
+    sl_utf8_carry      utf8;        // bytes of a code point split across pieces
+    char             * buf;         // pending pieces, back to back, NUL-terminated
+    int                len;
+    int                cap;
+    int              * offsets;     // max_tokens + 1 entries
+    int                n;           // pending pieces
+    double             t_oldest;
+    int                n_delivered; // pieces handed to the caller so far
+} sl_token_sink;
+
+// Returns 0 on success.
+int  sl_sink_init_single(sl_token_sink * s, llm_token_cb cb, void * user_ctx);
+
+// max_tokens <= 0 and max_us <= 0 select the defaults (16 pieces, 20 ms). Returns 0 on success.
+int  sl_sink_init_batched(sl_token_sink * s, llm_token_batch_cb cb, void * user_ctx, int max_tokens, int max_us);
+
+// Pieces go to ring; a BLOCK ring gives up waiting once *abort is set. Returns 0 on success.
+int  sl_sink_init_stream(sl_token_sink * s, sl_ring * ring, const _Atomic bool * abort);
+
+// One llm_token_info_t per push, even when the carry holds back all of its bytes.
+// Returns 0 on success.
+int  sl_sink_init_info(sl_token_sink * s, llm_token_info_cb cb, void * user_ctx, int top_logprobs);
+
+// Queue (or forward) one piece of len bytes; a trailing partial code point is held back
+// until the next piece completes it. Returns 0, or -1 when out of memory.
+int  sl_sink_push(sl_token_sink * s, const char * piece, int len);
+
+// Deliver whatever is pending (a held partial code point stays held).
+void sl_sink_flush(sl_token_sink * s);
+
+// End of stream: deliver held bytes as they are, then everything pending.
+void sl_sink_finish(sl_token_sink * s);
+
+void sl_sink_free(sl_token_sink * s);
+
+#endif // SONIFIED_EMIT_H
@@ -0,0 +1,595 @@
+#include "sonified_kernels.h"
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SL_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#define SL_NEON 1
+#include <arm_neon.h>
+#endif
+
+// ---- shared top-k heap (min-heap on value; on equal values the higher index is "smaller") ----
+// Force-inlined so that inside target("avx2"/"avx512f") functions the heap code is VEX-encoded
+// too; calling legacy-SSE helpers from the vector loop costs an SSE/AVX transition per hit.
+#define SL_INLINE static inline __attribute__((always_inline))
+
+SL_INLINE int heap_less(float va, int32_t ia, float vb, int32_t ib) {
+    return va < vb || (va == vb && ia > ib);
+}
+
+SL_INLINE void heap_sift_down(float * val, int32_t * idx, int32_t n, int32_t i) {
+    for (;;) {
+        int32_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && heap_less(val[l], idx[l], val[m], idx[m])) m = l;
+        if (r < n && heap_less(val[r], idx[r], val[m], idx[m])) m = r;
+        if (m == i) return;
+        float tv = val[i]; val[i] = val[m]; val[m] = tv;
+        int32_t ti = idx[i]; idx[i] = idx[m]; idx[m] = ti;
+        i = m;
+    }
+}
+
+// Seeds the heap with the first non-NaN elements; returns the position scanning should resume at.
+SL_INLINE int32_t heap_seed(const float * x, int32_t n, int32_t k, int32_t * idx, float * val, int32_t * filled) {
+    int32_t i = 0, f = 0;
+    for (; i < n && f < k; ++i) {
+        if (isnan(x[i])) continue;
+        val[f] = x[i]; idx[f] = i; ++f;
+    }
+    for (int32_t j = f / 2 - 1; j >= 0; --j) heap_sift_down(val, idx, f, j);
+    *filled = f;
+    return i;
+}
+
+SL_INLINE void heap_offer(float * val, int32_t * idx, int32_t k, float v, int32_t i) {
+    if (heap_less(val[0], idx[0], v, i)) {
+        val[0] = v; idx[0] = i;
+        heap_sift_down(val, idx, k, 0);
+    }
+}
+
+// In-place heapsort of the min-heap into descending order.
+SL_INLINE void heap_finish(float * val, int32_t * idx, int32_t n) {
+    for (int32_t end = n - 1; end > 0; --end) {
+        float tv = val[0]; val[0] = val[end]; val[end] = tv;
+        int32_t ti = idx[0]; idx[0] = idx[end]; idx[end] = ti;
+        heap_sift_down(val, idx, end, 0);
+    }
+}
+
+// ---- online log-sum-exp: running maximum m and sum of exp(x - m) ----
+
+SL_INLINE void lse_add(float * m, float * s, float v) {
+    if (!(v > -INFINITY)) return; // NaN or -inf adds nothing
+    if (v > *m) { *s = *s * expf(*m - v) + 1.0f; *m = v; }
+    else *s += expf(v - *m);
+}
+
+// Fold in a partial (m2, s2), e.g. one vector lane. Lanes start at m2 = -FLT_MAX, and one
+// still there saw no finite element (its s2 is only clamped exp(-inf) residue).
+SL_INLINE void lse_merge(float * m, float * s, float m2, float s2) {
+    if (!(s2 > 0.0f) || m2 == -FLT_MAX) return;
+    if (m2 > *m) { *s = *s * expf(*m - m2) + s2; *m = m2; }
+    else *s += s2 * expf(m2 - *m);
+}
+
+SL_INLINE float lse_result(float m, float s) {
+    return s > 0.0f ? m + logf(s) : -INFINITY;
+}
+
+// exp in vector registers (Cephes expf: range reduction by ln 2, degree-5 polynomial, 2^n
+// through the exponent bits). Inputs below -87.3 come out as ~1e-38 rather than 0, which
+// is far below anything a sum of at least one exp(0) can see.
+#define SL_EXP_HI 88.3762626647949f
+#define SL_EXP_LO -87.3365447504019f
+#define SL_LOG2E 1.44269504088896341f
+#define SL_EXP_C1 0.693359375f
+#define SL_EXP_C2 -2.12194440e-4f
+#define SL_EXP_P0 1.9875691500E-4f
+#define SL_EXP_P1 1.3981999507E-3f
+#define SL_EXP_P2 8.3334519073E-3f
+#define SL_EXP_P3 4.1665795894E-2f
+#define SL_EXP_P4 1.6666665459E-1f
+#define SL_EXP_P5 5.0000001201E-1f
+
+// ---- scalar reference ----
+
+int32_t sl_argmax_f32_scalar(const float * x, int32_t n) {
+    int32_t best = 0;
+    float best_v = -INFINITY;
+    for (int32_t i = 0; i < n; ++i) {
+        if (x[i] > best_v) { best_v = x[i]; best = i; }
+    }
+    return best;
+}
+
+int32_t sl_topk_f32_scalar(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val) {
+    if (k <= 0 || n <= 0) return 0;
+    int32_t f = 0;
+    int32_t i = heap_seed(x, n, k, out_idx, out_val, &f);
+    if (f == k) {
+        for (; i < n; ++i) {
+            if (x[i] > out_val[0]) heap_offer(out_val, out_idx, k, x[i], i);
+        }
+    }
+    heap_finish(out_val, out_idx, f);
+    return f;
+}
+
+int32_t sl_logsumexp_topk_f32_scalar(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val, float * out_lse) {
+    float m = -INFINITY;
+    for (int32_t i = 0; i < n; ++i) if (x[i] > m) m = x[i];
+    float s = 0.0f;
+    if (m > -INFINITY) {
+        for (int32_t i = 0; i < n; ++i) if (x[i] > -INFINITY) s += expf(x[i] - m);
+    }
+    *out_lse = lse_result(m, s);
+    return sl_topk_f32_scalar(x, n, k < n ? k : n, out_idx, out_val);
+}
+
+void sl_add_f32_scalar(float * x, const float * y, int32_t n) {
+    for (int32_t i = 0; i < n; ++i) x[i] += y[i];
+}
+
+void sl_scatter_add_f32_scalar(float * x, const int32_t * idx, const float * val, int32_t n) {
+    for (int32_t i = 0; i < n; ++i) x[idx[i]] += val[i];
+}
+
+// First index in [from, n) whose value equals m; vector paths use this for the tail.
+SL_INLINE int32_t find_first_eq_scalar(const float * x, int32_t from, int32_t n, float m) {
+    for (int32_t i = from; i < n; ++i) if (x[i] == m) return i;
+    return -1;
+}
+
+// Argmax is done as two cheap passes: a max reduction, then a scan for the first index
+// holding that value. Both are branch-free in the hot loop and match scalar tie-breaking.
+
+#if SL_X86
+
+__attribute__((target("avx2")))
+static int32_t argmax_avx2(const float * x, int32_t n) {
+    int32_t i = 0;
+    __m256 a0 = _mm256_set1_ps(-INFINITY), a1 = a0, a2 = a0, a3 = a0;
+    for (; i + 32 <= n; i += 32) {
+        // max(v, acc) returns acc when v is NaN
+        a0 = _mm256_max_ps(_mm256_loadu_ps(x + i),      a0);
+        a1 = _mm256_max_ps(_mm256_loadu_ps(x + i + 8),  a1);
+        a2 = _mm256_max_ps(_mm256_loadu_ps(x + i + 16), a2);
+        a3 = _mm256_max_ps(_mm256_loadu_ps(x + i + 24), a3);
+    }
+    for (; i + 8 <= n; i += 8) a0 = _mm256_max_ps(_mm256_loadu_ps(x + i), a0);
+    __m256 a = _mm256_max_ps(_mm256_max_ps(a0, a1), _mm256_max_ps(a2, a3));
+    __m128 h = _mm_max_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    h = _mm_max_ps(h, _mm_movehl_ps(h, h));
+    h = _mm_max_ss(h, _mm_shuffle_ps(h, h, 1));
+    float m = _mm_cvtss_f32(h);
+    for (; i < n; ++i) if (x[i] > m) m = x[i];
+
+    const __m256 vm = _mm256_set1_ps(m);
+    int32_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        int mask = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_loadu_ps(x + j), vm, _CMP_EQ_OQ));
+        if (mask) return j + __builtin_ctz((unsigned)mask);
+    }
+    int32_t r = find_first_eq_scalar(x, j, n, m);
+    return r < 0 ? 0 : r;
+}
+
+__attribute__((target("avx2")))
+static void add_avx2(float * x, const float * y, int32_t n) {
+    int32_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm256_storeu_ps(x + i,     _mm256_add_ps(_mm256_loadu_ps(x + i),     _mm256_loadu_ps(y + i)));
+        _mm256_storeu_ps(x + i + 8, _mm256_add_ps(_mm256_loadu_ps(x + i + 8), _mm256_loadu_ps(y + i + 8)));
+    }
+    for (; i + 8 <= n; i += 8) _mm256_storeu_ps(x + i, _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+    for (; i < n; ++i) x[i] += y[i];
+}
+
+__attribute__((target("avx512f")))
+static void add_avx512(float * x, const float * y, int32_t n) {
+    int32_t i = 0;
+    for (; i + 16 <= n; i += 16) _mm512_storeu_ps(x + i, _mm512_add_ps(_mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+    if (i < n) {
+        const __mmask16 m = (__mmask16)((1u << (n - i)) - 1u);
+        _mm512_mask_storeu_ps(x + i, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, x + i), _mm512_maskz_loadu_ps(m, y + i)));
+    }
+}
+
+// Sixteen entries per gather/add/scatter; distinct indices mean no lane conflicts.
+__attribute__((target("avx512f")))
+static void scatter_add_avx512(float * x, const int32_t * idx, const float * val, int32_t n) {
+    int32_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512i vi = _mm512_loadu_si512((const void *)(idx + i));
+        const __m512 v = _mm512_add_ps(_mm512_i32gather_ps(vi, x, 4), _mm512_loadu_ps(val + i));
+        _mm512_i32scatter_ps(x, vi, v, 4);
+    }
+    for (; i < n; ++i) x[idx[i]] += val[i];
+}
+
+__attribute__((target("avx512f")))
+static int32_t argmax_avx512(const float * x, int32_t n) {
+    int32_t i = 0;
+    __m512 a0 = _mm512_set1_ps(-INFINITY), a1 = a0, a2 = a0, a3 = a0;
+    for (; i + 64 <= n; i += 64) {
+        a0 = _mm512_max_ps(_mm512_loadu_ps(x + i),      a0);
+        a1 = _mm512_max_ps(_mm512_loadu_ps(x + i + 16), a1);
+        a2 = _mm512_max_ps(_mm512_loadu_ps(x + i + 32), a2);
+        a3 = _mm512_max_ps(_mm512_loadu_ps(x + i + 48), a3);
+    }
+    for (; i + 16 <= n; i += 16) a0 = _mm512_max_ps(_mm512_loadu_ps(x + i), a0);
+    float m = _mm512_reduce_max_ps(_mm512_max_ps(_mm512_max_ps(a0, a1), _mm512_max_ps(a2, a3)));
+    for (; i < n; ++i) if (x[i] > m) m = x[i];
+
+    const __m512 vm = _mm512_set1_ps(m);
+    int32_t j = 0;
+    for (; j + 16 <= n; j += 16) {
+        __mmask16 mask = _mm512_cmp_ps_mask(_mm512_loadu_ps(x + j), vm, _CMP_EQ_OQ);
+        if (mask) return j + __builtin_ctz((unsigned)mask);
+    }
+    int32_t r = find_first_eq_scalar(x, j, n, m);
+    return r < 0 ? 0 : r;
+}
+
+// Top-k: a vector compare against the current k-th value screens out almost every
+// element; only lanes that beat the threshold touch the heap.
+__attribute__((target("avx2")))
+static int32_t topk_avx2(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val) {
+    if (k <= 0 || n <= 0) return 0;
+    int32_t f = 0;
+    int32_t i = heap_seed(x, n, k, out_idx, out_val, &f);
+    if (f == k) {
+        __m256 thr = _mm256_set1_ps(out_val[0]);
+        for (; i + 8 <= n; i += 8) {
+            const __m256 v = _mm256_loadu_ps(x + i);
+            unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(v, thr, _CMP_GT_OQ));
+            if (!mask) continue;
+            while (mask) {
+                int32_t lane = __builtin_ctz(mask);
+                mask &= mask - 1;
+                if (x[i + lane] > out_val[0]) heap_offer(out_val, out_idx, k, x[i + lane], i + lane);
+            }
+            thr = _mm256_set1_ps(out_val[0]);
+        }
+        for (; i < n; ++i) if (x[i] > out_val[0]) heap_offer(out_val, out_idx, k, x[i], i);
+    }
+    heap_finish(out_val, out_idx, f);
+    return f;
+}
+
+__attribute__((target("avx512f")))
+static int32_t topk_avx512(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val) {
+    if (k <= 0 || n <= 0) return 0;
+    int32_t f = 0;
+    int32_t i = heap_seed(x, n, k, out_idx, out_val, &f);
+    if (f == k) {
+        __m512 thr = _mm512_set1_ps(out_val[0]);
+        for (; i + 16 <= n; i += 16) {
+            unsigned mask = (unsigned)_mm512_cmp_ps_mask(_mm512_loadu_ps(x + i), thr, _CMP_GT_OQ);
+            if (!mask) continue;
+            while (mask) {
+                int32_t lane = __builtin_ctz(mask);
+                mask &= mask - 1;
+                if (x[i + lane] > out_val[0]) heap_offer(out_val, out_idx, k, x[i + lane], i + lane);
+            }
+            thr = _mm512_set1_ps(out_val[0]);
+        }
+        for (; i < n; ++i) if (x[i] > out_val[0]) heap_offer(out_val, out_idx, k, x[i], i);
+    }
+    heap_finish(out_val, out_idx, f);
+    return f;
+}
+
+// Fused log-sum-exp + top-k: each lane keeps a running max and a sum of exp(x - max),
+// rescaled only in the (rare, after the first blocks) steps where some lane's max rises, so
+// the sweep costs about one exp per element; the loaded block is then screened against
+// the top-k threshold as in topk_*. The first k elements seed the heap and are summed in
+// scalar. NaN lanes are turned into -inf (max returns its second operand on NaN).
+
+__attribute__((target("avx2")))
+SL_INLINE __m256 exp_avx2(__m256 x) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(SL_EXP_LO)), _mm256_set1_ps(SL_EXP_HI));
+    const __m256 fx = _mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(SL_LOG2E)), _mm256_set1_ps(0.5f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(SL_EXP_C1)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(SL_EXP_C2)));
+    const __m256 z = _mm256_mul_ps(x, x);
+    __m256 y = _mm256_set1_ps(SL_EXP_P0);
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(SL_EXP_P1));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(SL_EXP_P2));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(SL_EXP_P3));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(SL_EXP_P4));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(SL_EXP_P5));
+    y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(y, z), x), _mm256_set1_ps(1.0f));
+    const __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(e));
+}
+
+__attribute__((target("avx2")))
+static int32_t lse_topk_avx2(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val, float * out_lse) {
+    float m = -INFINITY, s = 0.0f;
+    int32_t f = 0, i = 0;
+    if (k > 0 && n > 0) {
+        i = heap_seed(x, n, k, out_idx, out_val, &f);
+        for (int32_t j = 0; j < i; ++j) lse_add(&m, &s, x[j]);
+    }
+    const __m256 ninf = _mm256_set1_ps(-INFINITY);
+    __m256 vm = _mm256_set1_ps(-FLT_MAX), vs = _mm256_setzero_ps();
+    // with no heap to fill the threshold never passes
+    __m256 thr = _mm256_set1_ps(f == k && k > 0 ? out_val[0] : INFINITY);
+    for (; i + 8 <= n; i += 8) {
+        const __m256 v = _mm256_max_ps(_mm256_loadu_ps(x + i), ninf);
+        const __m256 mn = _mm256_max_ps(vm, v);
+        if (_mm256_movemask_ps(_mm256_cmp_ps(mn, vm, _CMP_GT_OQ))) {
+            vs = _mm256_mul_ps(vs, exp_avx2(_mm256_sub_ps(vm, mn)));
+            vm = mn;
+        }
+        vs = _mm256_add_ps(vs, exp_avx2(_mm256_sub_ps(v, vm)));
+        unsigned mask = (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(v, thr, _CMP_GT_OQ));
+        if (!mask) continue;
+        while (mask) {
+            int32_t lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (x[i + lane] > out_val[0]) heap_offer(out_val, out_idx, k, x[i + lane], i + lane);
+        }
+        thr = _mm256_set1_ps(out_val[0]);
+    }
+    float lm[8], ls[8];
+    _mm256_storeu_ps(lm, vm);
+    _mm256_storeu_ps(ls, vs);
+    for (int l = 0; l < 8; ++l) lse_merge(&m, &s, lm[l], ls[l]);
+    for (; i < n; ++i) {
+        lse_add(&m, &s, x[i]);
+        if (f == k && k > 0 && x[i] > out_val[0]) heap_offer(out_val, out_idx, k, x[i], i);
+    }
+    *out_lse = lse_result(m, s);
+    heap_finish(out_val, out_idx, f);
+    return f;
+}
+
+__attribute__((target("avx512f")))
+SL_INLINE __m512 exp_avx512(__m512 x) {
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(SL_EXP_LO)), _mm512_set1_ps(SL_EXP_HI));
+    const __m512 fx = _mm512_roundscale_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(SL_LOG2E), _mm512_set1_ps(0.5f)),
+                                           _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(SL_EXP_C1), x);
+    x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(SL_EXP_C2), x);
+    const __m512 z = _mm512_mul_ps(x, x);
+    __m512 y = _mm512_set1_ps(SL_EXP_P0);
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(SL_EXP_P1));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(SL_EXP_P2));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(SL_EXP_P3));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(SL_EXP_P4));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(SL_EXP_P5));
+    y = _mm512_add_ps(_mm512_fmadd_ps(y, z, x), _mm512_set1_ps(1.0f));
+    const __m512i e = _mm512_slli_epi32(_mm512_add_epi32(_mm512_cvttps_epi32(fx), _mm512_set1_epi32(127)), 23);
+    return _mm512_mul_ps(y, _mm512_castsi512_ps(e));
+}
+
+__attribute__((target("avx512f")))
+static int32_t lse_topk_avx512(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val, float * out_lse) {
+    float m = -INFINITY, s = 0.0f;
+    int32_t f = 0, i = 0;
+    if (k > 0 && n > 0) {
+        i = heap_seed(x, n, k, out_idx, out_val, &f);
+        for (int32_t j = 0; j < i; ++j) lse_add(&m, &s, x[j]);
+    }
+    const __m512 ninf = _mm512_set1_ps(-INFINITY);
+    __m512 vm = _mm512_set1_ps(-FLT_MAX), vs = _mm512_setzero_ps();
+    __m512 thr = _mm512_set1_ps(f == k && k > 0 ? out_val[0] : INFINITY);
+    for (; i + 16 <= n; i += 16) {
+        const __m512 v = _mm512_max_ps(_mm512_loadu_ps(x + i), ninf);
+        const __m512 mn = _mm512_max_ps(vm, v);
+        if (_mm512_cmp_ps_mask(mn, vm, _CMP_GT_OQ)) {
+            vs = _mm512_mul_ps(vs, exp_avx512(_mm512_sub_ps(vm, mn)));
+            vm = mn;
+        }
+        vs = _mm512_add_ps(vs, exp_avx512(_mm512_sub_ps(v, vm)));
+        unsigned mask = (unsigned)_mm512_cmp_ps_mask(v, thr, _CMP_GT_OQ);
+        if (!mask) continue;
+        while (mask) {
+            int32_t lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+            if (x[i + lane] > out_val[0]) heap_offer(out_val, out_idx, k, x[i + lane], i + lane);
+        }
+        thr = _mm512_set1_ps(out_val[0]);
+    }
+    float lm[16], ls[16];
+    _mm512_storeu_ps(lm, vm);
+    _mm512_storeu_ps(ls, vs);
+    for (int l = 0; l < 16; ++l) lse_merge(&m, &s, lm[l], ls[l]);
+    for (; i < n; ++i) {
+        lse_add(&m, &s, x[i]);
+        if (f == k && k > 0 && x[i] > out_val[0]) heap_offer(out_val, out_idx, k, x[i], i);
+    }
+    *out_lse = lse_result(m, s);
+    heap_finish(out_val, out_idx, f);
+    return f;
+}
+
+#elif SL_NEON
+
+static int32_t argmax_neon(const float * x, int32_t n) {
+    int32_t i = 0;
+    float32x4_t a0 = vdupq_n_f32(-INFINITY), a1 = a0, a2 = a0, a3 = a0;
+    for (; i + 16 <= n; i += 16) {
+        // maxnm ignores a quiet NaN operand
+        a0 = vmaxnmq_f32(a0, vld1q_f32(x + i));
+        a1 = vmaxnmq_f32(a1, vld1q_f32(x + i + 4));
+        a2 = vmaxnmq_f32(a2, vld1q_f32(x + i + 8));
+        a3 = vmaxnmq_f32(a3, vld1q_f32(x + i + 12));
+    }
+    for (; i + 4 <= n; i += 4) a0 = vmaxnmq_f32(a0, vld1q_f32(x + i));
+    float m = vmaxnmvq_f32(vmaxnmq_f32(vmaxnmq_f32(a0, a1), vmaxnmq_f32(a2, a3)));
+    for (; i < n; ++i) if (x[i] > m) m = x[i];
+
+    const float32x4_t vm = vdupq_n_f32(m);
+    int32_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        uint32x4_t eq = vceqq_f32(vld1q_f32(x + j), vm);
+        if (vmaxvq_u32(eq)) {
+            for (int32_t l = 0; l < 4; ++l) if (x[j + l] == m) return j + l;
+        }
+    }
+    int32_t r = find_first_eq_scalar(x, j, n, m);
+    return r < 0 ? 0 : r;
+}
+
+static void add_neon(float * x, const float * y, int32_t n) {
+    int32_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        vst1q_f32(x + i,     vaddq_f32(vld1q_f32(x + i),     vld1q_f32(y + i)));
+        vst1q_f32(x + i + 4, vaddq_f32(vld1q_f32(x + i + 4), vld1q_f32(y + i + 4)));
+    }
+    for (; i < n; ++i) x[i] += y[i];
+}
+
+static int32_t topk_neon(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val) {
+    if (k <= 0 || n <= 0) return 0;
+    int32_t f = 0;
+    int32_t i = heap_seed(x, n, k, out_idx, out_val, &f);
+    if (f == k) {
+        float32x4_t thr = vdupq_n_f32(out_val[0]);
+        for (; i + 4 <= n; i += 4) {
+            uint32x4_t gt = vcgtq_f32(vld1q_f32(x + i), thr);
+            if (!vmaxvq_u32(gt)) continue;
+            for (int32_t l = 0; l < 4; ++l) {
+                if (x[i + l] > out_val[0]) heap_offer(out_val, out_idx, k, x[i + l], i + l);
+            }
+            thr = vdupq_n_f32(out_val[0]);
+        }
+        for (; i < n; ++i) if (x[i] > out_val[0]) heap_offer(out_val, out_idx, k, x[i], i);
+    }
+    heap_finish(out_val, out_idx, f);
+    return f;
+}
+
+SL_INLINE float32x4_t exp_neon(float32x4_t x) {
+    x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(SL_EXP_LO)), vdupq_n_f32(SL_EXP_HI));
+    const float32x4_t fx = vrndmq_f32(vfmaq_f32(vdupq_n_f32(0.5f), x, vdupq_n_f32(SL_LOG2E)));
+    x = vfmsq_f32(x, fx, vdupq_n_f32(SL_EXP_C1));
+    x = vfmsq_f32(x, fx, vdupq_n_f32(SL_EXP_C2));
+    const float32x4_t z = vmulq_f32(x, x);
+    float32x4_t y = vdupq_n_f32(SL_EXP_P0);
+    y = vfmaq_f32(vdupq_n_f32(SL_EXP_P1), y, x);
+    y = vfmaq_f32(vdupq_n_f32(SL_EXP_P2), y, x);
+    y = vfmaq_f32(vdupq_n_f32(SL_EXP_P3), y, x);
+    y = vfmaq_f32(vdupq_n_f32(SL_EXP_P4), y, x);
+    y = vfmaq_f32(vdupq_n_f32(SL_EXP_P5), y, x);
+    y = vaddq_f32(vfmaq_f32(x, y, z), vdupq_n_f32(1.0f));
+    const int32x4_t e = vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(fx), vdupq_n_s32(127)), 23);
+    return vmulq_f32(y, vreinterpretq_f32_s32(e));
+}
+
+static int32_t lse_topk_neon(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val, float * out_lse) {
+    float m = -INFINITY, s = 0.0f;
+    int32_t f = 0, i = 0;
+    if (k > 0 && n > 0) {
+        i = heap_seed(x, n, k, out_idx, out_val, &f);
+        for (int32_t j = 0; j < i; ++j) lse_add(&m, &s, x[j]);
+    }
+    const float32x4_t ninf = vdupq_n_f32(-INFINITY);
+    float32x4_t vm = vdupq_n_f32(-FLT_MAX), vs = vdupq_n_f32(0.0f);
+    float32x4_t thr = vdupq_n_f32(f == k && k > 0 ? out_val[0] : INFINITY);
+    for (; i + 4 <= n; i += 4) {
+        const float32x4_t v = vmaxnmq_f32(vld1q_f32(x + i), ninf); // maxnm drops a NaN operand
+        const float32x4_t mn = vmaxq_f32(vm, v);
+        if (vmaxvq_u32(vcgtq_f32(mn, vm))) {
+            vs = vmulq_f32(vs, exp_neon(vsubq_f32(vm, mn)));
+            vm = mn;
+        }
+        vs = vaddq_f32(vs, exp_neon(vsubq_f32(v, vm)));
+        if (!vmaxvq_u32(vcgtq_f32(v, thr))) continue;
+        for (int32_t l = 0; l < 4; ++l) {
+            if (x[i + l] > out_val[0]) heap_offer(out_val, out_idx, k, x[i + l], i + l);
+        }
+        thr = vdupq_n_f32(out_val[0]);
+    }
+    float lm[4], ls[4];
+    vst1q_f32(lm, vm);
+    vst1q_f32(ls, vs);
+    for (int l = 0; l < 4; ++l) lse_merge(&m, &s, lm[l], ls[l]);
+    for (; i < n; ++i) {
+        lse_add(&m, &s, x[i]);
+        if (f == k && k > 0 && x[i] > out_val[0]) heap_offer(out_val, out_idx, k, x[i], i);
+    }
+    *out_lse = lse_result(m, s);
+    heap_finish(out_val, out_idx, f);
+    return f;
+}
+
+#endif
+
+// ---- dispatch ----
+
+typedef int32_t (*argmax_fn)(const float *, int32_t);
+typedef int32_t (*topk_fn)(const float *, int32_t, int32_t, int32_t *, float *);
+typedef int32_t (*lse_topk_fn)(const float *, int32_t, int32_t, int32_t *, float *, float *);
+typedef void    (*add_fn)(float *, const float *, int32_t);
+typedef void    (*scatter_add_fn)(float *, const int32_t *, const float *, int32_t);
+
+static argmax_fn      g_argmax  = sl_argmax_f32_scalar;
+static topk_fn        g_topk    = sl_topk_f32_scalar;
+static lse_topk_fn    g_lse_topk = sl_logsumexp_topk_f32_scalar;
+static add_fn         g_add     = sl_add_f32_scalar;
+static scatter_add_fn g_scatter = sl_scatter_add_f32_scalar; // no gain without a scatter store
+static const char * g_isa    = "scalar";
+static pthread_once_t g_dispatch_once = PTHREAD_ONCE_INIT;
+
+// SONIFIED_KERNELS_ISA=avx2|scalar caps the selection (benchmarks and tests); it never upgrades.
+static void resolve_dispatch(void) {
+    const char * cap = getenv("SONIFIED_KERNELS_ISA");
+    if (cap && strcmp(cap, "scalar") == 0) return;
+#if SL_X86
+    __builtin_cpu_init();
+    const bool allow512 = !(cap && strcmp(cap, "avx2") == 0);
+    if (allow512 && __builtin_cpu_supports("avx512f")) {
+        g_argmax = argmax_avx512; g_topk = topk_avx512; g_isa = "avx512";
+        g_add = add_avx512; g_scatter = scatter_add_avx512; g_lse_topk = lse_topk_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        g_argmax = argmax_avx2; g_topk = topk_avx2; g_isa = "avx2";
+        g_add = add_avx2; g_lse_topk = lse_topk_avx2;
+    }
+#elif SL_NEON
+    g_argmax = argmax_neon; g_topk = topk_neon; g_isa = "neon";
+    g_add = add_neon; g_lse_topk = lse_topk_neon;
+#endif
+}
+
+int32_t sl_argmax_f32(const float * x, int32_t n) {
+    pthread_once(&g_dispatch_once, resolve_dispatch);
+    return g_argmax(x, n);
+}
+
+int32_t sl_topk_f32(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val) {
+    pthread_once(&g_dispatch_once, resolve_dispatch);
+    if (k > n) k = n;
+    return g_topk(x, n, k, out_idx, out_val);
+}
+
+int32_t sl_logsumexp_topk_f32(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val, float * out_lse) {
+    pthread_once(&g_dispatch_once, resolve_dispatch);
+    if (k > n) k = n;
+    return g_lse_topk(x, n, k, out_idx, out_val, out_lse);
+}
+
+void sl_add_f32(float * x, const float * y, int32_t n) {
+    pthread_once(&g_dispatch_once, resolve_dispatch);
+    g_add(x, y, n);
+}
+
+void sl_scatter_add_f32(float * x, const int32_t * idx, const float * val, int32_t n) {
+    pthread_once(&g_dispatch_once, resolve_dispatch);
+    g_scatter(x, idx, val, n);
+}
+
+const char * sl_kernels_isa(void) {
+    pthread_once(&g_dispatch_once, resolve_dispatch);
+    return g_isa;
+}
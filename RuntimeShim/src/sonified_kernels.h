@@ -0,0 +1,43 @@
+// sonified_kernels.h
+//
+// Vectorized reductions and updates over logit rows used on the per-token critical path.
+// AVX-512 / AVX2 (x86, chosen at runtime via cpuid) and NEON (arm64) paths, with a
+// scalar fallback that defines the reference semantics. Free of llama.cpp types.
+
+#ifndef SONIFIED_KERNELS_H
+#define SONIFIED_KERNELS_H
+
+#include <stdint.h>
+
+// Index of the first maximum element of x[0..n). NaNs are ignored. n must be > 0.
+int32_t sl_argmax_f32(const float * x, int32_t n);
+
+// Partial top-k: writes the k largest elements (ties keep the lower index) to out_idx/out_val,
+// sorted by descending value. Returns the number written (min(k, n)).
+int32_t sl_topk_f32(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val);
+
+// Fused log-softmax support in one sweep: *out_lse = log(sum(exp(x[i]))) over the row, and
+// the k largest elements written as sl_topk_f32 does, so the log-probability of token i is
+// x[i] - *out_lse. NaNs are ignored; *out_lse is -INFINITY when every element is -inf or NaN.
+// The vector paths use a polynomial exp and agree with the scalar reference to within a few
+// ulp of the sum (the top-k agrees exactly). Returns the number of top-k entries written.
+int32_t sl_logsumexp_topk_f32(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val, float * out_lse);
+
+// x[i] += y[i] for i in [0, n) (a dense logit-bias row).
+void sl_add_f32(float * x, const float * y, int32_t n);
+
+// x[idx[i]] += val[i] for i in [0, n) (a sparse logit bias). Indices must be distinct.
+void sl_scatter_add_f32(float * x, const int32_t * idx, const float * val, int32_t n);
+
+// Name of the instruction set selected for this process ("avx512", "avx2", "neon", "scalar").
+// The env var SONIFIED_KERNELS_ISA=avx2|scalar caps the choice for comparisons.
+const char * sl_kernels_isa(void);
+
+// Scalar reference implementations (tests and benchmarks).
+int32_t sl_argmax_f32_scalar(const float * x, int32_t n);
+int32_t sl_topk_f32_scalar(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val);
+int32_t sl_logsumexp_topk_f32_scalar(const float * x, int32_t n, int32_t k, int32_t * out_idx, float * out_val, float * out_lse);
+void    sl_add_f32_scalar(float * x, const float * y, int32_t n);
+void    sl_scatter_add_f32_scalar(float * x, const int32_t * idx, const float * val, int32_t n);
+
+#endif // SONIFIED_KERNELS_H
@@ -1,16 +1,27 @@
 #include "sonified_llama.h"
+#include "sonified_constrain.h"
+#include "sonified_embed.h"
+#include "sonified_emit.h"
+#include "sonified_models.h"
+#include "sonified_platform.h"
+#include "sonified_sampling.h"
+#include "sonified_sched.h"
+#include "sonified_spec.h"
+#include "sonified_state.h"
+#include "sonified_stop.h"
+#include "sonified_tokenize.h"
 #include "llama.h"
+#include <errno.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <stdatomic.h>
-#include <time.h>
-#include <mach/mach.h>
 #include <stdio.h>
 #include <dlfcn.h>
+#include <pthread.h>
 // ---- simple thread-local last-error storage ----
 #if defined(__APPLE__)
-#include <pthread.h>
 static _Thread_local int g_last_err_code = 0;
 static _Thread_local char g_last_err_msg[256];
 static inline void set_last_error(int code, const char* msg) {
@@ -55,58 +66,67 @@ static int get_env_ctx_override(void) {
     return (int) v;
 }
 
-// lightweight timing + RSS helpers
+// lightweight timing + RSS helpers (platform specifics live in sonified_platform.c)
 static inline double now_ms(void) {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+    return sl_now_ms();
 }
 
 static inline size_t current_rss_bytes(void) {
-    task_vm_info_data_t info;
-    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
-    if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) return 0;
-    return (size_t)info.phys_footprint; // good proxy for resident set on macOS
+    return sl_current_rss_bytes();
 }
 
 // ---- helpers (no dependency on common/) ----
-static int detect_n_threads_default(void) {
-    return 4;
-}
-
-// two-pass tokenize; follow model BOS policy, parse special tokens
-static int tokenize_prompt(struct llama_model * model, const char * prompt, bool add_bos /*unused*/, llama_token ** out) {
-    if (!out) return -1;
-    if (!prompt) prompt = "";
-    const struct llama_vocab * vocab = llama_model_get_vocab(model);
-    const bool model_wants_bos = llama_vocab_get_add_bos(vocab);
-    const int32_t text_len = (int32_t)strlen(prompt);
-    int32_t need = llama_tokenize(vocab, prompt, text_len, NULL, 0, /*add_special=*/model_wants_bos, /*parse_special=*/true);
-    if (need < 0) need = -need; // API returns negative of required size when buffer is NULL
-    if (need <= 0) { *out = NULL; return 0; }
-    llama_token * buf = (llama_token *)malloc(sizeof(llama_token) * (size_t)need);
-    if (!buf) { *out = NULL; return -1; }
-    int32_t n = llama_tokenize(vocab, prompt, text_len, buf, need, /*add_special=*/model_wants_bos, /*parse_special=*/true);
-    if (n < 0) { free(buf); *out = NULL; return -1; }
-    *out = buf;
-    return (int)n;
-}
-
-// greedy: pick argmax from last logits
-static llama_token sample_greedy(struct llama_context * ctx, const struct llama_model * model) {
-    float * logits = llama_get_logits(ctx);
-    if (!logits) return LLAMA_TOKEN_NULL;
-    const struct llama_vocab * vocab = llama_model_get_vocab(model);
-    const int32_t n_vocab = llama_vocab_n_tokens(vocab);
-    int best = 0;
-    float best_v = logits[0];
-    for (int i = 1; i < n_vocab; ++i) {
-        const float v = logits[i];
-        if (v > best_v) { best_v = v; best = i; }
-    }
-    return (llama_token)best;
+
+// Thread counts from SONIFIED_THREADS / SONIFIED_THREADS_BATCH, else detected from the
+// usable physical cores (affinity mask and cgroup quota honored).
+static int get_env_threads(const char* name) {
+    const char *s = getenv(name);
+    if (!s || !*s) return 0;
+    long v = strtol(s, NULL, 10);
+    if (v < 1) return 0;
+    if (v > 512) v = 512;
+    return (int) v;
+}
+
+static void detect_threads(int* n_decode, int* n_prefill) {
+    sl_default_threads(n_decode, n_prefill);
+    const int env_decode = get_env_threads("SONIFIED_THREADS");
+    const int env_prefill = get_env_threads("SONIFIED_THREADS_BATCH");
+    if (env_decode > 0) *n_decode = env_decode;
+    if (env_prefill > 0) *n_prefill = env_prefill;
+    else if (env_decode > 0) *n_prefill = env_decode;
+}
+
+// ---- KV cache helpers (single place to adapt when llama.cpp's memory API moves) ----
+static inline bool kv_seq_rm(struct llama_context * ctx, llama_seq_id seq, llama_pos p0, llama_pos p1) {
+    return llama_kv_self_seq_rm(ctx, seq, p0, p1);
+}
+
+static inline void kv_clear(struct llama_context * ctx) {
+    llama_kv_self_clear(ctx);
+}
+
+// Length of the shared prefix of two token sequences.
+static int common_prefix_len(const llama_token * a, int na, const llama_token * b, int nb) {
+    const int n = na < nb ? na : nb;
+    int i = 0;
+    while (i < n && a[i] == b[i]) ++i;
+    return i;
 }
 
+// Cancellation must be observed within ~150 ms (LLMEngine.generate contract), so adaptive
+// prefill chunks are sized to take about this long.
+enum { PREFILL_CHUNK_TARGET_MS = 100, PREFILL_CHUNK_MIN = 32, PREFILL_CHUNK_START = 64 };
+
+// Default concurrent sequences served by the llm_submit scheduler, each with the handle's n_ctx.
+enum { SCHED_SLOTS = 4 };
+
+// Draft tokens verified per target step: default and hard cap; prompt lookup's cap.
+enum { SPEC_DRAFT_DEFAULT = 6, SPEC_DRAFT_MAX = 32, SPEC_LOOKUP_MAX = 8 };
+
+// Live constraints per handle (llm_constraint_create ids are index + 1).
+enum { CONSTRAINTS_MAX = 64 };
+
 // Private opaque context for our handle. Keep the first field as the
 // legacy stub flag to maintain ABI with existing stubbed eval/stats.
 typedef struct LLMContext {
@@ -114,21 +134,184 @@ typedef struct LLMContext {
     _Atomic bool cancelFlag;   // cooperative cancel checked inside decode loop
     struct llama_model*   model;
     struct llama_context* ctx;
+    struct llama_context_params cparams; // as created; the scheduler context derives from it
     int n_ctx;
+    int n_seq_max;           // scheduler slots
+    long long kv_cache_bytes; // K+V allocated for n_ctx cells
     int n_gpu_layers;
+    int n_threads;           // decode (one token per llama_decode)
+    int n_threads_batch;     // prefill
+    sl_sampler sampler;      // reused across evals; buffers sized to the vocab once
+    // Tokens currently held in the KV cache for seq 0, in position order. The next eval
+    // keeps the longest common prefix with its prompt and only decodes the remainder.
+    llama_token* kv_tokens;  // capacity n_ctx
+    int n_kv_tokens;
+    struct llama_batch batch; // explicit-position batch, capacity batch_cap (= n_batch)
+    int batch_cap;
+    // speculative decoding (llm_eval only); NULL when no draft model was given
+    sl_draft* draft;
+    int n_draft;
+    sl_token_seq prompt_seq; // llm_eval prompt text and tokens; a prompt extending it re-tokenizes only the tail
+    int prefix_cache_tokens; // scheduler prefix cache budget in KV cells (0 = off)
+    // continuous-batching scheduler for llm_submit, created on first use
+    sl_sched* sched;
+    pthread_mutex_t sched_mu;
+    // embedding context for llm_embed, created on first use; embed_mu serializes its calls
+    sl_embedder* embedder;
+    pthread_mutex_t embed_mu;
+    // constrained decoding: the vocabulary trie (built by the first llm_constraint_create),
+    // compiled constraints by id, and llm_eval's matcher state; con_mu guards the table
+    sl_vocab_trie* trie;
+    sl_constraint* constraints[CONSTRAINTS_MAX];
+    sl_constraint_state* con_state;
+    pthread_mutex_t con_mu;
+    // llm_token_id answers, guarded by ids_mu
+    sl_token_ids token_ids;
+    pthread_mutex_t ids_mu;
     // placeholders for future slices:
     llm_stats_t lastStats;   // persisted after each eval
 } LLMContext;
 
+// Decode n tokens of seq 0 starting at position pos0 through the handle's batch.
+// n must not exceed batch_cap. Only the last token requests logits when want_logits.
+static int decode_span(LLMContext * st, const llama_token * tokens, int n, int pos0, bool want_logits) {
+    struct llama_batch * b = &st->batch;
+    for (int i = 0; i < n; ++i) {
+        b->token[i] = tokens[i];
+        b->pos[i] = pos0 + i;
+        b->n_seq_id[i] = 1;
+        b->seq_id[i][0] = 0;
+        b->logits[i] = 0;
+    }
+    if (want_logits && n > 0) b->logits[n - 1] = 1;
+    b->n_tokens = n;
+    return llama_decode(st->ctx, *b);
+}
+
+// Decode tok followed by n_draft proposals at pos. With proposals every row gets logits,
+// so row i holds the target's prediction after batch token i.
+static int decode_step(LLMContext * st, llama_token tok, const llama_token * draft, int n_draft, int pos) {
+    struct llama_batch * b = &st->batch;
+    for (int i = 0; i <= n_draft; ++i) {
+        b->token[i] = i == 0 ? tok : draft[i - 1];
+        b->pos[i] = pos + i;
+        b->n_seq_id[i] = 1;
+        b->seq_id[i][0] = 0;
+        b->logits[i] = 1;
+    }
+    b->n_tokens = n_draft + 1;
+    return llama_decode(st->ctx, *b);
+}
+
+// Deterministic stub output shared by llm_eval and the stub scheduler. If the prompt
+// contains a gated tool marker [[tool:NAME:ARG]] a JSON tool call is emitted first.
+static int stub_generate(const char* prompt_utf8, llm_token_cb cb, void* user_ctx) {
+    if (prompt_utf8 && strcmp(prompt_utf8, "CAUSE_EVAL_FAIL") == 0) {
+        return -1;
+    }
+    // If the prompt contains a gated tool marker [[tool:NAME:ARG]] emit a JSON tool call first
+    // Or enable demo emission via environment variable SONIFIED_DEMO_TOOLCALL=1
+    if (prompt_utf8) {
+        bool demo = false;
+        const char * demo_env = getenv("SONIFIED_DEMO_TOOLCALL");
+        if (demo_env && strcmp(demo_env, "1") == 0) demo = true;
+        const char * start = strstr(prompt_utf8, "[[tool:");
+        char tool_name[64] = {0};
+        char tool_arg[256] = {0};
+        if (start) {
+            start += 7; // after '[[tool:'
+            const char * colon = strchr(start, ':');
+            const char * end = strstr(start, "]]" );
+            if (colon && end && colon < end) {
+                size_t nlen = (size_t)(colon - start);
+                size_t alen = (size_t)(end - colon - 1);
+                if (nlen > 0 && nlen < sizeof(tool_name) && alen > 0 && alen < sizeof(tool_arg)) {
+                    memcpy(tool_name, start, nlen);
+                    tool_name[nlen] = '\0';
+                    memcpy(tool_arg, colon + 1, alen);
+                    tool_arg[alen] = '\0';
+                }
+            }
+        } else if (demo) {
+            strncpy(tool_name, "math", sizeof(tool_name) - 1);
+            strncpy(tool_arg, "2^8", sizeof(tool_arg) - 1);
+        }
+        if (tool_name[0] != '\0' && strcmp(tool_name, "math") == 0 && tool_arg[0] != '\0') {
+            // Build minimal JSON: {"tool":{"name":"math","arguments":{"expression":"..."}}}
+            char json[512];
+            snprintf(json, sizeof(json),
+                     "{\"tool\":{\"name\":\"math\",\"arguments\":{\"expression\":\"%s\"}}}",
+                     tool_arg);
+            cb(json, user_ctx);
+        }
+    }
+    const char * piece = "ok";
+    cb(piece, user_ctx);
+    return 0;
+}
+
 // Global backend refcount so we init/free llama backends once
 static _Atomic int g_backend_refs = 0;
 
+llm_init_params_t llm_init_params_default(void) {
+    llm_init_params_t p;
+    memset(&p, 0, sizeof(p));
+    p.struct_size = (int)sizeof(p);
+    p.n_gpu_layers = -1;
+    p.use_mmap = 1;
+    p.use_mlock = 0;
+    p.flash_attn = -1;
+    p.draft_model_path = NULL;
+    p.n_draft = 0;
+    p.prefix_cache_mb = 0;
+    return p;
+}
+
+static bool kv_type_quantized(enum ggml_type t) {
+    return t != GGML_TYPE_F16 && t != GGML_TYPE_BF16 && t != GGML_TYPE_F32;
+}
+
+static enum ggml_type kv_ggml_type(int t, enum ggml_type fallback) {
+    switch (t) {
+        case LLM_KV_TYPE_F16:  return GGML_TYPE_F16;
+        case LLM_KV_TYPE_BF16: return GGML_TYPE_BF16;
+        case LLM_KV_TYPE_F32:  return GGML_TYPE_F32;
+        case LLM_KV_TYPE_Q8_0: return GGML_TYPE_Q8_0;
+        case LLM_KV_TYPE_Q4_0: return GGML_TYPE_Q4_0;
+        default:               return fallback;
+    }
+}
+
 llm_handle_t llm_init(const char* model_path) {
+    return llm_init_ex(model_path, NULL);
+}
+
+llm_handle_t llm_init_ex(const char* model_path, const llm_init_params_t* params) {
     if (!model_path || model_path[0] == '\0') {
         fprintf(stderr, "[sonified_llama] llm_init: empty model path\n");
         set_last_error(-2, "empty model path");
         return NULL;
     }
+    if (params && params->struct_size <= 0) {
+        fprintf(stderr, "[sonified_llama] llm_init_ex: params->struct_size not set\n");
+        set_last_error(22 /*EINVAL*/, "llm_init_params_t.struct_size not set (start from llm_init_params_default)");
+        return NULL;
+    }
+    // Overlay the caller's struct on the defaults, up to the size it was compiled with
+    llm_init_params_t ip = llm_init_params_default();
+    if (params) {
+        size_t n = (size_t)params->struct_size < sizeof(ip) ? (size_t)params->struct_size : sizeof(ip);
+        memcpy(&ip, params, n);
+        ip.struct_size = (int)sizeof(ip);
+    }
+    int n_ctx = ip.n_ctx;
+    if (n_ctx <= 0) {
+        n_ctx = 4096;
+        int ctx_override = get_env_ctx_override();
+        if (ctx_override > 0) n_ctx = ctx_override;
+    }
+    const int n_seq_max = ip.n_seq_max > 0 ? ip.n_seq_max : SCHED_SLOTS;
+
     // Deterministic failure for tests via env var
     static _Atomic int g_fail_once_consumed = 0;
     const char* fail_env = getenv("CAUSE_INIT_FAIL");
@@ -147,10 +330,15 @@ llm_handle_t llm_init(const char* model_path) {
         h->model = NULL;
         h->ctx = NULL;
         h->n_gpu_layers = 0;
-        int n_ctx = 4096;
-        int ctx_override = get_env_ctx_override();
-        if (ctx_override > 0) n_ctx = ctx_override;
         h->n_ctx = n_ctx;
+        h->n_seq_max = n_seq_max;
+        detect_threads(&h->n_threads, &h->n_threads_batch);
+        if (ip.n_threads > 0) h->n_threads = ip.n_threads;
+        if (ip.n_threads_batch > 0) h->n_threads_batch = ip.n_threads_batch;
+        pthread_mutex_init(&h->sched_mu, NULL);
+        pthread_mutex_init(&h->embed_mu, NULL);
+        pthread_mutex_init(&h->con_mu, NULL);
+        pthread_mutex_init(&h->ids_mu, NULL);
         memset(&h->lastStats, 0, sizeof(h->lastStats));
         return (llm_handle_t)h;
     }
@@ -162,14 +350,19 @@ llm_handle_t llm_init(const char* model_path) {
 
     // ----- model params (GPU offload on Apple Silicon by default) -----
     struct llama_model_params mparams = llama_model_default_params();
-    int n_gpu_layers = 0;
+    int n_gpu_layers = ip.n_gpu_layers;
+    if (n_gpu_layers < 0) {
+        n_gpu_layers = 0;
 #if defined(__APPLE__) && (defined(__aarch64__) || defined(__ARM64__))
-    n_gpu_layers = 999; // try to offload as many layers as possible by default
+        n_gpu_layers = 999; // try to offload as many layers as possible by default
 #endif
-    if (n_gpu_layers < 0) n_gpu_layers = 0;
+    }
     mparams.n_gpu_layers = n_gpu_layers;
+    mparams.use_mmap = ip.use_mmap != 0;
+    mparams.use_mlock = ip.use_mlock != 0;
 
-    struct llama_model* model = llama_load_model_from_file(model_path, mparams);
+    // shared with any other handle on the same file and load params
+    struct llama_model* model = sl_model_acquire(model_path, &mparams);
     if (!model) {
         fprintf(stderr, "[sonified_llama] llm_init: failed to load model at '%s' (insufficient memory or missing file)\n", model_path);
         set_last_error(12 /*ENOMEM*/, "failed to load model (likely OOM or missing file)");
@@ -177,21 +370,30 @@ llm_handle_t llm_init(const char* model_path) {
         return NULL;
     }
 
-    // ----- context params (sequence length, seed, etc.) -----
+    // ----- context params (sequence length, batch sizes, KV cache layout) -----
     struct llama_context_params cparams = llama_context_default_params();
-    int n_ctx = 4096; // default until options are added to public header
-    int ctx_override = get_env_ctx_override();
-    if (ctx_override > 0) {
-        n_ctx = ctx_override;
+    cparams.n_ctx = (uint32_t)n_ctx;
+    if (ip.n_batch > 0) cparams.n_batch = (uint32_t)ip.n_batch;
+    if (ip.n_ubatch > 0) cparams.n_ubatch = (uint32_t)ip.n_ubatch;
+    cparams.type_k = kv_ggml_type(ip.type_k, cparams.type_k);
+    cparams.type_v = kv_ggml_type(ip.type_v, cparams.type_v);
+    // llama.cpp only supports a quantized V cache with flash attention
+    if (ip.flash_attn >= 0) cparams.flash_attn = ip.flash_attn != 0;
+    else if (kv_type_quantized(cparams.type_v)) cparams.flash_attn = true;
+    if (kv_type_quantized(cparams.type_v) && !cparams.flash_attn) {
+        fprintf(stderr, "[sonified_llama] llm_init: quantized V cache requires flash attention\n");
+        set_last_error(22 /*EINVAL*/, "quantized V cache requires flash attention (flash_attn = 1 or -1)");
+        sl_model_release(model);
+        if (atomic_fetch_sub(&g_backend_refs, 1) == 1) llama_backend_free();
+        return NULL;
     }
-    cparams.n_ctx = n_ctx;
     // leave seed as default for now
 
     struct llama_context* ctx = llama_new_context_with_model(model, cparams);
     if (!ctx) {
         fprintf(stderr, "[sonified_llama] llm_init: failed to create context (n_ctx=%d)\n", n_ctx);
         set_last_error(12 /*ENOMEM*/, "failed to create context (likely OOM)");
-        llama_free_model(model);
+        sl_model_release(model);
         if (atomic_fetch_sub(&g_backend_refs, 1) == 1) llama_backend_free();
         return NULL;
     }
@@ -201,30 +403,138 @@ llm_handle_t llm_init(const char* model_path) {
         fprintf(stderr, "[sonified_llama] llm_init: out of memory allocating context\n");
         set_last_error(12 /*ENOMEM*/, "out of memory allocating context struct");
         llama_free(ctx);
-        llama_free_model(model);
+        sl_model_release(model);
+        if (atomic_fetch_sub(&g_backend_refs, 1) == 1) llama_backend_free();
+        return NULL;
+    }
+    h->kv_tokens = (llama_token*)malloc(sizeof(llama_token) * (size_t)n_ctx);
+    h->batch_cap = (int)llama_n_batch(ctx);
+    h->batch = llama_batch_init(h->batch_cap, 0, 1);
+    if (!h->kv_tokens || !h->batch.token || sl_sampler_init(&h->sampler, llama_vocab_n_tokens(llama_model_get_vocab(model))) != 0) {
+        fprintf(stderr, "[sonified_llama] llm_init: out of memory allocating sampler buffers\n");
+        set_last_error(12 /*ENOMEM*/, "out of memory allocating sampler buffers");
+        free(h->kv_tokens);
+        if (h->batch.token) llama_batch_free(h->batch);
+        free(h);
+        llama_free(ctx);
+        sl_model_release(model);
         if (atomic_fetch_sub(&g_backend_refs, 1) == 1) llama_backend_free();
         return NULL;
     }
     h->force_stats_fail = 0;
     h->model = model;
     h->ctx = ctx;
+    h->cparams = cparams;
     h->n_ctx = n_ctx;
+    h->n_seq_max = n_seq_max;
+    h->kv_cache_bytes = sl_kv_cache_bytes(model, n_ctx, cparams.type_k, cparams.type_v);
+    if (ip.prefix_cache_mb > 0) {
+        const long long per_cell = sl_kv_cache_bytes(model, 1, cparams.type_k, cparams.type_v);
+        const long long cells = per_cell > 0 ? (long long)ip.prefix_cache_mb * 1024 * 1024 / per_cell : 0;
+        h->prefix_cache_tokens = cells < INT_MAX ? (int)cells : INT_MAX; // the scheduler caps it
+    }
     h->n_gpu_layers = n_gpu_layers;
+    h->n_kv_tokens = 0;
+    detect_threads(&h->n_threads, &h->n_threads_batch);
+    if (ip.n_threads > 0) h->n_threads = ip.n_threads;
+    if (ip.n_threads_batch > 0) h->n_threads_batch = ip.n_threads_batch;
+    pthread_mutex_init(&h->sched_mu, NULL);
+    pthread_mutex_init(&h->embed_mu, NULL);
+    pthread_mutex_init(&h->con_mu, NULL);
+    pthread_mutex_init(&h->ids_mu, NULL);
     memset(&h->lastStats, 0, sizeof(h->lastStats));
+
+    if (ip.draft_model_path && ip.draft_model_path[0] != '\0') {
+        const char* err = NULL;
+        h->draft = sl_draft_create(ip.draft_model_path, &mparams, &cparams, model, &err);
+        if (!h->draft) {
+            fprintf(stderr, "[sonified_llama] llm_init: %s ('%s')\n", err, ip.draft_model_path);
+            llm_free((llm_handle_t)h);
+            set_last_error(strstr(err, "vocabulary") ? 22 /*EINVAL*/ : 12 /*ENOMEM*/, err);
+            return NULL;
+        }
+        h->n_draft = ip.n_draft > 0 ? ip.n_draft : SPEC_DRAFT_DEFAULT;
+        if (h->n_draft > SPEC_DRAFT_MAX) h->n_draft = SPEC_DRAFT_MAX;
+    }
     return (llm_handle_t)h;
 }
 
-int llm_eval(llm_handle_t h,
-             const char* prompt_utf8,
-             const llm_gen_opts_t* opts,
-             llm_token_cb cb,
-             void* user_ctx) {
-    if (!h || !cb) {
-        fprintf(stderr, "[sonified_llama] llm_eval: invalid arguments (handle/callback)\n");
+// Emit the text of one sampled token. Returns true when it produced any bytes.
+// The piece is checked against the stop conditions first: one that completes a condition is
+// cut at the end of the match and *stopped gets the llm_stop_reason. A per-token sink also
+// gets tok's log-probabilities from logits, the (biased) row it was sampled from.
+static bool emit_token(const struct llama_vocab* vocab, llama_token tok, const float* logits,
+                       sl_token_sink* sink, sl_stop* stop, int* stopped) {
+    char piece_buf[512];
+    int n = (int)llama_token_to_piece(vocab, tok, piece_buf, (int32_t)sizeof(piece_buf) - 1, /*lstrip=*/0, /*special=*/true);
+    if (n <= 0 || n >= (int)sizeof(piece_buf)) return false;
+    if (sl_stop_active(stop)) *stopped = sl_stop_feed(stop, piece_buf, n, &n);
+    piece_buf[n] = '\0';
+    if (sink->info_cb && logits && n > 0) {
+        sl_token_logprobs(logits, llama_vocab_n_tokens(vocab), tok, sink->top_logprobs, &sink->info);
+    }
+    sl_sink_push(sink, piece_buf, n);
+    return true;
+}
+
+// Adapts stub_generate's per-piece callback to a token sink.
+static void sink_piece_cb(const char* piece, void* user_ctx) {
+    if (piece) sl_sink_push((sl_token_sink*)user_ctx, piece, (int)strlen(piece));
+}
+
+// Constraint for opts->constraint, retained for the caller; NULL with *ok false for an
+// unknown id.
+static sl_constraint* resolve_constraint(LLMContext* st, const llm_gen_opts_t* opts, bool* ok) {
+    const int id = opts ? opts->constraint : 0;
+    *ok = true;
+    if (id == 0) return NULL;
+    sl_constraint* c = NULL;
+    pthread_mutex_lock(&st->con_mu);
+    if (id > 0 && id <= CONSTRAINTS_MAX) c = st->constraints[id - 1];
+    sl_constraint_retain(c);
+    pthread_mutex_unlock(&st->con_mu);
+    if (!c) {
+        set_last_error(22 /*EINVAL*/, "unknown constraint id");
+        *ok = false;
+    }
+    return c;
+}
+
+static int eval_run(LLMContext* st, const char* prompt_utf8, const sl_token_seq* tokens,
+                    const llm_gen_opts_t* opts, sl_constraint* con, sl_stop* stop, sl_token_sink* sink);
+
+// Reject a malformed logit bias up front (stub handles ignore it).
+static bool check_logit_bias(LLMContext* st, const llm_gen_opts_t* opts) {
+    if (!st->model || sl_logit_bias_valid(opts, st->sampler.n_vocab)) return true;
+    set_last_error(22 /*EINVAL*/, "logit bias names a token outside the vocabulary, or is +inf or NaN");
+    return false;
+}
+
+// Shared body of llm_eval and llm_eval_batched; every generated piece goes to sink.
+// tokens, when given, is the prompt already tokenized (llm_eval_tokens) and prompt_utf8 is NULL.
+static int eval_impl(LLMContext* st, const char* prompt_utf8, const sl_token_seq* tokens,
+                     const llm_gen_opts_t* opts, sl_token_sink* sink) {
+    sl_stop stop;
+    const int stop_rc = sl_stop_init(&stop, opts);
+    if (stop_rc != 0) {
+        if (stop_rc == -2) set_last_error(12 /*ENOMEM*/, "out of memory copying stop strings");
+        else set_last_error(22 /*EINVAL*/, "too many or too long stop strings (16 of 128 bytes at most)");
+        return -1;
+    }
+    if (!check_logit_bias(st, opts)) {
+        sl_stop_free(&stop);
         return -1;
     }
+    bool ok = true;
+    sl_constraint* con = resolve_constraint(st, opts, &ok);
+    const int rc = ok ? eval_run(st, prompt_utf8, tokens, opts, con, &stop, sink) : -1;
+    sl_constraint_release(con);
+    sl_stop_free(&stop);
+    return rc;
+}
 
-    LLMContext* st = (LLMContext*)h;
+static int eval_run(LLMContext* st, const char* prompt_utf8, const sl_token_seq* tokens,
+                    const llm_gen_opts_t* opts, sl_constraint* con, sl_stop* stop, sl_token_sink* sink) {
     atomic_store(&st->cancelFlag, false);
 
     // Stub path: no real model loaded. Emit a small deterministic stream and succeed unless forced to fail.
@@ -236,44 +546,7 @@ int llm_eval(llm_handle_t h,
         if (prompt_utf8 && strcmp(prompt_utf8, "CAUSE_STATS_FAIL") == 0) {
             st->force_stats_fail = 1;
         }
-        // If the prompt contains a gated tool marker [[tool:NAME:ARG]] emit a JSON tool call first
-        // Or enable demo emission via environment variable SONIFIED_DEMO_TOOLCALL=1
-        if (prompt_utf8) {
-            bool demo = false;
-            const char * demo_env = getenv("SONIFIED_DEMO_TOOLCALL");
-            if (demo_env && strcmp(demo_env, "1") == 0) demo = true;
-            const char * start = strstr(prompt_utf8, "[[tool:");
-            char tool_name[64] = {0};
-            char tool_arg[256] = {0};
-            if (start) {
-                start += 7; // after '[[tool:'
-                const char * colon = strchr(start, ':');
-                const char * end = strstr(start, "]]" );
-                if (colon && end && colon < end) {
-                    size_t nlen = (size_t)(colon - start);
-                    size_t alen = (size_t)(end - colon - 1);
-                    if (nlen > 0 && nlen < sizeof(tool_name) && alen > 0 && alen < sizeof(tool_arg)) {
-                        memcpy(tool_name, start, nlen);
-                        tool_name[nlen] = '\0';
-                        memcpy(tool_arg, colon + 1, alen);
-                        tool_arg[alen] = '\0';
-                    }
-                }
-            } else if (demo) {
-                strncpy(tool_name, "math", sizeof(tool_name) - 1);
-                strncpy(tool_arg, "2^8", sizeof(tool_arg) - 1);
-            }
-            if (tool_name[0] != '\0' && strcmp(tool_name, "math") == 0 && tool_arg[0] != '\0') {
-                // Build minimal JSON: {"tool":{"name":"math","arguments":{"expression":"..."}}}
-                char json[512];
-                snprintf(json, sizeof(json),
-                         "{\"tool\":{\"name\":\"math\",\"arguments\":{\"expression\":\"%s\"}}}",
-                         tool_arg);
-                cb(json, user_ctx);
-            }
-        }
-        const char * piece = "ok";
-        cb(piece, user_ctx);
+        stub_generate(prompt_utf8, sink_piece_cb, sink);
     llm_stats_t s = {0};
         s.ttfb_ms = 1;
         s.tok_per_sec = 100.0f;
@@ -289,7 +562,6 @@ int llm_eval(llm_handle_t h,
 
     // defaults (keep minimal for now)
     const int max_tokens = (opts && opts->max_tokens > 0) ? opts->max_tokens : 128;
-    const int n_threads  = detect_n_threads_default();
 
     // allow tests to force stats failure through special prompt string (preserve ABI behavior)
     st->force_stats_fail = 0;
@@ -300,8 +572,22 @@ int llm_eval(llm_handle_t h,
         st->force_stats_fail = 1;
     }
 
-    // configure threads
-    llama_set_n_threads(st->ctx, n_threads, n_threads);
+    // configure threads (llm_set_threads may have changed them since the last eval)
+    llama_set_n_threads(st->ctx, st->n_threads, st->n_threads_batch);
+    if (st->draft) sl_draft_set_threads(st->draft, st->n_threads, st->n_threads_batch);
+
+    // configure the sampler chain (rebuilt only when options change)
+    if (sl_sampler_configure(&st->sampler, opts) != 0) {
+        fprintf(stderr, "[sonified_llama] llm_eval: failed to configure sampler\n");
+        return -5;
+    }
+    if (con) {
+        if (!st->con_state) st->con_state = sl_constraint_state_create();
+        if (sl_constraint_reset(st->con_state, con) != 0) {
+            set_last_error(12 /*ENOMEM*/, "out of memory starting constrained decoding");
+            return -5;
+        }
+    }
 
     // ---- metrics instrumentation ----
     double t_start = now_ms();
@@ -311,13 +597,14 @@ int llm_eval(llm_handle_t h,
     int gen_tokens = 0;
     bool canceled = false;
 
-    // 1) tokenize
-    llama_token * prompt_tokens = NULL;
-    int n_prompt = tokenize_prompt(st->model, prompt_utf8, /*add_bos=*/true, &prompt_tokens);
+    // 1) tokenize (only the new tail when the prompt extends the previous one)
+    if (!tokens) tokens = &st->prompt_seq;
+    const int n_prompt = tokens == &st->prompt_seq ? sl_token_seq_assign(&st->prompt_seq, st->model, prompt_utf8) : tokens->n;
     if (n_prompt < 0) {
         fprintf(stderr, "[sonified_llama] llm_eval: prompt tokenization failed\n");
         return -2;
     }
+    const llama_token * prompt_tokens = tokens->toks.data;
     // If the prompt is empty, succeed without generating tokens
     if (n_prompt == 0) {
         double t_end = now_ms();
@@ -337,59 +624,186 @@ int llm_eval(llm_handle_t h,
     }
     // record prompt token count
     prompt_token_count = n_prompt;
+    if (n_prompt >= st->n_ctx) {
+        fprintf(stderr, "[sonified_llama] llm_eval: prompt (%d tokens) exceeds context (%d)\n", n_prompt, st->n_ctx);
+        return -6;
+    }
+
+    // 2) reuse the KV prefix shared with the previous call; at least one prompt token is
+    //    always decoded so that logits for the next position are fresh
+    int n_reused = common_prefix_len(st->kv_tokens, st->n_kv_tokens, prompt_tokens, n_prompt);
+    if (n_reused >= n_prompt) n_reused = n_prompt - 1;
+    if (n_reused < st->n_kv_tokens && !kv_seq_rm(st->ctx, 0, n_reused, -1)) {
+        // partial removal unsupported by this memory type: start over
+        kv_clear(st->ctx);
+        n_reused = 0;
+    }
+    st->n_kv_tokens = n_reused;
 
-    // 2) prefill (prompt)
-    if (n_prompt > 0) {
-        struct llama_batch batch = llama_batch_get_one(prompt_tokens, n_prompt);
-        if (llama_decode(st->ctx, batch) != 0) {
+    // 3) prefill the remainder of the prompt in chunks of at most n_batch tokens, checking
+    //    for cancellation in between. A fixed opts->prefill_chunk is honored as given;
+    //    otherwise the chunk starts small and is resized from measured throughput.
+    const int fixed_chunk = (opts && opts->prefill_chunk > 0) ? opts->prefill_chunk : 0;
+    int chunk = fixed_chunk > 0 ? fixed_chunk : PREFILL_CHUNK_START;
+    double prefill_ms = 0.0, prefill_chunk_max_ms = 0.0;
+    int prefill_chunks = 0;
+    while (st->n_kv_tokens < n_prompt) {
+        if (atomic_load(&st->cancelFlag)) { canceled = true; break; }
+        if (chunk > st->batch_cap) chunk = st->batch_cap;
+        if (chunk < 1) chunk = 1;
+        const int pos = st->n_kv_tokens;
+        const int n = (n_prompt - pos) < chunk ? (n_prompt - pos) : chunk;
+        const double t_chunk = now_ms();
+        if (decode_span(st, prompt_tokens + pos, n, pos, /*want_logits=*/pos + n == n_prompt) != 0) {
             fprintf(stderr, "[sonified_llama] llm_eval: llama_decode prefill failed\n");
-            free(prompt_tokens);
+            kv_clear(st->ctx);
+            st->n_kv_tokens = 0;
             return -3;
         }
+        memcpy(st->kv_tokens + pos, prompt_tokens + pos, sizeof(llama_token) * (size_t)n);
+        st->n_kv_tokens = pos + n;
+        const double dt = now_ms() - t_chunk;
+        prefill_ms += dt;
+        prefill_chunks += 1;
+        if (dt > prefill_chunk_max_ms) prefill_chunk_max_ms = dt;
+        if (fixed_chunk == 0 && dt > 0.0) {
+            int next = (int)((double)n * PREFILL_CHUNK_TARGET_MS / dt);
+            if (next < PREFILL_CHUNK_MIN) next = PREFILL_CHUNK_MIN;
+            if (next > 2 * chunk) next = 2 * chunk; // grow gradually; warm-up chunks run slow
+            chunk = next;
+        }
     }
     {
         size_t rss = current_rss_bytes();
         if (rss > peak_rss) peak_rss = rss;
     }
 
-    // 3) decode loop (greedy)
+    // 4) decode loop. With a draft model or prompt lookup, each step feeds the sampled token
+    //    together with the proposals; proposals are accepted while the target's sampler picks the
+    //    same token from the corresponding logits row, and the first disagreement is the
+    //    next token (already sampled), so the output matches plain decoding. A constraint
+    //    masks each step by what was emitted so far, so it decodes without proposals.
     const struct llama_vocab * vocab = llama_model_get_vocab(st->model);
     int produced = 0;
-    char piece_buf[512];
+    int logits_row = -1;                 // batch row with the logits for the next position
+    llama_token next = LLAMA_TOKEN_NULL; // sampled while verifying (rejected proposal)
+    const float * next_logits = NULL;    // ... and its row, valid until the next decode
+    llama_token draft[SPEC_DRAFT_MAX];
+    int spec_drafted = 0, spec_accepted = 0;
+    int lookup_drafted = 0, lookup_accepted = 0;
+    const bool lookup = opts && opts->prompt_lookup;
+    const bool speculate = (st->draft || lookup) && !con;
+    int stop_reason = -1;
 
-    while (produced < max_tokens) {
+    while (!canceled && produced < max_tokens) {
         if (atomic_load(&st->cancelFlag)) { canceled = true; break; } // cooperative cancel
 
         // pick next token
-        llama_token tok = sample_greedy(st->ctx, st->model);
-        if (tok == LLAMA_TOKEN_NULL) break;
-        if (llama_vocab_is_eog(vocab, tok)) break;
-
-        // convert token -> UTF-8 piece
-        int n = (int)llama_token_to_piece(vocab, tok, piece_buf, (int32_t)sizeof(piece_buf) - 1, /*lstrip=*/0, /*special=*/true);
-        if (n > 0 && n < (int)sizeof(piece_buf)) {
-            piece_buf[n] = '\0';
-            if (t_first == 0.0) t_first = now_ms();
-            cb(piece_buf, user_ctx);
+        llama_token tok = next;
+        const float * tok_logits = next_logits;
+        next = LLAMA_TOKEN_NULL;
+        next_logits = NULL;
+        if (tok == LLAMA_TOKEN_NULL) {
+            float * logits = llama_get_logits_ith(st->ctx, logits_row);
+            if (!logits) break;
+            sl_sampler_apply_bias(&st->sampler, logits);
+            tok = con ? sl_constraint_sample(st->con_state, &st->sampler, logits) : sl_sampler_sample(&st->sampler, logits);
+            tok_logits = logits;
+        }
+        if (tok == LLAMA_TOKEN_NULL || llama_vocab_is_eog(vocab, tok)) {
+            stop_reason = con && sl_constraint_stuck(st->con_state) ? LLM_STOP_CONSTRAINT : LLM_STOP_EOG;
+            break;
+        }
+        sl_sampler_accept(&st->sampler, tok);
+        if (con) sl_constraint_accept(st->con_state, tok);
+        int stopped = 0;
+        if (emit_token(vocab, tok, tok_logits, sink, stop, &stopped) && t_first == 0.0) t_first = now_ms();
+        if (stopped) {
+            // tok is the last token: it is never decoded, which is the step a cancel would waste
+            stop_reason = stopped;
+            produced += 1;
+            gen_tokens += 1;
+            break;
+        }
+
+        if (st->n_kv_tokens >= st->n_ctx) { stop_reason = LLM_STOP_CONTEXT; break; }
+
+        // draft proposals to verify in the same step
+        int n_draft = 0;
+        bool from_lookup = false;
+        if (speculate) {
+            int room = SPEC_DRAFT_MAX;
+            if (room > max_tokens - produced - 1) room = max_tokens - produced - 1;
+            if (room > st->n_ctx - st->n_kv_tokens - 1) room = st->n_ctx - st->n_kv_tokens - 1;
+            if (room > st->batch_cap - 1) room = st->batch_cap - 1;
+            st->kv_tokens[st->n_kv_tokens] = tok; // history through tok; the slot is free
+            if (lookup && room > 0) {
+                n_draft = sl_ngram_propose(vocab, st->kv_tokens, st->n_kv_tokens + 1, draft,
+                                           room < SPEC_LOOKUP_MAX ? room : SPEC_LOOKUP_MAX);
+                from_lookup = n_draft > 0;
+            }
+            if (st->draft && n_draft == 0 && room > 0) {
+                n_draft = sl_draft_propose(st->draft, st->kv_tokens, st->n_kv_tokens + 1, draft,
+                                           room < st->n_draft ? room : st->n_draft);
+                if (n_draft < 0) n_draft = 0; // draft failure only costs the speed-up
+            }
         }
 
-        // feed back the token
-        struct llama_batch step = llama_batch_get_one(&tok, 1);
-        if (llama_decode(st->ctx, step) != 0) {
+        // feed back the token (and proposals)
+        const int rc = n_draft > 0 ? decode_step(st, tok, draft, n_draft, st->n_kv_tokens)
+                                   : decode_span(st, &tok, 1, st->n_kv_tokens, /*want_logits=*/true);
+        if (rc != 0) {
             fprintf(stderr, "[sonified_llama] llm_eval: llama_decode step failed\n");
-            free(prompt_tokens);
+            kv_clear(st->ctx);
+            st->n_kv_tokens = 0;
             return -4;
         }
-
+        st->kv_tokens[st->n_kv_tokens++] = tok;
         produced += 1;
         gen_tokens += 1;
+        logits_row = -1;
+
+        if (n_draft > 0) {
+            int accepted = 0;
+            while (accepted < n_draft) {
+                float * logits = llama_get_logits_ith(st->ctx, accepted);
+                if (logits) sl_sampler_apply_bias(&st->sampler, logits);
+                const llama_token t = logits ? sl_sampler_sample(&st->sampler, logits) : LLAMA_TOKEN_NULL;
+                if (t != draft[accepted]) { next = t; next_logits = logits; break; }
+                sl_sampler_accept(&st->sampler, t); // proposals are never end-of-generation
+                int stopped = 0;
+                emit_token(vocab, t, logits, sink, stop, &stopped);
+                st->kv_tokens[st->n_kv_tokens++] = t;
+                produced += 1;
+                gen_tokens += 1;
+                accepted += 1;
+                if (stopped) { stop_reason = stopped; break; }
+            }
+            spec_drafted += n_draft;
+            spec_accepted += accepted;
+            if (from_lookup) {
+                lookup_drafted += n_draft;
+                lookup_accepted += accepted;
+            }
+            logits_row = accepted;
+            // drop the rejected proposals from the cache
+            if (accepted < n_draft && !kv_seq_rm(st->ctx, 0, st->n_kv_tokens, -1)) {
+                fprintf(stderr, "[sonified_llama] llm_eval: cannot remove rejected draft tokens\n");
+                kv_clear(st->ctx);
+                st->n_kv_tokens = 0;
+                return -4;
+            }
+            if (stop_reason >= 0) break;
+        }
+
         if ((gen_tokens & 7) == 0) {
             size_t r = current_rss_bytes();
             if (r > peak_rss) peak_rss = r;
         }
     }
 
-    free(prompt_tokens);
+    if (canceled) stop_reason = LLM_STOP_CANCELLED;
+    else if (stop_reason < 0) stop_reason = produced >= max_tokens ? LLM_STOP_MAX_TOKENS : LLM_STOP_EOG;
 
     // ---- finalize metrics ----
     double t_end = now_ms();
@@ -407,26 +821,572 @@ int llm_eval(llm_handle_t h,
     s.prompt_tokens = prompt_token_count;
     s.completion_tokens = gen_tokens;
     s.total_tokens = prompt_token_count + gen_tokens;
+    s.sample_ms = (float)st->sampler.sample_ms;
+    s.prompt_tokens_reused = n_reused;
+    s.prefill_ms = (float)prefill_ms;
+    s.prefill_chunks = prefill_chunks;
+    s.prefill_chunk_max_ms = (float)prefill_chunk_max_ms;
+    s.kv_cache_bytes = st->kv_cache_bytes;
+    s.kv_cells_used = st->n_kv_tokens;
+    s.spec_drafted = spec_drafted;
+    s.spec_accepted = spec_accepted;
+    s.spec_accept_rate = spec_drafted > 0 ? (float)spec_accepted / (float)spec_drafted : 0.0f;
+    s.spec_lookup_drafted = lookup_drafted;
+    s.spec_lookup_accepted = lookup_accepted;
+    s.stop_reason = stop_reason;
 
     st->lastStats = s; // persist snapshot for llm_stats
     return 0; // cancellation is not an error
 }
 
+int llm_eval(llm_handle_t h,
+             const char* prompt_utf8,
+             const llm_gen_opts_t* opts,
+             llm_token_cb cb,
+             void* user_ctx) {
+    if (!h || !cb) {
+        fprintf(stderr, "[sonified_llama] llm_eval: invalid arguments (handle/callback)\n");
+        return -1;
+    }
+    sl_token_sink sink;
+    if (sl_sink_init_single(&sink, cb, user_ctx) != 0) {
+        set_last_error(12 /*ENOMEM*/, "out of memory allocating token buffer");
+        return -1;
+    }
+    int rc = eval_impl((LLMContext*)h, prompt_utf8, NULL, opts, &sink);
+    sl_sink_finish(&sink); // bytes of a code point cut off by EOG/max_tokens/cancel
+    sl_sink_free(&sink);
+    return rc;
+}
+
+int llm_eval_batched(llm_handle_t h,
+                     const char* prompt_utf8,
+                     const llm_gen_opts_t* opts,
+                     int max_batch_tokens,
+                     int max_batch_us,
+                     llm_token_batch_cb cb,
+                     void* user_ctx) {
+    if (!h || !cb) {
+        fprintf(stderr, "[sonified_llama] llm_eval_batched: invalid arguments (handle/callback)\n");
+        return -1;
+    }
+    sl_token_sink sink;
+    if (sl_sink_init_batched(&sink, cb, user_ctx, max_batch_tokens, max_batch_us) != 0) {
+        set_last_error(12 /*ENOMEM*/, "out of memory allocating token batch buffer");
+        return -1;
+    }
+    int rc = eval_impl((LLMContext*)h, prompt_utf8, NULL, opts, &sink);
+    sl_sink_finish(&sink);
+    sl_sink_free(&sink);
+    return rc;
+}
+
+int llm_eval_logprobs(llm_handle_t h,
+                      const char* prompt_utf8,
+                      const llm_gen_opts_t* opts,
+                      int top_logprobs,
+                      llm_token_info_cb cb,
+                      void* user_ctx) {
+    if (!h || !cb) {
+        fprintf(stderr, "[sonified_llama] llm_eval_logprobs: invalid arguments (handle/callback)\n");
+        return -1;
+    }
+    if (top_logprobs < 0 || top_logprobs > LLM_TOP_LOGPROBS_MAX) {
+        set_last_error(22 /*EINVAL*/, "top_logprobs out of range (0..LLM_TOP_LOGPROBS_MAX)");
+        return -1;
+    }
+    sl_token_sink sink;
+    if (sl_sink_init_info(&sink, cb, user_ctx, top_logprobs) != 0) {
+        set_last_error(12 /*ENOMEM*/, "out of memory allocating token buffer");
+        return -1;
+    }
+    int rc = eval_impl((LLMContext*)h, prompt_utf8, NULL, opts, &sink);
+    sl_sink_finish(&sink);
+    sl_sink_free(&sink);
+    return rc;
+}
+
+enum { STREAM_DEFAULT_BYTES = 64 * 1024 };
+
+llm_stream_t llm_stream_create(int capacity_bytes, int overflow) {
+    if (overflow < LLM_STREAM_BLOCK || overflow > LLM_STREAM_GROW) {
+        set_last_error(22 /*EINVAL*/, "unknown stream overflow policy");
+        return NULL;
+    }
+    sl_ring * r = sl_ring_create(capacity_bytes > 0 ? capacity_bytes : STREAM_DEFAULT_BYTES, overflow);
+    if (!r) set_last_error(12 /*ENOMEM*/, "out of memory allocating stream ring");
+    return (llm_stream_t)r;
+}
+
+int llm_eval_stream(llm_handle_t h,
+                    const char* prompt_utf8,
+                    const llm_gen_opts_t* opts,
+                    llm_stream_t stream) {
+    sl_ring * ring = (sl_ring *)stream;
+    if (!h || !ring || sl_ring_closed(ring)) {
+        fprintf(stderr, "[sonified_llama] llm_eval_stream: invalid arguments (handle/stream)\n");
+        return -1;
+    }
+    LLMContext * st = (LLMContext *)h;
+    sl_token_sink sink;
+    if (sl_sink_init_stream(&sink, ring, &st->cancelFlag) != 0) {
+        set_last_error(12 /*ENOMEM*/, "out of memory allocating token buffer");
+        sl_ring_close(ring);
+        return -1;
+    }
+    int rc = eval_impl(st, prompt_utf8, NULL, opts, &sink);
+    sl_sink_finish(&sink);
+    sl_sink_free(&sink);
+    sl_ring_close(ring); // the reader sees end of stream once it has drained the ring
+    return rc;
+}
+
+int llm_stream_read(llm_stream_t stream, char* out, int max_bytes, int timeout_ms) {
+    if (!stream) return -1;
+    return sl_ring_read((sl_ring *)stream, out, max_bytes, timeout_ms);
+}
+
+int llm_stream_read_batch(llm_stream_t stream, char* out, int max_bytes, int min_pieces, int timeout_ms) {
+    if (!stream) return -1;
+    return sl_ring_read_batch((sl_ring *)stream, out, max_bytes, min_pieces, timeout_ms);
+}
+
+long long llm_stream_dropped(llm_stream_t stream) {
+    return stream ? sl_ring_dropped((sl_ring *)stream) : 0;
+}
+
+void llm_stream_free(llm_stream_t stream) {
+    sl_ring_free((sl_ring *)stream);
+}
+
 void llm_cancel(llm_handle_t h) {
     if (!h) return;
     LLMContext * ctx = (LLMContext *)h;
     atomic_store(&ctx->cancelFlag, true);
+    pthread_mutex_lock(&ctx->sched_mu);
+    sl_sched_cancel_all(ctx->sched);
+    pthread_mutex_unlock(&ctx->sched_mu);
+}
+
+void llm_cancel_eval(llm_handle_t h) {
+    if (!h) return;
+    atomic_store(&((LLMContext *)h)->cancelFlag, true);
+}
+
+// Scheduler for llm_submit; created on first use so llm_eval-only handles never pay for
+// the second context.
+static sl_sched* get_sched(LLMContext* st) {
+    pthread_mutex_lock(&st->sched_mu);
+    if (!st->sched) {
+        sl_sched_params p = {0};
+        p.n_slots = st->n_seq_max;
+        p.n_ctx_per_seq = st->n_ctx;
+        p.n_threads = st->n_threads;
+        p.n_threads_batch = st->n_threads_batch;
+        p.cparams = st->cparams;
+        p.prefix_cache_tokens = st->prefix_cache_tokens;
+        p.stub = stub_generate;
+        st->sched = sl_sched_create(st->model, &p);
+        if (!st->sched) set_last_error(12 /*ENOMEM*/, "failed to create batching scheduler (likely OOM)");
+    }
+    sl_sched* s = st->sched;
+    pthread_mutex_unlock(&st->sched_mu);
+    return s;
+}
+
+int llm_submit(llm_handle_t h, const char* prompt_utf8, const llm_gen_opts_t* opts) {
+    if (!h) {
+        fprintf(stderr, "[sonified_llama] llm_submit: invalid handle\n");
+        return -1;
+    }
+    LLMContext* st = (LLMContext*)h;
+    if (!check_logit_bias(st, opts)) return -1;
+    bool ok = true;
+    sl_constraint* con = resolve_constraint(st, opts, &ok);
+    if (!ok) return -1;
+    sl_sched* s = get_sched(st);
+    if (!s) {
+        sl_constraint_release(con);
+        return -1;
+    }
+    return sl_sched_submit(s, prompt_utf8, opts, con);
+}
+
+int llm_submit_n(llm_handle_t h, const char* prompt_utf8, const llm_gen_opts_t* opts, int n, int* out_seqs) {
+    if (!h || !out_seqs || n < 1) {
+        fprintf(stderr, "[sonified_llama] llm_submit_n: invalid arguments\n");
+        return -1;
+    }
+    LLMContext* st = (LLMContext*)h;
+    if (!check_logit_bias(st, opts)) return -1;
+    bool ok = true;
+    sl_constraint* con = resolve_constraint(st, opts, &ok);
+    if (!ok) return -1;
+    sl_sched* s = get_sched(st);
+    if (!s) {
+        sl_constraint_release(con);
+        return -1;
+    }
+    return sl_sched_submit_n(s, prompt_utf8, opts, con, n, out_seqs);
+}
+
+int llm_poll(llm_handle_t h, int seq, llm_seq_event_t* out_events, int max_events, int timeout_ms) {
+    if (!h) return -1;
+    LLMContext* st = (LLMContext*)h;
+    pthread_mutex_lock(&st->sched_mu);
+    sl_sched* s = st->sched;
+    pthread_mutex_unlock(&st->sched_mu);
+    if (!s) return seq == 0 ? 0 : -1; // nothing was ever submitted
+    return sl_sched_poll(s, seq, out_events, max_events, timeout_ms);
+}
+
+int llm_cancel_seq(llm_handle_t h, int seq) {
+    if (!h) return -1;
+    LLMContext* st = (LLMContext*)h;
+    pthread_mutex_lock(&st->sched_mu);
+    int rc = sl_sched_cancel(st->sched, seq);
+    pthread_mutex_unlock(&st->sched_mu);
+    return rc;
 }
 
 void llm_free(llm_handle_t h) {
     if (!h) return;
     LLMContext* ctx = (LLMContext*)h;
+    struct llama_model* model = ctx->model; // NULL for stub handles, which hold no backend ref
+    sl_sched_destroy(ctx->sched); // joins the worker before the model goes away
+    sl_draft_free(ctx->draft);
+    sl_embed_free(ctx->embedder);
+    for (int i = 0; i < CONSTRAINTS_MAX; ++i) sl_constraint_release(ctx->constraints[i]);
+    sl_constraint_state_free(ctx->con_state);
+    sl_vocab_trie_free(ctx->trie); // after the scheduler: its requests hold constraints over it
+    pthread_mutex_destroy(&ctx->sched_mu);
+    pthread_mutex_destroy(&ctx->embed_mu);
+    pthread_mutex_destroy(&ctx->con_mu);
+    sl_token_ids_free(&ctx->token_ids);
+    pthread_mutex_destroy(&ctx->ids_mu);
+    sl_sampler_free(&ctx->sampler);
+    free(ctx->kv_tokens);
+    sl_token_seq_free(&ctx->prompt_seq);
+    if (ctx->batch.token) llama_batch_free(ctx->batch);
     if (ctx->ctx)   llama_free(ctx->ctx);
-    if (ctx->model) llama_free_model(ctx->model);
     free(ctx);
-    if (atomic_fetch_sub(&g_backend_refs, 1) == 1) {
-        llama_backend_free();
+    if (model) {
+        sl_model_release(model); // weights go with the last handle
+        if (atomic_fetch_sub(&g_backend_refs, 1) == 1) {
+            llama_backend_free();
+        }
+    }
+}
+
+int llm_set_threads(llm_handle_t h, int n_decode, int n_prefill) {
+    if (!h) return -1;
+    LLMContext* st = (LLMContext*)h;
+    int auto_decode = 1, auto_prefill = 1;
+    detect_threads(&auto_decode, &auto_prefill);
+    st->n_threads = n_decode > 0 ? n_decode : auto_decode;
+    st->n_threads_batch = n_prefill > 0 ? n_prefill : auto_prefill;
+    pthread_mutex_lock(&st->sched_mu);
+    sl_sched_set_threads(st->sched, st->n_threads, st->n_threads_batch);
+    pthread_mutex_unlock(&st->sched_mu);
+    return 0;
+}
+
+int llm_get_threads(llm_handle_t h, int* n_decode, int* n_prefill) {
+    if (!h) return -1;
+    LLMContext* st = (LLMContext*)h;
+    if (n_decode) *n_decode = st->n_threads;
+    if (n_prefill) *n_prefill = st->n_threads_batch;
+    return 0;
+}
+
+int llm_tokenize(llm_handle_t h, const char* text_utf8, int* out_tokens, int max_tokens) {
+    if (!h || !text_utf8 || max_tokens < 0 || (max_tokens > 0 && !out_tokens)) return -1;
+    LLMContext* st = (LLMContext*)h;
+    if (!st->model) {
+        set_last_error(22 /*EINVAL*/, "tokenization needs a loaded model");
+        return -1;
+    }
+    // straight into the caller's buffer; llama.cpp reports the size when it is too small
+    const struct llama_vocab* vocab = llama_model_get_vocab(st->model);
+    const size_t len = strlen(text_utf8);
+    if (len > (size_t)INT32_MAX) return -1;
+    const int32_t n = llama_tokenize(vocab, text_utf8, (int32_t)len, (llama_token*)out_tokens, max_tokens,
+                                     /*add_special=*/llama_vocab_get_add_bos(vocab), /*parse_special=*/true);
+    if (n == INT32_MIN) {
+        set_last_error(22 /*EINVAL*/, "text has too many tokens");
+        return -1;
+    }
+    return n < 0 ? -n : n;
+}
+
+int llm_token_id(llm_handle_t h, const char* text_utf8) {
+    if (!h || !text_utf8) return -1;
+    LLMContext* st = (LLMContext*)h;
+    if (!st->model) {
+        set_last_error(22 /*EINVAL*/, "token ids need a loaded model");
+        return -1;
+    }
+    pthread_mutex_lock(&st->ids_mu);
+    const int id = sl_token_ids_get(&st->token_ids, st->model, text_utf8);
+    pthread_mutex_unlock(&st->ids_mu);
+    if (id == -1) set_last_error(12 /*ENOMEM*/, "out of memory caching a token id");
+    return id;
+}
+
+int llm_detokenize(llm_handle_t h, const int* tokens, int n_tokens, char* out_buf, int out_buf_len) {
+    if (!h || n_tokens < 0 || (n_tokens > 0 && !tokens) || out_buf_len < 0 || (out_buf_len > 0 && !out_buf)) return -1;
+    LLMContext* st = (LLMContext*)h;
+    if (!st->model) {
+        set_last_error(22 /*EINVAL*/, "detokenization needs a loaded model");
+        return -1;
+    }
+    const struct llama_vocab* vocab = llama_model_get_vocab(st->model);
+    const int cap = out_buf_len > 0 ? out_buf_len - 1 : 0; // room for the NUL
+    const int32_t n = llama_detokenize(vocab, (const llama_token*)tokens, n_tokens, out_buf, cap,
+                                       /*remove_special=*/false, /*unparse_special=*/true);
+    if (n == INT32_MIN) {
+        set_last_error(22 /*EINVAL*/, "detokenized text is too long");
+        return -1;
+    }
+    if (n >= 0 && out_buf_len > 0) out_buf[n] = '\0';
+    return n < 0 ? -n : n;
+}
+
+typedef struct LLMTokens {
+    const struct llama_model* model;
+    sl_token_seq seq;
+} LLMTokens;
+
+llm_tokens_t llm_tokens_create(llm_handle_t h, const char* text_utf8) {
+    if (!h || !text_utf8) return NULL;
+    LLMContext* st = (LLMContext*)h;
+    if (!st->model) {
+        set_last_error(22 /*EINVAL*/, "tokenization needs a loaded model");
+        return NULL;
+    }
+    LLMTokens* t = (LLMTokens*)calloc(1, sizeof(LLMTokens));
+    if (!t) {
+        set_last_error(12 /*ENOMEM*/, "out of memory allocating tokens");
+        return NULL;
+    }
+    t->model = st->model;
+    if (sl_token_seq_init(&t->seq, t->model, text_utf8) < 0) {
+        set_last_error(22 /*EINVAL*/, "prompt tokenization failed");
+        sl_token_seq_free(&t->seq);
+        free(t);
+        return NULL;
+    }
+    return (llm_tokens_t)t;
+}
+
+int llm_tokens_append(llm_tokens_t tokens, const char* suffix_utf8) {
+    LLMTokens* t = (LLMTokens*)tokens;
+    if (!t || !suffix_utf8) return -1;
+    const int n = sl_token_seq_append(&t->seq, t->model, suffix_utf8);
+    if (n < 0) set_last_error(22 /*EINVAL*/, "prompt tokenization failed");
+    return n;
+}
+
+int llm_tokens_count(llm_tokens_t tokens) {
+    return tokens ? ((LLMTokens*)tokens)->seq.n : -1;
+}
+
+int llm_tokens_retokenized(llm_tokens_t tokens) {
+    return tokens ? ((LLMTokens*)tokens)->seq.retokenized : -1;
+}
+
+void llm_tokens_free(llm_tokens_t tokens) {
+    LLMTokens* t = (LLMTokens*)tokens;
+    if (!t) return;
+    sl_token_seq_free(&t->seq);
+    free(t);
+}
+
+int llm_eval_tokens(llm_handle_t h,
+                    llm_tokens_t tokens,
+                    const llm_gen_opts_t* opts,
+                    llm_token_cb cb,
+                    void* user_ctx) {
+    LLMTokens* t = (LLMTokens*)tokens;
+    if (!h || !t || !cb || t->model != ((LLMContext*)h)->model) {
+        fprintf(stderr, "[sonified_llama] llm_eval_tokens: invalid arguments (handle/tokens/callback)\n");
+        return -1;
+    }
+    sl_token_sink sink;
+    if (sl_sink_init_single(&sink, cb, user_ctx) != 0) {
+        set_last_error(12 /*ENOMEM*/, "out of memory allocating token buffer");
+        return -1;
+    }
+    int rc = eval_impl((LLMContext*)h, NULL, &t->seq, opts, &sink);
+    sl_sink_finish(&sink);
+    sl_sink_free(&sink);
+    return rc;
+}
+
+int llm_embed_dim(llm_handle_t h) {
+    if (!h) return -1;
+    LLMContext* st = (LLMContext*)h;
+    return st->model ? llama_model_n_embd(st->model) : -1;
+}
+
+int llm_embed(llm_handle_t h, const char** texts, int n, float* out, int dim) {
+    return llm_embed_ex(h, texts, n, out, dim, NULL);
+}
+
+int llm_embed_ex(llm_handle_t h, const char** texts, int n, float* out, int dim, const llm_embed_opts_t* opts) {
+    if (!h || n < 0 || (n > 0 && (!texts || !out))) return -1;
+    LLMContext* st = (LLMContext*)h;
+    if (!st->model) {
+        set_last_error(22 /*EINVAL*/, "embeddings need a loaded model");
+        return -1;
+    }
+    const int pooling = opts ? opts->pooling : LLM_EMBED_MEAN;
+    const int normalize = opts ? opts->normalize : 1;
+    if (dim != llama_model_n_embd(st->model) || pooling < LLM_EMBED_MEAN || pooling > LLM_EMBED_LAST) {
+        set_last_error(22 /*EINVAL*/, "embedding dim or pooling does not match the model");
+        return -1;
+    }
+    for (int i = 0; i < n; ++i) {
+        if (!texts[i]) return -1;
+    }
+    if (n == 0) return 0;
+    pthread_mutex_lock(&st->embed_mu);
+    if (!st->embedder) st->embedder = sl_embed_create(st->model, &st->cparams);
+    int rc = -1;
+    if (!st->embedder) {
+        set_last_error(12 /*ENOMEM*/, "failed to create embedding context (likely OOM)");
+    } else {
+        rc = sl_embed_run(st->embedder, texts, n, out, pooling, normalize, st->n_threads_batch);
+        if (rc == -2) set_last_error(12 /*ENOMEM*/, "failed to tokenize a text for embedding (likely OOM)");
+        else if (rc == -3) set_last_error(22 /*EINVAL*/, "text exceeds n_batch tokens");
+        else if (rc == -4) set_last_error(12 /*ENOMEM*/, "llama_decode failed embedding texts (likely OOM)");
+    }
+    pthread_mutex_unlock(&st->embed_mu);
+    return rc;
+}
+
+int llm_constraint_create(llm_handle_t h, int kind, const char* spec_json) {
+    if (!h || !spec_json) return -1;
+    LLMContext* st = (LLMContext*)h;
+    if (!st->model) {
+        set_last_error(22 /*EINVAL*/, "constrained decoding needs a loaded model");
+        return -1;
+    }
+    pthread_mutex_lock(&st->con_mu);
+    int slot = 0;
+    while (slot < CONSTRAINTS_MAX && st->constraints[slot]) ++slot;
+    int rc = -1;
+    if (slot == CONSTRAINTS_MAX) {
+        set_last_error(22 /*EINVAL*/, "too many constraints on this handle");
+    } else if (!st->trie && !(st->trie = sl_vocab_trie_build(llama_model_get_vocab(st->model)))) {
+        set_last_error(12 /*ENOMEM*/, "out of memory indexing the vocabulary");
+        rc = -3;
+    } else {
+        const char* err = NULL;
+        sl_constraint* c = sl_constraint_create(st->trie, kind, spec_json, &err);
+        if (c) {
+            st->constraints[slot] = c;
+            rc = slot + 1;
+        } else if (err && strncmp(err, "out of memory", 13) == 0) {
+            set_last_error(12 /*ENOMEM*/, err);
+            rc = -3;
+        } else {
+            set_last_error(22 /*EINVAL*/, err);
+            rc = -2;
+        }
+    }
+    pthread_mutex_unlock(&st->con_mu);
+    return rc;
+}
+
+int llm_constraint_free(llm_handle_t h, int id) {
+    if (!h || id <= 0 || id > CONSTRAINTS_MAX) return -1;
+    LLMContext* st = (LLMContext*)h;
+    pthread_mutex_lock(&st->con_mu);
+    sl_constraint* c = st->constraints[id - 1];
+    st->constraints[id - 1] = NULL;
+    pthread_mutex_unlock(&st->con_mu);
+    sl_constraint_release(c); // generations still using it hold their own reference
+    return c ? 0 : -1;
+}
+
+int llm_state_save(llm_handle_t h, const char* path) {
+    if (!h || !path || path[0] == '\0') return -1;
+    LLMContext* st = (LLMContext*)h;
+    if (!st->model) {
+        set_last_error(22 /*EINVAL*/, "state snapshots need a loaded model");
+        return -1;
+    }
+    sl_state_header hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.model_hash = sl_model_fingerprint(st->model);
+    if (hdr.model_hash == 0) { // a snapshot tagged "unknown" would load into any model
+        fprintf(stderr, "[sonified_llama] llm_state_save: cannot fingerprint the model file\n");
+        set_last_error(22 /*EINVAL*/, "model file is unreadable; cannot tag the state snapshot");
+        return -1;
+    }
+    hdr.n_ctx = st->n_ctx;
+    hdr.type_k = (int32_t)st->cparams.type_k;
+    hdr.type_v = (int32_t)st->cparams.type_v;
+    hdr.n_tokens = st->n_kv_tokens;
+    hdr.state_bytes = llama_state_seq_get_size(st->ctx, 0);
+    uint8_t* state = (uint8_t*)malloc(hdr.state_bytes > 0 ? (size_t)hdr.state_bytes : 1);
+    if (!state) {
+        set_last_error(12 /*ENOMEM*/, "out of memory copying sequence state");
+        return -3;
+    }
+    hdr.state_bytes = llama_state_seq_get_data(st->ctx, state, (size_t)hdr.state_bytes, 0);
+    const int rc = sl_state_write(path, &hdr, st->kv_tokens, state);
+    free(state);
+    if (rc != 0) {
+        const int err = errno;
+        fprintf(stderr, "[sonified_llama] llm_state_save: cannot write '%s': %s\n", path, strerror(err));
+        set_last_error(err, "failed to write state snapshot");
+        return -2;
+    }
+    return hdr.n_tokens;
+}
+
+int llm_state_load(llm_handle_t h, const char* path) {
+    if (!h || !path || path[0] == '\0') return -1;
+    LLMContext* st = (LLMContext*)h;
+    if (!st->model) {
+        set_last_error(22 /*EINVAL*/, "state snapshots need a loaded model");
+        return -1;
+    }
+    sl_state_map m;
+    const int orc = sl_state_open(path, &m);
+    if (orc != 0) {
+        const int err = orc == -1 ? errno : 22 /*EINVAL*/;
+        fprintf(stderr, "[sonified_llama] llm_state_load: cannot read '%s'\n", path);
+        set_last_error(err, orc == -1 ? "failed to read state snapshot" : "not a state snapshot (or truncated)");
+        return -2;
+    }
+    const char* why = NULL;
+    const uint64_t fp = sl_model_fingerprint(st->model);
+    if (fp == 0 || m.hdr.model_hash == 0) why = "model fingerprint unknown; cannot verify the state snapshot";
+    else if (m.hdr.model_hash != fp) why = "state snapshot was saved with a different model";
+    else if (m.hdr.type_k != (int32_t)st->cparams.type_k || m.hdr.type_v != (int32_t)st->cparams.type_v) why = "state snapshot KV cache types differ";
+    else if (m.hdr.n_tokens > st->n_ctx) why = "state snapshot holds more tokens than n_ctx";
+    if (why) {
+        fprintf(stderr, "[sonified_llama] llm_state_load: %s ('%s')\n", why, path);
+        set_last_error(22 /*EINVAL*/, why);
+        sl_state_close(&m);
+        return -3;
+    }
+    kv_clear(st->ctx);
+    st->n_kv_tokens = 0;
+    if (m.hdr.n_tokens > 0 && llama_state_seq_set_data(st->ctx, m.state, (size_t)m.hdr.state_bytes, 0) == 0) {
+        fprintf(stderr, "[sonified_llama] llm_state_load: llama.cpp rejected the state in '%s'\n", path);
+        set_last_error(22 /*EINVAL*/, "llama.cpp rejected the saved sequence state");
+        kv_clear(st->ctx);
+        sl_state_close(&m);
+        return -4;
     }
+    memcpy(st->kv_tokens, m.tokens, sizeof(llama_token) * (size_t)m.hdr.n_tokens);
+    st->n_kv_tokens = m.hdr.n_tokens;
+    sl_state_close(&m);
+    return st->n_kv_tokens;
 }
 
 int llm_stats(llm_handle_t h, llm_stats_t* out_stats) {
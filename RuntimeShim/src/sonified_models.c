@@ -0,0 +1,156 @@
+#include "sonified_models.h"
+#include <limits.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct sl_model_entry {
+    struct sl_model_entry * next;
+    char                  * path;   // canonical (realpath) when resolvable
+    struct llama_model_params params;
+    struct llama_model    * model;
+    int                     refs;
+    uint64_t                fingerprint; // 0 until first asked for
+} sl_model_entry;
+
+// Loads happen under the lock so two handles racing on the same file load it once;
+// loads of different models are serialized as a consequence.
+static pthread_mutex_t  g_models_mu = PTHREAD_MUTEX_INITIALIZER;
+static sl_model_entry * g_models = NULL;
+
+// llm_init sets n_gpu_layers, use_mmap and use_mlock; vocab_only and check_tensors also
+// change what gets loaded. The device placement fields (split_mode, main_gpu, devices,
+// tensor_split), kv_overrides and the progress callback are ignored: every caller leaves
+// them at llama_model_default_params, and a caller that sets them must add them here.
+static bool same_params(const struct llama_model_params * a, const struct llama_model_params * b) {
+    return a->n_gpu_layers == b->n_gpu_layers && a->use_mmap == b->use_mmap && a->use_mlock == b->use_mlock &&
+           a->vocab_only == b->vocab_only && a->check_tensors == b->check_tensors;
+}
+
+struct llama_model * sl_model_acquire(const char * path, const struct llama_model_params * mparams) {
+    if (!path || !mparams) return NULL;
+    char resolved[PATH_MAX];
+    const char * key = realpath(path, resolved) ? resolved : path;
+
+    pthread_mutex_lock(&g_models_mu);
+    for (sl_model_entry * e = g_models; e; e = e->next) {
+        if (strcmp(e->path, key) == 0 && same_params(&e->params, mparams)) {
+            e->refs += 1;
+            pthread_mutex_unlock(&g_models_mu);
+            return e->model;
+        }
+    }
+    struct llama_model * model = NULL;
+    sl_model_entry * e = (sl_model_entry *)calloc(1, sizeof(sl_model_entry));
+    char * key_copy = e ? strdup(key) : NULL;
+    if (key_copy) model = llama_load_model_from_file(path, *mparams);
+    if (!model) {
+        free(key_copy);
+        free(e);
+        pthread_mutex_unlock(&g_models_mu);
+        return NULL;
+    }
+    e->path = key_copy;
+    e->params = *mparams;
+    e->model = model;
+    e->refs = 1;
+    e->next = g_models;
+    g_models = e;
+    pthread_mutex_unlock(&g_models_mu);
+    return model;
+}
+
+void sl_model_release(struct llama_model * model) {
+    if (!model) return;
+    struct llama_model * to_free = NULL;
+    pthread_mutex_lock(&g_models_mu);
+    for (sl_model_entry ** link = &g_models; *link; link = &(*link)->next) {
+        sl_model_entry * e = *link;
+        if (e->model != model) continue;
+        if (--e->refs == 0) {
+            *link = e->next;
+            to_free = e->model;
+            free(e->path);
+            free(e);
+        }
+        break;
+    }
+    pthread_mutex_unlock(&g_models_mu);
+    if (to_free) llama_free_model(to_free);
+}
+
+enum { FINGERPRINT_SPAN = 64 * 1024 };
+
+static uint64_t fnv1a(uint64_t h, const unsigned char * p, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t file_fingerprint(const char * path, uint64_t n_params) {
+    FILE * f = fopen(path, "rb");
+    if (!f) return 0;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    unsigned char * buf = (unsigned char *)malloc(FINGERPRINT_SPAN);
+    long long size = -1;
+    if (buf && fseeko(f, 0, SEEK_END) == 0) size = (long long)ftello(f);
+    if (size >= 0) {
+        h = fnv1a(h, (const unsigned char *)&size, sizeof(size));
+        h = fnv1a(h, (const unsigned char *)&n_params, sizeof(n_params));
+        const long long tail = size > FINGERPRINT_SPAN ? size - FINGERPRINT_SPAN : 0;
+        const long long offs[2] = { 0, tail };
+        for (int k = 0; k < 2 && size >= 0; ++k) {
+            if (fseeko(f, (off_t)offs[k], SEEK_SET) != 0) { size = -1; break; }
+            const size_t n = fread(buf, 1, FINGERPRINT_SPAN, f);
+            h = fnv1a(h, buf, n);
+        }
+    }
+    free(buf);
+    fclose(f);
+    if (size < 0) return 0;
+    return h ? h : 1; // 0 is reserved for "unknown"
+}
+
+uint64_t sl_model_fingerprint(const struct llama_model * model) {
+    if (!model) return 0;
+    uint64_t fp = 0;
+    pthread_mutex_lock(&g_models_mu);
+    for (sl_model_entry * e = g_models; e; e = e->next) {
+        if (e->model != model) continue;
+        if (e->fingerprint == 0) e->fingerprint = file_fingerprint(e->path, llama_model_n_params(model));
+        fp = e->fingerprint;
+        break;
+    }
+    pthread_mutex_unlock(&g_models_mu);
+    return fp;
+}
+
+static int meta_int(const struct llama_model * model, const char * arch, const char * suffix) {
+    char key[128];
+    char val[32];
+    snprintf(key, sizeof(key), "%s.%s", arch, suffix);
+    if (llama_model_meta_val_str(model, key, val, sizeof(val)) <= 0) return 0;
+    return atoi(val);
+}
+
+long long sl_kv_cache_bytes(const struct llama_model * model, int n_cells, enum ggml_type type_k, enum ggml_type type_v) {
+    if (!model || n_cells <= 0) return 0;
+    const int n_layer = llama_model_n_layer(model);
+    const int n_head = llama_model_n_head(model);
+    const int n_head_kv = llama_model_n_head_kv(model);
+    if (n_layer <= 0 || n_head <= 0 || n_head_kv <= 0) return 0;
+    char arch[64] = {0};
+    if (llama_model_meta_val_str(model, "general.architecture", arch, sizeof(arch)) <= 0) arch[0] = '\0';
+    int head_k = arch[0] ? meta_int(model, arch, "attention.key_length") : 0;
+    int head_v = arch[0] ? meta_int(model, arch, "attention.value_length") : 0;
+    if (head_k <= 0) head_k = llama_model_n_embd(model) / n_head;
+    if (head_v <= 0) head_v = head_k;
+    // ggml row size: bytes per block * elements / block size
+    const long long row_k = (long long)ggml_type_size(type_k) * head_k * n_head_kv / ggml_blck_size(type_k);
+    const long long row_v = (long long)ggml_type_size(type_v) * head_v * n_head_kv / ggml_blck_size(type_v);
+    return (long long)n_layer * n_cells * (row_k + row_v);
+}
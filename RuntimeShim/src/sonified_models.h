@@ -0,0 +1,27 @@
+// sonified_models.h
+//
+// Process-wide registry of loaded models. Handles opened on the same file with the same
+// load parameters share one llama_model (weights are mapped/loaded once) and each own
+// only their contexts; the last release frees the weights. Not part of the public API.
+
+#ifndef SONIFIED_MODELS_H
+#define SONIFIED_MODELS_H
+
+#include "llama.h"
+
+// Return the shared model for (canonical path, load params), loading it on first use.
+// Returns NULL if loading fails. Every successful acquire needs one sl_model_release.
+struct llama_model * sl_model_acquire(const char * path, const struct llama_model_params * mparams);
+
+void sl_model_release(struct llama_model * model);
+
+// Identity of the file behind a registered model: FNV-1a over its size, first and last
+// 64 KiB (GGUF metadata and trailing tensor data) and the parameter count. Cheap enough
+// to tag saved state; not an integrity checksum. Computed once per model; 0 if unknown.
+uint64_t sl_model_fingerprint(const struct llama_model * model);
+
+// Bytes of K+V for n_cells cells of every layer at the given cache types. Head sizes come
+// from the GGUF attention.key_length/value_length keys when present.
+long long sl_kv_cache_bytes(const struct llama_model * model, int n_cells, enum ggml_type type_k, enum ggml_type type_v);
+
+#endif // SONIFIED_MODELS_H
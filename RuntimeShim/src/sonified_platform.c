@@ -0,0 +1,166 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+#include "sonified_platform.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/sysctl.h>
+#endif
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+double sl_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+// getrusage reports the peak, not the current, RSS; still satisfies the peak_rss_mb contract
+static size_t rusage_peak_rss_bytes(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return 0;
+#if defined(__APPLE__)
+    return (size_t)ru.ru_maxrss;          // bytes on Darwin
+#else
+    return (size_t)ru.ru_maxrss * 1024u;  // kilobytes on Linux/BSD
+#endif
+}
+
+size_t sl_current_rss_bytes(void) {
+#if defined(__APPLE__)
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) != KERN_SUCCESS) {
+        return rusage_peak_rss_bytes();
+    }
+    return (size_t)info.phys_footprint; // good proxy for resident set on macOS
+#elif defined(__linux__)
+    // statm: size resident shared text lib data dt (in pages)
+    FILE* f = fopen("/proc/self/statm", "r");
+    if (!f) return rusage_peak_rss_bytes();
+    unsigned long size_pages = 0, resident_pages = 0;
+    int n = fscanf(f, "%lu %lu", &size_pages, &resident_pages);
+    fclose(f);
+    if (n != 2) return rusage_peak_rss_bytes();
+    long page = sysconf(_SC_PAGESIZE);
+    if (page <= 0) page = 4096;
+    return (size_t)resident_pages * (size_t)page;
+#else
+    return rusage_peak_rss_bytes();
+#endif
+}
+
+// ---- CPU topology ----
+
+#if defined(__linux__)
+// Whole CPUs granted by a CFS quota, or 0 when unlimited / not in a cgroup.
+static int cgroup_cpu_limit(void) {
+    long long quota = -1, period = 0;
+    FILE* f = fopen("/sys/fs/cgroup/cpu.max", "r"); // v2: "<quota|max> <period>"
+    if (f) {
+        char q[32] = {0};
+        if (fscanf(f, "%31s %lld", q, &period) == 2 && strcmp(q, "max") != 0) quota = atoll(q);
+        fclose(f);
+    } else {
+        f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_quota_us", "r"); // v1, -1 when unlimited
+        if (f) {
+            if (fscanf(f, "%lld", &quota) != 1) quota = -1;
+            fclose(f);
+        }
+        f = fopen("/sys/fs/cgroup/cpu/cpu.cfs_period_us", "r");
+        if (f) {
+            if (fscanf(f, "%lld", &period) != 1) period = 0;
+            fclose(f);
+        }
+    }
+    if (quota <= 0 || period <= 0) return 0;
+    return (int)((quota + period - 1) / period);
+}
+#endif
+
+#if defined(__APPLE__)
+static int sysctl_int(const char* name) {
+    int v = 0;
+    size_t len = sizeof(v);
+    if (sysctlbyname(name, &v, &len, NULL, 0) != 0) return 0;
+    return v;
+}
+#endif
+
+static int online_cpus(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+int sl_available_cpus(void) {
+#if defined(__linux__)
+    int n = 0;
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) n = CPU_COUNT(&set);
+    if (n <= 0) n = online_cpus();
+    const int limit = cgroup_cpu_limit();
+    if (limit > 0 && limit < n) n = limit;
+    return n;
+#else
+    return online_cpus();
+#endif
+}
+
+int sl_physical_cores(void) {
+    const int avail = sl_available_cpus();
+    int n = 0;
+#if defined(__linux__)
+    // A CPU is counted when it is the first of its SMT sibling group that we may run on.
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        cpu_set_t seen;
+        CPU_ZERO(&seen);
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (!CPU_ISSET(cpu, &set) || CPU_ISSET(cpu, &seen)) continue;
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+            FILE* f = fopen(path, "r");
+            char list[256] = {0};
+            if (f) {
+                if (!fgets(list, sizeof(list), f)) list[0] = '\0';
+                fclose(f);
+            }
+            // entries look like "3,35" or "0-1"
+            for (char* p = list; *p;) {
+                char* end = NULL;
+                long a = strtol(p, &end, 10);
+                if (end == p) break;
+                long b = a;
+                if (*end == '-') b = strtol(end + 1, &end, 10);
+                for (long c = a; c <= b && c < CPU_SETSIZE; ++c) CPU_SET((int)c, &seen);
+                p = (*end == ',') ? end + 1 : end;
+                if (*p == '\n') break;
+            }
+            CPU_SET(cpu, &seen);
+            n += 1;
+        }
+    }
+#elif defined(__APPLE__)
+    n = sysctl_int("hw.physicalcpu");
+#endif
+    if (n <= 0) n = avail;
+    return n < avail ? n : avail;
+}
+
+void sl_default_threads(int* n_decode, int* n_prefill) {
+    const int cores = sl_physical_cores();
+    int decode = cores;
+#if defined(__APPLE__)
+    const int perf = sysctl_int("hw.perflevel0.physicalcpu"); // performance cores only
+    if (perf > 0 && perf < decode) decode = perf;
+#endif
+    if (n_decode) *n_decode = decode > 0 ? decode : 1;
+    if (n_prefill) *n_prefill = cores > 0 ? cores : 1;
+}
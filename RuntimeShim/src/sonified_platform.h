@@ -0,0 +1,31 @@
+// sonified_platform.h
+//
+// Internal OS probes shared by the runtime shim translation units.
+// Not part of the public API; keep free of llama.cpp types.
+
+#ifndef SONIFIED_PLATFORM_H
+#define SONIFIED_PLATFORM_H
+
+#include <stddef.h>
+
+// Monotonic wall clock in milliseconds (arbitrary epoch).
+double sl_now_ms(void);
+
+// Current resident set size of this process in bytes, or 0 if unavailable.
+// macOS: task phys_footprint. Linux: /proc/self/statm. Elsewhere: getrusage peak.
+size_t sl_current_rss_bytes(void);
+
+// CPUs this process may run on: the affinity mask (Linux), capped by a cgroup v1/v2 CPU
+// quota rounded up. Always >= 1.
+int sl_available_cpus(void);
+
+// Physical cores usable by this process: SMT siblings counted once, restricted to the
+// affinity mask and capped by sl_available_cpus(). macOS reports hw.physicalcpu.
+int sl_physical_cores(void);
+
+// Default llama.cpp thread counts. Prefill is compute-bound and uses every usable physical
+// core; decode is bandwidth-bound and synchronizes every token, so on Apple Silicon it
+// stays on the performance cores. Both are >= 1.
+void sl_default_threads(int * n_decode, int * n_prefill);
+
+#endif // SONIFIED_PLATFORM_H
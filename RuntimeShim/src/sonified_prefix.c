@@ -0,0 +1,198 @@
+#include "sonified_prefix.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct sl_prefix_entry {
+    llama_seq_id   seq;
+    int            n_pages;   // 0 when the sequence is free
+    uint64_t     * hashes;    // chain hash after each page
+    llama_token  * tokens;    // n_pages * SL_PREFIX_PAGE, to rule out hash collisions
+    int            cap_pages;
+    unsigned long  last_used;
+} sl_prefix_entry;
+
+struct sl_prefix_cache {
+    struct llama_context * ctx;
+    sl_prefix_entry      * entries;
+    int                    n_entries;
+    int                    budget_pages;
+    int                    used_pages;
+    unsigned long          tick;
+    int                    hits;
+    int                    misses;
+};
+
+// FNV-1a over the page's token ids, seeded with the previous page's hash.
+static uint64_t page_hash(uint64_t prev, const llama_token * page) {
+    uint64_t h = prev;
+    const unsigned char * p = (const unsigned char *)page;
+    for (size_t i = 0; i < sizeof(llama_token) * SL_PREFIX_PAGE; ++i) {
+        h ^= p[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t * chain_hashes(const llama_token * tokens, int n_pages) {
+    uint64_t * h = (uint64_t *)malloc(sizeof(uint64_t) * (size_t)(n_pages > 0 ? n_pages : 1));
+    if (!h) return NULL;
+    uint64_t prev = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < n_pages; ++i) h[i] = prev = page_hash(prev, tokens + (size_t)i * SL_PREFIX_PAGE);
+    return h;
+}
+
+// Pages e shares with a prompt whose chain hashes are h[0..n_pages).
+static int shared_pages(const sl_prefix_entry * e, const uint64_t * h, const llama_token * tokens, int n_pages) {
+    int k = e->n_pages < n_pages ? e->n_pages : n_pages;
+    while (k > 0 && e->hashes[k - 1] != h[k - 1]) --k; // chain hashes: equal at k means equal before
+    if (k > 0 && memcmp(e->tokens, tokens, sizeof(llama_token) * (size_t)k * SL_PREFIX_PAGE) != 0) return 0;
+    return k;
+}
+
+static sl_prefix_entry * best_match(sl_prefix_cache * c, const uint64_t * h, const llama_token * tokens, int n_pages, int * out_k) {
+    sl_prefix_entry * best = NULL;
+    int best_k = 0;
+    for (int i = 0; i < c->n_entries; ++i) {
+        sl_prefix_entry * e = &c->entries[i];
+        if (e->n_pages == 0) continue;
+        const int k = shared_pages(e, h, tokens, n_pages);
+        if (k > best_k) {
+            best = e;
+            best_k = k;
+        }
+    }
+    *out_k = best_k;
+    return best;
+}
+
+static void evict(sl_prefix_cache * c, sl_prefix_entry * e) {
+    llama_kv_self_seq_rm(c->ctx, e->seq, -1, -1);
+    c->used_pages -= e->n_pages;
+    e->n_pages = 0;
+}
+
+// Evict least recently used entries other than keep until need more pages fit (and, when
+// want_free, a sequence is free). Returns false if that cannot be done.
+static bool make_room(sl_prefix_cache * c, int need, const sl_prefix_entry * keep, bool want_free) {
+    if (need > c->budget_pages) return false;
+    for (;;) {
+        bool have_free = false;
+        sl_prefix_entry * lru = NULL;
+        for (int i = 0; i < c->n_entries; ++i) {
+            sl_prefix_entry * e = &c->entries[i];
+            if (e->n_pages == 0) { have_free = true; continue; }
+            if (e != keep && (!lru || e->last_used < lru->last_used)) lru = e;
+        }
+        if (c->used_pages + need <= c->budget_pages && (have_free || !want_free)) return true;
+        if (!lru) return false;
+        evict(c, lru);
+    }
+}
+
+static bool reserve(sl_prefix_entry * e, int n_pages) {
+    if (n_pages <= e->cap_pages) return true;
+    uint64_t * h = (uint64_t *)realloc(e->hashes, sizeof(uint64_t) * (size_t)n_pages);
+    if (!h) return false;
+    e->hashes = h;
+    llama_token * t = (llama_token *)realloc(e->tokens, sizeof(llama_token) * (size_t)n_pages * SL_PREFIX_PAGE);
+    if (!t) return false;
+    e->tokens = t;
+    e->cap_pages = n_pages;
+    return true;
+}
+
+sl_prefix_cache * sl_prefix_create(struct llama_context * ctx, int seq0, int n_seqs, int budget_tokens) {
+    if (!ctx || n_seqs <= 0 || budget_tokens < SL_PREFIX_PAGE) return NULL;
+    sl_prefix_cache * c = (sl_prefix_cache *)calloc(1, sizeof(sl_prefix_cache));
+    if (!c) return NULL;
+    c->entries = (sl_prefix_entry *)calloc((size_t)n_seqs, sizeof(sl_prefix_entry));
+    if (!c->entries) {
+        free(c);
+        return NULL;
+    }
+    c->ctx = ctx;
+    c->n_entries = n_seqs;
+    c->budget_pages = budget_tokens / SL_PREFIX_PAGE;
+    for (int i = 0; i < n_seqs; ++i) c->entries[i].seq = seq0 + i;
+    return c;
+}
+
+void sl_prefix_free(sl_prefix_cache * c) {
+    if (!c) return;
+    for (int i = 0; i < c->n_entries; ++i) {
+        free(c->entries[i].hashes);
+        free(c->entries[i].tokens);
+    }
+    free(c->entries);
+    free(c);
+}
+
+int sl_prefix_lookup(sl_prefix_cache * c, const llama_token * tokens, int n, llama_seq_id dst) {
+    if (!c) return 0;
+    const int n_pages = (n - 1) / SL_PREFIX_PAGE; // the last prompt token is always decoded
+    if (n_pages == 0) return 0;
+    uint64_t * h = chain_hashes(tokens, n_pages);
+    if (!h) return 0;
+    int k = 0;
+    sl_prefix_entry * e = best_match(c, h, tokens, n_pages, &k);
+    free(h);
+    if (!e) {
+        c->misses += 1;
+        return 0;
+    }
+    llama_kv_self_seq_cp(c->ctx, e->seq, dst, 0, k * SL_PREFIX_PAGE);
+    e->last_used = ++c->tick;
+    c->hits += 1;
+    return k * SL_PREFIX_PAGE;
+}
+
+void sl_prefix_insert(sl_prefix_cache * c, const llama_token * tokens, int n, llama_seq_id src) {
+    if (!c) return;
+    const int n_pages = n / SL_PREFIX_PAGE;
+    if (n_pages == 0) return;
+    uint64_t * h = chain_hashes(tokens, n_pages);
+    if (!h) return;
+    int k = 0;
+    sl_prefix_entry * e = best_match(c, h, tokens, n_pages, &k);
+    if (e && k == n_pages) { // already cached
+        e->last_used = ++c->tick;
+        free(h);
+        return;
+    }
+    if (e && k == e->n_pages) {
+        // this prompt continues e: append the new pages to its sequence
+        if (!make_room(c, n_pages - k, e, false) || !reserve(e, n_pages)) {
+            free(h);
+            return;
+        }
+        llama_kv_self_seq_cp(c->ctx, src, e->seq, k * SL_PREFIX_PAGE, n_pages * SL_PREFIX_PAGE);
+    } else {
+        if (!make_room(c, n_pages, NULL, true)) {
+            free(h);
+            return;
+        }
+        e = NULL;
+        for (int i = 0; i < c->n_entries && !e; ++i) {
+            if (c->entries[i].n_pages == 0) e = &c->entries[i];
+        }
+        if (!e || !reserve(e, n_pages)) {
+            free(h);
+            return;
+        }
+        k = 0;
+        llama_kv_self_seq_cp(c->ctx, src, e->seq, 0, n_pages * SL_PREFIX_PAGE);
+    }
+    memcpy(e->hashes, h, sizeof(uint64_t) * (size_t)n_pages);
+    memcpy(e->tokens, tokens, sizeof(llama_token) * (size_t)n_pages * SL_PREFIX_PAGE);
+    c->used_pages += n_pages - k;
+    e->n_pages = n_pages;
+    e->last_used = ++c->tick;
+    free(h);
+}
+
+void sl_prefix_counters(const sl_prefix_cache * c, int * hits, int * misses) {
+    *hits = c ? c->hits : 0;
+    *misses = c ? c->misses : 0;
+}
@@ -0,0 +1,36 @@
+// sonified_prefix.h
+//
+// Content-addressed prefix cache for the continuous-batching scheduler. Prompts are cut
+// into SL_PREFIX_PAGE-token pages and identified by a rolling hash over the page chain, so
+// a page hash names the whole prefix up to it. Cached prefixes live in spare sequences of
+// the scheduler's llama_context; a request that shares pages with one gets them through
+// llama_kv_self_seq_cp (cells are shared, not recomputed) and prefills only the rest.
+// Entries are evicted least recently used first to stay under a token (KV byte) budget.
+// Not part of the public API.
+
+#ifndef SONIFIED_PREFIX_H
+#define SONIFIED_PREFIX_H
+
+#include "llama.h"
+
+enum { SL_PREFIX_PAGE = 64 };
+
+typedef struct sl_prefix_cache sl_prefix_cache;
+
+// Cache prefixes in sequences seq0 .. seq0 + n_seqs - 1 of ctx, holding at most
+// budget_tokens cached tokens in total. Returns NULL when out of memory.
+sl_prefix_cache * sl_prefix_create(struct llama_context * ctx, int seq0, int n_seqs, int budget_tokens);
+void              sl_prefix_free(sl_prefix_cache * c);
+
+// Copy the longest cached page-aligned prefix of tokens[0..n) into the empty sequence dst,
+// leaving at least one token to decode. Returns the tokens copied (0 on a miss). Prompts
+// of one page or less are neither hits nor misses.
+int  sl_prefix_lookup(sl_prefix_cache * c, const llama_token * tokens, int n, llama_seq_id dst);
+
+// Remember the full pages of tokens[0..n), which sequence src holds in the KV cache.
+// Extends an entry it continues, otherwise evicts as needed and adds a new one.
+void sl_prefix_insert(sl_prefix_cache * c, const llama_token * tokens, int n, llama_seq_id src);
+
+void sl_prefix_counters(const sl_prefix_cache * c, int * hits, int * misses);
+
+#endif // SONIFIED_PREFIX_H
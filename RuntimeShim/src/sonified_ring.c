@@ -0,0 +1,273 @@
+#include "sonified_ring.h"
+#include "sonified_llama.h"
+#include "sonified_utf8.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum { RING_MIN_BYTES = 64, RING_WAIT_SLICE_MS = 20 };
+
+// One power-of-two buffer. GROW chains a larger one and the producer never comes back;
+// the consumer frees a segment once it is drained and a successor exists.
+typedef struct ring_seg {
+    struct ring_seg * _Atomic next;
+    size_t            mask;
+    _Atomic size_t    head;                        // bytes consumed (consumer-owned)
+    char              pad0[64 - sizeof(size_t)];   // keep head and tail on separate lines
+    _Atomic size_t    tail;                        // bytes produced (producer-owned)
+    char              pad1[64 - sizeof(size_t)];
+    char              data[];
+} ring_seg;
+
+struct sl_ring {
+    int               overflow;  // llm_stream_overflow
+    ring_seg        * wr;        // producer-owned
+    ring_seg        * rd;        // consumer-owned
+    _Atomic bool      closed;
+    _Atomic long long dropped;
+    _Atomic long long pieces;    // completed writes
+    long long         pieces_read; // consumer-owned: pieces seen by the last read
+    _Atomic bool      reader_waiting;
+    _Atomic bool      writer_waiting;
+    pthread_mutex_t   mu;        // sleep/wake only
+    pthread_cond_t    cv;
+};
+
+static ring_seg * seg_new(size_t cap) {
+    ring_seg * s = (ring_seg *)malloc(sizeof(ring_seg) + cap);
+    if (!s) return NULL;
+    atomic_init(&s->next, NULL);
+    atomic_init(&s->head, 0);
+    atomic_init(&s->tail, 0);
+    s->mask = cap - 1;
+    return s;
+}
+
+static size_t pow2_at_least(size_t n) {
+    size_t cap = RING_MIN_BYTES;
+    while (cap < n) cap <<= 1;
+    return cap;
+}
+
+sl_ring * sl_ring_create(int capacity, int overflow) {
+    sl_ring * r = (sl_ring *)calloc(1, sizeof(sl_ring));
+    if (!r) return NULL;
+    r->overflow = overflow;
+    r->wr = r->rd = seg_new(pow2_at_least(capacity > 0 ? (size_t)capacity : 0));
+    if (!r->wr) {
+        free(r);
+        return NULL;
+    }
+    atomic_init(&r->closed, false);
+    atomic_init(&r->dropped, 0);
+    atomic_init(&r->pieces, 0);
+    atomic_init(&r->reader_waiting, false);
+    atomic_init(&r->writer_waiting, false);
+    pthread_mutex_init(&r->mu, NULL);
+    pthread_cond_init(&r->cv, NULL);
+    return r;
+}
+
+void sl_ring_free(sl_ring * r) {
+    if (!r) return;
+    for (ring_seg * s = r->rd; s;) {
+        ring_seg * next = atomic_load(&s->next);
+        free(s);
+        s = next;
+    }
+    pthread_cond_destroy(&r->cv);
+    pthread_mutex_destroy(&r->mu);
+    free(r);
+}
+
+// Wake the other side if it announced it is about to sleep. The fence orders our last
+// head/tail store before the flag load, pairing with the fence in wait_until.
+static void wake_if(sl_ring * r, _Atomic bool * waiting) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load_explicit(waiting, memory_order_relaxed)) return;
+    pthread_mutex_lock(&r->mu);
+    pthread_cond_broadcast(&r->cv);
+    pthread_mutex_unlock(&r->mu);
+}
+
+static void abs_deadline(struct timespec * ts, int ms) {
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec += 1;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+// Sleep up to ms while ready(r, arg) is false; the other side wakes us through wake_if.
+static void wait_until(sl_ring * r, _Atomic bool * waiting, bool (*ready)(sl_ring *, const void *), const void * arg, int ms) {
+    atomic_store_explicit(waiting, true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    pthread_mutex_lock(&r->mu);
+    if (!ready(r, arg)) {
+        struct timespec ts;
+        abs_deadline(&ts, ms);
+        pthread_cond_timedwait(&r->cv, &r->mu, &ts);
+    }
+    pthread_mutex_unlock(&r->mu);
+    atomic_store_explicit(waiting, false, memory_order_relaxed);
+}
+
+// ---- producer ----
+
+static bool has_room(sl_ring * r, const void * arg) {
+    const ring_seg * s = r->wr;
+    return atomic_load_explicit(&s->tail, memory_order_relaxed) - atomic_load_explicit(&s->head, memory_order_acquire) < s->mask + 1;
+}
+
+static void seg_put(ring_seg * s, const char * data, size_t n) {
+    const size_t tail = atomic_load_explicit(&s->tail, memory_order_relaxed);
+    const size_t pos = tail & s->mask;
+    const size_t first = n < s->mask + 1 - pos ? n : s->mask + 1 - pos;
+    memcpy(s->data + pos, data, first);
+    memcpy(s->data, data + first, n - first);
+    atomic_store_explicit(&s->tail, tail + n, memory_order_release);
+}
+
+int sl_ring_write(sl_ring * r, const char * data, int n, const _Atomic bool * abort) {
+    size_t left = n > 0 ? (size_t)n : 0;
+    while (left > 0) {
+        ring_seg * s = r->wr;
+        const size_t used = atomic_load_explicit(&s->tail, memory_order_relaxed) - atomic_load_explicit(&s->head, memory_order_acquire);
+        const size_t room = s->mask + 1 - used;
+        if (room >= left) {
+            seg_put(s, data, left);
+            break;
+        }
+        if (r->overflow == LLM_STREAM_DROP) {
+            atomic_fetch_add(&r->dropped, 1);
+            return 1;
+        }
+        if (r->overflow == LLM_STREAM_GROW) {
+            ring_seg * bigger = seg_new(pow2_at_least((s->mask + 1) * 2 > left ? (s->mask + 1) * 2 : left));
+            if (!bigger) return -1;
+            r->wr = bigger;
+            atomic_store_explicit(&s->next, bigger, memory_order_release);
+            continue;
+        }
+        // BLOCK: a write larger than the free space goes in pieces as the reader drains
+        if (room > 0) {
+            seg_put(s, data, room);
+            data += room;
+            left -= room;
+            wake_if(r, &r->reader_waiting);
+            continue;
+        }
+        if (abort && atomic_load(abort)) return -1;
+        wait_until(r, &r->writer_waiting, has_room, NULL, RING_WAIT_SLICE_MS);
+    }
+    atomic_fetch_add_explicit(&r->pieces, 1, memory_order_release);
+    wake_if(r, &r->reader_waiting);
+    return 0;
+}
+
+void sl_ring_close(sl_ring * r) {
+    atomic_store(&r->closed, true);
+    wake_if(r, &r->reader_waiting);
+}
+
+bool sl_ring_closed(sl_ring * r) {
+    return atomic_load(&r->closed);
+}
+
+long long sl_ring_dropped(sl_ring * r) {
+    return atomic_load(&r->dropped);
+}
+
+// ---- consumer ----
+
+// Anything new since the reader looked at tail == *seen (or a successor, or close)?
+static bool has_news(sl_ring * r, const void * arg) {
+    const ring_seg * s = r->rd;
+    return atomic_load_explicit(&s->tail, memory_order_acquire) != *(const size_t *)arg ||
+           atomic_load_explicit(&s->next, memory_order_acquire) != NULL ||
+           atomic_load(&r->closed);
+}
+
+int sl_ring_read(sl_ring * r, char * out, int max, int timeout_ms) {
+    if (!out || max <= 0) return 0;
+    const double deadline_ms = timeout_ms > 0 ? (double)timeout_ms : 0.0;
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (;;) {
+        ring_seg * s = r->rd;
+        // pieces and closed before tail: what they count is covered by the tail below
+        const long long pieces = atomic_load_explicit(&r->pieces, memory_order_acquire);
+        const bool closed = atomic_load(&r->closed);
+        ring_seg * next = atomic_load_explicit(&s->next, memory_order_acquire);
+        const size_t head = atomic_load_explicit(&s->head, memory_order_relaxed);
+        const size_t tail = atomic_load_explicit(&s->tail, memory_order_acquire);
+        const size_t avail = tail - head;
+        if (avail == 0 && next) { // drained and abandoned by the producer
+            r->rd = next;
+            free(s);
+            continue;
+        }
+        if (avail > 0) {
+            size_t k = avail < (size_t)max ? avail : (size_t)max;
+            const size_t pos = head & s->mask;
+            const size_t first = k < s->mask + 1 - pos ? k : s->mask + 1 - pos;
+            memcpy(out, s->data + pos, first);
+            memcpy(out + first, s->data, k - first);
+            // hold back a split code point while the producer may still complete it
+            if (k < avail || (!closed && !next)) {
+                const size_t hold = (size_t)sl_utf8_incomplete_tail(out, (int)k);
+                if (hold < k) k -= hold;
+                else if (max >= 4) k = 0; // only part of a code point so far: wait for the rest
+            }
+            if (k > 0) {
+                r->pieces_read = pieces;
+                atomic_store_explicit(&s->head, head + k, memory_order_release);
+                wake_if(r, &r->writer_waiting);
+                return (int)k;
+            }
+        } else if (closed) {
+            return -1;
+        }
+        if (timeout_ms == 0) return 0;
+        int wait_ms = RING_WAIT_SLICE_MS * 50;
+        if (timeout_ms > 0) {
+            struct timespec t1;
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            const double spent = (double)(t1.tv_sec - t0.tv_sec) * 1000.0 + (double)(t1.tv_nsec - t0.tv_nsec) / 1e6;
+            if (spent >= deadline_ms) return 0;
+            wait_ms = (int)(deadline_ms - spent) + 1;
+        }
+        wait_until(r, &r->reader_waiting, has_news, &tail, wait_ms);
+    }
+}
+
+// Enough new pieces for a batch, or a reason not to wait for them: a full segment stalls a
+// BLOCK producer, and a closed ring gets no more.
+static bool has_batch(sl_ring * r, const void * arg) {
+    const ring_seg * s = r->rd;
+    return atomic_load_explicit(&r->pieces, memory_order_acquire) - r->pieces_read >= *(const long long *)arg ||
+           atomic_load_explicit(&s->tail, memory_order_acquire) - atomic_load_explicit(&s->head, memory_order_relaxed) > s->mask ||
+           atomic_load(&r->closed);
+}
+
+int sl_ring_read_batch(sl_ring * r, char * out, int max, int min_pieces, int timeout_ms) {
+    if (min_pieces <= 1 || timeout_ms == 0) return sl_ring_read(r, out, max, timeout_ms);
+    const long long want = min_pieces;
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (!has_batch(r, &want)) {
+        int wait_ms = RING_WAIT_SLICE_MS * 50;
+        if (timeout_ms > 0) {
+            struct timespec t1;
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            const double spent = (double)(t1.tv_sec - t0.tv_sec) * 1000.0 + (double)(t1.tv_nsec - t0.tv_nsec) / 1e6;
+            if (spent >= (double)timeout_ms) break;
+            wait_ms = (int)((double)timeout_ms - spent) + 1;
+        }
+        wait_until(r, &r->reader_waiting, has_batch, &want, wait_ms);
+    }
+    return sl_ring_read(r, out, max, 0);
+}
@@ -0,0 +1,43 @@
+// sonified_ring.h
+//
+// Single-producer / single-consumer byte ring behind llm_stream_t. The decode thread
+// writes token pieces, the caller drains them from its own thread; the data path is
+// lock-free (acquire/release head and tail), and a mutex/condvar is touched only when one
+// side actually has to sleep. Not part of the public API; free of llama.cpp types.
+
+#ifndef SONIFIED_RING_H
+#define SONIFIED_RING_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+typedef struct sl_ring sl_ring;
+
+// capacity is rounded up to a power of two (minimum 64 bytes); overflow is an
+// llm_stream_overflow. Returns NULL when out of memory.
+sl_ring * sl_ring_create(int capacity, int overflow);
+void      sl_ring_free(sl_ring * r);
+
+// Producer. Writes n bytes as one unit: BLOCK waits for room (giving up when *abort turns
+// true), DROP discards the whole write and counts it, GROW chains a larger segment.
+// Returns 0 when written, 1 when dropped, -1 when out of memory or aborted.
+int  sl_ring_write(sl_ring * r, const char * data, int n, const _Atomic bool * abort);
+
+// Producer: no more writes; the reader sees end of stream once the ring is drained.
+void sl_ring_close(sl_ring * r);
+
+// Consumer. Copies up to max bytes, never ending inside a UTF-8 sequence that the producer
+// may still complete (max < 4 excepted). Blocks up to timeout_ms for data (0 = non-blocking,
+// < 0 = indefinitely). Returns the bytes read, 0 on timeout, or -1 at end of stream.
+int  sl_ring_read(sl_ring * r, char * out, int max, int timeout_ms);
+
+// Consumer. Same, but first waits up to timeout_ms until min_pieces writes have landed since
+// the previous read (or the ring is full or closed), then copies whatever is buffered.
+int  sl_ring_read_batch(sl_ring * r, char * out, int max, int min_pieces, int timeout_ms);
+
+// Writes discarded under DROP.
+long long sl_ring_dropped(sl_ring * r);
+
+bool sl_ring_closed(sl_ring * r);
+
+#endif // SONIFIED_RING_H
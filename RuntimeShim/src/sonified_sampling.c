@@ -0,0 +1,315 @@
+#include "sonified_sampling.h"
+#include "sonified_kernels.h"
+#include "sonified_platform.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { SL_DEFAULT_PENALTY_LAST_N = 64 };
+// A bias on at least n_vocab / SL_BIAS_DENSE_DIV ids is added as a whole row: a streaming
+// vector add beats that many scattered read-modify-writes.
+enum { SL_BIAS_DENSE_DIV = 16 };
+
+static sl_sampler_cfg cfg_from_opts(const llm_gen_opts_t * opts) {
+    sl_sampler_cfg c;
+    memset(&c, 0, sizeof(c)); // padding-free compare in sl_sampler_configure
+    c.temperature    = opts ? opts->temperature : 0.0f;
+    c.top_p          = (opts && opts->top_p > 0.0f && opts->top_p < 1.0f) ? opts->top_p : 1.0f;
+    c.min_p          = (opts && opts->min_p > 0.0f) ? opts->min_p : 0.0f;
+    c.repeat_penalty = (opts && opts->repeat_penalty > 0.0f) ? opts->repeat_penalty : 1.0f;
+    c.top_k          = (opts && opts->top_k > 0) ? opts->top_k : 0;
+    c.penalty_last_n = (opts && opts->penalty_last_n > 0) ? opts->penalty_last_n : SL_DEFAULT_PENALTY_LAST_N;
+    c.seed           = (opts && opts->seed > 0) ? (uint32_t)opts->seed : LLAMA_DEFAULT_SEED;
+    if (c.temperature < 0.0f) c.temperature = 0.0f;
+    if (c.repeat_penalty == 1.0f) c.penalty_last_n = 0;
+    return c;
+}
+
+static struct llama_sampler * build_chain(const sl_sampler_cfg * c) {
+    struct llama_sampler_chain_params sp = llama_sampler_chain_default_params();
+    sp.no_perf = true;
+    struct llama_sampler * chain = llama_sampler_chain_init(sp);
+    if (!chain) return NULL;
+    // Repetition penalties are applied by sl_sampler itself in O(window) rather than by
+    // llama's penalties stage, which does a hash lookup per vocab entry.
+    if (c->top_k > 0)      llama_sampler_chain_add(chain, llama_sampler_init_top_k(c->top_k));
+    if (c->top_p < 1.0f)   llama_sampler_chain_add(chain, llama_sampler_init_top_p(c->top_p, 1));
+    if (c->min_p > 0.0f)   llama_sampler_chain_add(chain, llama_sampler_init_min_p(c->min_p, 1));
+    llama_sampler_chain_add(chain, llama_sampler_init_temp(c->temperature));
+    llama_sampler_chain_add(chain, llama_sampler_init_dist(c->seed));
+    return chain;
+}
+
+int sl_sampler_init(sl_sampler * s, int32_t n_vocab) {
+    if (!s || n_vocab <= 0) return -1;
+    memset(s, 0, sizeof(*s));
+    s->n_vocab = n_vocab;
+    s->cur   = (llama_token_data *)malloc(sizeof(llama_token_data) * (size_t)n_vocab);
+    s->stamp = (uint32_t *)calloc((size_t)n_vocab, sizeof(uint32_t));
+    if (!s->cur || !s->stamp) {
+        sl_sampler_free(s);
+        return -1;
+    }
+    return 0;
+}
+
+void sl_sampler_free(sl_sampler * s) {
+    if (!s) return;
+    if (s->chain) llama_sampler_free(s->chain);
+    free(s->cur);
+    free(s->stamp);
+    free(s->topk_idx);
+    free(s->topk_val);
+    free(s->bias_idx);
+    free(s->bias_val);
+    free(s->bias_row);
+    free(s->history);
+    memset(s, 0, sizeof(*s));
+}
+
+// Starts a fresh stamp generation (no token carries it yet).
+static void next_stamp(sl_sampler * s) {
+    if (++s->stamp_gen == 0) {
+        memset(s->stamp, 0, sizeof(uint32_t) * (size_t)s->n_vocab);
+        s->stamp_gen = 1;
+    }
+}
+
+// Replace the logit bias with opts', summing repeated ids into one entry each.
+static int set_bias(sl_sampler * s, const llm_gen_opts_t * opts) {
+    for (int32_t i = 0; i < s->n_bias; ++i) s->bias_row[s->bias_idx[i]] = 0.0f;
+    s->n_bias = 0;
+    s->bias_dense = false;
+    const int32_t n = (opts && opts->logit_bias && opts->n_logit_bias > 0) ? opts->n_logit_bias : 0;
+    if (n == 0) return 0;
+    if (!s->bias_row && !(s->bias_row = (float *)calloc((size_t)s->n_vocab, sizeof(float)))) return -1;
+    const int32_t want = n < s->n_vocab ? n : s->n_vocab;
+    if (want > s->bias_cap) {
+        int32_t * bi = (int32_t *)realloc(s->bias_idx, sizeof(int32_t) * (size_t)want);
+        if (bi) s->bias_idx = bi;
+        float * bv = (float *)realloc(s->bias_val, sizeof(float) * (size_t)want);
+        if (bv) s->bias_val = bv;
+        if (!bi || !bv) return -1;
+        s->bias_cap = want;
+    }
+    next_stamp(s);
+    for (int32_t i = 0; i < n; ++i) {
+        const int32_t t = opts->logit_bias[i].token;
+        if (t < 0 || t >= s->n_vocab) continue;
+        if (s->stamp[t] != s->stamp_gen) {
+            s->stamp[t] = s->stamp_gen;
+            s->bias_idx[s->n_bias++] = t;
+        }
+        s->bias_row[t] += opts->logit_bias[i].bias;
+    }
+    for (int32_t i = 0; i < s->n_bias; ++i) s->bias_val[i] = s->bias_row[s->bias_idx[i]];
+    s->bias_dense = s->n_bias >= s->n_vocab / SL_BIAS_DENSE_DIV;
+    return 0;
+}
+
+int sl_sampler_configure(sl_sampler * s, const llm_gen_opts_t * opts) {
+    if (!s || !s->cur) return -1;
+    sl_sampler_cfg c = cfg_from_opts(opts);
+    const bool changed = !s->configured || memcmp(&c, &s->cfg, sizeof(c)) != 0;
+    if (changed) {
+        if (s->chain) { llama_sampler_free(s->chain); s->chain = NULL; }
+        if (c.temperature > 0.0f) {
+            s->chain = build_chain(&c);
+            if (!s->chain) return -1;
+        }
+        if (c.penalty_last_n > s->hist_cap) {
+            llama_token * h = (llama_token *)realloc(s->history, sizeof(llama_token) * (size_t)c.penalty_last_n);
+            if (!h) return -1;
+            s->history = h;
+            s->hist_cap = c.penalty_last_n;
+        }
+        // Prefilter scratch: top_k (or 1 for greedy) plus room for every penalized token
+        const int want = (c.top_k > 0 ? c.top_k : 1) + c.penalty_last_n;
+        if ((c.top_k > 0 || c.penalty_last_n > 0) && want > s->topk_cap) {
+            int32_t * ti = (int32_t *)realloc(s->topk_idx, sizeof(int32_t) * (size_t)want);
+            if (ti) s->topk_idx = ti;
+            float * tv = (float *)realloc(s->topk_val, sizeof(float) * (size_t)want);
+            if (tv) s->topk_val = tv;
+            if (!ti || !tv) return -1;
+            s->topk_cap = want;
+        }
+        s->cfg = c;
+        s->configured = true;
+    } else if (s->chain) {
+        llama_sampler_reset(s->chain); // re-seeds dist so fixed seeds stay reproducible
+    }
+    if (set_bias(s, opts) != 0) return -1;
+    s->hist_len = 0;
+    s->hist_head = 0;
+    s->sample_ms = 0.0;
+    return 0;
+}
+
+bool sl_logit_bias_valid(const llm_gen_opts_t * opts, int32_t n_vocab) {
+    if (!opts || opts->n_logit_bias == 0) return true;
+    if (opts->n_logit_bias < 0 || !opts->logit_bias) return false;
+    for (int i = 0; i < opts->n_logit_bias; ++i) {
+        const llm_logit_bias_t * b = &opts->logit_bias[i];
+        if (b->token < 0 || b->token >= n_vocab) return false;
+        if (isnan(b->bias) || b->bias == INFINITY) return false; // +inf - inf would be NaN
+    }
+    return true;
+}
+
+void sl_sampler_apply_bias(sl_sampler * s, float * logits) {
+    if (!s || !logits || s->n_bias == 0) return;
+    const double t0 = sl_now_ms();
+    if (s->bias_dense) sl_add_f32(logits, s->bias_row, s->n_vocab);
+    else sl_scatter_add_f32(logits, s->bias_idx, s->bias_val, s->n_bias);
+    s->sample_ms += sl_now_ms() - t0;
+}
+
+static llama_token argmax_candidates(const llama_token_data * cur, int32_t n) {
+    int best = 0;
+    float best_v = cur[0].logit;
+    for (int i = 1; i < n; ++i) {
+        if (cur[i].logit > best_v) { best_v = cur[i].logit; best = i; }
+    }
+    return cur[best].id;
+}
+
+static inline float penalize(float l, float penalty) {
+    return (l <= 0.0f) ? (l * penalty) : (l / penalty);
+}
+
+// Stamps every distinct token in the penalty window with a fresh generation.
+static void mark_penalty_window(sl_sampler * s) {
+    next_stamp(s);
+    for (int i = 0; i < s->hist_len; ++i) {
+        const llama_token t = s->history[i];
+        if (t >= 0 && t < s->n_vocab) s->stamp[t] = s->stamp_gen;
+    }
+}
+
+// Full layout: candidates are in token-id order, so each penalized token is a direct index.
+static void apply_repeat_penalty_full(sl_sampler * s) {
+    if (s->hist_len == 0) return;
+    mark_penalty_window(s);
+    const float penalty = s->cfg.repeat_penalty;
+    for (int i = 0; i < s->hist_len; ++i) {
+        const llama_token t = s->history[i];
+        if (t < 0 || t >= s->n_vocab || s->stamp[t] != s->stamp_gen) continue;
+        s->stamp[t] = 0; // visit once
+        s->cur[t].logit = penalize(s->cur[t].logit, penalty);
+    }
+}
+
+static bool apply_repeat_penalty_candidates(sl_sampler * s, int32_t n_cand) {
+    if (s->hist_len == 0) return false;
+    mark_penalty_window(s);
+    const float penalty = s->cfg.repeat_penalty;
+    bool any = false;
+    for (int32_t i = 0; i < n_cand; ++i) {
+        if (s->stamp[s->cur[i].id] == s->stamp_gen) {
+            s->cur[i].logit = penalize(s->cur[i].logit, penalty);
+            any = true;
+        }
+    }
+    return any;
+}
+
+// Fills cur with the candidates the chain will see and returns how many there are.
+// A penalty >= 1 only ever lowers a logit, so the top (k + |window|) raw logits are
+// guaranteed to contain the top k after penalties; when that set is small we skip the
+// full-vocab copy. A penalty below 1 raises recent tokens from anywhere in the row, so it
+// always takes the full copy.
+static int32_t gather_candidates(sl_sampler * s, const float * logits, bool * sorted) {
+    const int32_t n = s->n_vocab;
+    const int k = s->chain ? s->cfg.top_k : 1;
+    const int m = (k > 0 && s->cfg.repeat_penalty >= 1.0f) ? k + s->hist_len : 0;
+    llama_token_data * cur = s->cur;
+    *sorted = false;
+    if (m > 0 && m <= s->topk_cap && m <= n / 8) {
+        const int32_t c = sl_topk_f32(logits, n, m, s->topk_idx, s->topk_val);
+        for (int32_t i = 0; i < c; ++i) {
+            cur[i].id = s->topk_idx[i];
+            cur[i].logit = s->topk_val[i];
+            cur[i].p = 0.0f;
+        }
+        const bool penalized = s->cfg.penalty_last_n > 0 && apply_repeat_penalty_candidates(s, c);
+        *sorted = !penalized; // sl_topk_f32 returns descending order
+        return c;
+    }
+    for (int32_t i = 0; i < n; ++i) {
+        cur[i].id = i;
+        cur[i].logit = logits[i];
+        cur[i].p = 0.0f;
+    }
+    if (s->cfg.penalty_last_n > 0) apply_repeat_penalty_full(s);
+    return n;
+}
+
+llama_token sl_sampler_sample(sl_sampler * s, const float * logits) {
+    if (!s || !logits || !s->configured) return LLAMA_TOKEN_NULL;
+    const double t0 = sl_now_ms();
+    llama_token tok;
+    if (!s->chain && s->cfg.penalty_last_n == 0) {
+        tok = (llama_token)sl_argmax_f32(logits, s->n_vocab);
+    } else {
+        bool sorted = false;
+        const int32_t n_cand = gather_candidates(s, logits, &sorted);
+        if (n_cand <= 0) {
+            tok = LLAMA_TOKEN_NULL;
+        } else if (!s->chain) {
+            tok = argmax_candidates(s->cur, n_cand);
+        } else {
+            llama_token_data_array arr = { s->cur, (size_t)n_cand, -1, sorted };
+            llama_sampler_apply(s->chain, &arr);
+            tok = (arr.selected >= 0 && (size_t)arr.selected < arr.size) ? arr.data[arr.selected].id : LLAMA_TOKEN_NULL;
+        }
+    }
+    s->sample_ms += sl_now_ms() - t0;
+    return tok;
+}
+
+llama_token sl_sampler_sample_from(sl_sampler * s, const float * logits, const llama_token * ids, int32_t n_ids) {
+    if (!s || !logits || !ids || n_ids <= 0 || !s->configured) return LLAMA_TOKEN_NULL;
+    const double t0 = sl_now_ms();
+    llama_token_data * cur = s->cur;
+    for (int32_t i = 0; i < n_ids; ++i) {
+        cur[i].id = ids[i];
+        cur[i].logit = logits[ids[i]];
+        cur[i].p = 0.0f;
+    }
+    if (s->cfg.penalty_last_n > 0) apply_repeat_penalty_candidates(s, n_ids);
+    llama_token tok;
+    if (!s->chain) {
+        tok = argmax_candidates(cur, n_ids);
+    } else {
+        llama_token_data_array arr = { cur, (size_t)n_ids, -1, false };
+        llama_sampler_apply(s->chain, &arr);
+        tok = (arr.selected >= 0 && (size_t)arr.selected < arr.size) ? arr.data[arr.selected].id : LLAMA_TOKEN_NULL;
+    }
+    s->sample_ms += sl_now_ms() - t0;
+    return tok;
+}
+
+void sl_token_logprobs(const float * logits, int32_t n_vocab, llama_token tok, int n_top, llm_token_info_t * info) {
+    int32_t idx[LLM_TOP_LOGPROBS_MAX];
+    float val[LLM_TOP_LOGPROBS_MAX];
+    float lse = 0.0f;
+    if (n_top > LLM_TOP_LOGPROBS_MAX) n_top = LLM_TOP_LOGPROBS_MAX;
+    const int32_t n = sl_logsumexp_topk_f32(logits, n_vocab, n_top > 0 ? n_top : 0, idx, val, &lse);
+    info->token = tok;
+    info->logprob = tok >= 0 && tok < n_vocab ? logits[tok] - lse : -INFINITY;
+    info->n_top = n;
+    for (int32_t i = 0; i < n; ++i) {
+        info->top[i].token = idx[i];
+        info->top[i].logprob = val[i] - lse;
+    }
+}
+
+void sl_sampler_accept(sl_sampler * s, llama_token tok) {
+    if (!s || !s->configured) return;
+    if (s->cfg.penalty_last_n > 0 && s->history) {
+        s->history[s->hist_head] = tok;
+        s->hist_head = (s->hist_head + 1) % s->cfg.penalty_last_n;
+        if (s->hist_len < s->cfg.penalty_last_n) s->hist_len += 1;
+    }
+    if (s->chain) llama_sampler_accept(s->chain, tok);
+}
@@ -0,0 +1,82 @@
+// sonified_sampling.h
+//
+// Internal sampler pipeline used by llm_eval. Wraps a llama_sampler_chain for the
+// stochastic stages and owns every buffer it needs, so sampling a token does not
+// allocate. Not part of the public API.
+
+#ifndef SONIFIED_SAMPLING_H
+#define SONIFIED_SAMPLING_H
+
+#include "sonified_llama.h"
+#include "llama.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Normalized sampler settings derived from llm_gen_opts_t (zero values already resolved).
+typedef struct sl_sampler_cfg {
+    float    temperature;    // <= 0 selects greedy
+    float    top_p;          // 1 disables
+    float    min_p;          // 0 disables
+    float    repeat_penalty; // 1 disables
+    int      top_k;          // 0 disables
+    int      penalty_last_n; // window length for repeat_penalty
+    uint32_t seed;
+} sl_sampler_cfg;
+
+typedef struct sl_sampler {
+    struct llama_sampler * chain;    // top-k/top-p/min-p/temp/dist; NULL when greedy
+    llama_token_data     * cur;      // n_vocab candidates, refilled in place every step
+    uint32_t             * stamp;    // per-token marker to visit each penalized token once
+    uint32_t               stamp_gen;
+    int32_t              * topk_idx; // partial top-k scratch (top_k + penalty window entries)
+    float                * topk_val;
+    int                    topk_cap;
+    int32_t              * bias_idx; // logit bias merged per token: distinct ids and their sums
+    float                * bias_val;
+    int32_t                n_bias;
+    int32_t                bias_cap;
+    float                * bias_row; // n_vocab sums, zero except at bias_idx; allocated on first use
+    bool                   bias_dense; // enough ids that adding the whole row is cheaper
+    llama_token          * history;  // ring of the last penalty_last_n accepted tokens
+    int                    hist_cap;
+    int                    hist_len;
+    int                    hist_head;
+    int32_t                n_vocab;
+    bool                   configured;
+    sl_sampler_cfg         cfg;
+    double                 sample_ms; // time spent in sl_sampler_sample since the last configure
+} sl_sampler;
+
+// Allocate per-vocab buffers. Returns 0 on success.
+int  sl_sampler_init(sl_sampler * s, int32_t n_vocab);
+void sl_sampler_free(sl_sampler * s);
+
+// Resolve options into a config; the chain is rebuilt only when the config changes.
+// Resets history, RNG state and the sample_ms counter, and copies the logit bias (ids
+// outside the vocabulary are skipped). Returns 0 on success.
+int  sl_sampler_configure(sl_sampler * s, const llm_gen_opts_t * opts);
+
+// True when opts' logit bias is well formed for a vocabulary of n_vocab tokens: ids in
+// range, biases finite or -INFINITY (a ban).
+bool sl_logit_bias_valid(const llm_gen_opts_t * opts, int32_t n_vocab);
+
+// Add the configured logit bias to a row of n_vocab logits in place, before sampling from
+// it: a scatter over the biased ids, or a vector add of the dense row when many are biased.
+// Does not allocate.
+void sl_sampler_apply_bias(sl_sampler * s, float * logits);
+
+// Pick the next token from a row of n_vocab logits. Does not allocate.
+llama_token sl_sampler_sample(sl_sampler * s, const float * logits);
+
+// Same, restricted to the n_ids candidates in ids (a constraint's allowed set): only those
+// logits are read, so the cost is O(n_ids). Does not allocate.
+llama_token sl_sampler_sample_from(sl_sampler * s, const float * logits, const llama_token * ids, int32_t n_ids);
+
+// Fill info's token, logprob and the n_top (<= LLM_TOP_LOGPROBS_MAX) most likely tokens
+// from a row of n_vocab logits: one fused log-sum-exp + top-k sweep. Does not allocate.
+void sl_token_logprobs(const float * logits, int32_t n_vocab, llama_token tok, int n_top, llm_token_info_t * info);
+
+// Record a token that was actually emitted (feeds penalties and the chain).
+void sl_sampler_accept(sl_sampler * s, llama_token tok);
+
+#endif // SONIFIED_SAMPLING_H
@@ -0,0 +1,766 @@
+#include "sonified_sched.h"
+#include "sonified_models.h"
+#include "sonified_platform.h"
+#include "sonified_prefix.h"
+#include "sonified_sampling.h"
+#include "sonified_stop.h"
+#include "sonified_tokenize.h"
+#include "sonified_utf8.h"
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum { REQ_QUEUED = 0, REQ_ACTIVE = 1, REQ_FINISHED = 2 };
+enum { SCHED_DEFAULT_MAX_TOKENS = 128, SCHED_PIECE_MAX = 256 };
+enum { SCHED_PREFIX_SEQS = 8 }; // cached prefixes, in seq ids after the slots
+
+typedef struct sl_req {
+    struct sl_req  * next;        // live list in submit order (guarded by mu)
+    int              id;
+    int              group;       // id of the first request of an llm_submit_n group; 0 when alone
+    int              branch;      // index within the group
+    int              state;       // REQ_* (guarded by mu)
+    _Atomic bool     cancel;
+    llm_gen_opts_t   opts;
+    sl_constraint  * con;         // NULL when unconstrained; one reference
+    sl_stop          stop;        // stop strings copied at submit (worker-owned)
+    llm_logit_bias_t * bias;      // opts.logit_bias copied at submit; NULL when none
+    int              stop_reason; // LLM_STOP_STRING / LLM_STOP_TOOL_CALL / LLM_STOP_CONSTRAINT once decided
+    llama_token    * prompt;
+    int              n_prompt;
+    int              max_tokens;
+    // progress, owned by the worker while active
+    int              slot;
+    int              n_past;      // tokens of this sequence held in the KV cache
+    int              n_reused;    // prompt tokens copied from the prefix cache (or a fork)
+    int              fork_src;    // group member whose prefill this one waits to copy, or 0
+    bool             prefilled;   // prompt complete (and offered to the prefix cache)
+    int              n_gen;
+    llama_token      pending;     // sampled token to feed back next step
+    bool             has_pending;
+    int              n_in_batch;  // tokens contributed to the current step
+    int              out_idx;     // batch row with this sequence's logits, or -1
+    char             piece[SCHED_PIECE_MAX];
+    int              piece_len;
+    sl_utf8_carry    utf8;        // partial code point held back from the events (guarded by mu)
+    double           t_submit;
+    double           t_first;
+    // undelivered events, a ring (guarded by mu)
+    llm_seq_event_t * ev;
+    int              ev_head;
+    int              ev_len;
+    int              ev_cap;
+} sl_req;
+
+struct sl_sched {
+    struct llama_model       * model;     // NULL in stub mode
+    struct llama_context     * ctx;
+    const struct llama_vocab * vocab;
+    struct llama_batch         batch;
+    int                        n_batch;   // batch capacity
+    int                        n_step;    // token budget per step (one micro-batch)
+    int                        n_slots;
+    int                        n_ctx_per_seq;
+    long long                  kv_cache_bytes;
+    sl_prefix_cache          * prefix;    // NULL when disabled (worker-owned)
+    sl_req                  ** slots;     // active request per slot (worker-owned)
+    sl_sampler               * samplers;  // one per slot
+    sl_constraint_state     ** cstates;   // one per slot, created when a constrained request is admitted
+    int                        n_active;  // worker-owned
+    sl_sched_stub_fn           stub;
+    pthread_t                  thread;
+    bool                       thread_started;
+    pthread_mutex_t            mu;
+    pthread_cond_t             work_cv;   // worker waits for submissions
+    pthread_cond_t             event_cv;  // pollers wait for events
+    sl_req                   * live_head;
+    sl_req                   * live_tail;
+    int                        n_queued;
+    int                        next_id;
+    int                        n_threads;       // requested; applied by the worker
+    int                        n_threads_batch;
+    bool                       threads_dirty;
+    bool                       stop;
+};
+
+static void req_free(sl_req * r) {
+    if (!r) return;
+    sl_constraint_release(r->con);
+    sl_stop_free(&r->stop);
+    free(r->bias);
+    free(r->prompt);
+    free(r->ev);
+    free(r);
+}
+
+// ---- events (mu held) ----
+
+static int push_event(sl_req * r, const llm_seq_event_t * e) {
+    if (r->ev_len == r->ev_cap) {
+        const int cap = r->ev_cap ? r->ev_cap * 2 : 16;
+        llm_seq_event_t * ev = (llm_seq_event_t *)malloc(sizeof(*ev) * (size_t)cap);
+        if (!ev) {
+            fprintf(stderr, "[sonified_llama] scheduler: out of memory queuing event for seq %d\n", r->id);
+            return -1;
+        }
+        for (int i = 0; i < r->ev_len; ++i) ev[i] = r->ev[(r->ev_head + i) % r->ev_cap];
+        free(r->ev);
+        r->ev = ev;
+        r->ev_cap = cap;
+        r->ev_head = 0;
+    }
+    r->ev[(r->ev_head + r->ev_len) % r->ev_cap] = *e;
+    r->ev_len += 1;
+    return 0;
+}
+
+// Queue text as TOKEN events; long text is split between code points, never inside one.
+static void push_text(sl_req * r, const char * text, int len) {
+    while (len > 0) {
+        llm_seq_event_t e;
+        memset(&e, 0, sizeof(e));
+        e.seq = r->id;
+        e.branch = r->branch;
+        e.kind = LLM_SEQ_EVENT_TOKEN;
+        e.text_len = len < LLM_SEQ_TEXT_MAX - 1 ? len : LLM_SEQ_TEXT_MAX - 1;
+        if (e.text_len < len) { // back up to the lead byte of a sequence straddling the cut
+            int cut = e.text_len;
+            while (cut > e.text_len - 3 && ((unsigned char)text[cut] & 0xC0) == 0x80) --cut;
+            if (((unsigned char)text[cut] & 0xC0) != 0x80) e.text_len = cut;
+        }
+        memcpy(e.text, text, (size_t)e.text_len);
+        e.text[e.text_len] = '\0';
+        if (push_event(r, &e) != 0) return;
+        text += e.text_len;
+        len -= e.text_len;
+    }
+}
+
+// Queue one token piece through the request's UTF-8 carry.
+static void push_piece(sl_req * r, const char * piece, int len) {
+    char out[SCHED_PIECE_MAX + 4];
+    while (len > 0) {
+        const int n = len < SCHED_PIECE_MAX ? len : SCHED_PIECE_MAX;
+        push_text(r, out, sl_utf8_carry_feed(&r->utf8, piece, n, out));
+        piece += n;
+        len -= n;
+    }
+}
+
+static void stub_piece_cb(const char * token_utf8, void * user_ctx) {
+    sl_req * r = (sl_req *)user_ctx;
+    if (!token_utf8) return;
+    push_piece(r, token_utf8, (int)strlen(token_utf8));
+    r->n_gen += 1;
+}
+
+// The members waiting to fork the prefill of src, which ended before it completed, prefill
+// the prompt themselves: the first in slot order, the others forking from it.
+static void release_forks(sl_sched * s, int src) {
+    sl_req * first = NULL;
+    for (int i = 0; i < s->n_slots; ++i) {
+        sl_req * f = s->slots[i];
+        if (!f || f->fork_src != src) continue;
+        if (!first) {
+            first = f;
+            f->fork_src = 0;
+            f->n_reused = sl_prefix_lookup(s->prefix, f->prompt, f->n_prompt, i);
+            f->n_past = f->n_reused;
+        } else {
+            f->fork_src = first->id;
+        }
+    }
+}
+
+// Retire r with a terminal event. error_code == 0 reports DONE (success unless cancelled).
+// Called with mu held; only the worker retires active requests.
+static void finish_locked(sl_sched * s, sl_req * r, int error_code, double sample_ms) {
+    if (r->state == REQ_FINISHED) return;
+    if (r->state == REQ_QUEUED) {
+        s->n_queued -= 1;
+    } else if (r->state == REQ_ACTIVE) {
+        llama_kv_self_seq_rm(s->ctx, r->slot, -1, -1);
+        s->slots[r->slot] = NULL;
+        s->n_active -= 1;
+        if (r->group && !r->prefilled) release_forks(s, r->id);
+    }
+    r->state = REQ_FINISHED;
+
+    // a sequence cut off mid code point (EOG, max_tokens, cancel) still delivers every byte
+    char tail[4];
+    push_text(r, tail, sl_utf8_carry_flush(&r->utf8, tail));
+
+    const double t_end = sl_now_ms();
+    const double decode_ms = (r->n_gen > 0 && r->t_first > 0.0 && t_end > r->t_first) ? (t_end - r->t_first) : 0.0;
+    llm_seq_event_t e;
+    memset(&e, 0, sizeof(e));
+    e.seq = r->id;
+    e.branch = r->branch;
+    e.kind = error_code ? LLM_SEQ_EVENT_ERROR : LLM_SEQ_EVENT_DONE;
+    e.error_code = error_code;
+    e.stats.ttfb_ms = (r->n_gen > 0 && r->t_first > 0.0) ? (int)(r->t_first - r->t_submit) : 0;
+    e.stats.tok_per_sec = decode_ms > 0.0 ? (float)((double)r->n_gen / (decode_ms / 1000.0)) : 0.0f;
+    e.stats.total_ms = (int)(t_end - r->t_submit);
+    e.stats.peak_rss_mb = (int)((double)sl_current_rss_bytes() / (1024.0 * 1024.0));
+    e.stats.success = (error_code == 0 && !atomic_load(&r->cancel)) ? 1 : 0;
+    e.stats.prompt_tokens = r->n_prompt;
+    e.stats.prompt_tokens_reused = r->n_reused;
+    sl_prefix_counters(s->prefix, &e.stats.prefix_cache_hits, &e.stats.prefix_cache_misses);
+    e.stats.completion_tokens = r->n_gen;
+    e.stats.total_tokens = r->n_prompt + r->n_gen;
+    e.stats.sample_ms = (float)sample_ms;
+    e.stats.kv_cache_bytes = s->kv_cache_bytes;
+    e.stats.kv_cells_used = r->n_past;
+    e.stats.stop_reason = atomic_load(&r->cancel) ? LLM_STOP_CANCELLED
+                        : r->stop_reason ? r->stop_reason
+                        : r->n_gen >= r->max_tokens ? LLM_STOP_MAX_TOKENS
+                        : r->n_past >= s->n_ctx_per_seq ? LLM_STOP_CONTEXT : LLM_STOP_EOG;
+    push_event(r, &e);
+    pthread_cond_broadcast(&s->event_cv);
+}
+
+// ---- worker ----
+
+static inline void batch_add(struct llama_batch * b, int i, llama_token tok, llama_pos pos, llama_seq_id seq, bool logits) {
+    b->token[i] = tok;
+    b->pos[i] = pos;
+    b->n_seq_id[i] = 1;
+    b->seq_id[i][0] = seq;
+    b->logits[i] = logits ? 1 : 0;
+}
+
+// Put r in a free slot (mu held). fork_src != 0 leaves its prompt to be copied from that
+// member's prefill; otherwise it starts from the longest cached prefix. Returns false when
+// r was retired instead.
+static bool admit_one_locked(sl_sched * s, sl_req * r, int fork_src) {
+    int slot = 0;
+    while (s->slots[slot]) ++slot;
+    if (sl_sampler_configure(&s->samplers[slot], &r->opts) != 0) {
+        finish_locked(s, r, -5, 0.0);
+        return false;
+    }
+    if (r->con) {
+        if (!s->cstates[slot]) s->cstates[slot] = sl_constraint_state_create();
+        if (sl_constraint_reset(s->cstates[slot], r->con) != 0) {
+            finish_locked(s, r, -5, 0.0);
+            return false;
+        }
+    }
+    r->state = REQ_ACTIVE;
+    r->slot = slot;
+    r->fork_src = fork_src;
+    r->n_reused = fork_src ? 0 : sl_prefix_lookup(s->prefix, r->prompt, r->n_prompt, slot);
+    r->n_past = r->n_reused;
+    s->slots[slot] = r;
+    s->n_queued -= 1;
+    s->n_active += 1;
+    return true;
+}
+
+// Move queued requests into free slots (mu held). A group is admitted whole, once there
+// are slots for all its members, so its first admitted member prefills for every branch;
+// later requests wait behind it.
+static void admit_locked(sl_sched * s) {
+    for (sl_req * r = s->live_head; r && s->n_queued > 0 && s->n_active < s->n_slots; r = r->next) {
+        if (r->state != REQ_QUEUED || atomic_load(&r->cancel)) continue;
+        if (!r->group) {
+            admit_one_locked(s, r, 0);
+            continue;
+        }
+        int need = 0;
+        for (sl_req * m = r; m && m->group == r->group; m = m->next) {
+            if (m->state == REQ_QUEUED && !atomic_load(&m->cancel)) ++need;
+        }
+        if (s->n_slots - s->n_active < need) break;
+        int src = 0;
+        for (; r->next && r->next->group == r->group; r = r->next) {
+            if (r->state == REQ_QUEUED && !atomic_load(&r->cancel) && admit_one_locked(s, r, src) && !src) src = r->id;
+        }
+        if (r->state == REQ_QUEUED && !atomic_load(&r->cancel)) admit_one_locked(s, r, src);
+    }
+}
+
+// Group members waiting on a prompt whose last chunk was just decoded copy its KV cells
+// and sample from its logits row, so they continue exactly as if they had prefilled it.
+static void fork_prefills(sl_sched * s) {
+    for (int j = 0; j < s->n_slots; ++j) {
+        sl_req * f = s->slots[j];
+        if (!f || !f->fork_src) continue;
+        for (int i = 0; i < s->n_slots; ++i) {
+            const sl_req * src = s->slots[i];
+            if (!src || src->id != f->fork_src) continue;
+            if (src->prefilled || src->has_pending || src->out_idx < 0) break; // not completing in this step
+            llama_kv_self_seq_cp(s->ctx, i, j, -1, -1);
+            f->fork_src = 0;
+            f->n_reused = f->n_prompt;
+            f->n_past = src->n_past;
+            f->n_in_batch = src->n_in_batch;
+            f->out_idx = src->out_idx;
+            f->prefilled = true; // src offers the prompt to the prefix cache
+            break;
+        }
+    }
+}
+
+// Advance every active sequence by one llama_decode: the pending token of each decoding
+// sequence first, then prompt chunks of prefilling sequences in the remaining budget.
+static void step(sl_sched * s) {
+    struct llama_batch * b = &s->batch;
+    int n = 0;
+    for (int i = 0; i < s->n_slots; ++i) {
+        sl_req * r = s->slots[i];
+        if (!r) continue;
+        r->n_in_batch = 0;
+        r->out_idx = -1;
+        if (atomic_load(&r->cancel) || !r->has_pending) continue;
+        batch_add(b, n, r->pending, r->n_past, i, true);
+        r->out_idx = n;
+        r->n_in_batch = 1;
+        n += 1;
+    }
+    // Prompts are prefilled in chunks that fill the step up to one micro-batch: llama.cpp
+    // runs micro-batches back to back anyway, so larger steps would only delay the other
+    // streams and cancellation.
+    const int budget = n > s->n_step ? n : s->n_step;
+    for (int i = 0; i < s->n_slots && n < budget; ++i) {
+        sl_req * r = s->slots[i];
+        if (!r || atomic_load(&r->cancel) || r->fork_src || r->n_past >= r->n_prompt) continue;
+        const int left = r->n_prompt - r->n_past;
+        const int take = left < budget - n ? left : budget - n;
+        for (int j = 0; j < take; ++j) {
+            const int pos = r->n_past + j;
+            batch_add(b, n + j, r->prompt[pos], pos, i, pos == r->n_prompt - 1);
+        }
+        if (take == left) r->out_idx = n + take - 1;
+        r->n_in_batch = take;
+        n += take;
+    }
+    b->n_tokens = n;
+    const int rc = n > 0 ? llama_decode(s->ctx, *b) : 0;
+    if (rc != 0) fprintf(stderr, "[sonified_llama] scheduler: llama_decode failed (%d) for a %d-token step\n", rc, n);
+    if (rc == 0) fork_prefills(s);
+
+    // sample outside the lock; pollers only contend for the short publish below
+    int codes[s->n_slots];
+    bool done[s->n_slots];
+    int biased[s->n_slots]; // logits rows already biased: forked branches share their source's row
+    int n_biased = 0;
+    for (int i = 0; i < s->n_slots; ++i) {
+        codes[i] = 0;
+        done[i] = false;
+        sl_req * r = s->slots[i];
+        if (!r) continue;
+        r->piece_len = 0;
+        if (atomic_load(&r->cancel)) { done[i] = true; continue; }
+        if (r->n_in_batch == 0) continue;
+        if (rc != 0) {
+            codes[i] = r->has_pending ? -4 : -3;
+            done[i] = true;
+            continue;
+        }
+        r->n_past += r->n_in_batch;
+        r->has_pending = false;
+        if (!r->prefilled && r->n_past >= r->n_prompt) {
+            r->prefilled = true;
+            sl_prefix_insert(s->prefix, r->prompt, r->n_prompt, i);
+        }
+        if (r->out_idx < 0) continue; // prompt not fully prefilled yet
+
+        if (r->n_gen >= r->max_tokens) { done[i] = true; continue; }
+        float * logits = llama_get_logits_ith(s->ctx, r->out_idx);
+        llama_token tok = LLAMA_TOKEN_NULL;
+        if (logits) {
+            // a group shares one opts, so the first branch on a row biases it for all of them
+            bool seen = false;
+            for (int k = 0; k < n_biased && !seen; ++k) seen = biased[k] == r->out_idx;
+            if (!seen) {
+                sl_sampler_apply_bias(&s->samplers[i], logits);
+                biased[n_biased++] = r->out_idx;
+            }
+            tok = r->con ? sl_constraint_sample(s->cstates[i], &s->samplers[i], logits)
+                         : sl_sampler_sample(&s->samplers[i], logits);
+        }
+        if (tok == LLAMA_TOKEN_NULL || llama_vocab_is_eog(s->vocab, tok)) {
+            if (r->con && sl_constraint_stuck(s->cstates[i])) r->stop_reason = LLM_STOP_CONSTRAINT;
+            done[i] = true;
+            continue;
+        }
+        sl_sampler_accept(&s->samplers[i], tok);
+        if (r->con) sl_constraint_accept(s->cstates[i], tok);
+        int len = (int)llama_token_to_piece(s->vocab, tok, r->piece, (int32_t)sizeof(r->piece) - 1, /*lstrip=*/0, /*special=*/true);
+        if (len > 0 && len < (int)sizeof(r->piece)) {
+            if (sl_stop_active(&r->stop)) r->stop_reason = sl_stop_feed(&r->stop, r->piece, len, &len);
+            r->piece_len = len;
+            if (r->t_first == 0.0) r->t_first = sl_now_ms();
+        }
+        r->n_gen += 1;
+        r->pending = tok;
+        r->has_pending = true;
+        if (r->stop_reason || r->n_gen >= r->max_tokens || r->n_past >= s->n_ctx_per_seq) done[i] = true;
+    }
+
+    pthread_mutex_lock(&s->mu);
+    bool published = false;
+    for (int i = 0; i < s->n_slots; ++i) {
+        sl_req * r = s->slots[i];
+        if (!r) continue;
+        if (r->piece_len > 0) {
+            push_piece(r, r->piece, r->piece_len);
+            published = true;
+        }
+        if (done[i]) finish_locked(s, r, codes[i], s->samplers[i].sample_ms);
+    }
+    if (published) pthread_cond_broadcast(&s->event_cv);
+    pthread_mutex_unlock(&s->mu);
+}
+
+static void * worker_main(void * arg) {
+    sl_sched * s = (sl_sched *)arg;
+    for (;;) {
+        pthread_mutex_lock(&s->mu);
+        while (!s->stop && s->n_queued == 0 && s->n_active == 0) {
+            pthread_cond_wait(&s->work_cv, &s->mu);
+        }
+        if (s->stop) {
+            pthread_mutex_unlock(&s->mu);
+            break;
+        }
+        admit_locked(s);
+        if (s->threads_dirty) {
+            llama_set_n_threads(s->ctx, s->n_threads, s->n_threads_batch);
+            s->threads_dirty = false;
+        }
+        pthread_mutex_unlock(&s->mu);
+        step(s);
+    }
+    return NULL;
+}
+
+// ---- public entry points ----
+
+sl_sched * sl_sched_create(struct llama_model * model, const sl_sched_params * params) {
+    if (!params || params->n_slots <= 0 || params->n_ctx_per_seq <= 0) return NULL;
+    sl_sched * s = (sl_sched *)calloc(1, sizeof(sl_sched));
+    if (!s) return NULL;
+    s->model = model;
+    s->n_slots = params->n_slots;
+    s->n_ctx_per_seq = params->n_ctx_per_seq;
+    s->stub = params->stub;
+    s->next_id = 1;
+    pthread_mutex_init(&s->mu, NULL);
+    pthread_cond_init(&s->work_cv, NULL);
+    pthread_cond_init(&s->event_cv, NULL);
+    if (!model) return s;
+
+    // cached prefixes get cells of their own on top of the slots' budget
+    // (at most what SCHED_PREFIX_SEQS full-length prefixes could use)
+    int prefix_tokens = params->prefix_cache_tokens >= SL_PREFIX_PAGE ? params->prefix_cache_tokens : 0;
+    if (prefix_tokens > SCHED_PREFIX_SEQS * s->n_ctx_per_seq) prefix_tokens = SCHED_PREFIX_SEQS * s->n_ctx_per_seq;
+    struct llama_context_params cparams = params->cparams;
+    cparams.n_ctx = (uint32_t)(s->n_slots * s->n_ctx_per_seq + prefix_tokens);
+    cparams.n_seq_max = (uint32_t)(s->n_slots + (prefix_tokens ? SCHED_PREFIX_SEQS : 0));
+    s->ctx = llama_new_context_with_model(model, cparams);
+    if (!s->ctx) {
+        fprintf(stderr, "[sonified_llama] scheduler: failed to create context (%d slots x %d)\n", s->n_slots, s->n_ctx_per_seq);
+        sl_sched_destroy(s);
+        return NULL;
+    }
+    if (params->n_threads > 0) {
+        s->n_threads = params->n_threads;
+        s->n_threads_batch = params->n_threads_batch > 0 ? params->n_threads_batch : params->n_threads;
+        llama_set_n_threads(s->ctx, s->n_threads, s->n_threads_batch);
+    }
+    s->vocab = llama_model_get_vocab(model);
+    s->kv_cache_bytes = sl_kv_cache_bytes(model, (int)cparams.n_ctx, cparams.type_k, cparams.type_v);
+    if (prefix_tokens) {
+        s->prefix = sl_prefix_create(s->ctx, s->n_slots, SCHED_PREFIX_SEQS, prefix_tokens);
+        if (!s->prefix) {
+            sl_sched_destroy(s);
+            return NULL;
+        }
+    }
+    s->n_batch = (int)llama_n_batch(s->ctx);
+    s->n_step = (int)llama_n_ubatch(s->ctx);
+    if (s->n_step <= 0 || s->n_step > s->n_batch) s->n_step = s->n_batch;
+    s->batch = llama_batch_init(s->n_batch, 0, 1);
+    s->slots = (sl_req **)calloc((size_t)s->n_slots, sizeof(sl_req *));
+    s->samplers = (sl_sampler *)calloc((size_t)s->n_slots, sizeof(sl_sampler));
+    s->cstates = (sl_constraint_state **)calloc((size_t)s->n_slots, sizeof(sl_constraint_state *));
+    if (!s->batch.token || !s->slots || !s->samplers || !s->cstates) {
+        sl_sched_destroy(s);
+        return NULL;
+    }
+    const int32_t n_vocab = llama_vocab_n_tokens(s->vocab);
+    for (int i = 0; i < s->n_slots; ++i) {
+        if (sl_sampler_init(&s->samplers[i], n_vocab) != 0) {
+            sl_sched_destroy(s);
+            return NULL;
+        }
+    }
+    if (pthread_create(&s->thread, NULL, worker_main, s) != 0) {
+        fprintf(stderr, "[sonified_llama] scheduler: failed to start worker thread\n");
+        sl_sched_destroy(s);
+        return NULL;
+    }
+    s->thread_started = true;
+    return s;
+}
+
+void sl_sched_destroy(sl_sched * s) {
+    if (!s) return;
+    if (s->thread_started) {
+        pthread_mutex_lock(&s->mu);
+        s->stop = true;
+        pthread_cond_broadcast(&s->work_cv);
+        pthread_mutex_unlock(&s->mu);
+        pthread_join(s->thread, NULL);
+    }
+    for (sl_req * r = s->live_head; r;) {
+        sl_req * next = r->next;
+        req_free(r);
+        r = next;
+    }
+    if (s->samplers) {
+        for (int i = 0; i < s->n_slots; ++i) sl_sampler_free(&s->samplers[i]);
+        free(s->samplers);
+    }
+    if (s->cstates) {
+        for (int i = 0; i < s->n_slots; ++i) sl_constraint_state_free(s->cstates[i]);
+        free(s->cstates);
+    }
+    free(s->slots);
+    sl_prefix_free(s->prefix);
+    if (s->batch.token) llama_batch_free(s->batch);
+    if (s->ctx) llama_free(s->ctx);
+    pthread_cond_destroy(&s->event_cv);
+    pthread_cond_destroy(&s->work_cv);
+    pthread_mutex_destroy(&s->mu);
+    free(s);
+}
+
+// A request with its own copies of opts' borrowed fields. The prompt is tokenized here, on
+// the caller's thread, so the worker only ever decodes; like, when given, is a request for
+// the same prompt whose tokens are copied instead. Returns NULL with *rc set on failure, in
+// which case con is released.
+static sl_req * req_create(sl_sched * s, const char * prompt_utf8, const llm_gen_opts_t * opts,
+                           sl_constraint * con, const sl_req * like, int * rc) {
+    *rc = -1;
+    sl_req * r = (sl_req *)calloc(1, sizeof(sl_req));
+    if (!r) {
+        sl_constraint_release(con);
+        return NULL;
+    }
+    r->con = con;
+    if (opts) r->opts = *opts;
+    r->opts.stop = NULL; // borrowed; the copy lives in r->stop
+    r->opts.n_stop = 0;
+    if (sl_stop_init(&r->stop, opts) != 0) {
+        req_free(r);
+        return NULL;
+    }
+    r->opts.logit_bias = NULL; // borrowed too; point it at the request's copy
+    r->opts.n_logit_bias = 0;
+    if (opts && opts->logit_bias && opts->n_logit_bias > 0) {
+        r->bias = (llm_logit_bias_t *)malloc(sizeof(llm_logit_bias_t) * (size_t)opts->n_logit_bias);
+        if (!r->bias) {
+            req_free(r);
+            return NULL;
+        }
+        memcpy(r->bias, opts->logit_bias, sizeof(llm_logit_bias_t) * (size_t)opts->n_logit_bias);
+        r->opts.logit_bias = r->bias;
+        r->opts.n_logit_bias = opts->n_logit_bias;
+    }
+    r->max_tokens = r->opts.max_tokens > 0 ? r->opts.max_tokens : SCHED_DEFAULT_MAX_TOKENS;
+    r->slot = -1;
+    r->t_submit = sl_now_ms();
+    if (!s->model) return r;
+
+    if (like) {
+        r->n_prompt = like->n_prompt;
+        if (r->n_prompt > 0) {
+            r->prompt = (llama_token *)malloc(sizeof(llama_token) * (size_t)r->n_prompt);
+            if (!r->prompt) {
+                req_free(r);
+                return NULL;
+            }
+            memcpy(r->prompt, like->prompt, sizeof(llama_token) * (size_t)r->n_prompt);
+        }
+        return r;
+    }
+    r->n_prompt = sl_tokenize_prompt(s->model, prompt_utf8, &r->prompt);
+    if (r->n_prompt < 0) {
+        req_free(r);
+        *rc = -2;
+        return NULL;
+    }
+    if (r->n_prompt >= s->n_ctx_per_seq) {
+        fprintf(stderr, "[sonified_llama] llm_submit: prompt (%d tokens) exceeds context (%d)\n", r->n_prompt, s->n_ctx_per_seq);
+        req_free(r);
+        *rc = -6;
+        return NULL;
+    }
+    return r;
+}
+
+int sl_sched_submit(sl_sched * s, const char * prompt_utf8, const llm_gen_opts_t * opts, sl_constraint * con) {
+    int id = 0;
+    const int rc = sl_sched_submit_n(s, prompt_utf8, opts, con, 1, &id);
+    return rc < 0 ? rc : id;
+}
+
+int sl_sched_submit_n(sl_sched * s, const char * prompt_utf8, const llm_gen_opts_t * opts, sl_constraint * con,
+                      int n, int * out_ids) {
+    if (!s || !out_ids || n < 1 || n > s->n_slots) {
+        sl_constraint_release(con);
+        return -1;
+    }
+    sl_req * reqs[n];
+    for (int k = 0; k < n; ++k) {
+        if (k > 0) sl_constraint_retain(con); // one reference per request
+        int rc = 0;
+        reqs[k] = req_create(s, prompt_utf8, opts, con, k > 0 ? reqs[0] : NULL, &rc);
+        if (!reqs[k]) {
+            for (int j = 0; j < k; ++j) req_free(reqs[j]);
+            return rc;
+        }
+        reqs[k]->branch = k;
+        // distinct seeds; random ones (seed <= 0) differ anyway
+        const int seed = reqs[k]->opts.seed;
+        if (seed > 0) reqs[k]->opts.seed = seed <= INT_MAX - k ? seed + k : seed - k;
+    }
+
+    pthread_mutex_lock(&s->mu);
+    const int group = n > 1 ? s->next_id : 0;
+    for (int k = 0; k < n; ++k) {
+        sl_req * r = reqs[k];
+        r->id = s->next_id++;
+        r->group = group;
+        if (s->live_tail) s->live_tail->next = r; else s->live_head = r;
+        s->live_tail = r;
+        s->n_queued += 1; // stub and empty requests retire right away
+        out_ids[k] = r->id;
+    }
+    bool work = false;
+    for (int k = 0; k < n; ++k) {
+        sl_req * r = reqs[k];
+        if (!s->model) {
+            const int rc = s->stub ? s->stub(prompt_utf8, stub_piece_cb, r) : 0;
+            if (r->n_gen > 0) r->t_first = sl_now_ms();
+            finish_locked(s, r, rc < 0 ? rc : 0, 0.0);
+        } else if (r->n_prompt == 0) {
+            finish_locked(s, r, 0, 0.0);
+        } else {
+            work = true;
+        }
+    }
+    if (work) pthread_cond_signal(&s->work_cv);
+    pthread_mutex_unlock(&s->mu);
+    return 0;
+}
+
+// Pop up to max events for seq (any when 0) in submit order; requests whose terminal
+// event is returned are unlinked and freed. mu held.
+static int collect_locked(sl_sched * s, int seq, llm_seq_event_t * out, int max, bool * found) {
+    int n = 0;
+    sl_req * prev = NULL;
+    sl_req * r = s->live_head;
+    while (r && n < max) {
+        sl_req * next = r->next;
+        if (seq != 0 && r->id != seq) {
+            prev = r;
+            r = next;
+            continue;
+        }
+        *found = true;
+        bool terminal = false;
+        while (r->ev_len > 0 && n < max) {
+            out[n] = r->ev[r->ev_head];
+            terminal = out[n].kind != LLM_SEQ_EVENT_TOKEN;
+            r->ev_head = (r->ev_head + 1) % r->ev_cap;
+            r->ev_len -= 1;
+            n += 1;
+        }
+        if (terminal) {
+            if (prev) prev->next = next; else s->live_head = next;
+            if (s->live_tail == r) s->live_tail = prev;
+            req_free(r);
+        } else {
+            prev = r;
+        }
+        if (seq != 0) break;
+        r = next;
+    }
+    return n;
+}
+
+int sl_sched_poll(sl_sched * s, int seq, llm_seq_event_t * out, int max_events, int timeout_ms) {
+    if (!s || !out || max_events <= 0 || seq < 0) return -1;
+    struct timespec deadline;
+    if (timeout_ms > 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+    pthread_mutex_lock(&s->mu);
+    int n = 0;
+    for (;;) {
+        bool found = false;
+        n = collect_locked(s, seq, out, max_events, &found);
+        if (n > 0) break;
+        if (seq != 0 && !found) { n = -1; break; }
+        if (timeout_ms == 0) break;
+        if (timeout_ms < 0) {
+            pthread_cond_wait(&s->event_cv, &s->mu);
+        } else if (pthread_cond_timedwait(&s->event_cv, &s->mu, &deadline) == ETIMEDOUT) {
+            found = false;
+            n = collect_locked(s, seq, out, max_events, &found);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s->mu);
+    return n;
+}
+
+int sl_sched_cancel(sl_sched * s, int seq) {
+    if (!s) return -1;
+    int rc = -1;
+    pthread_mutex_lock(&s->mu);
+    for (sl_req * r = s->live_head; r; r = r->next) {
+        if (r->id != seq) continue;
+        atomic_store(&r->cancel, true);
+        if (r->state == REQ_QUEUED) finish_locked(s, r, 0, 0.0);
+        rc = 0;
+        break;
+    }
+    pthread_mutex_unlock(&s->mu);
+    return rc;
+}
+
+void sl_sched_cancel_all(sl_sched * s) {
+    if (!s) return;
+    pthread_mutex_lock(&s->mu);
+    for (sl_req * r = s->live_head; r; r = r->next) {
+        atomic_store(&r->cancel, true);
+        if (r->state == REQ_QUEUED) finish_locked(s, r, 0, 0.0);
+    }
+    pthread_mutex_unlock(&s->mu);
+}
+
+void sl_sched_set_threads(sl_sched * s, int n_threads, int n_threads_batch) {
+    if (!s || n_threads <= 0 || n_threads_batch <= 0) return;
+    pthread_mutex_lock(&s->mu);
+    s->n_threads = n_threads;
+    s->n_threads_batch = n_threads_batch;
+    s->threads_dirty = s->ctx != NULL;
+    pthread_mutex_unlock(&s->mu);
+}
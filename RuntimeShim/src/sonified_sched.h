@@ -0,0 +1,49 @@
+// sonified_sched.h
+//
+// Continuous-batching scheduler behind llm_submit/llm_poll/llm_cancel_seq.
+// One scheduler per handle; it owns a multi-sequence llama_context on the handle's model
+// and a worker thread. Not part of the public API.
+
+#ifndef SONIFIED_SCHED_H
+#define SONIFIED_SCHED_H
+
+#include "sonified_llama.h"
+#include "sonified_constrain.h"
+#include "llama.h"
+
+typedef struct sl_sched sl_sched;
+
+// Generator used in stub mode (no model): emits pieces through cb and returns 0, or a
+// negative code to fail the request.
+typedef int (*sl_sched_stub_fn)(const char * prompt_utf8, llm_token_cb cb, void * user_ctx);
+
+typedef struct sl_sched_params {
+    int n_slots;       // concurrent sequences (llama seq ids 0..n_slots-1)
+    int n_ctx_per_seq; // context budget per sequence
+    int n_threads;
+    int n_threads_batch;
+    struct llama_context_params cparams; // base context params; n_ctx and n_seq_max are overridden
+    int prefix_cache_tokens; // KV cells reserved for the prefix cache (sonified_prefix.h); 0 = off
+    sl_sched_stub_fn stub; // stub mode only
+} sl_sched_params;
+
+// model == NULL creates a stub scheduler that answers every request synchronously
+// (mirrors the llm_eval stub path). Returns NULL on failure.
+sl_sched * sl_sched_create(struct llama_model * model, const sl_sched_params * params);
+void       sl_sched_destroy(sl_sched * s);
+
+// con (may be NULL) is a reference the request takes over, released when it is freed or
+// when submission fails.
+int  sl_sched_submit(sl_sched * s, const char * prompt_utf8, const llm_gen_opts_t * opts, sl_constraint * con);
+// n requests for one prompt (llm_submit_n), tokenized once and admitted together; the
+// first admitted prefills and the others fork its KV cells. Writes the n ids to out_ids
+// and returns 0, or a negative code (-1 also when n exceeds the slots).
+int  sl_sched_submit_n(sl_sched * s, const char * prompt_utf8, const llm_gen_opts_t * opts, sl_constraint * con,
+                       int n, int * out_ids);
+int  sl_sched_poll(sl_sched * s, int seq, llm_seq_event_t * out, int max_events, int timeout_ms);
+int  sl_sched_cancel(sl_sched * s, int seq);
+void sl_sched_cancel_all(sl_sched * s);
+// Applied by the worker before its next step.
+void sl_sched_set_threads(sl_sched * s, int n_threads, int n_threads_batch);
+
+#endif // SONIFIED_SCHED_H
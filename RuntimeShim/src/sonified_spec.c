@@ -0,0 +1,155 @@
+#include "sonified_spec.h"
+#include "sonified_kernels.h"
+#include "sonified_models.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct sl_draft {
+    struct llama_model       * model;
+    struct llama_context     * ctx;
+    const struct llama_vocab * vocab;
+    int32_t                    n_vocab;
+    struct llama_batch         batch;
+    int                        n_batch;
+    int                        n_ctx;
+    llama_token              * tokens;  // held in the draft cache, in position order
+    int                        n_tokens;
+};
+
+sl_draft * sl_draft_create(const char * path,
+                           const struct llama_model_params * mparams,
+                           const struct llama_context_params * cparams,
+                           const struct llama_model * target,
+                           const char ** err) {
+    struct llama_model * model = sl_model_acquire(path, mparams);
+    if (!model) {
+        *err = "failed to load draft model";
+        return NULL;
+    }
+    const struct llama_vocab * tv = llama_model_get_vocab(target);
+    const struct llama_vocab * dv = llama_model_get_vocab(model);
+    if (llama_vocab_n_tokens(tv) != llama_vocab_n_tokens(dv) || llama_vocab_eos(tv) != llama_vocab_eos(dv)) {
+        *err = "draft model vocabulary does not match the target";
+        sl_model_release(model);
+        return NULL;
+    }
+    struct llama_context_params dp = *cparams;
+    dp.n_seq_max = 1;
+    struct llama_context * ctx = llama_new_context_with_model(model, dp);
+    sl_draft * d = ctx ? (sl_draft *)calloc(1, sizeof(sl_draft)) : NULL;
+    if (d) {
+        d->n_ctx = (int)llama_n_ctx(ctx);
+        d->n_batch = (int)llama_n_batch(ctx);
+        d->tokens = (llama_token *)malloc(sizeof(llama_token) * (size_t)d->n_ctx);
+        d->batch = llama_batch_init(d->n_batch, 0, 1);
+    }
+    if (!d || !d->tokens || !d->batch.token) {
+        *err = "failed to create draft context (likely OOM)";
+        if (d) {
+            free(d->tokens);
+            if (d->batch.token) llama_batch_free(d->batch);
+            free(d);
+        }
+        if (ctx) llama_free(ctx);
+        sl_model_release(model);
+        return NULL;
+    }
+    d->model = model;
+    d->ctx = ctx;
+    d->vocab = dv;
+    d->n_vocab = llama_vocab_n_tokens(dv);
+    return d;
+}
+
+void sl_draft_free(sl_draft * d) {
+    if (!d) return;
+    llama_batch_free(d->batch);
+    llama_free(d->ctx);
+    sl_model_release(d->model);
+    free(d->tokens);
+    free(d);
+}
+
+void sl_draft_set_threads(sl_draft * d, int n_threads, int n_threads_batch) {
+    llama_set_n_threads(d->ctx, n_threads, n_threads_batch);
+}
+
+// Append tokens to the draft cache; logits only for the last one.
+static int draft_decode(sl_draft * d, const llama_token * toks, int n) {
+    while (n > 0) {
+        const int m = n < d->n_batch ? n : d->n_batch;
+        for (int i = 0; i < m; ++i) {
+            d->batch.token[i] = toks[i];
+            d->batch.pos[i] = d->n_tokens + i;
+            d->batch.n_seq_id[i] = 1;
+            d->batch.seq_id[i][0] = 0;
+            d->batch.logits[i] = (i == m - 1) ? 1 : 0;
+        }
+        d->batch.n_tokens = m;
+        if (llama_decode(d->ctx, d->batch) != 0) return -1;
+        for (int i = 0; i < m; ++i) d->tokens[d->n_tokens + i] = toks[i];
+        d->n_tokens += m;
+        toks += m;
+        n -= m;
+    }
+    return 0;
+}
+
+int sl_draft_propose(sl_draft * d, const llama_token * hist, int n_hist, llama_token * out, int max) {
+    if (n_hist <= 0 || max <= 0) return 0;
+    if (n_hist + max > d->n_ctx) max = d->n_ctx - n_hist;
+    if (max <= 0) return 0;
+
+    // keep the shared prefix, but always re-decode the last history token for fresh logits
+    int keep = 0;
+    const int lim = d->n_tokens < n_hist ? d->n_tokens : n_hist;
+    while (keep < lim && d->tokens[keep] == hist[keep]) ++keep;
+    if (keep >= n_hist) keep = n_hist - 1;
+    if (keep < d->n_tokens && !llama_kv_self_seq_rm(d->ctx, 0, keep, -1)) {
+        llama_kv_self_clear(d->ctx);
+        keep = 0;
+    }
+    d->n_tokens = keep;
+    if (draft_decode(d, hist + keep, n_hist - keep) != 0) {
+        llama_kv_self_clear(d->ctx);
+        d->n_tokens = 0;
+        return -1;
+    }
+
+    int n = 0;
+    while (n < max) {
+        const float * logits = llama_get_logits_ith(d->ctx, -1);
+        if (!logits) break;
+        const llama_token tok = (llama_token)sl_argmax_f32(logits, d->n_vocab);
+        if (llama_vocab_is_eog(d->vocab, tok)) break;
+        out[n++] = tok;
+        if (n == max) break; // the last proposal needs no logits of its own
+        if (draft_decode(d, &tok, 1) != 0) {
+            llama_kv_self_clear(d->ctx);
+            d->n_tokens = 0;
+            return -1;
+        }
+    }
+    return n;
+}
+
+int sl_ngram_propose(const struct llama_vocab * vocab, const llama_token * hist, int n_hist,
+                     llama_token * out, int max) {
+    if (max <= 0) return 0;
+    for (int n = SL_NGRAM_MAX; n >= SL_NGRAM_MIN; --n) {
+        if (n_hist <= n) continue;
+        const llama_token * key = hist + n_hist - n;
+        // newest match first: recent output is the likeliest to be repeated
+        for (int i = n_hist - n - 1; i >= 0; --i) {
+            if (hist[i] != key[0] || memcmp(hist + i, key, sizeof(llama_token) * (size_t)n) != 0) continue;
+            int m = 0;
+            for (int j = i + n; j < n_hist && m < max; ++j) {
+                if (llama_vocab_is_eog(vocab, hist[j])) break;
+                out[m++] = hist[j];
+            }
+            if (m > 0) return m;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,44 @@
+// sonified_spec.h
+//
+// Speculative decoding support for llm_eval. A draft model, much smaller than the target
+// but sharing its vocabulary, greedily proposes the next few tokens; llm_eval verifies
+// them with one batched llama_decode on the target and keeps the longest prefix the
+// target's own sampler agrees with, so output is unchanged while accepted tokens cost a
+// fraction of a target step. Prompt lookup is the draft-free variant: proposals are
+// copied from an earlier occurrence of the last few tokens in the prompt or output.
+// Not part of the public API.
+
+#ifndef SONIFIED_SPEC_H
+#define SONIFIED_SPEC_H
+
+#include "llama.h"
+
+typedef struct sl_draft sl_draft;
+
+// Load the draft model at path (through the shared model registry) and give it a
+// single-sequence context shaped like cparams. The draft must share target's vocabulary.
+// Returns NULL on failure with *err describing it.
+sl_draft * sl_draft_create(const char * path,
+                           const struct llama_model_params * mparams,
+                           const struct llama_context_params * cparams,
+                           const struct llama_model * target,
+                           const char ** err);
+
+void sl_draft_free(sl_draft * d);
+
+void sl_draft_set_threads(sl_draft * d, int n_threads, int n_threads_batch);
+
+// Propose up to max tokens continuing hist[0..n_hist). The draft cache keeps the longest
+// prefix shared with the previous call, so steady-state drafting only decodes the tokens
+// accepted since. Stops early at end-of-generation. Returns the count, or -1 on failure.
+int sl_draft_propose(sl_draft * d, const llama_token * hist, int n_hist, llama_token * out, int max);
+
+// Prompt lookup: find the most recent earlier occurrence of the last n tokens of
+// hist[0..n_hist) (n from SL_NGRAM_MAX down to SL_NGRAM_MIN) and copy up to max of the tokens
+// that followed it, stopping before end-of-generation tokens. No state, no allocation.
+// Returns the count (0 when nothing matches).
+enum { SL_NGRAM_MIN = 2, SL_NGRAM_MAX = 4 };
+int sl_ngram_propose(const struct llama_vocab * vocab, const llama_token * hist, int n_hist,
+                     llama_token * out, int max);
+
+#endif // SONIFIED_SPEC_H
@@ -0,0 +1,126 @@
+#include "sonified_state.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Token ids are padded so the state blob starts 8-byte aligned within the file.
+static size_t tokens_bytes(int32_t n_tokens) {
+    return ((size_t)n_tokens * sizeof(int32_t) + 7u) & ~(size_t)7u;
+}
+
+static int write_all(int fd, const void * data, size_t n) {
+    const char * p = (const char *)data;
+    while (n > 0) {
+        const ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+int sl_state_write(const char * path, sl_state_header * hdr, const int32_t * tokens, const void * state) {
+    memset(hdr->magic, 0, sizeof(hdr->magic));
+    memcpy(hdr->magic, SL_STATE_MAGIC, sizeof(SL_STATE_MAGIC) - 1);
+    hdr->version = SL_STATE_VERSION;
+    hdr->header_bytes = (uint32_t)sizeof(*hdr);
+
+    const size_t plen = strlen(path);
+    char * tmp = (char *)malloc(plen + 16);
+    if (!tmp) {
+        errno = ENOMEM;
+        return -1;
+    }
+    snprintf(tmp, plen + 16, "%s.tmp.%d", path, (int)getpid());
+    const int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free(tmp);
+        return -1;
+    }
+    static const char zeros[8] = { 0 };
+    const size_t tok = (size_t)hdr->n_tokens * sizeof(int32_t);
+    int rc = write_all(fd, hdr, sizeof(*hdr));
+    if (rc == 0) rc = write_all(fd, tokens, tok);
+    if (rc == 0) rc = write_all(fd, zeros, tokens_bytes(hdr->n_tokens) - tok);
+    if (rc == 0) rc = write_all(fd, state, (size_t)hdr->state_bytes);
+    if (rc == 0) rc = fsync(fd);
+    if (close(fd) != 0) rc = -1;
+    if (rc == 0) rc = rename(tmp, path);
+    if (rc != 0) {
+        const int saved = errno;
+        unlink(tmp);
+        errno = saved;
+    }
+    free(tmp);
+    return rc;
+}
+
+int sl_state_open(const char * path, sl_state_map * m) {
+    memset(m, 0, sizeof(*m));
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat sb;
+    if (fstat(fd, &sb) != 0) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)sb.st_size < sizeof(sl_state_header)) {
+        close(fd);
+        return -2;
+    }
+    m->len = (size_t)sb.st_size;
+    void * base = mmap(NULL, m->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base != MAP_FAILED) {
+        m->base = base;
+        m->mapped = true;
+        madvise(base, m->len, MADV_SEQUENTIAL); // read once, front to back
+    } else {
+        // e.g. a filesystem without mmap support: read it instead
+        m->base = malloc(m->len);
+        size_t got = 0;
+        while (m->base && got < m->len) {
+            const ssize_t r = read(fd, (char *)m->base + got, m->len - got);
+            if (r < 0 && errno == EINTR) continue;
+            if (r <= 0) break;
+            got += (size_t)r;
+        }
+        if (!m->base || got < m->len) {
+            const int saved = m->base ? EIO : ENOMEM;
+            free(m->base);
+            m->base = NULL;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+    }
+    close(fd);
+
+    memcpy(&m->hdr, m->base, sizeof(m->hdr));
+    const sl_state_header * h = &m->hdr;
+    const size_t body = m->len - sizeof(*h);
+    if (memcmp(h->magic, SL_STATE_MAGIC, sizeof(SL_STATE_MAGIC) - 1) != 0 || h->version != SL_STATE_VERSION ||
+        h->header_bytes != sizeof(*h) || h->n_tokens < 0 || tokens_bytes(h->n_tokens) > body ||
+        h->state_bytes != body - tokens_bytes(h->n_tokens)) {
+        sl_state_close(m);
+        return -2;
+    }
+    m->tokens = (const int32_t *)((const char *)m->base + sizeof(*h));
+    m->state = (const uint8_t *)m->tokens + tokens_bytes(h->n_tokens);
+    return 0;
+}
+
+void sl_state_close(sl_state_map * m) {
+    if (m->base) {
+        if (m->mapped) munmap(m->base, m->len);
+        else free(m->base);
+    }
+    memset(m, 0, sizeof(*m));
+}
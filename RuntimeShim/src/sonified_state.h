@@ -0,0 +1,50 @@
+// sonified_state.h
+//
+// On-disk format behind llm_state_save / llm_state_load: a fixed header that pins a snapshot
+// to the model fingerprint, context size and KV cache types, then the cached token ids, then
+// llama.cpp's opaque sequence state. Snapshots are mapped read-only on load so the state is
+// handed to llama.cpp straight from the page cache. Not part of the public API; free of
+// llama.cpp types.
+
+#ifndef SONIFIED_STATE_H
+#define SONIFIED_STATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SL_STATE_MAGIC   "SLSTATE"
+#define SL_STATE_VERSION 1u
+
+typedef struct sl_state_header {
+    char     magic[8];     // SL_STATE_MAGIC, NUL-padded
+    uint32_t version;      // SL_STATE_VERSION
+    uint32_t header_bytes; // sizeof(sl_state_header) when written
+    uint64_t model_hash;   // sl_model_fingerprint of the model that produced it
+    int32_t  n_ctx;        // context size of the saving handle
+    int32_t  type_k;       // KV cache types (enum ggml_type)
+    int32_t  type_v;
+    int32_t  n_tokens;     // token ids following the header
+    uint64_t state_bytes;  // sequence state following the token ids
+} sl_state_header;
+
+// Write hdr (magic, version and header_bytes filled in here), tokens and state to a
+// temporary file next to path and rename it into place, so readers never see a partial
+// snapshot. Returns 0, or -1 with errno set.
+int sl_state_write(const char * path, sl_state_header * hdr, const int32_t * tokens, const void * state);
+
+typedef struct sl_state_map {
+    sl_state_header hdr;
+    const int32_t * tokens; // hdr.n_tokens ids
+    const uint8_t * state;  // hdr.state_bytes bytes
+    void          * base;   // mapping, or heap copy when mmap is unavailable
+    size_t          len;
+    bool            mapped;
+} sl_state_map;
+
+// Map the snapshot at path and check its framing (magic, version, sizes). Returns 0, -1 when
+// the file cannot be read (errno set), or -2 when it is not a snapshot or is truncated.
+int  sl_state_open(const char * path, sl_state_map * m);
+void sl_state_close(sl_state_map * m);
+
+#endif // SONIFIED_STATE_H
@@ -0,0 +1,134 @@
+#include "sonified_stop.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char k_tool_marker[] = "{\"tool\":";
+enum { TOOL_MARKER_LEN = sizeof(k_tool_marker) - 1, TOOL_CAPTURE_MAX = 32 * 1024 };
+
+int sl_stop_init(sl_stop * s, const llm_gen_opts_t * opts) {
+    memset(s, 0, sizeof(*s));
+    if (!opts) return 0;
+    s->tool_call = opts->stop_tool_call != 0;
+    if (opts->n_stop <= 0 || !opts->stop) return 0;
+    if (opts->n_stop > SL_STOP_MAX) return -1;
+    size_t total = 0;
+    for (int i = 0; i < opts->n_stop; ++i) {
+        const size_t n = opts->stop[i] ? strlen(opts->stop[i]) : 0;
+        if (n > SL_STOP_LEN_MAX) return -1;
+        total += n;
+    }
+    s->strs = (char *)malloc(total + 1);
+    if (!s->strs) return -2;
+    for (int i = 0; i < opts->n_stop; ++i) {
+        const int n = opts->stop[i] ? (int)strlen(opts->stop[i]) : 0;
+        if (n == 0) continue; // an empty string never stops
+        memcpy(s->strs + s->off[s->n], opts->stop[i], (size_t)n);
+        s->off[s->n + 1] = s->off[s->n] + n;
+        s->n += 1;
+        if (n > s->max_len) s->max_len = n;
+    }
+    return 0;
+}
+
+void sl_stop_free(sl_stop * s) {
+    free(s->strs);
+    s->strs = NULL;
+    s->n = 0;
+}
+
+// Earliest end (in piece bytes) of a stop string ending inside piece, or -1.
+static int match_strings(const sl_stop * s, const char * piece, int len) {
+    char window[2 * SL_STOP_LEN_MAX];
+    int best = -1;
+    // only the first max_len bytes of the piece can hold the earliest end of a match that
+    // starts in the tail; longer pieces are also scanned on their own below
+    const int head = len < s->max_len ? len : s->max_len;
+    memcpy(window, s->tail, (size_t)s->tail_len);
+    memcpy(window + s->tail_len, piece, (size_t)head);
+    const int wlen = s->tail_len + head;
+    for (int k = 0; k < s->n; ++k) {
+        const char * str = s->strs + s->off[k];
+        const int n = s->off[k + 1] - s->off[k];
+        for (int i = 0; i + n <= wlen; ++i) {
+            const int end = i + n - s->tail_len;
+            if (end <= 0) continue; // already emitted without stopping
+            if (best >= 0 && end >= best) break;
+            if (memcmp(window + i, str, (size_t)n) == 0) { best = end; break; }
+        }
+        for (int i = 0; i + n <= len; ++i) {
+            if (best >= 0 && i + n >= best) break;
+            if (memcmp(piece + i, str, (size_t)n) == 0) { best = i + n; break; }
+        }
+    }
+    return best;
+}
+
+// Keep the last max_len - 1 bytes of output for matches spanning pieces.
+static void push_tail(sl_stop * s, const char * piece, int len) {
+    const int cap = s->max_len - 1;
+    if (cap <= 0) return;
+    if (len >= cap) {
+        memcpy(s->tail, piece + len - cap, (size_t)cap);
+        s->tail_len = cap;
+        return;
+    }
+    const int drop = s->tail_len + len > cap ? s->tail_len + len - cap : 0;
+    memmove(s->tail, s->tail + drop, (size_t)(s->tail_len - drop));
+    s->tail_len -= drop;
+    memcpy(s->tail + s->tail_len, piece, (size_t)len);
+    s->tail_len += len;
+}
+
+// Bytes of piece through the brace closing a tool call, or -1.
+static int match_tool_call(sl_stop * s, const char * piece, int len) {
+    for (int i = 0; i < len; ++i) {
+        const char c = piece[i];
+        if (s->depth == 0) {
+            if (c == k_tool_marker[s->trig]) s->trig += 1;
+            else s->trig = c == '{' ? 1 : 0;
+            if (s->trig == TOOL_MARKER_LEN) {
+                s->trig = 0;
+                s->depth = 1;
+                s->in_str = false;
+                s->esc = false;
+                s->captured = TOOL_MARKER_LEN;
+            }
+            continue;
+        }
+        if (++s->captured > TOOL_CAPTURE_MAX) { // ToolCallDetector gives up as well
+            s->depth = 0;
+            continue;
+        }
+        if (s->in_str) {
+            if (s->esc) s->esc = false;
+            else if (c == '\\') s->esc = true;
+            else if (c == '"') s->in_str = false;
+        } else if (c == '"') {
+            s->in_str = true;
+        } else if (c == '{') {
+            s->depth += 1;
+        } else if (c == '}' && --s->depth == 0) {
+            return i + 1;
+        }
+    }
+    return -1;
+}
+
+int sl_stop_feed(sl_stop * s, const char * piece, int len, int * keep) {
+    if (len <= 0) return 0;
+    int end = s->n > 0 ? match_strings(s, piece, len) : -1;
+    int reason = end >= 0 ? LLM_STOP_STRING : 0;
+    if (s->tool_call) {
+        const int t = match_tool_call(s, piece, end >= 0 ? end : len);
+        if (t >= 0) {
+            end = t;
+            reason = LLM_STOP_TOOL_CALL;
+        }
+    }
+    if (reason) {
+        *keep = end;
+        return reason;
+    }
+    push_tail(s, piece, len);
+    return 0;
+}
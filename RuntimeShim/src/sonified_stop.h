@@ -0,0 +1,46 @@
+// sonified_stop.h
+//
+// Stop conditions for llm_gen_opts_t.stop / stop_tool_call, checked on every emitted piece
+// inside the decode loop so generation ends on the token that completes one instead of a
+// step later (or several, when the caller watches the text and cancels). Literal stop
+// strings are matched across piece boundaries against a tail of the output; the tool-call
+// terminator tracks brace depth from the opening {"tool": the way ToolCallDetector does,
+// ignoring braces inside strings. Not part of the public API.
+
+#ifndef SONIFIED_STOP_H
+#define SONIFIED_STOP_H
+
+#include "sonified_llama.h"
+#include <stdbool.h>
+
+// Limits on llm_gen_opts_t.stop: strings per call and bytes per string.
+enum { SL_STOP_MAX = 16, SL_STOP_LEN_MAX = 128 };
+
+typedef struct sl_stop {
+    char * strs;      // the stop strings back to back (owned copy)
+    int    off[SL_STOP_MAX + 1];
+    int    n;
+    int    max_len;
+    char   tail[SL_STOP_LEN_MAX]; // last max_len - 1 bytes of output
+    int    tail_len;
+    bool   tool_call;
+    int    trig;      // bytes of {"tool": matched
+    int    depth;     // brace depth inside a call, 0 when not in one
+    bool   in_str;
+    bool   esc;
+    int    captured;  // bytes of the current call, capped like ToolCallDetector's buffer
+} sl_stop;
+
+// Copy the conditions of opts (NULL or none leaves s inactive). Returns 0, -1 when the
+// strings exceed the limits above, or -2 when out of memory.
+int  sl_stop_init(sl_stop * s, const llm_gen_opts_t * opts);
+void sl_stop_free(sl_stop * s);
+
+static inline bool sl_stop_active(const sl_stop * s) { return s->n > 0 || s->tool_call; }
+
+// Feed an emitted piece. Returns 0 when output goes on, otherwise the llm_stop_reason that
+// ends it, with *keep set to the bytes of the piece up to the end of the match (the rest is
+// not emitted).
+int sl_stop_feed(sl_stop * s, const char * piece, int len, int * keep);
+
+#endif // SONIFIED_STOP_H
@@ -0,0 +1,234 @@
+#include "sonified_tokenize.h"
+#include <limits.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { TOKENIZE_SLACK = 16 }; // BOS/EOS added by the model plus short-text headroom
+
+// Incremental appends: how far back a control token may be, the first fallback window,
+// and the tokens before the cut that must re-tokenize unchanged.
+enum { APPEND_CONTROL_MAX = 512, APPEND_BACKOFF = 8, APPEND_VERIFY = 4, APPEND_TRIES = 3 };
+
+void sl_token_buf_free(sl_token_buf * b) {
+    if (!b) return;
+    free(b->data);
+    b->data = NULL;
+    b->cap = 0;
+}
+
+static bool reserve(sl_token_buf * b, int n) {
+    if (n <= b->cap) return true;
+    llama_token * d = (llama_token *)realloc(b->data, sizeof(llama_token) * (size_t)n);
+    if (!d) return false;
+    b->data = d;
+    b->cap = n;
+    return true;
+}
+
+// Tokenize text[0..len) into b from index at; special tokens are always parsed.
+static int tokenize_at(const struct llama_vocab * vocab, const char * text, size_t len, bool add_special, sl_token_buf * b, int at) {
+    if (len > (size_t)(INT32_MAX - TOKENIZE_SLACK)) return -1;
+    const int32_t text_len = (int32_t)len;
+
+    // one pass when the estimate holds; llama_tokenize reports the exact size when it does not
+    const int estimate = at + text_len / 2 + TOKENIZE_SLACK;
+    if (!reserve(b, estimate)) return -1;
+    int32_t n = llama_tokenize(vocab, text, text_len, b->data + at, b->cap - at, add_special, /*parse_special=*/true);
+    if (n < 0) {
+        if (n == INT32_MIN || -n > INT32_MAX - at || !reserve(b, at - n)) return -1; // INT32_MIN: the count overflowed
+        n = llama_tokenize(vocab, text, text_len, b->data + at, b->cap - at, add_special, /*parse_special=*/true);
+        if (n < 0) return -1;
+    }
+    return (int)n;
+}
+
+// follow model BOS policy, parse special tokens
+int sl_tokenize_into(const struct llama_model * model, const char * prompt, sl_token_buf * b) {
+    if (!b) return -1;
+    if (!prompt) prompt = "";
+    const struct llama_vocab * vocab = llama_model_get_vocab(model);
+    return tokenize_at(vocab, prompt, strlen(prompt), llama_vocab_get_add_bos(vocab), b, 0);
+}
+
+int sl_tokenize_prompt(const struct llama_model * model, const char * prompt, llama_token ** out) {
+    if (!out) return -1;
+    *out = NULL;
+    sl_token_buf b = { NULL, 0 };
+    const int n = sl_tokenize_into(model, prompt, &b);
+    if (n <= 0) {
+        sl_token_buf_free(&b);
+        return n;
+    }
+    *out = b.data;
+    return n;
+}
+
+// ---- incremental tokenization ----
+
+static int seq_full(sl_token_seq * s, const struct llama_vocab * vocab) {
+    const int n = tokenize_at(vocab, s->text, s->len, llama_vocab_get_add_bos(vocab), &s->toks, 0);
+    s->n = n < 0 ? 0 : n;
+    s->retokenized = s->n;
+    return n;
+}
+
+// Byte offset in the old text (old_len bytes) where token w starts, checking that the pieces
+// of tokens w..n-1 spell the text's tail. Returns -1 when they do not (e.g. an added BOS).
+static long long tail_offset(const sl_token_seq * s, const struct llama_vocab * vocab, int w, size_t old_len) {
+    size_t end = old_len;
+    char piece[256];
+    for (int i = s->n - 1; i >= w; --i) {
+        const int32_t m = llama_token_to_piece(vocab, s->toks.data[i], piece, (int32_t)sizeof(piece), /*lstrip=*/0, /*special=*/true);
+        if (m < 0 || (size_t)m > end || memcmp(s->text + end - (size_t)m, piece, (size_t)m) != 0) return -1;
+        end -= (size_t)m;
+    }
+    return (long long)end;
+}
+
+int sl_token_seq_init(sl_token_seq * s, const struct llama_model * model, const char * text) {
+    memset(s, 0, sizeof(*s));
+    return sl_token_seq_append(s, model, text);
+}
+
+int sl_token_seq_append(sl_token_seq * s, const struct llama_model * model, const char * suffix) {
+    if (!suffix) suffix = "";
+    const struct llama_vocab * vocab = llama_model_get_vocab(model);
+    const size_t add = strlen(suffix);
+    const size_t old_len = s->len;
+    if (s->len + add + 1 > s->cap) {
+        size_t cap = s->cap ? s->cap : 256;
+        while (cap < s->len + add + 1) cap *= 2;
+        char * t = (char *)realloc(s->text, cap);
+        if (!t) return -1;
+        s->text = t;
+        s->cap = cap;
+    }
+    memcpy(s->text + s->len, suffix, add);
+    s->len += add;
+    s->text[s->len] = '\0';
+    if (add == 0 && s->n > 0) {
+        s->retokenized = 0;
+        return s->n;
+    }
+    if (s->n == 0) return seq_full(s, vocab);
+
+    // cut right after the last control token when it is close to the end (token 0 may be BOS)
+    int w = -1, cut = -1;
+    for (int i = s->n - 1; i >= 1 && i >= s->n - APPEND_CONTROL_MAX; --i) {
+        if (llama_vocab_is_control(vocab, s->toks.data[i])) {
+            w = i;
+            cut = i + 1;
+            break;
+        }
+    }
+    sl_token_buf scratch = { NULL, 0 };
+    for (int attempt = 0, back = APPEND_BACKOFF; attempt < APPEND_TRIES; ++attempt, back *= 8) {
+        if (cut < 0 || attempt > 0) {
+            cut = s->n - back;
+            w = cut - APPEND_VERIFY;
+        }
+        if (w < 1) break; // the start may carry BOS: tokenize everything
+        const long long off = tail_offset(s, vocab, w, old_len);
+        if (off < 0) break;
+        const int m = tokenize_at(vocab, s->text + off, s->len - (size_t)off, /*add_special=*/false, &scratch, 0);
+        const int verify = cut - w;
+        if (m < verify || memcmp(scratch.data, s->toks.data + w, sizeof(llama_token) * (size_t)verify) != 0) continue;
+        if (!reserve(&s->toks, cut + m - verify)) break;
+        memcpy(s->toks.data + cut, scratch.data + verify, sizeof(llama_token) * (size_t)(m - verify));
+        s->n = cut + m - verify;
+        s->retokenized = m - verify;
+        sl_token_buf_free(&scratch);
+        return s->n;
+    }
+    sl_token_buf_free(&scratch);
+    return seq_full(s, vocab);
+}
+
+int sl_token_seq_assign(sl_token_seq * s, const struct llama_model * model, const char * text) {
+    if (!text) text = "";
+    const size_t len = strlen(text);
+    if (s->toks.data && len >= s->len && memcmp(text, s->text, s->len) == 0) {
+        return sl_token_seq_append(s, model, text + s->len);
+    }
+    s->len = 0;
+    s->n = 0;
+    return sl_token_seq_append(s, model, text);
+}
+
+void sl_token_seq_free(sl_token_seq * s) {
+    if (!s) return;
+    sl_token_buf_free(&s->toks);
+    free(s->text);
+    memset(s, 0, sizeof(*s));
+}
+
+// ---- single-token ids ----
+
+static uint32_t hash_text(const char * t) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (; *t; ++t) h = (h ^ (uint8_t)*t) * 16777619u;
+    return h;
+}
+
+// Slot holding text, or the empty slot where it belongs.
+static int ids_slot(const sl_token_ids * c, const char * text, uint32_t h) {
+    int i = (int)(h & (uint32_t)(c->cap - 1));
+    while (c->keys[i] && (c->hashes[i] != h || strcmp(c->keys[i], text) != 0)) i = (i + 1) & (c->cap - 1);
+    return i;
+}
+
+static bool ids_grow(sl_token_ids * c) {
+    const int cap = c->cap ? c->cap * 2 : 64;
+    sl_token_ids g = { NULL, NULL, NULL, cap, c->count };
+    g.keys = (char **)calloc((size_t)cap, sizeof(char *));
+    g.ids = (int32_t *)malloc(sizeof(int32_t) * (size_t)cap);
+    g.hashes = (uint32_t *)malloc(sizeof(uint32_t) * (size_t)cap);
+    if (!g.keys || !g.ids || !g.hashes) {
+        free(g.keys); free(g.ids); free(g.hashes);
+        return false;
+    }
+    for (int i = 0; i < c->cap; ++i) {
+        if (!c->keys[i]) continue;
+        const int j = ids_slot(&g, c->keys[i], c->hashes[i]);
+        g.keys[j] = c->keys[i];
+        g.ids[j] = c->ids[i];
+        g.hashes[j] = c->hashes[i];
+    }
+    free(c->keys); free(c->ids); free(c->hashes);
+    *c = g;
+    return true;
+}
+
+int sl_token_ids_get(sl_token_ids * c, const struct llama_model * model, const char * text) {
+    const uint32_t h = hash_text(text);
+    if (c->cap > 0) {
+        const int i = ids_slot(c, text, h);
+        if (c->keys[i]) return c->ids[i];
+    }
+    // two slots are enough to tell one token from more; a larger count comes back negative
+    llama_token toks[2];
+    const size_t len = strlen(text);
+    const int32_t n = len > (size_t)INT32_MAX ? -1
+        : llama_tokenize(llama_model_get_vocab(model), text, (int32_t)len, toks, 2, /*add_special=*/false, /*parse_special=*/true);
+    const int32_t id = n == 1 ? toks[0] : -2;
+
+    if ((c->count + 1) * 4 > c->cap * 3 && !ids_grow(c)) return -1; // load factor <= 3/4
+    char * key = strdup(text);
+    if (!key) return -1;
+    const int i = ids_slot(c, text, h);
+    c->keys[i] = key;
+    c->ids[i] = id;
+    c->hashes[i] = h;
+    ++c->count;
+    return id;
+}
+
+void sl_token_ids_free(sl_token_ids * c) {
+    if (!c) return;
+    for (int i = 0; i < c->cap; ++i) free(c->keys[i]);
+    free(c->keys);
+    free(c->ids);
+    free(c->hashes);
+    memset(c, 0, sizeof(*c));
+}
@@ -0,0 +1,68 @@
+// sonified_tokenize.h
+//
+// Prompt tokenization shared by llm_eval, llm_tokenize and the batching scheduler.
+// Tokenization is a single llama_tokenize pass into a buffer sized from the text length
+// (bytes / 2 plus slack covers typical BPE vocabularies); only when that overflows is the
+// exact size taken from llama.cpp and the pass repeated. Not part of the public API.
+
+#ifndef SONIFIED_TOKENIZE_H
+#define SONIFIED_TOKENIZE_H
+
+#include "llama.h"
+
+// Growable token buffer, reused across calls (e.g. one per handle for llm_eval prompts).
+typedef struct sl_token_buf {
+    llama_token * data;
+    int           cap;
+} sl_token_buf;
+
+void sl_token_buf_free(sl_token_buf * b);
+
+// Tokenize a UTF-8 prompt following the model's BOS policy and parsing special tokens,
+// into b (grown as needed; its contents are replaced). Returns the token count, or -1
+// when tokenization fails or memory runs out.
+int sl_tokenize_into(const struct llama_model * model, const char * prompt, sl_token_buf * b);
+
+// As sl_tokenize_into, but *out owns a malloc'd array (NULL when the prompt is empty).
+int sl_tokenize_prompt(const struct llama_model * model, const char * prompt, llama_token ** out);
+
+// A prompt's text and tokens, extended by appending text. Appending re-tokenizes only a
+// tail, so tokens that merge across the old end are redone: from the last control token
+// (special tokens split the text before BPE runs, so that cut is exact) or, without one
+// nearby, from a few tokens back, where the re-tokenized tail must reproduce the old tokens
+// just before the cut. The old tail's pieces must spell the old text (no BOS, no SPM space
+// prefix in the window); otherwise the window widens and, in the end, the whole text is
+// tokenized again.
+typedef struct sl_token_seq {
+    sl_token_buf toks;
+    int          n;
+    char       * text;        // NUL-terminated
+    size_t       len;
+    size_t       cap;
+    int          retokenized; // tokens produced by the last init/append (not reused)
+} sl_token_seq;
+
+// init and append return the token count, or -1 when tokenization fails or memory runs out.
+int  sl_token_seq_init(sl_token_seq * s, const struct llama_model * model, const char * text);
+int  sl_token_seq_append(sl_token_seq * s, const struct llama_model * model, const char * suffix);
+// Make s hold text: an append when text extends the current text, a fresh tokenization
+// (buffers kept) otherwise. s must be zeroed or initialized.
+int  sl_token_seq_assign(sl_token_seq * s, const struct llama_model * model, const char * text);
+void sl_token_seq_free(sl_token_seq * s);
+
+// Text -> single-token id answers for llm_token_id, an open-addressing table that keeps
+// its keys. Not thread-safe. Must be zeroed before first use.
+typedef struct sl_token_ids {
+    char    ** keys;  // NULL marks an empty slot
+    int32_t  * ids;   // token id, or -2 when the text is not exactly one token
+    uint32_t * hashes;
+    int        cap;   // power of two
+    int        count;
+} sl_token_ids;
+
+// The id of the one token text encodes to (special tokens parsed, no BOS), -2 when it is
+// not a single token, or -1 when memory runs out. Tokenizes each distinct text once.
+int  sl_token_ids_get(sl_token_ids * c, const struct llama_model * model, const char * text);
+void sl_token_ids_free(sl_token_ids * c);
+
+#endif // SONIFIED_TOKENIZE_H
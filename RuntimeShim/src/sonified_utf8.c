@@ -0,0 +1,42 @@
+#include "sonified_utf8.h"
+#include <string.h>
+
+// Sequence length announced by a lead byte; 0 for continuation or invalid bytes.
+static int seq_len(unsigned char b) {
+    if (b < 0x80) return 1;
+    if ((b & 0xE0) == 0xC0) return b >= 0xC2 ? 2 : 0;
+    if ((b & 0xF0) == 0xE0) return 3;
+    if ((b & 0xF8) == 0xF0) return b <= 0xF4 ? 4 : 0;
+    return 0;
+}
+
+int sl_utf8_incomplete_tail(const char * str, int n) {
+    const unsigned char * s = (const unsigned char *)str;
+    const int lim = n < 4 ? n : 4;
+    for (int back = 1; back <= lim; ++back) {
+        const unsigned char b = s[n - back];
+        if ((b & 0xC0) == 0x80) continue; // continuation byte: keep looking for its lead
+        const int want = seq_len(b);
+        return (want > back) ? back : 0;  // invalid leads and complete sequences are emitted
+    }
+    return 0; // four continuation bytes in a row: nothing to wait for
+}
+
+int sl_utf8_carry_feed(sl_utf8_carry * c, const char * in, int n, char * out) {
+    if (n < 0) n = 0;
+    int total = c->len;
+    memcpy(out, c->pending, (size_t)c->len);
+    if (n > 0) memcpy(out + total, in, (size_t)n);
+    total += n;
+    const int hold = sl_utf8_incomplete_tail(out, total);
+    c->len = hold;
+    memcpy(c->pending, out + total - hold, (size_t)hold);
+    return total - hold;
+}
+
+int sl_utf8_carry_flush(sl_utf8_carry * c, char * out) {
+    const int n = c->len;
+    memcpy(out, c->pending, (size_t)n);
+    c->len = 0;
+    return n;
+}
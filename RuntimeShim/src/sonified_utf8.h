@@ -0,0 +1,30 @@
+// sonified_utf8.h
+//
+// Carry buffer that keeps streamed token pieces on UTF-8 code point boundaries.
+// llama_token_to_piece may split a multi-byte sequence across tokens (byte-fallback,
+// emoji, CJK); feeding pieces through a carry emits only complete code points and holds
+// at most 3 trailing bytes until the rest arrive. Not part of the public API.
+
+#ifndef SONIFIED_UTF8_H
+#define SONIFIED_UTF8_H
+
+typedef struct sl_utf8_carry {
+    char pending[4];
+    int  len;
+} sl_utf8_carry;
+
+static inline void sl_utf8_carry_reset(sl_utf8_carry * c) { c->len = 0; }
+
+// Append n bytes and write to out the longest prefix of (pending + in) that does not end
+// inside a code point; the incomplete tail stays pending. out needs n + 4 bytes. Invalid
+// bytes are passed through unchanged rather than held. Returns the bytes written.
+int sl_utf8_carry_feed(sl_utf8_carry * c, const char * in, int n, char * out);
+
+// Bytes at the end of s[0..n) that begin a code point not yet complete (0..3).
+int sl_utf8_incomplete_tail(const char * s, int n);
+
+// End of stream: write any pending bytes (an incomplete sequence) to out (4 bytes) as-is.
+// Returns the bytes written.
+int sl_utf8_carry_flush(sl_utf8_carry * c, char * out);
+
+#endif // SONIFIED_UTF8_H
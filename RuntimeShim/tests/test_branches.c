@@ -0,0 +1,93 @@
+// test_branches.c
+//
+// llm_submit_n branches sample their first token from the logits row of one shared prefill.
+// With a logit bias set, every branch must see that row biased exactly once: the bias below
+// lifts the runner-up to three quarters of its gap to the greedy token, so a branch that saw
+// it twice would pick the runner-up. Needs SONIFIED_TEST_MODEL=/path/to/model.gguf;
+// skipped (77) otherwise.
+
+#include "sonified_llama.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { TEST_SKIP = 77, N_BRANCHES = 3 };
+static const char * const PROMPT = "The capital of France is";
+
+typedef struct first_token {
+    llm_token_logprob_t top[2];
+    int  n_top;
+    char text[64];
+} first_token;
+
+static void info_cb(const llm_token_info_t * info, void * user) {
+    first_token * f = (first_token *)user;
+    if (info->token < 0 || f->n_top) return;
+    f->n_top = info->n_top;
+    memcpy(f->top, info->top, sizeof(llm_token_logprob_t) * (size_t)info->n_top);
+    snprintf(f->text, sizeof(f->text), "%s", info->text);
+}
+
+// Output of seq until its terminal event; returns -1 on error.
+static int drain(llm_handle_t h, int seq, char * out, size_t cap) {
+    llm_seq_event_t ev[8];
+    out[0] = '\0';
+    for (;;) {
+        const int n = llm_poll(h, seq, ev, 8, 5000);
+        if (n <= 0) return -1;
+        for (int i = 0; i < n; ++i) {
+            if (ev[i].kind == LLM_SEQ_EVENT_TOKEN) strncat(out, ev[i].text, cap - strlen(out) - 1);
+            else return ev[i].kind == LLM_SEQ_EVENT_DONE ? 0 : -1;
+        }
+    }
+}
+
+int main(void) {
+    const char * path = getenv("SONIFIED_TEST_MODEL");
+    if (!path || !*path) {
+        printf("SONIFIED_TEST_MODEL not set; skipping\n");
+        return TEST_SKIP;
+    }
+    llm_handle_t h = llm_init(path);
+    if (!h) {
+        fprintf(stderr, "llm_init failed: %s\n", llm_last_error_message());
+        return 1;
+    }
+    llm_gen_opts_t o = {0};
+    o.max_tokens = 1;
+    o.temperature = 0.0f; // greedy: every branch picks the top token of the row it sees
+
+    first_token f = {0};
+    if (llm_eval_logprobs(h, PROMPT, &o, 2, info_cb, &f) != 0 || f.n_top < 2) {
+        fprintf(stderr, "llm_eval_logprobs failed\n");
+        llm_free(h);
+        return 1;
+    }
+    const float gap = f.top[0].logprob - f.top[1].logprob;
+    if (gap <= 1e-3f) {
+        printf("top two tokens tie; skipping\n");
+        llm_free(h);
+        return TEST_SKIP;
+    }
+    const llm_logit_bias_t bias = { f.top[1].token, 0.75f * gap };
+    o.logit_bias = &bias;
+    o.n_logit_bias = 1;
+
+    int failures = 0;
+    int seqs[N_BRANCHES];
+    char out[128];
+    if (llm_submit_n(h, PROMPT, &o, N_BRANCHES, seqs) != 0) {
+        fprintf(stderr, "llm_submit_n failed\n");
+        failures += 1;
+    } else {
+        for (int k = 0; k < N_BRANCHES; ++k) {
+            if (drain(h, seqs[k], out, sizeof(out)) != 0 || strcmp(out, f.text) != 0) {
+                fprintf(stderr, "branch %d: '%s', want '%s'\n", k, out, f.text);
+                failures += 1;
+            }
+        }
+    }
+    printf("first token '%s', runner-up %d biased by %.3f\n", f.text, f.top[1].token, bias.bias);
+    llm_free(h);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,295 @@
+// test_constrain.c
+//
+// The constraint matcher against a small stub vocabulary: every byte as a token, a few
+// multi-byte pieces and one end-of-generation token. Each case is generated by forcing its
+// tokens through sl_constraint_sample (the wanted token gets the only high logit, so it
+// comes back only if the constraint allows it), once byte by byte and once with the
+// longest matching pieces. Accepted text must go through whole and leave only
+// end-of-generation allowed; rejected text must be refused before it completes. A
+// vocabulary without the bytes a value needs must end in a dead end (sl_constraint_stuck).
+// A top-level number only ends at the byte after it, so those cases carry a trailing space.
+
+#include "sonified_constrain.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// ---- stub vocabulary (the llama.cpp calls sonified_constrain.c makes) ----
+
+struct llama_vocab {
+    int32_t              n;
+    const char * const * pieces; // NULL for the end-of-generation token
+};
+
+int32_t llama_vocab_n_tokens(const struct llama_vocab * v) { return v->n; }
+
+bool llama_vocab_is_eog(const struct llama_vocab * v, llama_token t) { return v->pieces[t] == NULL; }
+
+int32_t llama_token_to_piece(const struct llama_vocab * v, llama_token t, char * buf, int32_t len, int32_t lstrip, bool special) {
+    const char * p = v->pieces[t];
+    if (!p) return 0;
+    const int32_t n = t < 256 ? 1 : (int32_t)strlen(p); // single bytes include NUL
+    if (n > len) return -n;
+    memcpy(buf, p, (size_t)n);
+    return n;
+}
+
+// Greedy sampling never builds a llama_sampler chain; these only satisfy the linker.
+struct llama_sampler_chain_params llama_sampler_chain_default_params(void) { abort(); }
+struct llama_sampler * llama_sampler_chain_init(struct llama_sampler_chain_params p) { abort(); }
+void llama_sampler_chain_add(struct llama_sampler * c, struct llama_sampler * s) { abort(); }
+struct llama_sampler * llama_sampler_init_dist(uint32_t seed) { abort(); }
+struct llama_sampler * llama_sampler_init_top_k(int32_t k) { abort(); }
+struct llama_sampler * llama_sampler_init_top_p(float p, size_t min_keep) { abort(); }
+struct llama_sampler * llama_sampler_init_min_p(float p, size_t min_keep) { abort(); }
+struct llama_sampler * llama_sampler_init_temp(float t) { abort(); }
+void llama_sampler_apply(struct llama_sampler * s, llama_token_data_array * cur) { abort(); }
+void llama_sampler_accept(struct llama_sampler * s, llama_token t) { abort(); }
+void llama_sampler_reset(struct llama_sampler * s) { abort(); }
+void llama_sampler_free(struct llama_sampler * s) { abort(); }
+
+// ---- harness ----
+
+static const char * const k_multi[] = { "th", "\":", "{\"", "}}", "\"}", "true", "null", "  " };
+enum { N_MULTI = sizeof(k_multi) / sizeof(k_multi[0]) };
+
+typedef struct vocab_fixture {
+    struct llama_vocab vocab;
+    const char *       pieces[256 + N_MULTI + 1];
+    char               bytes[256][2];
+    int32_t            eog;
+} vocab_fixture;
+
+// Every byte (or only those in only, when set) plus the multi-byte pieces made of them.
+static void vocab_init(vocab_fixture * f, const char * only) {
+    memset(f, 0, sizeof(*f));
+    int32_t n = 0;
+    for (int b = 0; b < 256; ++b) {
+        f->bytes[b][0] = (char)b;
+        const bool keep = !only || (b != 0 && strchr(only, b));
+        f->pieces[n++] = keep ? f->bytes[b] : "\x01\x01"; // kept out: an unusable two-byte piece
+    }
+    for (int i = 0; i < N_MULTI; ++i) {
+        const bool keep = !only || strspn(k_multi[i], only) == strlen(k_multi[i]);
+        f->pieces[n++] = keep ? k_multi[i] : "\x01\x01";
+    }
+    f->eog = n;
+    f->pieces[n++] = NULL;
+    f->vocab.n = n;
+    f->vocab.pieces = f->pieces;
+}
+
+static int32_t token_at(const vocab_fixture * f, const char * s, int len, int longest) {
+    int32_t best = (unsigned char)s[0];
+    int best_len = 1;
+    for (int i = 0; longest && i < N_MULTI; ++i) {
+        const int n = (int)strlen(k_multi[i]);
+        if (n > best_len && n <= len && memcmp(s, k_multi[i], (size_t)n) == 0 && f->pieces[256 + i] == k_multi[i]) {
+            best = 256 + i;
+            best_len = n;
+        }
+    }
+    return best;
+}
+
+typedef struct walk_result {
+    int  consumed; // bytes of text the constraint let through
+    bool eog_only; // afterwards a preferred ordinary token is refused for end-of-generation
+    bool stuck;
+} walk_result;
+
+static walk_result walk(const vocab_fixture * f, const sl_constraint * c, const char * text, int longest) {
+    walk_result r = { 0, false, false };
+    sl_sampler smp;
+    sl_constraint_state * st = sl_constraint_state_create();
+    float * logits = (float *)malloc(sizeof(float) * (size_t)f->vocab.n);
+    llm_gen_opts_t opts;
+    memset(&opts, 0, sizeof(opts)); // greedy
+    if (!st || !logits || sl_sampler_init(&smp, f->vocab.n) != 0 || sl_sampler_configure(&smp, &opts) != 0 ||
+        sl_constraint_reset(st, c) != 0) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    const int len = (int)strlen(text);
+    while (r.consumed < len) {
+        const int32_t want = token_at(f, text + r.consumed, len - r.consumed, longest);
+        for (int32_t i = 0; i < f->vocab.n; ++i) logits[i] = 0.0f;
+        logits[want] = 10.0f;
+        const llama_token tok = sl_constraint_sample(st, &smp, logits);
+        if (tok != want) break;
+        sl_sampler_accept(&smp, tok);
+        sl_constraint_accept(st, tok);
+        r.consumed += want < 256 ? 1 : (int)strlen(k_multi[want - 256]);
+    }
+    if (r.consumed == len) {
+        for (int32_t i = 0; i < f->vocab.n; ++i) logits[i] = 0.0f;
+        logits[' '] = 10.0f;
+        r.eog_only = sl_constraint_sample(st, &smp, logits) == f->eog;
+    }
+    r.stuck = sl_constraint_stuck(st);
+    free(logits);
+    sl_sampler_free(&smp);
+    sl_constraint_state_free(st);
+    return r;
+}
+
+typedef struct text_case {
+    const char * text;
+    int          ok; // accepted as a complete value (or, for free text, passed through)
+} text_case;
+
+static int check_cases(const vocab_fixture * f, const char * name, int kind, const char * spec,
+                       const text_case * cases, int n) {
+    const char * err = NULL;
+    sl_vocab_trie * trie = sl_vocab_trie_build(&f->vocab);
+    sl_constraint * c = trie ? sl_constraint_create(trie, kind, spec, &err) : NULL;
+    if (!c) {
+        fprintf(stderr, "%s: cannot compile %s (%s)\n", name, spec, err ? err : "out of memory");
+        sl_vocab_trie_free(trie);
+        return 1;
+    }
+    int failures = 0;
+    for (int i = 0; i < n; ++i) {
+        for (int longest = 0; longest < 2; ++longest) {
+            const walk_result r = walk(f, c, cases[i].text, longest);
+            const bool accepted = r.consumed == (int)strlen(cases[i].text) && r.eog_only;
+            if (accepted != (cases[i].ok != 0) || r.stuck) {
+                fprintf(stderr, "%s: '%s' %s (%d bytes through%s), want %s\n", name, cases[i].text,
+                        accepted ? "accepted" : "rejected", r.consumed, r.stuck ? ", stuck" : "",
+                        cases[i].ok ? "accepted" : "rejected");
+                failures += 1;
+                break;
+            }
+        }
+    }
+    sl_constraint_release(c);
+    sl_vocab_trie_free(trie);
+    return failures;
+}
+
+#define CASES(...) (const text_case[]){ __VA_ARGS__ }, (int)(sizeof((const text_case[]){ __VA_ARGS__ }) / sizeof(text_case))
+
+static int run_keywords(const vocab_fixture * f) {
+    int failures = 0;
+    failures += check_cases(f, "object", LLM_CONSTRAINT_JSON, "{\"type\":\"object\"}", CASES(
+        { "{}", 1 }, { "{ \"a\" : [1, {\"b\": null}] }", 1 }, { "[]", 0 }, { "{\"a\"}", 0 }, { "{,}", 0 }));
+    failures += check_cases(f, "array", LLM_CONSTRAINT_JSON, "{\"type\":\"array\"}", CASES(
+        { "[]", 1 }, { "[1, \"x\", true, null, {}]", 1 }, { "{}", 0 }, { "[1,]", 0 }));
+    failures += check_cases(f, "string", LLM_CONSTRAINT_JSON, "{\"type\":\"string\"}", CASES(
+        { "\"\"", 1 }, { "\"th\\\"e \\\\ \\n \\u00e9\"", 1 }, { "\"a\"", 1 }, { "a", 0 }, { "\"\\x\"", 0 }, { "\"a\nb\"", 0 }));
+    failures += check_cases(f, "number", LLM_CONSTRAINT_JSON, "{\"type\":\"number\"}", CASES(
+        { "0 ", 1 }, { "-12.5e+3 ", 1 }, { "3.25\n", 1 }, { "3.25", 0 }, { "01", 0 }, { "1. ", 0 }, { "+1", 0 }, { "\"1\"", 0 }));
+    failures += check_cases(f, "integer", LLM_CONSTRAINT_JSON, "{\"type\":\"integer\"}", CASES(
+        { "42 ", 1 }, { "-7 ", 1 }, { "1.5", 0 }, { "1e3", 0 }, { "- ", 0 }));
+    failures += check_cases(f, "boolean", LLM_CONSTRAINT_JSON, "{\"type\":\"boolean\"}", CASES(
+        { "true", 1 }, { "false", 1 }, { "tru", 0 }, { "null", 0 }));
+    failures += check_cases(f, "null", LLM_CONSTRAINT_JSON, "{\"type\":\"null\"}", CASES(
+        { "null", 1 }, { "nul", 0 }, { "0", 0 }));
+    failures += check_cases(f, "properties", LLM_CONSTRAINT_JSON,
+        "{\"type\":\"object\",\"properties\":{\"city\":{\"type\":\"string\"},\"days\":{\"type\":\"integer\"}}}", CASES(
+        { "{\"city\":\"Paris\",\"days\":3}", 1 }, { "{}", 1 }, { "{\"days\":3}", 1 },
+        { "{\"days\":3,\"city\":\"x\"}", 0 }, { "{\"city\":1}", 0 }, { "{\"extra\":1}", 0 }));
+    failures += check_cases(f, "required", LLM_CONSTRAINT_JSON,
+        "{\"type\":\"object\",\"properties\":{\"a\":{\"type\":\"null\"},\"b\":{\"type\":\"null\"}},\"required\":[\"b\"]}", CASES(
+        { "{\"b\":null}", 1 }, { "{\"a\":null,\"b\":null}", 1 }, { "{\"a\":null}", 0 }, { "{}", 0 }));
+    failures += check_cases(f, "items", LLM_CONSTRAINT_JSON,
+        "{\"type\":\"array\",\"items\":{\"type\":\"boolean\"}}", CASES(
+        { "[true,false]", 1 }, { "[]", 1 }, { "[true,1]", 0 }, { "[null]", 0 }));
+    failures += check_cases(f, "min_max_items", LLM_CONSTRAINT_JSON,
+        "{\"type\":\"array\",\"items\":{\"type\":\"null\"},\"minItems\":1,\"maxItems\":2}", CASES(
+        { "[null]", 1 }, { "[null,null]", 1 }, { "[]", 0 }, { "[null,null,null]", 0 }));
+    failures += check_cases(f, "enum", LLM_CONSTRAINT_JSON,
+        "{\"type\":\"string\",\"enum\":[\"celsius\",\"fahrenheit\"]}", CASES(
+        { "\"celsius\"", 1 }, { "\"fahrenheit\"", 1 }, { "\"kelvin\"", 0 }, { "\"cel\"", 0 }));
+    failures += check_cases(f, "const", LLM_CONSTRAINT_JSON, "{\"const\":\"v1\"}", CASES(
+        { "\"v1\"", 1 }, { "\"v2\"", 0 }, { "\"v\"", 0 }));
+    failures += check_cases(f, "unsupported_any", LLM_CONSTRAINT_JSON, "{\"anyOf\":[{\"type\":\"string\"}]}", CASES(
+        { "1 ", 1 }, { "{\"x\":[null]}", 1 }, { "\"s\"", 1 }, { "nope", 0 }));
+    return failures;
+}
+
+static int run_tool_calls(const vocab_fixture * f) {
+    static const char * const tools =
+        "[{\"name\":\"get_time\",\"parameters\":{\"type\":\"object\",\"properties\":{},\"additionalProperties\":false}},"
+        "{\"name\":\"math\",\"parameters\":\"{\\\"type\\\":\\\"object\\\",\\\"properties\\\":{\\\"expr\\\":{\\\"type\\\":\\\"string\\\"}},\\\"required\\\":[\\\"expr\\\"]}\"}]";
+    int failures = check_cases(f, "tool_call", LLM_CONSTRAINT_TOOL_CALL, tools, CASES(
+        { "Let me check. {\"tool\":{\"name\":\"get_time\",\"arguments\":{}}}", 1 },
+        { "{\"tool\":{\"name\":\"math\",\"arguments\":{\"expr\":\"1+1\"}}}", 1 },
+        { "{{\"tool\": {\"name\":\"math\",\"arguments\":{\"expr\":\"x\"}}}", 1 },
+        { "{\"tool\":{\"name\":\"math\",\"arguments\":{}}}", 0 },
+        { "{\"tool\":{\"name\":\"get_time\",\"arguments\":{\"expr\":\"1\"}}}", 0 },
+        { "{\"tool\":{\"name\":\"nope\",\"arguments\":{}}}", 0 },
+        { "{\"tool\":{\"arguments\":{},\"name\":\"math\"}}", 0 }));
+
+    // before a call opens, text runs free and nothing forces the end
+    const char * err = NULL;
+    sl_vocab_trie * trie = sl_vocab_trie_build(&f->vocab);
+    sl_constraint * c = sl_constraint_create(trie, LLM_CONSTRAINT_TOOL_CALL, tools, &err);
+    const char * free_text = "plain text, {\"not\": a call} :)";
+    const walk_result r = walk(f, c, free_text, 0);
+    if (r.consumed != (int)strlen(free_text) || r.eog_only || r.stuck) {
+        fprintf(stderr, "tool_call: free text stopped after %d bytes\n", r.consumed);
+        failures += 1;
+    }
+    sl_constraint_release(c);
+
+    // malformed specs are refused with a message
+    static const struct { int kind; const char * spec; } bad[] = {
+        { LLM_CONSTRAINT_JSON, "{nope" },
+        { LLM_CONSTRAINT_JSON, "[1," },
+        { LLM_CONSTRAINT_TOOL_CALL, "[{\"x\":1}]" },
+        { LLM_CONSTRAINT_TOOL_CALL, "{\"name\":\"x\"}" },
+    };
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i) {
+        err = NULL;
+        c = sl_constraint_create(trie, bad[i].kind, bad[i].spec, &err);
+        if (c || !err) {
+            fprintf(stderr, "spec '%s' compiled\n", bad[i].spec);
+            failures += 1;
+        }
+        sl_constraint_release(c);
+    }
+    sl_vocab_trie_free(trie);
+    return failures;
+}
+
+// No token can continue the value: sampling must stop (and say why) instead of going free.
+static int run_dead_ends(void) {
+    vocab_fixture f;
+    vocab_init(&f, "{}\":,tolnamerg_iu"); // no digits, no whitespace
+    static const struct { const char * name; int kind; const char * spec; const char * prefix; } cases[] = {
+        { "integer_without_digits", LLM_CONSTRAINT_JSON, "{\"type\":\"integer\"}", "" },
+        { "tool_name_without_its_bytes", LLM_CONSTRAINT_TOOL_CALL, "[{\"name\":\"xyz\",\"parameters\":{}}]",
+          "{\"tool\":{\"name\":\"" },
+    };
+    int failures = 0;
+    sl_vocab_trie * trie = sl_vocab_trie_build(&f.vocab);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        const char * err = NULL;
+        sl_constraint * c = sl_constraint_create(trie, cases[i].kind, cases[i].spec, &err);
+        const walk_result r = c ? walk(&f, c, cases[i].prefix, 0) : (walk_result){ 0, false, false };
+        // the prefix goes through; the next sample has nothing to draw from
+        if (!c || r.consumed != (int)strlen(cases[i].prefix) || r.eog_only || !r.stuck) {
+            fprintf(stderr, "%s: %d bytes through, stuck %d\n", cases[i].name, r.consumed, r.stuck);
+            failures += 1;
+        }
+        sl_constraint_release(c);
+    }
+    sl_vocab_trie_free(trie);
+    return failures;
+}
+
+int main(void) {
+    vocab_fixture f;
+    vocab_init(&f, NULL);
+    int failures = 0;
+    failures += run_keywords(&f);
+    failures += run_tool_calls(&f);
+    failures += run_dead_ends();
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
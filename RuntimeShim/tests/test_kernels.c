@@ -0,0 +1,133 @@
+// test_kernels.c
+//
+// The dispatched argmax/top-k and bias-add kernels must agree exactly with the scalar
+// reference, including ties, NaNs, -inf and tails shorter than a vector; the fused
+// log-sum-exp must agree to float rounding.
+
+#include "sonified_kernels.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t g_rng = 12345u;
+static uint32_t next_u32(void) {
+    g_rng ^= g_rng << 13; g_rng ^= g_rng >> 17; g_rng ^= g_rng << 5;
+    return g_rng;
+}
+
+static int32_t gcd(int32_t a, int32_t b) {
+    while (b) { int32_t t = a % b; a = b; b = t; }
+    return a;
+}
+
+static int check_row(const float * x, int32_t n, int32_t k) {
+    int32_t a = sl_argmax_f32(x, n);
+    int32_t b = sl_argmax_f32_scalar(x, n);
+    if (a != b) {
+        fprintf(stderr, "argmax mismatch n=%d: got %d want %d\n", n, a, b);
+        return 1;
+    }
+    int32_t ia[64], ib[64];
+    float va[64], vb[64];
+    int32_t ca = sl_topk_f32(x, n, k, ia, va);
+    int32_t cb = sl_topk_f32_scalar(x, n, k < n ? k : n, ib, vb);
+    if (ca != cb) {
+        fprintf(stderr, "topk count mismatch n=%d k=%d: %d vs %d\n", n, k, ca, cb);
+        return 1;
+    }
+    for (int32_t i = 0; i < ca; ++i) {
+        if (ia[i] != ib[i] || va[i] != vb[i]) {
+            fprintf(stderr, "topk mismatch n=%d k=%d at %d: (%d,%f) vs (%d,%f)\n", n, k, i, ia[i], va[i], ib[i], vb[i]);
+            return 1;
+        }
+        if (i > 0 && va[i] > va[i - 1]) {
+            fprintf(stderr, "topk not sorted n=%d k=%d at %d\n", n, k, i);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int check_logsumexp(const float * x, int32_t n, int32_t k) {
+    int32_t ia[64], ib[64];
+    float va[64], vb[64], la = 0.0f, lb = 0.0f;
+    int32_t ca = sl_logsumexp_topk_f32(x, n, k, ia, va, &la);
+    int32_t cb = sl_logsumexp_topk_f32_scalar(x, n, k < n ? k : n, ib, vb, &lb);
+    if (ca != cb || memcmp(ia, ib, sizeof(int32_t) * (size_t)ca) != 0 || memcmp(va, vb, sizeof(float) * (size_t)ca) != 0) {
+        fprintf(stderr, "logsumexp top-k mismatch n=%d k=%d\n", n, k);
+        return 1;
+    }
+    const int same = (isinf(la) && la == lb) || fabsf(la - lb) <= 1e-5f * fmaxf(1.0f, fabsf(lb));
+    if (!same) {
+        fprintf(stderr, "logsumexp mismatch n=%d: got %.9g want %.9g\n", n, la, lb);
+        return 1;
+    }
+    return 0;
+}
+
+// Dense and sparse adds of a bias to a row; y doubles as the sparse values.
+static int check_add(const float * x, const float * y, int32_t n, int32_t * idx, float * a, float * b) {
+    memcpy(a, x, sizeof(float) * (size_t)n);
+    memcpy(b, x, sizeof(float) * (size_t)n);
+    sl_add_f32(a, y, n);
+    sl_add_f32_scalar(b, y, n);
+    if (memcmp(a, b, sizeof(float) * (size_t)n) != 0) {
+        fprintf(stderr, "add mismatch n=%d\n", n);
+        return 1;
+    }
+    // distinct indices: a random stride coprime to n walks a permutation
+    int32_t m = 1 + (int32_t)(next_u32() % (uint32_t)n), step = 1 + (int32_t)(next_u32() % (uint32_t)n);
+    while (gcd(step, n) != 1) ++step;
+    for (int32_t i = 0; i < m; ++i) idx[i] = (int32_t)(((int64_t)i * step) % n);
+    memcpy(a, x, sizeof(float) * (size_t)n);
+    memcpy(b, x, sizeof(float) * (size_t)n);
+    sl_scatter_add_f32(a, idx, y, m);
+    sl_scatter_add_f32_scalar(b, idx, y, m);
+    if (memcmp(a, b, sizeof(float) * (size_t)n) != 0) {
+        fprintf(stderr, "scatter add mismatch n=%d m=%d\n", n, m);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    printf("kernels isa: %s\n", sl_kernels_isa());
+    int failures = 0;
+    float * x = (float *)malloc(sizeof(float) * 5000);
+    float * y = (float *)malloc(sizeof(float) * 5000);
+    float * a = (float *)malloc(sizeof(float) * 5000);
+    float * b = (float *)malloc(sizeof(float) * 5000);
+    int32_t * idx = (int32_t *)malloc(sizeof(int32_t) * 5000);
+    for (int iter = 0; iter < 2000; ++iter) {
+        int32_t n = 1 + (int32_t)(next_u32() % 4999);
+        int32_t k = 1 + (int32_t)(next_u32() % 64);
+        int mode = (int)(next_u32() % 4);
+        for (int32_t i = 0; i < n; ++i) {
+            switch (mode) {
+            case 0: x[i] = (float)(next_u32() % 100000) / 1000.0f - 50.0f; break;
+            case 1: x[i] = (float)(next_u32() % 8); break;                 // heavy ties
+            case 2: x[i] = (next_u32() % 7 == 0) ? NAN : (float)(next_u32() % 1000); break;
+            default: x[i] = (next_u32() % 3 == 0) ? -INFINITY : -(float)(next_u32() % 50); break;
+            }
+        }
+        for (int32_t i = 0; i < n; ++i) {
+            y[i] = (next_u32() % 5 == 0) ? -INFINITY : (float)(next_u32() % 1600) / 100.0f - 8.0f; // bans and biases
+        }
+        failures += check_row(x, n, k);
+        failures += check_logsumexp(x, n, (int32_t)(next_u32() % 21)); // k = 0 is the lse alone
+        failures += check_add(x, y, n, idx, a, b);
+        if (failures > 10) break;
+    }
+    free(x);
+    free(y);
+    free(a);
+    free(b);
+    free(idx);
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,225 @@
+// test_prefix.c
+//
+// The scheduler's prefix cache against a stub KV cache: llama_kv_self_seq_cp and
+// llama_kv_self_seq_rm move token ids between per-sequence arrays, so every hit can be
+// checked against the prompt it claims to share. Covers hits and misses (and their
+// counters), the last prompt token always left to decode, extending a cached chain in
+// place, least-recently-used eviction under the page budget, and the token comparison that
+// rejects a chain-hash collision. sonified_prefix.c is included rather than linked so the
+// collision case can plant a colliding hash; nothing else touches its internals.
+
+#include "../src/sonified_prefix.c"
+#include <stdio.h>
+
+enum { N_SEQ = 8, N_POS = 1024, PAGE = SL_PREFIX_PAGE };
+
+// ---- stub KV cache (the llama.cpp calls sonified_prefix.c makes) ----
+
+static llama_token g_kv[N_SEQ][N_POS];
+static int         g_len[N_SEQ];  // positions 0 .. len-1 are held
+static int         g_bad_calls;   // copies from cells a sequence does not hold, or leaving a gap
+static int         g_copies;
+static int         g_last_src;
+
+void llama_kv_self_seq_cp(struct llama_context * ctx, llama_seq_id src, llama_seq_id dst, llama_pos p0, llama_pos p1) {
+    g_copies += 1;
+    g_last_src = src;
+    if (src < 0 || src >= N_SEQ || dst < 0 || dst >= N_SEQ || p0 < 0 || p1 > g_len[src] || p0 > g_len[dst]) {
+        g_bad_calls += 1;
+        return;
+    }
+    memcpy(&g_kv[dst][p0], &g_kv[src][p0], sizeof(llama_token) * (size_t)(p1 - p0));
+    if (p1 > g_len[dst]) g_len[dst] = p1;
+}
+
+bool llama_kv_self_seq_rm(struct llama_context * ctx, llama_seq_id seq, llama_pos p0, llama_pos p1) {
+    if (seq < 0 || seq >= N_SEQ || p0 != -1 || p1 != -1) {
+        g_bad_calls += 1;
+        return false;
+    }
+    g_len[seq] = 0;
+    return true;
+}
+
+// ---- harness ----
+
+static int g_ctx_storage;
+#define CTX ((struct llama_context *)&g_ctx_storage)
+
+// Decoding a prompt into seq: the cells the cache later copies from.
+static void decode(int seq, const llama_token * tokens, int n) {
+    memcpy(g_kv[seq], tokens, sizeof(llama_token) * (size_t)n);
+    g_len[seq] = n;
+}
+
+static void clear_seq(int seq) { g_len[seq] = 0; }
+
+// A fresh cache comes with a fresh context: no sequence holds anything.
+static sl_prefix_cache * create(int n_seqs, int budget_tokens) {
+    memset(g_len, 0, sizeof(g_len));
+    return sl_prefix_create(CTX, 4, n_seqs, budget_tokens);
+}
+
+static void fill(llama_token * t, int n, int seed) {
+    for (int i = 0; i < n; ++i) t[i] = (llama_token)(seed * 7919 + i * 31) % 32000;
+}
+
+// Looks up tokens[0..n) into the scratch sequence 0 and checks the copied cells match.
+static int lookup(sl_prefix_cache * c, const llama_token * tokens, int n) {
+    clear_seq(0);
+    const int got = sl_prefix_lookup(c, tokens, n, 0);
+    if (got > 0 && (g_len[0] < got || memcmp(g_kv[0], tokens, sizeof(llama_token) * (size_t)got) != 0)) {
+        fprintf(stderr, "lookup copied cells that do not match the prompt\n");
+        g_bad_calls += 1;
+    }
+    return got;
+}
+
+static int expect(const char * what, int got, int want) {
+    if (got == want) return 0;
+    fprintf(stderr, "%s: %d, want %d\n", what, got, want);
+    return 1;
+}
+
+static int expect_counters(const char * what, const sl_prefix_cache * c, int hits, int misses) {
+    int h = 0, m = 0;
+    sl_prefix_counters(c, &h, &m);
+    if (h == hits && m == misses) return 0;
+    fprintf(stderr, "%s: %d hits %d misses, want %d and %d\n", what, h, m, hits, misses);
+    return 1;
+}
+
+static int run_hits_and_misses(void) {
+    int failures = 0;
+    llama_token a[4 * PAGE], b[4 * PAGE];
+    fill(a, 4 * PAGE, 1);
+    fill(b, 4 * PAGE, 2);
+    sl_prefix_cache * c = create(2, 4 * PAGE);
+    if (!c) return 1;
+
+    failures += expect("one page is too short to count", lookup(c, a, PAGE), 0);
+    failures += expect_counters("short prompt", c, 0, 0);
+    failures += expect("empty cache", lookup(c, a, 2 * PAGE + 2), 0);
+    failures += expect_counters("empty cache", c, 0, 1);
+
+    decode(1, a, 2 * PAGE + 2);
+    sl_prefix_insert(c, a, 2 * PAGE + 2, 1);
+    failures += expect("same prompt", lookup(c, a, 2 * PAGE + 2), 2 * PAGE);
+    failures += expect_counters("same prompt", c, 1, 1);
+    // the last prompt token is always decoded, so an exact two-page prompt reuses one page
+    failures += expect("exactly two pages", lookup(c, a, 2 * PAGE), PAGE);
+    failures += expect("two pages and one token", lookup(c, a, 2 * PAGE + 1), 2 * PAGE);
+    failures += expect("longer prompt", lookup(c, a, 4 * PAGE), 2 * PAGE);
+    failures += expect("other prompt", lookup(c, b, 4 * PAGE), 0);
+    failures += expect_counters("after lookups", c, 4, 2);
+
+    // a prompt that diverges inside the second page shares only the first
+    llama_token d[3 * PAGE];
+    memcpy(d, a, sizeof(d));
+    d[PAGE + 5] += 1;
+    failures += expect("diverging prompt", lookup(c, d, 3 * PAGE), PAGE);
+    sl_prefix_free(c);
+    return failures;
+}
+
+static int run_extend(void) {
+    int failures = 0;
+    llama_token a[4 * PAGE];
+    fill(a, 4 * PAGE, 3);
+    sl_prefix_cache * c = create(2, 4 * PAGE);
+    if (!c) return 1;
+
+    decode(1, a, 2 * PAGE);
+    sl_prefix_insert(c, a, 2 * PAGE, 1);
+    // a later prompt continuing the cached one grows the same entry, copying only new pages
+    decode(1, a, 3 * PAGE + 3);
+    const int copies = g_copies;
+    sl_prefix_insert(c, a, 3 * PAGE + 3, 1);
+    failures += expect("copies to extend", g_copies - copies, 1);
+    failures += expect("extended sequence length", g_len[4], 3 * PAGE);
+    failures += expect("second sequence stays free", g_len[5], 0);
+    failures += expect("extended prefix", lookup(c, a, 4 * PAGE), 3 * PAGE);
+    failures += expect("served from the extended entry", g_last_src, 4);
+    failures += expect("pages in use", c->used_pages, 3);
+
+    // inserting a prefix that is already cached copies nothing
+    const int before = g_copies;
+    sl_prefix_insert(c, a, 2 * PAGE, 1);
+    failures += expect("copies for a cached prefix", g_copies - before, 0);
+    sl_prefix_free(c);
+    return failures;
+}
+
+static int run_eviction(void) {
+    int failures = 0;
+    llama_token a[3 * PAGE], b[3 * PAGE], x[3 * PAGE], big[6 * PAGE];
+    fill(a, 3 * PAGE, 4);
+    fill(b, 3 * PAGE, 5);
+    fill(x, 3 * PAGE, 6);
+    fill(big, 6 * PAGE, 7);
+    sl_prefix_cache * c = create(3, 4 * PAGE); // three sequences, four pages
+    if (!c) return 1;
+
+    decode(1, a, 2 * PAGE);
+    sl_prefix_insert(c, a, 2 * PAGE, 1);
+    decode(1, b, 2 * PAGE);
+    sl_prefix_insert(c, b, 2 * PAGE, 1);
+    failures += expect("budget filled", c->used_pages, 4);
+    failures += expect("touch a", lookup(c, a, 2 * PAGE + 1), 2 * PAGE);
+
+    // one more page: b is the least recently used and goes, a stays
+    decode(1, x, PAGE);
+    sl_prefix_insert(c, x, PAGE, 1);
+    failures += expect("a survives", lookup(c, a, 2 * PAGE + 1), 2 * PAGE);
+    failures += expect("b evicted", lookup(c, b, 2 * PAGE + 1), 0);
+    failures += expect("x cached", lookup(c, x, PAGE + 1), PAGE);
+    failures += expect("pages in use after eviction", c->used_pages, 3);
+    int held = 0;
+    for (int s = 4; s < 7; ++s) held += g_len[s];
+    failures += expect("evicted cells released", held, 3 * PAGE);
+
+    // a prompt larger than the whole budget is not cached and evicts nothing
+    decode(1, big, 6 * PAGE);
+    sl_prefix_insert(c, big, 6 * PAGE, 1);
+    failures += expect("oversized prompt", lookup(c, big, 6 * PAGE), 0);
+    failures += expect("a still cached", lookup(c, a, 2 * PAGE + 1), 2 * PAGE);
+    sl_prefix_free(c);
+    return failures;
+}
+
+// Pages whose chain hash matches a cached entry's must still match token for token.
+static int run_collision(void) {
+    int failures = 0;
+    llama_token a[3 * PAGE], d[3 * PAGE];
+    fill(a, 3 * PAGE, 8);
+    fill(d, 3 * PAGE, 9);
+    sl_prefix_cache * c = create(1, 4 * PAGE);
+    if (!c) return 1;
+    decode(1, a, 2 * PAGE);
+    sl_prefix_insert(c, a, 2 * PAGE, 1);
+    uint64_t * h = chain_hashes(d, 2);
+    if (!h) return 1;
+    memcpy(c->entries[0].hashes, h, sizeof(uint64_t) * 2); // entry now claims d's hashes
+    free(h);
+    const int copies = g_copies;
+    failures += expect("colliding prompt", lookup(c, d, 2 * PAGE + 1), 0);
+    failures += expect("copies on a collision", g_copies - copies, 0);
+    failures += expect_counters("collision", c, 0, 1);
+    sl_prefix_free(c);
+    return failures;
+}
+
+int main(void) {
+    int failures = 0;
+    failures += run_hits_and_misses();
+    failures += run_extend();
+    failures += run_eviction();
+    failures += run_collision();
+    failures += expect("bad KV calls", g_bad_calls, 0);
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
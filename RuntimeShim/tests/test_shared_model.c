@@ -0,0 +1,88 @@
+// test_shared_model.c
+//
+// Two handles on the same GGUF must share one copy of the weights: opening the second
+// handle may grow RSS by its own context (KV cache plus compute buffers), never by the
+// model again. Needs SONIFIED_TEST_MODEL=/path/to/model.gguf; skipped (77) otherwise.
+
+#include "sonified_llama.h"
+#include "sonified_platform.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+enum { TEST_CTX = 1024, TEST_SKIP = 77 };
+static const double COMPUTE_ALLOWANCE_MB = 512.0; // scratch/output buffers of one context
+
+static void noop_cb(const char * t, void * u) { (void)t; (void)u; }
+
+static double mb(size_t bytes) { return (double)bytes / (1024.0 * 1024.0); }
+
+static llm_handle_t open_and_run(const char * path) {
+    llm_init_params_t p = llm_init_params_default();
+    p.n_ctx = TEST_CTX;
+    p.n_batch = 512;
+    p.use_mmap = 0; // weights in anonymous memory, so a second copy would show in RSS
+    llm_handle_t h = llm_init_ex(path, &p);
+    if (!h) return NULL;
+    llm_gen_opts_t o = {0};
+    o.max_tokens = 4;
+    if (llm_eval(h, "Hello", &o, noop_cb, NULL) != 0) {
+        llm_free(h);
+        return NULL;
+    }
+    return h;
+}
+
+int main(void) {
+    const char * path = getenv("SONIFIED_TEST_MODEL");
+    if (!path || !*path) {
+        printf("SONIFIED_TEST_MODEL not set; skipping\n");
+        return TEST_SKIP;
+    }
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "cannot stat %s\n", path);
+        return 1;
+    }
+    const double model_mb = mb((size_t)st.st_size);
+
+    const size_t rss0 = sl_current_rss_bytes();
+    llm_handle_t a = open_and_run(path);
+    const size_t rss1 = sl_current_rss_bytes();
+    llm_handle_t b = open_and_run(path);
+    const size_t rss2 = sl_current_rss_bytes();
+    if (!a || !b) {
+        fprintf(stderr, "llm_init_ex/llm_eval failed: %s\n", llm_last_error_message());
+        return 1;
+    }
+    // the KV cache the second handle allocated, as the shim reports it
+    llm_stats_t stats;
+    if (llm_stats(b, &stats) != 0 || stats.kv_cache_bytes <= 0) {
+        fprintf(stderr, "llm_stats reported no KV cache size\n");
+        return 1;
+    }
+    const double kv_mb = mb((size_t)stats.kv_cache_bytes);
+    const double first_mb = mb(rss1 - rss0);
+    const double second_mb = rss2 > rss1 ? mb(rss2 - rss1) : 0.0;
+    printf("model %.0f MB, kv cache %.0f MB, first handle +%.0f MB, second handle +%.0f MB\n",
+           model_mb, kv_mb, first_mb, second_mb);
+
+    int failures = 0;
+    if (second_mb > kv_mb + COMPUTE_ALLOWANCE_MB) {
+        fprintf(stderr, "second handle grew RSS by %.0f MB, more than its context (%.0f MB + %.0f MB)\n",
+                second_mb, kv_mb, COMPUTE_ALLOWANCE_MB);
+        failures += 1;
+    }
+
+    // the weights must outlive the handle that loaded them
+    llm_free(a);
+    llm_gen_opts_t o = {0};
+    o.max_tokens = 4;
+    if (llm_eval(b, "Hello again", &o, noop_cb, NULL) != 0) {
+        fprintf(stderr, "eval on the surviving handle failed\n");
+        failures += 1;
+    }
+    llm_free(b);
+    return failures ? 1 : 0;
+}
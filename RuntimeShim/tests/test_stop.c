@@ -0,0 +1,212 @@
+// test_stop.c
+//
+// Output reaches sl_stop_feed in pieces cut at arbitrary byte offsets. For every case the
+// text is fed whole, byte by byte and in random pieces, and the emitted bytes (each piece
+// up to *keep once a condition fires) must end exactly where a whole-text reference says:
+// at the earliest end of any stop string, or at the brace that closes a {"tool": call.
+
+#include "sonified_stop.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { SPLIT_RUNS = 200 };
+
+static uint32_t g_rng = 1779033703u;
+static uint32_t next_u32(void) {
+    g_rng ^= g_rng << 13; g_rng ^= g_rng >> 17; g_rng ^= g_rng << 5;
+    return g_rng;
+}
+
+// Earliest end of any of the strings in text, or -1.
+static int reference_end(const char * text, int len, const char * const * stop, int n_stop) {
+    for (int e = 1; e <= len; ++e) {
+        for (int k = 0; k < n_stop; ++k) {
+            const int n = (int)strlen(stop[k]);
+            if (n > 0 && e >= n && memcmp(text + e - n, stop[k], (size_t)n) == 0) return e;
+        }
+    }
+    return -1;
+}
+
+// Feed text cut by mode (0 whole, 1 byte by byte, 2 random) and return the bytes emitted
+// before the stop, or len when nothing stopped; *reason gets sl_stop_feed's result.
+static int feed(const llm_gen_opts_t * opts, const char * text, int len, int mode, int * reason) {
+    sl_stop s;
+    if (sl_stop_init(&s, opts) != 0) return -2;
+    int off = 0;
+    *reason = 0;
+    while (off < len) {
+        int n = mode == 0 ? len - off : mode == 1 ? 1 : 1 + (int)(next_u32() % 9);
+        if (n > len - off) n = len - off;
+        int keep = n;
+        *reason = sl_stop_feed(&s, text + off, n, &keep);
+        if (*reason) {
+            off += keep;
+            break;
+        }
+        off += n;
+    }
+    sl_stop_free(&s);
+    return off;
+}
+
+static int check(const char * name, const llm_gen_opts_t * opts, const char * text, int len, int want_end, int want_reason) {
+    int failures = 0;
+    for (int run = 0; run < SPLIT_RUNS && failures == 0; ++run) {
+        const int mode = run < 2 ? run : 2;
+        int reason = 0;
+        const int end = feed(opts, text, len, mode, &reason);
+        const int expect = want_end >= 0 ? want_end : len;
+        if (end != expect || reason != (want_end >= 0 ? want_reason : 0)) {
+            fprintf(stderr, "%s: split mode %d stopped at %d (reason %d), want %d (reason %d)\n",
+                    name, mode, end, reason, expect, want_end >= 0 ? want_reason : 0);
+            failures += 1;
+        }
+    }
+    return failures;
+}
+
+static int run_strings(void) {
+    static const char * const single[] = { "</answer>" };
+    static const char * const overlap[] = { "aab", "ab", "abab" };
+    static const char * const nested[] = { "world!", "lo w" };
+    static const char * const prefix[] = { "stop", "stopping" };
+    static const struct {
+        const char * name;
+        const char * const * stop;
+        int n_stop;
+        const char * text;
+    } cases[] = {
+        { "single", single, 1, "the answer is 42</answer> and then more" },
+        { "single_absent", single, 1, "the answer is 42</answe r>" },
+        { "overlap", overlap, 3, "xaaaab tail" },
+        { "overlap_repeat", overlap, 3, "bbaba bab abab" },
+        { "nested", nested, 2, "hello world! bye" },
+        { "prefix", prefix, 2, "keep stopping now" },
+        { "at_start", prefix, 2, "stop" },
+    };
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        llm_gen_opts_t opts;
+        memset(&opts, 0, sizeof(opts));
+        opts.stop = cases[i].stop;
+        opts.n_stop = cases[i].n_stop;
+        const int len = (int)strlen(cases[i].text);
+        const int want = reference_end(cases[i].text, len, cases[i].stop, cases[i].n_stop);
+        failures += check(cases[i].name, &opts, cases[i].text, len, want, LLM_STOP_STRING);
+    }
+    return failures;
+}
+
+static int run_tool_calls(void) {
+    static const struct {
+        const char * name;
+        const char * before;
+        const char * call;   // the stop lands right after it
+        const char * after;
+    } cases[] = {
+        { "flat", "Let me check. ", "{\"tool\":{\"name\":\"clock\",\"arguments\":{}}}", " extra" },
+        { "nested", "", "{\"tool\":{\"name\":\"q\",\"arguments\":{\"a\":{\"b\":{\"c\":[1,{\"d\":2}]}}}}}", "}}}" },
+        { "braces_in_string", "ok ", "{\"tool\":{\"name\":\"echo\",\"arguments\":{\"text\":\"}}{ }\"}}}", "}" },
+        { "escaped_quote", "", "{\"tool\":{\"name\":\"echo\",\"arguments\":{\"text\":\"say \\\"}\\\" now\"}}}", " done" },
+        { "escaped_backslash", "", "{\"tool\":{\"name\":\"p\",\"arguments\":{\"path\":\"C:\\\\\"}}}", "\"}" },
+        { "marker_after_brace", "{{", "{\"tool\":{\"name\":\"x\",\"arguments\":{}}}", "" },
+    };
+    llm_gen_opts_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.stop_tool_call = 1;
+    int failures = 0;
+    char text[512];
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        const int len = snprintf(text, sizeof(text), "%s%s%s", cases[i].before, cases[i].call, cases[i].after);
+        const int want = (int)(strlen(cases[i].before) + strlen(cases[i].call));
+        failures += check(cases[i].name, &opts, text, len, want, LLM_STOP_TOOL_CALL);
+    }
+    // braces without the marker never stop
+    const char * plain = "{\"tools\":{}} {\"name\":\"x\"}";
+    failures += check("no_marker", &opts, plain, (int)strlen(plain), -1, 0);
+
+    // a stop string inside the call ends output first
+    static const char * const stop[] = { "\"name\"" };
+    opts.stop = stop;
+    opts.n_stop = 1;
+    const char * both = "{\"tool\":{\"name\":\"x\",\"arguments\":{}}}";
+    failures += check("string_first", &opts, both, (int)strlen(both), reference_end(both, (int)strlen(both), stop, 1), LLM_STOP_STRING);
+    return failures;
+}
+
+// A call longer than ToolCallDetector's 32 KiB buffer is abandoned; a later call still stops.
+static int run_tool_cap(void) {
+    const char * open = "{\"tool\":{\"name\":\"big\",\"arguments\":{\"s\":\"";
+    const char * close = "\"}}}";
+    const char * next = " {\"tool\":{\"name\":\"small\",\"arguments\":{}}}";
+    const int fill = 40 * 1024;
+    const int cap = 32 * 1024;
+    const size_t n_open = strlen(open), n_close = strlen(close), n_next = strlen(next);
+    char * text = (char *)malloc(n_open + (size_t)fill + n_close + n_next + 1);
+    if (!text) return 1;
+    llm_gen_opts_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.stop_tool_call = 1;
+    int failures = 0;
+
+    // just under the cap: the call closes and stops
+    const int under = cap - (int)(n_open + n_close);
+    memcpy(text, open, n_open);
+    memset(text + n_open, 'x', (size_t)under);
+    memcpy(text + n_open + under, close, n_close);
+    int len = (int)(n_open + (size_t)under + n_close);
+    failures += check("cap_under", &opts, text, len, len, LLM_STOP_TOOL_CALL);
+
+    // over the cap: the first call is dropped, the one after it stops
+    memset(text + n_open, 'x', (size_t)fill);
+    memcpy(text + n_open + fill, close, n_close);
+    memcpy(text + n_open + fill + n_close, next, n_next);
+    len = (int)(n_open + (size_t)fill + n_close + n_next);
+    failures += check("cap_over", &opts, text, len, len, LLM_STOP_TOOL_CALL);
+    free(text);
+    return failures;
+}
+
+static int run_limits(void) {
+    int failures = 0;
+    llm_gen_opts_t opts;
+    memset(&opts, 0, sizeof(opts));
+    sl_stop s;
+    const char * many[SL_STOP_MAX + 1];
+    for (int i = 0; i <= SL_STOP_MAX; ++i) many[i] = "x";
+    opts.stop = many;
+    opts.n_stop = SL_STOP_MAX + 1;
+    if (sl_stop_init(&s, &opts) != -1) failures += 1;
+    char long_str[SL_STOP_LEN_MAX + 2];
+    memset(long_str, 'y', sizeof(long_str) - 1);
+    long_str[sizeof(long_str) - 1] = '\0';
+    const char * one[] = { long_str };
+    opts.stop = one;
+    opts.n_stop = 1;
+    if (sl_stop_init(&s, &opts) != -1) failures += 1;
+    // empty strings never stop and leave the condition inactive
+    const char * empty[] = { "", NULL };
+    opts.stop = empty;
+    opts.n_stop = 2;
+    if (sl_stop_init(&s, &opts) != 0 || sl_stop_active(&s)) failures += 1;
+    sl_stop_free(&s);
+    if (failures) fprintf(stderr, "limits: %d failures\n", failures);
+    return failures;
+}
+
+int main(void) {
+    int failures = 0;
+    failures += run_strings();
+    failures += run_tool_calls();
+    failures += run_tool_cap();
+    failures += run_limits();
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
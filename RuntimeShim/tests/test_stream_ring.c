@@ -0,0 +1,167 @@
+// test_stream_ring.c
+//
+// A producer thread writes numbered pieces while the consumer drains with random stalls.
+// BLOCK and GROW must deliver every byte in order; DROP must deliver an in-order
+// subsequence of whole pieces whose size plus the drop count is the number written.
+// Every read must end on a code point boundary. sl_ring_read_batch must return as soon as
+// min_pieces writes are buffered and whatever is buffered once it times out.
+
+#include "sonified_llama.h"
+#include "sonified_ring.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+enum { N_PIECES = 20000 };
+
+static const char * const k_policy[] = { "block", "drop", "grow" };
+
+typedef struct producer {
+    sl_ring * ring;
+    _Atomic bool abort;
+    int written;
+} producer;
+
+// "<i>é€𝄞;" for odd i, "<i>;" otherwise: numbered, with multi-byte characters in the mix.
+static int make_piece(int i, char * out) {
+    return snprintf(out, 64, (i & 1) ? "%d\xc3\xa9\xe2\x82\xac\xf0\x9d\x84\x9e;" : "%d;", i);
+}
+
+static void * produce(void * arg) {
+    producer * p = (producer *)arg;
+    char piece[64];
+    for (int i = 0; i < N_PIECES; ++i) {
+        const int n = make_piece(i, piece);
+        if (sl_ring_write(p->ring, piece, n, &p->abort) < 0) break;
+        p->written += 1;
+    }
+    sl_ring_close(p->ring);
+    return NULL;
+}
+
+static uint32_t g_rng = 88172645u;
+static uint32_t next_u32(void) {
+    g_rng ^= g_rng << 13; g_rng ^= g_rng >> 17; g_rng ^= g_rng << 5;
+    return g_rng;
+}
+
+static int ends_on_boundary(const unsigned char * s, int n) {
+    int i = n - 1, cont = 0;
+    while (i >= 0 && (s[i] & 0xC0) == 0x80) { --i; ++cont; }
+    if (i < 0) return cont == 0;
+    const int want = s[i] < 0x80 ? 1 : (s[i] & 0xE0) == 0xC0 ? 2 : (s[i] & 0xF0) == 0xE0 ? 3 : 4;
+    return cont + 1 == want;
+}
+
+static int run(int policy) {
+    producer p;
+    memset(&p, 0, sizeof(p));
+    p.ring = sl_ring_create(256, policy);
+    if (!p.ring) return 1;
+    pthread_t th;
+    pthread_create(&th, NULL, produce, &p);
+
+    size_t cap = 1 << 20, len = 0;
+    char * got = (char *)malloc(cap);
+    char buf[512];
+    int failures = 0;
+    for (;;) {
+        const int n = sl_ring_read(p.ring, buf, 4 + (int)(next_u32() % (sizeof(buf) - 4)), 50);
+        if (n < 0) break;
+        if (n > 0 && !ends_on_boundary((const unsigned char *)buf, n)) failures += 1;
+        memcpy(got + len, buf, (size_t)n);
+        len += (size_t)n;
+        if (next_u32() % 64 == 0) {
+            struct timespec ts = { 0, (long)(next_u32() % 2000) * 1000L }; // slow consumer
+            nanosleep(&ts, NULL);
+        }
+    }
+    pthread_join(th, NULL);
+
+    // walk the pieces back out of the concatenation
+    char piece[64];
+    size_t off = 0;
+    int last = -1, seen = 0;
+    while (off < len && !failures) {
+        const int i = atoi(got + off);
+        const int n = make_piece(i, piece);
+        if (i <= last || off + (size_t)n > len || memcmp(got + off, piece, (size_t)n) != 0) {
+            fprintf(stderr, "%s: bad piece at byte %zu\n", k_policy[policy], off);
+            failures += 1;
+            break;
+        }
+        if (policy != LLM_STREAM_DROP && i != last + 1) {
+            fprintf(stderr, "%s: piece %d missing\n", k_policy[policy], last + 1);
+            failures += 1;
+        }
+        last = i;
+        seen += 1;
+        off += (size_t)n;
+    }
+    const long long dropped = sl_ring_dropped(p.ring);
+    if (!failures && (p.written != N_PIECES || seen + dropped != N_PIECES || (policy != LLM_STREAM_DROP && dropped))) {
+        fprintf(stderr, "%s: written %d, read %d, dropped %lld\n", k_policy[policy], p.written, seen, dropped);
+        failures += 1;
+    }
+    printf("%s: read %d pieces, dropped %lld\n", k_policy[policy], seen, dropped);
+    free(got);
+    sl_ring_free(p.ring);
+    return failures;
+}
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+static int run_batch(void) {
+    sl_ring * r = sl_ring_create(256, LLM_STREAM_BLOCK);
+    if (!r) return 1;
+    char buf[64];
+    int failures = 0;
+
+    // short of the batch: everything buffered comes back once the wait times out
+    for (int i = 0; i < 3; ++i) sl_ring_write(r, "ab", 2, NULL);
+    double t0 = now_ms();
+    int n = sl_ring_read_batch(r, buf, sizeof(buf), 4, 30);
+    if (n != 6 || now_ms() - t0 < 25.0) {
+        fprintf(stderr, "batch: short batch read %d after %.1f ms\n", n, now_ms() - t0);
+        failures += 1;
+    }
+    // a full batch since that read returns without waiting
+    for (int i = 0; i < 4; ++i) sl_ring_write(r, "cd", 2, NULL);
+    t0 = now_ms();
+    n = sl_ring_read_batch(r, buf, sizeof(buf), 4, 5000);
+    if (n != 8 || now_ms() - t0 > 1000.0) {
+        fprintf(stderr, "batch: full batch read %d after %.1f ms\n", n, now_ms() - t0);
+        failures += 1;
+    }
+    // nothing buffered: 0 after the wait, then end of stream once closed
+    if (sl_ring_read_batch(r, buf, sizeof(buf), 4, 10) != 0) failures += 1;
+    sl_ring_write(r, "e", 1, NULL);
+    sl_ring_close(r);
+    if (sl_ring_read_batch(r, buf, sizeof(buf), 4, 5000) != 1 || sl_ring_read_batch(r, buf, sizeof(buf), 4, 5000) != -1) {
+        fprintf(stderr, "batch: closed ring not drained\n");
+        failures += 1;
+    }
+    sl_ring_free(r);
+    return failures;
+}
+
+int main(void) {
+    int failures = 0;
+    failures += run(LLM_STREAM_BLOCK);
+    failures += run(LLM_STREAM_DROP);
+    failures += run(LLM_STREAM_GROW);
+    failures += run_batch();
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,154 @@
+// test_utf8_stream.c
+//
+// Byte-fallback tokens split code points at arbitrary byte offsets. Streamed through the
+// token sink (single and batched), every delivered piece must be valid, complete UTF-8 and
+// the concatenation must equal the generated bytes; invalid input must pass through intact.
+
+#include "sonified_emit.h"
+#include "sonified_utf8.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t g_rng = 2463534242u;
+static uint32_t next_u32(void) {
+    g_rng ^= g_rng << 13; g_rng ^= g_rng >> 17; g_rng ^= g_rng << 5;
+    return g_rng;
+}
+
+// Append one random code point (ASCII, 2-, 3- or 4-byte) to s.
+static int put_code_point(unsigned char * s) {
+    uint32_t cp;
+    switch (next_u32() % 4) {
+    case 0: cp = 0x20 + next_u32() % 0x5F; break;
+    case 1: cp = 0x80 + next_u32() % (0x800 - 0x80); break;
+    case 2: cp = 0x800 + next_u32() % (0x10000 - 0x800); if (cp >= 0xD800 && cp <= 0xDFFF) cp = 0x4E2D; break;
+    default: cp = 0x10000 + next_u32() % (0x110000 - 0x10000); break;
+    }
+    if (cp < 0x80) { s[0] = (unsigned char)cp; return 1; }
+    if (cp < 0x800) { s[0] = (unsigned char)(0xC0 | (cp >> 6)); s[1] = (unsigned char)(0x80 | (cp & 0x3F)); return 2; }
+    if (cp < 0x10000) {
+        s[0] = (unsigned char)(0xE0 | (cp >> 12));
+        s[1] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+        s[2] = (unsigned char)(0x80 | (cp & 0x3F));
+        return 3;
+    }
+    s[0] = (unsigned char)(0xF0 | (cp >> 18));
+    s[1] = (unsigned char)(0x80 | ((cp >> 12) & 0x3F));
+    s[2] = (unsigned char)(0x80 | ((cp >> 6) & 0x3F));
+    s[3] = (unsigned char)(0x80 | (cp & 0x3F));
+    return 4;
+}
+
+// Structural check: every lead byte is followed by exactly its continuation bytes.
+static int valid_utf8(const unsigned char * s, int n) {
+    for (int i = 0; i < n;) {
+        const unsigned char b = s[i];
+        const int want = b < 0x80 ? 1 : (b & 0xE0) == 0xC0 ? 2 : (b & 0xF0) == 0xE0 ? 3 : (b & 0xF8) == 0xF0 ? 4 : 0;
+        if (want == 0 || i + want > n) return 0;
+        for (int k = 1; k < want; ++k) if ((s[i + k] & 0xC0) != 0x80) return 0;
+        i += want;
+    }
+    return 1;
+}
+
+typedef struct capture {
+    unsigned char buf[8192];
+    int  len;
+    int  pieces;
+    int  check_valid;
+    int  bad;
+} capture;
+
+static void on_piece(capture * c, const char * p, int n) {
+    if (n <= 0) { c->bad += 1; return; } // empty deliveries are a bug too
+    if (c->check_valid && !valid_utf8((const unsigned char *)p, n)) c->bad += 1;
+    memcpy(c->buf + c->len, p, (size_t)n);
+    c->len += n;
+    c->pieces += 1;
+}
+
+static void single_cb(const char * token_utf8, void * user_ctx) {
+    on_piece((capture *)user_ctx, token_utf8, (int)strlen(token_utf8));
+}
+
+static void batch_cb(const char * utf8, const int * offsets, int n_tokens, void * user_ctx) {
+    for (int i = 0; i < n_tokens; ++i) on_piece((capture *)user_ctx, utf8 + offsets[i], offsets[i + 1] - offsets[i]);
+}
+
+// Split src into random 1..6 byte "tokens" and stream them through a sink.
+static int run_sink(const unsigned char * src, int n, int batched, int check_valid) {
+    capture c;
+    memset(&c, 0, sizeof(c));
+    c.check_valid = check_valid;
+    sl_token_sink sink;
+    int rc = batched ? sl_sink_init_batched(&sink, batch_cb, &c, 1 + (int)(next_u32() % 8), 1000000)
+                     : sl_sink_init_single(&sink, single_cb, &c);
+    if (rc != 0) return 1;
+    for (int i = 0; i < n;) {
+        int k = 1 + (int)(next_u32() % 6);
+        if (k > n - i) k = n - i;
+        if (sl_sink_push(&sink, (const char *)src + i, k) != 0) { sl_sink_free(&sink); return 1; }
+        i += k;
+    }
+    sl_sink_finish(&sink);
+    sl_sink_free(&sink);
+    if (c.bad) {
+        fprintf(stderr, "%s: %d invalid piece(s)\n", batched ? "batched" : "single", c.bad);
+        return 1;
+    }
+    if (c.len != n || memcmp(c.buf, src, (size_t)n) != 0) {
+        fprintf(stderr, "%s: output differs from input (%d vs %d bytes)\n", batched ? "batched" : "single", c.len, n);
+        return 1;
+    }
+    return 0;
+}
+
+// Arbitrary bytes (NUL excluded, as pieces are C strings): nothing lost, at most 3 held.
+static int run_invalid(const unsigned char * src, int n) {
+    sl_utf8_carry carry;
+    sl_utf8_carry_reset(&carry);
+    unsigned char out[8192 + 4];
+    int len = 0;
+    for (int i = 0; i < n;) {
+        int k = 1 + (int)(next_u32() % 6);
+        if (k > n - i) k = n - i;
+        len += sl_utf8_carry_feed(&carry, (const char *)src + i, k, (char *)out + len);
+        if (carry.len > 3) {
+            fprintf(stderr, "carry holds %d bytes\n", carry.len);
+            return 1;
+        }
+        i += k;
+    }
+    len += sl_utf8_carry_flush(&carry, (char *)out + len);
+    if (len != n || memcmp(out, src, (size_t)n) != 0) {
+        fprintf(stderr, "invalid input not passed through (%d vs %d bytes)\n", len, n);
+        return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    int failures = 0;
+    unsigned char src[4096 + 4];
+    for (int iter = 0; iter < 2000 && failures <= 10; ++iter) {
+        int n = 0;
+        const int target = 1 + (int)(next_u32() % 4096);
+        while (n < target) n += put_code_point(src + n);
+        failures += run_sink(src, n, iter & 1, 1);
+        // truncated stream (EOG mid code point): the tail is still delivered
+        const int cut = n - (int)(next_u32() % 3);
+        if (cut > 0) failures += run_sink(src, cut, iter & 1, 0);
+
+        n = 1 + (int)(next_u32() % 4096);
+        for (int i = 0; i < n; ++i) src[i] = (unsigned char)(1 + next_u32() % 255);
+        failures += run_invalid(src, n);
+    }
+    if (failures) {
+        fprintf(stderr, "%d failures\n", failures);
+        return 1;
+    }
+    printf("ok\n");
+    return 0;
+}
@@ -89,6 +89,29 @@ public final class HarmonyTurn: @unchecked Sendable {
         self.chatTemplateProvider = chatTemplateProvider
     }
 
+    /// The turn's options with the role tags `PromptBuilder.Harmony` writes banned where the
+    /// model has them as single tokens, so a reply cannot start the next turn itself. A bias
+    /// the caller set for a tag wins.
+    private func replyOptions() -> GenerateOptions {
+        var opts = options
+        for role in ["system", "user", "assistant", "tool"] {
+            guard let id = try? engine.tokenID(for: "<|\(role)|>") else { continue }
+            if opts.logitBias[id] == nil { opts.logitBias[id] = -.infinity }
+        }
+        return opts
+    }
+
+    /// Options for the leg that may call a tool: generation ends on the token closing the
+    /// call, and calls are held to the toolbox's schemas so they name a registered tool and
+    /// parse (a constraint set by the caller wins).
+    private func toolLegOptions() -> GenerateOptions {
+        var opts = replyOptions()
+        opts.stopOnToolCall = true
+        guard opts.constraint == nil, let schemas = toolbox?.toolSchemas(), !schemas.isEmpty else { return opts }
+        opts.constraint = .toolCall(schemas.map { (name: $0.name, parametersJSONSchema: $0.parametersJSONSchema) })
+        return opts
+    }
+
     /// Streams HarmonyEvents by adapting the base engine's streaming contract.
     public func stream() -> AsyncThrowingStream<HarmonyEvent, Error> {
         return AsyncThrowingStream { continuation in
@@ -103,12 +126,14 @@ public final class HarmonyTurn: @unchecked Sendable {
 
                     // First leg
                     let prompt1 = PromptBuilder.Harmony.render(system: systemPrompt, messages: messages, provider: chatTemplateProvider)
-                    let stream1 = engine.generate(prompt: prompt1, options: options)
-
+                    let legOptions = self.toolLegOptions()
                     var detector = ToolCallDetector()
+                    var deadEnd = false
                     // If we already captured from inline marker, skip parsing for tool JSON in first leg
 
-                    leg1: for try await ev in stream1 {
+                    // The loop owns the only reference to leg 1's stream: leaving it early releases the
+                    // stream, which cancels that generation alone (other conversations keep going).
+                    leg1: for try await ev in engine.generate(prompt: prompt1, options: legOptions) {
                         switch ev {
                         case .token(let t):
                             // Parse tokens for tool-call JSON if not already captured; stop at the first tool call
@@ -128,8 +153,15 @@ public final class HarmonyTurn: @unchecked Sendable {
                                 // Already captured tool; suppress further text from leg1
                             }
                         case .metrics(let m):
+                            deadEnd = deadEnd || m.stopReason == .constraintDeadEnd
                             continuation.yield(.metrics(m))
                         case .done:
+                            // The tool-call constraint ran out of tokens mid-call: the buffered
+                            // call is unchecked, so neither run it nor show it as text
+                            if deadEnd && capturedTool == nil {
+                                continuation.finish(throwing: HarmonyToolboxError.unfinishedToolCall)
+                                return
+                            }
                             // No tool call detected; flush trailing text and finish
                             let tail = detector.finish()
                             for d in tail {
@@ -141,8 +173,7 @@ public final class HarmonyTurn: @unchecked Sendable {
                         }
                     }
 
-                    // If we get here, a tool call was captured in leg1. Stop the first leg promptly.
-                    self.engine.cancelCurrent()
+                    // If we get here, a tool call was captured in leg1 (and leaving the loop stopped it).
 
                     // Resolve and invoke the tool once
                     let (toolName, rawArgs) = capturedTool!
@@ -180,7 +211,7 @@ public final class HarmonyTurn: @unchecked Sendable {
                     var followupMessages = self.messages
                     followupMessages.append(HarmonyMessage(role: .tool, content: toolResult.content, name: toolResult.name))
                     let prompt2 = PromptBuilder.Harmony.render(system: self.systemPrompt, messages: followupMessages, provider: self.chatTemplateProvider)
-                    let stream2 = self.engine.generate(prompt: prompt2, options: self.options)
+                    let stream2 = self.engine.generate(prompt: prompt2, options: self.replyOptions())
 
                     var detector2 = ToolCallDetector()
                     for try await ev in stream2 {
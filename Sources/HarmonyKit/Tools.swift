@@ -24,6 +24,8 @@ public enum HarmonyToolboxError: Error, Equatable {
     case duplicateToolName(String)
     case missingTool(String)
     case invalidArguments(String)
+    /// The model started a tool call that no registered tool schema could complete.
+    case unfinishedToolCall
 }
 
 /// Registry of Harmony tools keyed by name.
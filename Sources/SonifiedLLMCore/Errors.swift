@@ -14,6 +14,8 @@ public enum LLMError: LocalizedError {
     }
     case engineInitFailed(reason: EngineInitFailureReason, message: String)
     case notLoaded
+    /// The engine does not implement this capability (e.g. embeddings on the mock engine).
+    case unsupported(String)
 
     public var errorDescription: String? {
         switch self {
@@ -25,6 +27,7 @@ public enum LLMError: LocalizedError {
         case .runtimeFailure(let code): return "Runtime failure (\(code))."
         case .engineInitFailed(let reason, let message): return "Engine initialization failed (\(reason.rawValue)): \(message)"
         case .notLoaded: return "Engine is not loaded."
+        case .unsupported(let feature): return "This engine does not support \(feature)."
         }
     }
 
@@ -50,6 +53,8 @@ public enum LLMError: LocalizedError {
             }
         case .notLoaded:
             return "Call load(modelURL:spec:) before generating."
+        case .unsupported:
+            return "Use the runtime engine from EngineFactory.makeDefaultEngine()."
         }
     }
 }
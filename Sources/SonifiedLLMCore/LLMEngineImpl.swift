@@ -9,18 +9,47 @@ final class LLMEngineImpl: LLMEngine, @unchecked Sendable {
     private var _stats: LLMMetrics = .init()
     private var handle: UnsafeMutableRawPointer?
     private let stateQueue = DispatchQueue(label: "sonified.runtime.state")
+    // Drains the llm_eval stream ring and yields tokens, off the decode thread.
+    private let drainQueue = DispatchQueue(label: "sonified.runtime.drain")
     private var currentTask: Task<Void, Never>?
-    private var isCancelledFlag: Bool = false
+    // Running generate / generateBranches streams, oldest first.
+    private var generations: [Generation] = []
     private var cachedChatTemplate: String?
     private var hasFetchedChatTemplate: Bool = false
     private var loadedFromStub: Bool = false
+    // The llm_eval path runs one call at a time: held by a generate call or a state transfer.
+    private let evalSlot = DispatchSemaphore(value: 1)
+    // llm_constraint_create ids by kind and spec, compiled once per loaded model.
+    private var constraintIDs: [String: Int32] = [:]
+    private static let maxConstraints = 64
 
     func load(modelURL: URL, spec: LLMModelSpec) async throws {
         if isLoaded { return }
         // Allow special stub handle by name to route to C stub path
         let pathOrStub = (modelURL.lastPathComponent == "stub" || modelURL.path == "stub") ? "stub" : modelURL.path
+        // The spec's context window is a per-handle load parameter (no SONIFIED_CTX needed)
+        var params = llm_init_params_default()
+        if spec.contextTokens > 0 { params.n_ctx = Int32(spec.contextTokens) }
+        if let kv = spec.kvCacheType {
+            let t: llm_kv_type
+            switch kv {
+            case .f16: t = LLM_KV_TYPE_F16
+            case .q8_0: t = LLM_KV_TYPE_Q8_0
+            case .q4_0: t = LLM_KV_TYPE_Q4_0
+            }
+            params.type_k = Int32(t.rawValue)
+            params.type_v = Int32(t.rawValue) // flash attention is enabled automatically for quantized V
+        }
+        // Speculative decoding: the draft path only has to outlive llm_init_ex
+        params.n_draft = Int32(spec.draftTokens)
+        params.prefix_cache_mb = Int32(spec.prefixCacheMB)
+        let draftPath = spec.draftModelURL?.path
         let h = pathOrStub.withCString { cstr -> UnsafeMutableRawPointer? in
-            return llm_init(cstr)
+            guard let draftPath else { return llm_init_ex(cstr, &params) }
+            return draftPath.withCString { dstr in
+                params.draft_model_path = dstr
+                return llm_init_ex(cstr, &params)
+            }
         }
         guard let h else {
             // Map to typed init failure using last error from runtime when available (dynamic lookup)
@@ -67,142 +96,473 @@ final class LLMEngineImpl: LLMEngine, @unchecked Sendable {
                 self.cachedChatTemplate = nil
                 self.hasFetchedChatTemplate = false
                 self.loadedFromStub = false
+                self.constraintIDs = [:] // freed with the handle
             }
             return self.handle
         }
         if let h { llm_free(h) }
     }
 
+    /// Cancels the most recently started generation that is still running. Other streams on
+    /// the engine keep going; each stream also cancels its own generation when its consumer
+    /// stops iterating.
     func cancelCurrent() {
-        stateQueue.sync { self.isCancelledFlag = true }
-        if let h = stateQueue.sync(execute: { self.handle }) {
-            llm_cancel(h)
+        guard let g = stateQueue.sync(execute: { self.generations.last }) else { return }
+        cancel(g)
+    }
+
+    /// Cancellation state of one stream; fields are guarded by stateQueue.
+    private final class Generation: @unchecked Sendable {
+        var evalStarted = false // owns the llm_eval path (it may wait for it first)
+        var seqs: [Int32] = [] // scheduler sequences once submitted
+        var cancelled = false
+    }
+
+    /// Registers a stream's generation; it is cancelled if the consumer stops iterating
+    /// early and forgotten once the stream terminates.
+    private func begin<T>(continuation: AsyncThrowingStream<T, Error>.Continuation) -> Generation {
+        let g = Generation()
+        stateQueue.sync { self.generations.append(g) }
+        continuation.onTermination = { [weak self] termination in
+            guard let self else { return }
+            if case .cancelled = termination { self.cancel(g) }
+            self.stateQueue.sync { self.generations.removeAll { $0 === g } }
         }
+        return g
+    }
+
+    /// llm_cancel_eval on the llm_eval path, llm_cancel_seq for scheduler sequences (one not
+    /// submitted yet is cancelled as soon as llm_submit returns; one still waiting for the
+    /// llm_eval path never starts).
+    private func cancel(_ g: Generation) {
+        let target = stateQueue.sync { () -> (UnsafeMutableRawPointer, Bool, [Int32])? in
+            guard !g.cancelled, let h = self.handle else { return nil }
+            g.cancelled = true
+            return (h, g.evalStarted, g.seqs)
+        }
+        guard let (h, evalStarted, seqs) = target else { return }
+        if evalStarted { llm_cancel_eval(h) }
+        seqs.forEach { _ = llm_cancel_seq(h, $0) }
+    }
+
+    /// Records submitted sequences, cancelling them if the stream was cancelled meanwhile.
+    private func submitted(_ seqs: [Int32], to g: Generation, handle h: UnsafeMutableRawPointer) {
+        let cancelled = stateQueue.sync { () -> Bool in
+            g.seqs = seqs
+            return g.cancelled
+        }
+        if cancelled { seqs.forEach { _ = llm_cancel_seq(h, $0) } }
     }
 
     private func makeCOpts(from opts: GenerateOptions) -> llm_gen_opts_t {
         var c = llm_gen_opts_t()
         // Keep context_length as a simple heuristic for metrics display;
-        // actual context window is determined at init time via env override.
+        // the actual context window is fixed at load time from LLMModelSpec.contextTokens.
         c.context_length = Int32(opts.maxTokens + 512)
         let t = opts.greedy ? 0.0 : opts.temperature
         c.temperature = Float(t)
         c.top_p = Float(opts.topP)
         c.max_tokens = Int32(opts.maxTokens)
         c.seed = Int32(opts.seed)
+        c.top_k = Int32(opts.topK)
+        c.repeat_penalty = Float(opts.repeatPenalty)
+        c.prompt_lookup = opts.promptLookup ? 1 : 0
+        c.stop_tool_call = opts.stopOnToolCall ? 1 : 0
         return c
     }
 
+    /// Id of the compiled constraint, compiling it on first use; 0 on the stub runtime.
+    private func constraintID(for constraint: OutputConstraint, handle h: UnsafeMutableRawPointer) throws -> Int32 {
+        let kind: llm_constraint_kind
+        let spec: String
+        switch constraint {
+        case .jsonSchema(let schema):
+            kind = LLM_CONSTRAINT_JSON
+            spec = schema
+        case .toolCall(let tools):
+            kind = LLM_CONSTRAINT_TOOL_CALL
+            // each schema travels as a JSON string; the runtime parses it
+            let list = tools.map { ["name": $0.name, "parameters": $0.parametersJSONSchema] }
+            let data = try JSONSerialization.data(withJSONObject: list, options: [.sortedKeys])
+            spec = String(decoding: data, as: UTF8.self)
+        }
+        let key = "\(kind.rawValue):\(spec)"
+        return try stateQueue.sync { () throws -> Int32 in
+            if self.loadedFromStub { return 0 }
+            if let id = self.constraintIDs[key] { return id }
+            if self.constraintIDs.count >= Self.maxConstraints {
+                // generations still running keep their own reference
+                self.constraintIDs.values.forEach { _ = llm_constraint_free(h, $0) }
+                self.constraintIDs = [:]
+            }
+            let id = spec.withCString { llm_constraint_create(h, Int32(kind.rawValue), $0) }
+            if id <= 0 { throw LLMError.runtimeFailure(code: Int(id)) }
+            self.constraintIDs[key] = id
+            return id
+        }
+    }
+
     func generate(prompt: String, options: GenerateOptions) -> AsyncThrowingStream<LLMEvent, Error> {
         AsyncThrowingStream { continuation in
             guard let h = self.stateQueue.sync(execute: { self.handle }), self.isLoaded else {
                 continuation.finish(throwing: LLMError.notLoaded)
                 return
             }
-            self.stateQueue.sync { self.isCancelledFlag = false }
             let startTimeNs = DispatchTime.now().uptimeNanoseconds
             var cOpts = self.makeCOpts(from: options)
-            // Box the continuation for the C callback
-            final class Box {
-                let cont: AsyncThrowingStream<LLMEvent, Error>.Continuation
-                var earlyMetricsSent: Bool = false
-                let startTimeNs: UInt64
-                var completionTokens: Int = 0
-                let promptTokens: Int
-                init(_ c: AsyncThrowingStream<LLMEvent, Error>.Continuation, startTimeNs: UInt64, promptTokens: Int) {
-                    self.cont = c
-                    self.startTimeNs = startTimeNs
-                    self.promptTokens = promptTokens
+            // stop strings and logit bias are read during the call; borrowed keeps them alive until then
+            let borrowed = BorrowedOptions(options)
+            borrowed.apply(to: &cOpts)
+            if let constraint = options.constraint {
+                do {
+                    cOpts.constraint = try self.constraintID(for: constraint, handle: h)
+                } catch {
+                    continuation.finish(throwing: error)
+                    return
                 }
             }
-            // Accurate prompt token count is provided by runtime stats after eval.
-            // For early metrics at TTFB, report 0 and update in final metrics.
-            let approxPromptTokens = 0
-            let box = Unmanaged.passRetained(Box(continuation, startTimeNs: startTimeNs, promptTokens: approxPromptTokens))
-            let ctx = UnsafeMutableRawPointer(box.toOpaque())
-            // Non-capturing C callback
-            let cb: @convention(c) (UnsafePointer<CChar>?, UnsafeMutableRawPointer?) -> Void = { token, ctx in
-                guard let ctx = ctx else { return }
-                let box = Unmanaged<Box>.fromOpaque(ctx).takeUnretainedValue()
-                if let token = token {
-                    if box.earlyMetricsSent == false {
-                        box.earlyMetricsSent = true
-                        let now = DispatchTime.now().uptimeNanoseconds
-                        let ttfbMs = Int((now &- box.startTimeNs) / 1_000_000)
-                        box.cont.yield(.metrics(LLMMetrics(ttfbMs: ttfbMs, promptTokens: box.promptTokens, completionTokens: 0, totalTokens: box.promptTokens)))
-                    }
-                    box.completionTokens += 1
-                    box.cont.yield(.token(String(cString: token)))
-                }
+            // A call overlapping a running one waits for the llm_eval path, unless it opted
+            // into sharing decode steps through the scheduler.
+            let idle = self.evalSlot.wait(timeout: .now()) == .success
+            if !idle && options.batchWhenBusy && options.onLogprobs == nil {
+                let g = self.begin(continuation: continuation)
+                self.generateBatched(handle: h, prompt: prompt, cOpts: cOpts, borrowed: borrowed, generation: g,
+                                     startTimeNs: startTimeNs, continuation: continuation)
+                return
             }
+            let g = self.begin(continuation: continuation)
             self.currentTask = Task.detached { [weak self] in
                 guard let self else { return }
+                if !idle { self.evalSlot.wait() }
+                defer { self.evalSlot.signal() }
+                // A call cancelled while it waited never starts
+                guard self.startEval(g) else {
+                    self.finishEval(evalRc: 0, statsRc: 0, stats: llm_stats_t(), context: Int(cOpts.context_length),
+                                    piecesDropped: 0, generation: g, continuation: continuation)
+                    return
+                }
                 #if DEBUG
                 if prompt == "CAUSE_EVAL_FAIL" {
                     continuation.finish(throwing: LLMError.runtimeFailure(code: -1))
-                    box.release()
                     return
                 }
                 #endif
-                let evalRc: Int32 = prompt.withCString { cstr in
-                    llm_eval(h, cstr, &cOpts, cb, ctx)
+                if let onLogprobs = options.onLogprobs {
+                    self.evalWithLogprobs(handle: h, prompt: prompt, cOpts: cOpts, borrowed: borrowed, generation: g,
+                                          topLogprobs: options.topLogprobs, onLogprobs: onLogprobs,
+                                          startTimeNs: startTimeNs, continuation: continuation)
+                } else {
+                    self.evalStreaming(handle: h, prompt: prompt, cOpts: cOpts, borrowed: borrowed, generation: g,
+                                       options: options, startTimeNs: startTimeNs, continuation: continuation)
                 }
-                var s = llm_stats_t()
-                var statsRc = llm_stats(h, &s)
-                #if DEBUG
-                if prompt == "CAUSE_STATS_FAIL" { statsRc = -1 }
-                #endif
-                let wasCancelled = self.stateQueue.sync { self.isCancelledFlag }
-                if wasCancelled {
-                    let b = Unmanaged<Box>.fromOpaque(ctx).takeUnretainedValue()
-                    let m = LLMMetrics(
-                        chip: "unknown",
-                        ramGB: 0,
-                        quant: "Q4_K_M",
-                        context: Int(cOpts.context_length),
-                        ttfbMs: Int(s.ttfb_ms),
-                        promptTokens: Int(s.prompt_tokens),
-                        completionTokens: Int(s.completion_tokens),
-                        totalTokens: Int(s.total_tokens),
-                        tokPerSec: Double(s.tok_per_sec),
-                        totalDurationMillis: Int(s.total_ms),
-                        peakRSSMB: Int(s.peak_rss_mb),
-                        success: false
-                    )
-                    self.stateQueue.sync { self._stats = m }
-                    continuation.yield(.metrics(m))
-                    continuation.yield(.done)
-                    continuation.finish()
-                    box.release()
+            }
+        }
+    }
+
+    /// Marks `g` as owning the llm_eval path; false if it was cancelled before it got there.
+    private func startEval(_ g: Generation) -> Bool {
+        stateQueue.sync { () -> Bool in
+            g.evalStarted = true
+            return !g.cancelled
+        }
+    }
+
+    /// Runs a generation through llm_eval_stream. The decode loop writes into the runtime's
+    /// stream ring; tokens are drained and yielded on drainQueue, so consumer work never runs
+    /// on the decode thread.
+    private func evalStreaming(handle h: UnsafeMutableRawPointer,
+                               prompt: String,
+                               cOpts: llm_gen_opts_t,
+                               borrowed: BorrowedOptions,
+                               generation g: Generation,
+                               options: GenerateOptions,
+                               startTimeNs: UInt64,
+                               continuation: AsyncThrowingStream<LLMEvent, Error>.Continuation) {
+        let overflow: llm_stream_overflow
+        switch options.streamOverflow {
+        case .block: overflow = LLM_STREAM_BLOCK
+        case .dropAndCount: overflow = LLM_STREAM_DROP
+        case .grow: overflow = LLM_STREAM_GROW
+        }
+        guard let stream = llm_stream_create(Int32(clamping: options.streamBufferBytes), Int32(overflow.rawValue)) else {
+            continuation.finish(throwing: LLMError.runtimeFailure(code: -1))
+            return
+        }
+        let batchTokens = Int32(clamping: options.streamBatchTokens)
+        let batchMillis = Int32(clamping: max(1, options.streamBatchMillis))
+        let drained = DispatchGroup()
+        drained.enter()
+        drainQueue.async {
+            defer { drained.leave() }
+            var buffer = [CChar](repeating: 0, count: 16 * 1024)
+            var earlyMetricsSent = false
+            while true {
+                // After the first token, wait for a batch of streamBatchTokens (or streamBatchMillis)
+                let n = buffer.withUnsafeMutableBufferPointer { buf in
+                    earlyMetricsSent && batchTokens > 1
+                        ? llm_stream_read_batch(stream, buf.baseAddress, Int32(buf.count), batchTokens, batchMillis)
+                        : llm_stream_read(stream, buf.baseAddress, Int32(buf.count), 50)
+                }
+                if n < 0 { break }
+                if n == 0 { continue }
+                // Text still buffered when the user cancels is discarded (cancellation SLA)
+                if self.stateQueue.sync(execute: { g.cancelled }) { continue }
+                if !earlyMetricsSent {
+                    earlyMetricsSent = true
+                    let ttfbMs = Int((DispatchTime.now().uptimeNanoseconds &- startTimeNs) / 1_000_000)
+                    // Accurate prompt token count is provided by runtime stats after eval.
+                    continuation.yield(.metrics(LLMMetrics(ttfbMs: ttfbMs, promptTokens: 0, completionTokens: 0, totalTokens: 0)))
+                }
+                let text = buffer.withUnsafeBufferPointer { raw in
+                    raw.prefix(Int(n)).withMemoryRebound(to: UInt8.self) { String(decoding: $0, as: UTF8.self) }
+                }
+                continuation.yield(.token(text))
+            }
+        }
+        var opts = cOpts
+        let evalRc: Int32 = withExtendedLifetime(borrowed) {
+            prompt.withCString { cstr in llm_eval_stream(h, cstr, &opts, stream) }
+        }
+        var s = llm_stats_t()
+        var statsRc = llm_stats(h, &s)
+        #if DEBUG
+        if prompt == "CAUSE_STATS_FAIL" { statsRc = -1 }
+        #endif
+        // Final metrics follow the last token: wait for the drain to reach end of stream
+        drained.wait()
+        let dropped = Int(llm_stream_dropped(stream))
+        llm_stream_free(stream)
+        finishEval(evalRc: evalRc, statsRc: statsRc, stats: s, context: Int(cOpts.context_length),
+                   piecesDropped: dropped, generation: g, continuation: continuation)
+    }
+
+    /// Final `.metrics` and `.done` of an llm_eval_* call, or the error it failed with.
+    private func finishEval(evalRc: Int32, statsRc: Int32, stats s: llm_stats_t, context: Int, piecesDropped: Int,
+                            generation g: Generation, continuation: AsyncThrowingStream<LLMEvent, Error>.Continuation) {
+        let wasCancelled = self.stateQueue.sync { g.cancelled }
+        if wasCancelled {
+            let m = Self.metrics(from: s, context: context, piecesDropped: piecesDropped,
+                                 stopReason: .cancelled, success: false)
+            self.stateQueue.sync { self._stats = m }
+            continuation.yield(.metrics(m))
+            continuation.yield(.done)
+            continuation.finish()
+            return
+        }
+
+        if evalRc != 0 || statsRc != 0 {
+            let code = evalRc != 0 ? Int(evalRc) : Int(statsRc)
+            continuation.finish(throwing: LLMError.runtimeFailure(code: code))
+        } else {
+            let m = Self.metrics(from: s, context: context, piecesDropped: piecesDropped)
+            self.stateQueue.sync { self._stats = m }
+            continuation.yield(.metrics(m))
+            continuation.yield(.done)
+            continuation.finish()
+        }
+    }
+
+    /// Serves `GenerateOptions.onLogprobs` through llm_eval_logprobs. The stream ring only
+    /// carries text, so each token and its log-probabilities come through one callback on
+    /// the decode thread; yielding the text only buffers it for the consumer.
+    private func evalWithLogprobs(handle h: UnsafeMutableRawPointer,
+                                  prompt: String,
+                                  cOpts: llm_gen_opts_t,
+                                  borrowed: BorrowedOptions,
+                                  generation g: Generation,
+                                  topLogprobs: Int,
+                                  onLogprobs: @escaping @Sendable (TokenLogprobs) -> Void,
+                                  startTimeNs: UInt64,
+                                  continuation: AsyncThrowingStream<LLMEvent, Error>.Continuation) {
+        let sink = LogprobSink(continuation: continuation, onLogprobs: onLogprobs, startTimeNs: startTimeNs) { [weak self] in
+            self?.stateQueue.sync { g.cancelled } ?? false
+        }
+        let top = Int32(min(max(topLogprobs, 0), Int(LLM_TOP_LOGPROBS_MAX)))
+        var opts = cOpts
+        let ctx = Unmanaged.passRetained(sink).toOpaque()
+        let evalRc: Int32 = withExtendedLifetime(borrowed) {
+            prompt.withCString { cstr in
+                llm_eval_logprobs(h, cstr, &opts, top, { info, user in
+                    guard let info, let user else { return }
+                    Unmanaged<LogprobSink>.fromOpaque(user).takeUnretainedValue().receive(info.pointee)
+                }, ctx)
+            }
+        }
+        Unmanaged<LogprobSink>.fromOpaque(ctx).release()
+        var s = llm_stats_t()
+        let statsRc = llm_stats(h, &s)
+        finishEval(evalRc: evalRc, statsRc: statsRc, stats: s, context: Int(cOpts.context_length),
+                   piecesDropped: 0, generation: g, continuation: continuation)
+    }
+
+    /// Serves a `batchWhenBusy` generate call that overlaps one already running on this
+    /// handle through the runtime's continuous-batching scheduler, so concurrent streams
+    /// share decode steps instead of waiting for the single llm_eval context.
+    private func generateBatched(handle h: UnsafeMutableRawPointer,
+                                 prompt: String,
+                                 cOpts: llm_gen_opts_t,
+                                 borrowed: BorrowedOptions,
+                                 generation g: Generation,
+                                 startTimeNs: UInt64,
+                                 continuation: AsyncThrowingStream<LLMEvent, Error>.Continuation) {
+        Task.detached { [weak self] in
+            var opts = cOpts
+            let seq = withExtendedLifetime(borrowed) { prompt.withCString { llm_submit(h, $0, &opts) } }
+            guard seq > 0 else {
+                continuation.finish(throwing: LLMError.runtimeFailure(code: Int(seq)))
+                return
+            }
+            self?.submitted([seq], to: g, handle: h)
+            var events = [llm_seq_event_t](repeating: llm_seq_event_t(), count: 16)
+            var earlyMetricsSent = false
+            while true {
+                let n = events.withUnsafeMutableBufferPointer { buf in
+                    llm_poll(h, seq, buf.baseAddress, Int32(buf.count), 100)
+                }
+                if n < 0 {
+                    continuation.finish(throwing: LLMError.runtimeFailure(code: Int(n)))
                     return
                 }
+                for ev in events.prefix(Int(n)) {
+                    switch ev.kind {
+                    case Int32(LLM_SEQ_EVENT_TOKEN.rawValue):
+                        if !earlyMetricsSent {
+                            earlyMetricsSent = true
+                            let ttfbMs = Int((DispatchTime.now().uptimeNanoseconds &- startTimeNs) / 1_000_000)
+                            continuation.yield(.metrics(LLMMetrics(ttfbMs: ttfbMs, promptTokens: 0, completionTokens: 0, totalTokens: 0)))
+                        }
+                        let text = withUnsafeBytes(of: ev.text) { raw in
+                            String(decoding: raw.prefix(Int(ev.text_len)), as: UTF8.self)
+                        }
+                        continuation.yield(.token(text))
+                    case Int32(LLM_SEQ_EVENT_DONE.rawValue):
+                        let m = Self.metrics(from: ev.stats, context: Int(cOpts.context_length))
+                        self?.stateQueue.sync { self?._stats = m }
+                        continuation.yield(.metrics(m))
+                        continuation.yield(.done)
+                        continuation.finish()
+                        return
+                    default:
+                        continuation.finish(throwing: LLMError.runtimeFailure(code: Int(ev.error_code)))
+                        return
+                    }
+                }
+            }
+        }
+    }
 
-                if evalRc != 0 || statsRc != 0 {
-                    let code = evalRc != 0 ? Int(evalRc) : Int(statsRc)
-                    continuation.finish(throwing: LLMError.runtimeFailure(code: code))
-                } else {
-                    let b = Unmanaged<Box>.fromOpaque(ctx).takeUnretainedValue()
-                    let m = LLMMetrics(
-                        chip: "unknown",
-                        ramGB: 0,
-                        quant: "Q4_K_M",
-                        context: Int(cOpts.context_length),
-                        ttfbMs: Int(s.ttfb_ms),
-                        promptTokens: Int(s.prompt_tokens),
-                        completionTokens: Int(s.completion_tokens),
-                        totalTokens: Int(s.total_tokens),
-                        tokPerSec: Double(s.tok_per_sec),
-                        totalDurationMillis: Int(s.total_ms),
-                        peakRSSMB: Int(s.peak_rss_mb),
-                        success: s.success != 0
-                    )
-                    self.stateQueue.sync { self._stats = m }
-                    continuation.yield(.metrics(m))
-                    continuation.yield(.done)
+    /// Metrics of a finished run from its `llm_stats_t`; `stopReason` and `success` override
+    /// what the stats say (a cancelled run).
+    private static func metrics(from s: llm_stats_t, context: Int, piecesDropped: Int = 0,
+                                stopReason: StopReason? = nil, success: Bool? = nil) -> LLMMetrics {
+        LLMMetrics(
+            chip: "unknown",
+            ramGB: 0,
+            quant: "Q4_K_M",
+            context: context,
+            ttfbMs: Int(s.ttfb_ms),
+            promptTokens: Int(s.prompt_tokens),
+            completionTokens: Int(s.completion_tokens),
+            totalTokens: Int(s.total_tokens),
+            promptTokensReused: Int(s.prompt_tokens_reused),
+            tokPerSec: Double(s.tok_per_sec),
+            totalDurationMillis: Int(s.total_ms),
+            sampleMillis: Double(s.sample_ms),
+            prefillMillis: Double(s.prefill_ms),
+            prefillChunks: Int(s.prefill_chunks),
+            prefillChunkMaxMillis: Double(s.prefill_chunk_max_ms),
+            peakRSSMB: Int(s.peak_rss_mb),
+            kvCacheBytes: Int(s.kv_cache_bytes),
+            kvCellsUsed: Int(s.kv_cells_used),
+            specDraftedTokens: Int(s.spec_drafted),
+            specAcceptedTokens: Int(s.spec_accepted),
+            specLookupDraftedTokens: Int(s.spec_lookup_drafted),
+            specLookupAcceptedTokens: Int(s.spec_lookup_accepted),
+            prefixCacheHits: Int(s.prefix_cache_hits),
+            prefixCacheMisses: Int(s.prefix_cache_misses),
+            streamPiecesDropped: piecesDropped,
+            stopReason: stopReason ?? StopReason(rawValue: Int(s.stop_reason)) ?? .endOfGeneration,
+            success: success ?? (s.success != 0)
+        )
+    }
+
+    /// `count` completions of one prompt through `llm_submit_n`: one prefill, forked to every
+    /// branch, which then share decode steps. Branch events interleave as they are polled.
+    func generateBranches(prompt: String, count: Int, options: GenerateOptions) -> AsyncThrowingStream<BranchEvent, Error> {
+        AsyncThrowingStream { continuation in
+            guard let h = self.stateQueue.sync(execute: { self.handle }), self.isLoaded else {
+                continuation.finish(throwing: LLMError.notLoaded)
+                return
+            }
+            var cOpts = self.makeCOpts(from: options)
+            let borrowed = BorrowedOptions(options)
+            borrowed.apply(to: &cOpts)
+            if let constraint = options.constraint {
+                do {
+                    cOpts.constraint = try self.constraintID(for: constraint, handle: h)
+                } catch {
+                    continuation.finish(throwing: error)
+                    return
+                }
+            }
+            let g = self.begin(continuation: continuation)
+            Task.detached { [weak self] in
+                var opts = cOpts
+                var seqs = [Int32](repeating: 0, count: max(count, 1))
+                let rc = withExtendedLifetime(borrowed) {
+                    prompt.withCString { p in
+                        seqs.withUnsafeMutableBufferPointer { llm_submit_n(h, p, &opts, Int32(count), $0.baseAddress) }
+                    }
+                }
+                guard rc == 0 else {
+                    continuation.finish(throwing: LLMError.runtimeFailure(code: Int(rc)))
+                    return
+                }
+                self?.submitted(seqs, to: g, handle: h)
+                var live = Array(seqs.indices)
+                var events = [llm_seq_event_t](repeating: llm_seq_event_t(), count: 16)
+                // Drains one branch; returns false once its terminal event has been delivered.
+                func drain(_ branch: Int, timeoutMs: Int32) throws -> (events: Int, live: Bool) {
+                    let n = events.withUnsafeMutableBufferPointer { buf in
+                        llm_poll(h, seqs[branch], buf.baseAddress, Int32(buf.count), timeoutMs)
+                    }
+                    if n < 0 { throw LLMError.runtimeFailure(code: Int(n)) }
+                    for ev in events.prefix(Int(n)) {
+                        switch ev.kind {
+                        case Int32(LLM_SEQ_EVENT_TOKEN.rawValue):
+                            let text = withUnsafeBytes(of: ev.text) { raw in
+                                String(decoding: raw.prefix(Int(ev.text_len)), as: UTF8.self)
+                            }
+                            continuation.yield(BranchEvent(branch: branch, event: .token(text)))
+                        case Int32(LLM_SEQ_EVENT_DONE.rawValue):
+                            let m = Self.metrics(from: ev.stats, context: Int(cOpts.context_length))
+                            continuation.yield(BranchEvent(branch: branch, event: .metrics(m)))
+                            continuation.yield(BranchEvent(branch: branch, event: .done))
+                            return (Int(n), false)
+                        default:
+                            throw LLMError.runtimeFailure(code: Int(ev.error_code))
+                        }
+                    }
+                    return (Int(n), true)
+                }
+                do {
+                    while !live.isEmpty {
+                        var drained = 0
+                        live = try live.filter { branch in
+                            let r = try drain(branch, timeoutMs: 0)
+                            drained += r.events
+                            return r.live
+                        }
+                        // nothing ready: block briefly on one branch (they advance in the same steps)
+                        if drained == 0, let first = live.first, try !drain(first, timeoutMs: 50).live {
+                            live.removeFirst()
+                        }
+                    }
                     continuation.finish()
+                } catch {
+                    seqs.forEach { _ = llm_cancel_seq(h, $0) }
+                    continuation.finish(throwing: error)
                 }
-                // release the box
-                box.release()
             }
         }
     }
@@ -211,6 +571,63 @@ final class LLMEngineImpl: LLMEngine, @unchecked Sendable {
         stateQueue.sync { _stats }
     }
 
+    /// Tokens `text` costs as a prompt; does not touch the KV cache, so it is safe during `generate`.
+    func tokenCount(of text: String) throws -> Int {
+        guard let h = stateQueue.sync(execute: { self.handle }), isLoaded else { throw LLMError.notLoaded }
+        let n = text.withCString { llm_tokenize(h, $0, nil, 0) }
+        if n < 0 { throw LLMError.runtimeFailure(code: Int(n)) }
+        return Int(n)
+    }
+
+    /// Single-token id of `text`, or nil when it is several tokens; cached by the runtime.
+    func tokenID(for text: String) throws -> Int32? {
+        guard let h = stateQueue.sync(execute: { self.handle }), isLoaded else { throw LLMError.notLoaded }
+        let id = text.withCString { llm_token_id(h, $0) }
+        if id == -2 { return nil }
+        if id < 0 { throw LLMError.runtimeFailure(code: Int(id)) }
+        return id
+    }
+
+    /// One vector per text from the runtime's embedding context; safe during `generate`.
+    func embeddings(for texts: [String], pooling: EmbeddingPooling, normalize: Bool) throws -> [[Float]] {
+        guard let h = stateQueue.sync(execute: { self.handle }), isLoaded else { throw LLMError.notLoaded }
+        if texts.isEmpty { return [] }
+        let dim = Int(llm_embed_dim(h))
+        if dim <= 0 { throw LLMError.runtimeFailure(code: -1) }
+        let cStrings = texts.map { UnsafePointer<CChar>(strdup($0)) }
+        defer { cStrings.forEach { free(UnsafeMutablePointer(mutating: $0)) } }
+        var out = [Float](repeating: 0, count: texts.count * dim)
+        var opts = llm_embed_opts_t(pooling: Int32(pooling.rawValue), normalize: normalize ? 1 : 0)
+        let rc = cStrings.withUnsafeBufferPointer { ptrs -> Int32 in
+            out.withUnsafeMutableBufferPointer { buf in
+                llm_embed_ex(h, UnsafeMutablePointer(mutating: ptrs.baseAddress), Int32(texts.count), buf.baseAddress, Int32(dim), &opts)
+            }
+        }
+        if rc != 0 { throw LLMError.runtimeFailure(code: Int(rc)) }
+        return (0..<texts.count).map { Array(out[($0 * dim)..<(($0 + 1) * dim)]) }
+    }
+
+    @discardableResult
+    func saveSessionState(to url: URL) throws -> Int {
+        try transferState(at: url, save: true)
+    }
+
+    @discardableResult
+    func loadSessionState(from url: URL) throws -> Int {
+        try transferState(at: url, save: false)
+    }
+
+    /// Saves (`save == true`) or restores the `llm_eval` sequence's KV cache. The sequence is
+    /// claimed like a generation, so a concurrent `generate` waits for the transfer.
+    private func transferState(at url: URL, save: Bool) throws -> Int {
+        guard let h = stateQueue.sync(execute: { self.handle }), isLoaded else { throw LLMError.notLoaded }
+        guard evalSlot.wait(timeout: .now()) == .success else { throw LLMError.runtimeFailure(code: -1) } // llm_eval is busy
+        defer { evalSlot.signal() }
+        let rc = url.path.withCString { save ? llm_state_save(h, $0) : llm_state_load(h, $0) }
+        if rc < 0 { throw LLMError.runtimeFailure(code: Int(rc)) }
+        return Int(rc)
+    }
+
     /// Returns the model's embedded chat template if available.
     /// Cached after the first successful or unsuccessful lookup.
     /// Thread-safe and non-throwing. Returns nil if not available.
@@ -253,6 +670,81 @@ final class LLMEngineImpl: LLMEngine, @unchecked Sendable {
         return fallback
     }
 }
+
+/// Context of llm_eval_logprobs' callback: yields each token's text, then hands its
+/// log-probabilities to `GenerateOptions.onLogprobs`.
+final class LogprobSink {
+    private let continuation: AsyncThrowingStream<LLMEvent, Error>.Continuation
+    private let onLogprobs: @Sendable (TokenLogprobs) -> Void
+    private let startTimeNs: UInt64
+    private let isCancelled: () -> Bool
+    private var earlyMetricsSent = false
+
+    init(continuation: AsyncThrowingStream<LLMEvent, Error>.Continuation,
+         onLogprobs: @escaping @Sendable (TokenLogprobs) -> Void,
+         startTimeNs: UInt64,
+         isCancelled: @escaping () -> Bool) {
+        self.continuation = continuation
+        self.onLogprobs = onLogprobs
+        self.startTimeNs = startTimeNs
+        self.isCancelled = isCancelled
+    }
+
+    /// Called on the decode thread, once per token.
+    func receive(_ info: llm_token_info_t) {
+        // Tokens still arriving after the user cancels are discarded (cancellation SLA)
+        if isCancelled() { return }
+        if !earlyMetricsSent {
+            earlyMetricsSent = true
+            let ttfbMs = Int((DispatchTime.now().uptimeNanoseconds &- startTimeNs) / 1_000_000)
+            continuation.yield(.metrics(LLMMetrics(ttfbMs: ttfbMs, promptTokens: 0, completionTokens: 0, totalTokens: 0)))
+        }
+        let text = info.text.map { String(cString: $0) } ?? ""
+        if !text.isEmpty { continuation.yield(.token(text)) }
+        // token -1: the stub runtime, or bytes cut off at the end
+        guard info.token >= 0 else { return }
+        let top = withUnsafeBytes(of: info.top) { raw in
+            raw.bindMemory(to: llm_token_logprob_t.self).prefix(Int(info.n_top)).map {
+                TokenLogprobs.Alternative(tokenID: $0.token, logprob: $0.logprob)
+            }
+        }
+        onLogprobs(TokenLogprobs(tokenID: info.token, logprob: info.logprob, top: top))
+    }
+}
+
+/// Copies of what `llm_gen_opts_t` borrows from `GenerateOptions` (NUL-terminated stop
+/// strings, the logit bias), valid while the storage is alive.
+final class BorrowedOptions {
+    private let stop: UnsafeMutablePointer<UnsafePointer<CChar>?>
+    private let stopCount: Int
+    private let bias: UnsafeMutablePointer<llm_logit_bias_t>
+    private let biasCount: Int
+
+    init(_ options: GenerateOptions) {
+        stopCount = options.stop.count
+        stop = .allocate(capacity: max(1, stopCount))
+        for (i, string) in options.stop.enumerated() { stop[i] = UnsafePointer(strdup(string)) }
+        biasCount = options.logitBias.count
+        bias = .allocate(capacity: max(1, biasCount))
+        for (i, entry) in options.logitBias.sorted(by: { $0.key < $1.key }).enumerated() {
+            bias[i] = llm_logit_bias_t(token: entry.key, bias: entry.value)
+        }
+    }
+
+    /// Points `c`'s borrowed fields at this storage.
+    func apply(to c: inout llm_gen_opts_t) {
+        c.stop = UnsafePointer(stop)
+        c.n_stop = Int32(stopCount)
+        c.logit_bias = UnsafePointer(bias)
+        c.n_logit_bias = Int32(biasCount)
+    }
+
+    deinit {
+        for i in 0..<stopCount { free(UnsafeMutablePointer(mutating: stop[i])) }
+        stop.deallocate()
+        bias.deallocate()
+    }
+}
 #endif
 
 
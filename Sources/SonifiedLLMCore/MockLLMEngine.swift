@@ -33,7 +33,7 @@ final class MockLLMEngine: LLMEngine {
 
             let start = DispatchTime.now().uptimeNanoseconds
             self.isCancelledFlag = false
-            currentTask = Task {
+            let task = Task {
                 // Simulate TTFB
                 try? await Task.sleep(nanoseconds: 300_000_000) // 300ms
 
@@ -102,6 +102,11 @@ final class MockLLMEngine: LLMEngine {
                 continuation.yield(.done)
                 continuation.finish()
             }
+            currentTask = task
+            // Dropping the stream early cancels this run only
+            continuation.onTermination = { termination in
+                if case .cancelled = termination { task.cancel() }
+            }
         }
     }
 }
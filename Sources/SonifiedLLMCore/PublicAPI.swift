@@ -24,34 +24,93 @@ public struct LLMModelSpec: Codable, Sendable {
         case mxfp4
     }
 
+    /// Element type of the KV cache. Quantized caches cut its memory roughly 2x (`q8_0`)
+    /// or 3.5x (`q4_0`) relative to `f16`, at some cost in accuracy.
+    public enum KVCacheType: String, Codable, Sendable {
+        case f16
+        case q8_0
+        case q4_0
+    }
+
     public let name: String          // e.g., "gpt-oss-20b"
     public let quant: Quantization   // e.g., .q4_K_M
     public let contextTokens: Int    // e.g., 4096
     /// Tokenizer identifier when overriding model-embedded tokenizer. Usually leave nil.
     public let tokenizer: String?
+    /// KV cache element type for keys and values; nil keeps the runtime default (`f16`).
+    public let kvCacheType: KVCacheType?
+    /// Smaller model of the same family (same tokenizer) used for speculative decoding; it
+    /// proposes tokens the target verifies in batches. Output is unchanged. See
+    /// `BundledModelSelector.draft(for:catalog:caps:)` for pairing through the catalog.
+    public let draftModelURL: URL?
+    /// Draft tokens proposed per step; `0` keeps the runtime default.
+    public let draftTokens: Int
+    /// Extra KV cache, in MiB, for prompt prefixes shared by scheduler generations
+    /// (`GenerateOptions.batchWhenBusy`, `generateBranches`) with the same system prompt and
+    /// tool schemas: later requests copy the cached pages instead of prefilling them. `0`
+    /// disables the cache.
+    public let prefixCacheMB: Int
 
-    public init(name: String, quant: Quantization, contextTokens: Int, tokenizer: String? = nil) {
+    public init(name: String, quant: Quantization, contextTokens: Int, tokenizer: String? = nil, kvCacheType: KVCacheType? = nil,
+                draftModelURL: URL? = nil, draftTokens: Int = 0, prefixCacheMB: Int = 0) {
         self.name = name
         self.quant = quant
         self.contextTokens = contextTokens
         self.tokenizer = tokenizer
+        self.kvCacheType = kvCacheType
+        self.draftModelURL = draftModelURL
+        self.draftTokens = draftTokens
+        self.prefixCacheMB = prefixCacheMB
+    }
+
+    private enum CodingKeys: String, CodingKey {
+        case name, quant, contextTokens, tokenizer, kvCacheType, draftModelURL, draftTokens, prefixCacheMB
+    }
+
+    // Runtime tuning fields are optional in encoded specs.
+    public init(from decoder: Decoder) throws {
+        let c = try decoder.container(keyedBy: CodingKeys.self)
+        self.init(name: try c.decode(String.self, forKey: .name),
+                  quant: try c.decode(Quantization.self, forKey: .quant),
+                  contextTokens: try c.decode(Int.self, forKey: .contextTokens),
+                  tokenizer: try c.decodeIfPresent(String.self, forKey: .tokenizer),
+                  kvCacheType: try c.decodeIfPresent(KVCacheType.self, forKey: .kvCacheType),
+                  draftModelURL: try c.decodeIfPresent(URL.self, forKey: .draftModelURL),
+                  draftTokens: try c.decodeIfPresent(Int.self, forKey: .draftTokens) ?? 0,
+                  prefixCacheMB: try c.decodeIfPresent(Int.self, forKey: .prefixCacheMB) ?? 0)
     }
 }
 
+/// What the runtime does when generated text arrives faster than the stream consumer reads it.
+public enum StreamOverflowPolicy: Sendable, Equatable {
+    /// Decoding pauses until the consumer catches up (no text is lost).
+    case block
+    /// Tokens that do not fit the buffer are discarded; the count is reported in
+    /// `LLMMetrics.streamPiecesDropped`. Decoding never waits on the consumer.
+    case dropAndCount
+    /// The buffer grows as needed; decoding never waits and nothing is lost.
+    case grow
+}
+
 /// Options controlling text generation.
 ///
 /// Supported knobs:
 /// - `temperature`: Softens or sharpens the distribution (higher = more random).
 /// - `topP`: Nucleus sampling threshold.
+/// - `topK`: Keep only the `k` most likely tokens (`0` disables).
+/// - `repeatPenalty`: Penalize recently generated tokens (`1.0` disables).
 /// - `maxTokens`: Upper bound on number of tokens to generate.
 /// - `seed`: Optional PRNG seed for reproducibility.
+/// - `greedy`: Always pick the most likely token (ignores temperature/topP/topK).
+/// - `streamBatchTokens` / `streamBatchMillis`: Coalesce streamed tokens into fewer `.token` events.
 ///
-/// Note: The context window size ("contextTokens") is defined by the loaded model
-/// via `LLMModelSpec.context` and not configured here.
+/// Note: The context window size is fixed when the model is loaded, from
+/// `LLMModelSpec.contextTokens`, and not configured here.
 /// Example:
 /// ```swift
 /// let opts = GenerateOptions(temperature: 0.7, topP: 0.9, maxTokens: 256, seed: 42)
 /// ```
+
 public struct GenerateOptions: Sendable {
     // Core knobs
     public var maxTokens: Int
@@ -61,6 +120,54 @@ public struct GenerateOptions: Sendable {
     public var repeatPenalty: Double
     public var seed: Int
     public var greedy: Bool
+    /// Tokens are decoded into a runtime buffer and yielded off the decode thread; each
+    /// `.token` event carries whatever text is buffered when it is read. `1` (default) reads
+    /// as soon as text arrives; larger values wait until that many tokens are buffered (or
+    /// `streamBatchMillis` has passed) so events carry several tokens at high tok/s. The
+    /// first token is never delayed.
+    public var streamBatchTokens: Int = 1
+    /// Longest wait for a `streamBatchTokens` batch, in milliseconds.
+    public var streamBatchMillis: Int = 20
+    /// Size of the buffer between the decode loop and the stream consumer, in bytes.
+    public var streamBufferBytes: Int = 64 * 1024
+    /// Behaviour when the consumer falls `streamBufferBytes` behind the decode loop.
+    public var streamOverflow: StreamOverflowPolicy = .block
+    /// Draft-free speculative decoding: tokens that followed an earlier occurrence of the
+    /// last few tokens (in the prompt or the output so far) are proposed and verified in one
+    /// step. Output is unchanged; it pays off when the reply copies spans from the prompt,
+    /// such as tool results or retrieved documents.
+    public var promptLookup: Bool = false
+    /// Holds the output to a JSON shape by masking, at every step, the tokens that could
+    /// not continue it. Turns off `promptLookup` and draft-model speculation for the call.
+    /// The stub runtime ignores it.
+    public var constraint: OutputConstraint? = nil
+    /// Literal strings that end generation (at most 16, of up to 128 bytes each). The token
+    /// that completes one is the last; its text after the match is not streamed.
+    public var stop: [String] = []
+    /// End generation on the token that closes a `{"tool":…}` object, instead of decoding
+    /// on until the consumer notices the call and cancels.
+    public var stopOnToolCall: Bool = false
+    /// Added to the logits of these token ids (from `LLMEngine.tokenID(for:)`) at every step,
+    /// before sampling and any `constraint`; `-.infinity` bans a token. The stub runtime
+    /// ignores it.
+    public var logitBias: [Int32: Float] = [:]
+    /// Called with each generated token's log-probability and the `topLogprobs` most likely
+    /// alternatives, after `logitBias` and before temperature, over the whole vocabulary even
+    /// where `constraint` limits the choice. It runs on the decode thread, right after the
+    /// token's text is yielded as `.token` (a token that only begins a multi-byte character
+    /// has no text of its own), so it should return quickly. Tokens are then yielded one at a
+    /// time, so the stream buffering options do not apply. Such calls wait for an
+    /// overlapping generation even with `batchWhenBusy`; the stub runtime never calls it.
+    public var onLogprobs: (@Sendable (TokenLogprobs) -> Void)? = nil
+    /// Alternatives per `onLogprobs` call, `0...20`.
+    public var topLogprobs: Int = 0
+    /// A call that overlaps a generation already running on the engine waits for it by
+    /// default. Set, it instead joins the runtime's continuous-batching scheduler and shares
+    /// decode steps with other such calls. Scheduler streams yield tokens as they are
+    /// polled, so the `stream…` buffering options, draft-model speculation and `onLogprobs`
+    /// do not apply (a call with `onLogprobs` still waits). The scheduler's KV cache, room for
+    /// four sequences of the full context, is allocated on first use.
+    public var batchWhenBusy: Bool = false
 
     // New preferred initializer (with requested defaults)
     public init(maxTokens: Int = 128,
@@ -91,8 +198,39 @@ public struct GenerateOptions: Sendable {
     }
 }
 
+/// Shape `GenerateOptions.constraint` holds generated text to. Schemas are JSON Schema
+/// text; `type`, `properties`, `required`, `items`, `minItems`/`maxItems` and string
+/// `enum`/`const` are enforced, properties come out in schema order, and any other schema
+/// admits any JSON value.
+public enum OutputConstraint: Sendable {
+    /// The whole reply is one JSON value matching the schema.
+    case jsonSchema(String)
+    /// Text is free until the model opens a tool call (`{"tool":`); from there the call must
+    /// be `{"tool":{"name":…,"arguments":…}}` naming one of these tools, with arguments
+    /// matching its parameter schema.
+    case toolCall([(name: String, parametersJSONSchema: String)])
+}
+
 // MARK: - Metrics & Events
 
+/// Why a generation ended (`LLMMetrics.stopReason`).
+public enum StopReason: Int, Sendable {
+    /// The model emitted an end-of-generation token.
+    case endOfGeneration = 0
+    /// `GenerateOptions.maxTokens` was reached.
+    case maxTokens = 1
+    /// A `GenerateOptions.stop` string was completed.
+    case stopString = 2
+    /// A tool call closed (`GenerateOptions.stopOnToolCall`).
+    case toolCall = 3
+    case cancelled = 4
+    /// The context window filled up.
+    case contextFull = 5
+    /// No token could continue `GenerateOptions.constraint`: the output ends inside an
+    /// unfinished value (for example a partial tool call).
+    case constraintDeadEnd = 6
+}
+
 /// Aggregate performance and accounting metrics for a single generation run.
 ///
 /// Example:
@@ -115,10 +253,43 @@ public struct LLMMetrics: Sendable, Equatable {
     public let completionTokens: Int
     /// Total tokens for the run (prompt + completion)
     public let totalTokens: Int
-    /// Completion tokens per second, excluding prefill/TTFB
+    /// Prompt tokens served from the engine's KV cache instead of being prefilled again
+    public let promptTokensReused: Int
+    /// Completion tokens per second, excluding prefill/TTFB (with speculative decoding, the
+    /// effective rate including accepted draft tokens)
     public let tokPerSec: Double
     public let totalDurationMillis: Int
+    /// Time spent choosing tokens (the sampler chain), summed over the run
+    public let sampleMillis: Double
+    /// Time spent decoding the prompt, in `prefillChunks` llama_decode calls
+    public let prefillMillis: Double
+    public let prefillChunks: Int
+    /// Slowest single prefill chunk (bounds cancellation latency during prefill)
+    public let prefillChunkMaxMillis: Double
     public let peakRSSMB: Int
+    /// Bytes allocated for the K and V caches of the context that served the run
+    public let kvCacheBytes: Int
+    /// KV cache cells holding this run's tokens when it finished
+    public let kvCellsUsed: Int
+    /// Speculative decoding: tokens proposed by the draft model
+    public let specDraftedTokens: Int
+    /// Speculative decoding: proposals the target accepted
+    public let specAcceptedTokens: Int
+    /// The prompt-lookup share of `specDraftedTokens` and `specAcceptedTokens`
+    public let specLookupDraftedTokens: Int
+    public let specLookupAcceptedTokens: Int
+    /// Fraction of draft proposals accepted (0 when nothing was drafted)
+    public var specAcceptRate: Double {
+        specDraftedTokens > 0 ? Double(specAcceptedTokens) / Double(specDraftedTokens) : 0
+    }
+    /// Scheduler generations: prefix-cache lookups that found / missed shared prompt pages
+    /// (engine totals when this run finished; see `LLMModelSpec.prefixCacheMB`)
+    public let prefixCacheHits: Int
+    public let prefixCacheMisses: Int
+    /// Tokens discarded because the consumer fell behind (`StreamOverflowPolicy.dropAndCount`)
+    public let streamPiecesDropped: Int
+    /// Why the run ended
+    public let stopReason: StopReason
     public let success: Bool
 
     public init(chip: String = "unknown",
@@ -130,9 +301,24 @@ public struct LLMMetrics: Sendable, Equatable {
                 promptTokens: Int = 0,
                 completionTokens: Int = 0,
                 totalTokens: Int = 0,
+                promptTokensReused: Int = 0,
                 tokPerSec: Double = 0,
                 totalDurationMillis: Int = 0,
+                sampleMillis: Double = 0,
+                prefillMillis: Double = 0,
+                prefillChunks: Int = 0,
+                prefillChunkMaxMillis: Double = 0,
                 peakRSSMB: Int = 0,
+                kvCacheBytes: Int = 0,
+                kvCellsUsed: Int = 0,
+                specDraftedTokens: Int = 0,
+                specAcceptedTokens: Int = 0,
+                specLookupDraftedTokens: Int = 0,
+                specLookupAcceptedTokens: Int = 0,
+                prefixCacheHits: Int = 0,
+                prefixCacheMisses: Int = 0,
+                streamPiecesDropped: Int = 0,
+                stopReason: StopReason = .endOfGeneration,
                 success: Bool = true) {
         self.chip = chip
         self.ramGB = ramGB
@@ -143,13 +329,54 @@ public struct LLMMetrics: Sendable, Equatable {
         self.promptTokens = promptTokens
         self.completionTokens = completionTokens
         self.totalTokens = totalTokens
+        self.promptTokensReused = promptTokensReused
         self.tokPerSec = tokPerSec
         self.totalDurationMillis = totalDurationMillis
+        self.sampleMillis = sampleMillis
+        self.prefillMillis = prefillMillis
+        self.prefillChunks = prefillChunks
+        self.prefillChunkMaxMillis = prefillChunkMaxMillis
         self.peakRSSMB = peakRSSMB
+        self.kvCacheBytes = kvCacheBytes
+        self.kvCellsUsed = kvCellsUsed
+        self.specDraftedTokens = specDraftedTokens
+        self.specAcceptedTokens = specAcceptedTokens
+        self.specLookupDraftedTokens = specLookupDraftedTokens
+        self.specLookupAcceptedTokens = specLookupAcceptedTokens
+        self.prefixCacheHits = prefixCacheHits
+        self.prefixCacheMisses = prefixCacheMisses
+        self.streamPiecesDropped = streamPiecesDropped
+        self.stopReason = stopReason
         self.success = success
     }
 }
 
+/// Log-probabilities of one generated token (`GenerateOptions.onLogprobs`), natural log, from
+/// the model's distribution after `logitBias`. Inside a `constraint`ed value they are not
+/// renormalized over the allowed tokens, and `top` may list tokens the constraint rules out.
+public struct TokenLogprobs: Sendable, Equatable {
+    public struct Alternative: Sendable, Equatable {
+        public let tokenID: Int32
+        public let logprob: Float
+
+        public init(tokenID: Int32, logprob: Float) {
+            self.tokenID = tokenID
+            self.logprob = logprob
+        }
+    }
+
+    public let tokenID: Int32
+    public let logprob: Float
+    /// Most likely tokens at this position, most likely first.
+    public let top: [Alternative]
+
+    public init(tokenID: Int32, logprob: Float, top: [Alternative]) {
+        self.tokenID = tokenID
+        self.logprob = logprob
+        self.top = top
+    }
+}
+
 ///
 /// Event ordering contract:
 /// 1) Optional early `.metrics` exactly once when first token is ready (TTFB).
@@ -181,6 +408,18 @@ public enum LLMEvent: Sendable, Equatable {
     case done
 }
 
+/// An event of one branch of `LLMEngine.generateBranches`.
+public struct BranchEvent: Sendable, Equatable {
+    /// Index of the branch, `0..<count`.
+    public let branch: Int
+    public let event: LLMEvent
+
+    public init(branch: Int, event: LLMEvent) {
+        self.branch = branch
+        self.event = event
+    }
+}
+
 // MARK: - Protocols
 
 public protocol LLMEngine: AnyObject, Sendable {
@@ -213,9 +452,53 @@ public protocol LLMEngine: AnyObject, Sendable {
     /// }
     /// ```
     func generate(prompt: String, options: GenerateOptions) -> AsyncThrowingStream<LLMEvent, Error>
+    /// Cancels the most recently started generation that is still running; other concurrent
+    /// streams are unaffected. Dropping a stream before `.done` cancels its generation too.
     func cancelCurrent()
     /// Snapshot of the last run's final `.metrics` (not live). Matches the payload of the final `.metrics` event.
     var stats: LLMMetrics { get }
+    /// Number of tokens `text` occupies when sent as a prompt (BOS and special tokens as
+    /// `generate` tokenizes them), for context budgeting without running generation.
+    /// - Throws: `LLMError.notLoaded`, `.runtimeFailure(code: -1)` on the stub runtime, or
+    ///   `.unsupported` from engines without a tokenizer (the default implementation).
+    func tokenCount(of text: String) throws -> Int
+    /// `count` completions of one prompt, e.g. candidates to rank: the prompt is prefilled once
+    /// and its KV cache forked to every branch, which then decode together, so the cost is
+    /// about one prefill plus batched decoding rather than `count` full runs. Branch `k`
+    /// samples with seed `options.seed + k` (independent random seeds when `seed` is not positive); with
+    /// `greedy` every branch is the same. Branch events interleave; each branch ends with its
+    /// own `.metrics` and `.done`, and the stream finishes after the last.
+    /// - Throws (from the stream): `LLMError.notLoaded`, `.runtimeFailure(code: -1)` when
+    ///   `count` exceeds the runtime's concurrent sequences, or `.unsupported` from engines
+    ///   without a runtime (the default implementation).
+    func generateBranches(prompt: String, count: Int, options: GenerateOptions) -> AsyncThrowingStream<BranchEvent, Error>
+    /// Id of the single token `text` encodes to, special tokens such as `<|user|>` included,
+    /// for `GenerateOptions.logitBias`; `nil` when the text is more than one token. The
+    /// runtime caches answers, so repeat lookups are cheap.
+    /// - Throws: `LLMError.notLoaded`, `.runtimeFailure(code: -1)` on the stub runtime, or
+    ///   `.unsupported` from engines without a tokenizer (the default implementation).
+    func tokenID(for text: String) throws -> Int32?
+    /// Sentence embeddings for `texts` from the loaded model, batched into as few decodes as
+    /// fit. Runs on a context of its own, so it does not disturb an ongoing `generate`.
+    /// - Throws: `LLMError.notLoaded`, `.runtimeFailure(code:)` with the `llm_embed` code
+    ///   (`-1` on the stub runtime, `-3` for a text longer than the batch), or `.unsupported`
+    ///   from engines without a runtime (the default implementation).
+    func embeddings(for texts: [String], pooling: EmbeddingPooling, normalize: Bool) throws -> [[Float]]
+    /// Saves the KV cache of the engine's primary sequence (the last prompt and completion)
+    /// to `url`, e.g. after priming a long system prompt and tool schemas. The file is tied
+    /// to the loaded model, context size and KV cache type. Returns the tokens saved.
+    /// - Throws: `LLMError.notLoaded`, `.runtimeFailure(code:)` with the `llm_state_save`
+    ///   code (`-1` also when a generation is using the primary sequence), or `.unsupported`
+    ///   from engines without a runtime (the default implementation).
+    @discardableResult
+    func saveSessionState(to url: URL) throws -> Int
+    /// Restores a snapshot written by `saveSessionState(to:)` so the next `generate` whose
+    /// prompt starts with the saved tokens skips their prefill. Memory-mapped: a 4k-token
+    /// prefix restores in milliseconds. Returns the tokens restored.
+    /// - Throws: as `saveSessionState(to:)`; `.runtimeFailure(code: -3)` means the snapshot
+    ///   belongs to a different model or configuration and the caller should prefill instead.
+    @discardableResult
+    func loadSessionState(from url: URL) throws -> Int
 }
 
 /// Returns the model's embedded chat template when available for this engine instance.
@@ -228,6 +511,63 @@ public func engineChatTemplate(_ engine: LLMEngine) -> String? {
     return nil
 }
 
+/// How `LLMEngine.embeddings(for:pooling:normalize:)` reduces a text's token vectors to one.
+public enum EmbeddingPooling: Int, Sendable {
+    /// Average of all tokens.
+    case mean = 0
+    /// First token (BERT-style `[CLS]`).
+    case cls = 1
+    /// Last token (decoder-only embedding models).
+    case last = 2
+}
+
+public extension LLMEngine {
+    func tokenCount(of text: String) throws -> Int {
+        throw LLMError.unsupported("token counting")
+    }
+
+    func generateBranches(prompt: String, count: Int, options: GenerateOptions) -> AsyncThrowingStream<BranchEvent, Error> {
+        AsyncThrowingStream { $0.finish(throwing: LLMError.unsupported("branched generation")) }
+    }
+
+    func generateBranches(prompt: String, count: Int) -> AsyncThrowingStream<BranchEvent, Error> {
+        generateBranches(prompt: prompt, count: count, options: .init())
+    }
+
+    func tokenID(for text: String) throws -> Int32? {
+        throw LLMError.unsupported("token ids")
+    }
+
+    func embeddings(for texts: [String], pooling: EmbeddingPooling, normalize: Bool) throws -> [[Float]] {
+        throw LLMError.unsupported("embeddings")
+    }
+
+    /// Mean-pooled, normalized embeddings.
+    func embeddings(for texts: [String]) throws -> [[Float]] {
+        try embeddings(for: texts, pooling: .mean, normalize: true)
+    }
+
+    /// Normalized embeddings.
+    func embeddings(for texts: [String], pooling: EmbeddingPooling) throws -> [[Float]] {
+        try embeddings(for: texts, pooling: pooling, normalize: true)
+    }
+
+    /// Mean-pooled embeddings.
+    func embeddings(for texts: [String], normalize: Bool) throws -> [[Float]] {
+        try embeddings(for: texts, pooling: .mean, normalize: normalize)
+    }
+
+    @discardableResult
+    func saveSessionState(to url: URL) throws -> Int {
+        throw LLMError.unsupported("session state snapshots")
+    }
+
+    @discardableResult
+    func loadSessionState(from url: URL) throws -> Int {
+        throw LLMError.unsupported("session state snapshots")
+    }
+}
+
 public protocol ModelStore: Sendable {
     /// Ensure the model described by `spec` is available locally.
     /// Returns the file URL and provenance. UI should use `location.url` and may display `location.source`.
@@ -268,6 +608,8 @@ public struct BundledCatalogEntry: Codable, Sendable, Equatable {
     public let path: String
     public let minRamGB: Int?
     public let arch: [String]?
+    /// Name of another catalog entry to use as this model's speculative-decoding draft.
+    public var draft: String? = nil
 }
 
 public struct BundledCatalog: Codable, Sendable, Equatable {
@@ -387,4 +729,17 @@ public enum BundledModelSelector {
         for e in othersSorted { if !list.contains(e) { list.append(e) } }
         return list
     }
+
+    /// The draft entry paired with `target` through its `draft` field, preferring the same
+    /// quantization. Nil when the target has no draft or none of its entries fits `caps`
+    /// alongside the target (RAM minimums are summed).
+    public static func draft(for target: BundledCatalogEntry, catalog: [BundledCatalogEntry], caps: DeviceCaps) -> BundledCatalogEntry? {
+        guard let name = target.draft, name != target.name else { return nil }
+        let fits = catalog.filter { e in
+            guard e.name == name else { return false }
+            if let allowed = e.arch, !allowed.isEmpty, !allowed.contains(caps.arch) { return false }
+            return (target.minRamGB ?? 0) + (e.minRamGB ?? 0) <= caps.ramGB
+        }
+        return fits.first(where: { $0.quant == target.quant }) ?? fits.first
+    }
 }
@@ -15,6 +15,7 @@ public enum ModelIndexGenerator {
         let path: String
         var minRamGB: Int?
         var arch: [String]?
+        var draft: String? = nil
     }
     struct Catalog: Codable, Equatable {
         let embedded: Bool
@@ -29,18 +30,19 @@ public enum ModelIndexGenerator {
                                outputURL: URL,
                                embedded: Bool = true) throws {
         var entries = scan(modelsRoot: modelsRoot)
-        // Merge existing minRamGB/arch if output exists
+        // Merge existing minRamGB/arch/draft if output exists
         if FileManager.default.fileExists(atPath: outputURL.path),
            let data = try? Data(contentsOf: outputURL),
            let existing = try? JSONDecoder().decode(Catalog.self, from: data) {
-            let capsByKey: [String: (Int?, [String]?)] = Dictionary(uniqueKeysWithValues: existing.models.map { e in
-                ((e.name + "|" + e.quant), (e.minRamGB, e.arch))
+            let capsByKey: [String: (Int?, [String]?, String?)] = Dictionary(uniqueKeysWithValues: existing.models.map { e in
+                ((e.name + "|" + e.quant), (e.minRamGB, e.arch, e.draft))
             })
             entries = entries.map { e in
                 var copy = e
                 if let caps = capsByKey[e.name + "|" + e.quant] {
                     copy.minRamGB = caps.0
                     copy.arch = caps.1
+                    copy.draft = caps.2
                 }
                 return copy
             }
@@ -8,6 +8,8 @@ public struct ModelSelectionResult: Sendable, Equatable {
     public let chosenQuant: String
     public let url: URL
     public let source: ModelLocation.Source
+    /// Speculative-decoding draft paired with the chosen model in the catalog, if bundled.
+    public var draftURL: URL? = nil
 }
 
 /// Helper for CLI and apps to resolve a bundled model automatically without downloads.
@@ -37,6 +39,10 @@ public enum ModelAutoSelection {
         let requestedQuant = spec.quant.rawValue
 
         if let data = readCatalogData(from: bundle), let catalog = try? JSONDecoder().decode(BundledCatalog.self, from: data) {
+            func draftURL(for entry: BundledCatalogEntry) -> URL? {
+                guard let d = BundledModelSelector.draft(for: entry, catalog: catalog.models, caps: caps) else { return nil }
+                return BundledModelLocator.resolvePath(d.path, in: bundle) ?? BundledModelLocator.locate(name: d.name, quant: d.quant, in: bundle)
+            }
             // Exact entry first (subject to caps)
             if let exact = catalog.models.first(where: { $0.name == requestedName && $0.quant == requestedQuant }) {
                 let passes: Bool = {
@@ -50,7 +56,8 @@ public enum ModelAutoSelection {
                                                 chosenName: exact.name,
                                                 chosenQuant: exact.quant,
                                                 url: url,
-                                                source: .bundled)
+                                                source: .bundled,
+                                                draftURL: draftURL(for: exact))
                 }
             }
 
@@ -62,7 +69,8 @@ public enum ModelAutoSelection {
                                                 chosenName: chosen.name,
                                                 chosenQuant: chosen.quant,
                                                 url: url,
-                                                source: .bundled)
+                                                source: .bundled,
+                                                draftURL: draftURL(for: chosen))
                 }
             }
 
@@ -23,6 +23,31 @@ final class ModelSelectionTests: XCTestCase {
         XCTAssertTrue(rv.url.path.contains("gpt-oss-7b"))
     }
 
+    func testCatalogPairsDraftWithTarget() throws {
+        let bundle = Bundle.module
+        let spec = LLMModelSpec(name: "gpt-oss-20b", quant: .q4_K_M, contextTokens: 4096)
+        let rv = try ModelAutoSelection.resolve(spec: spec, caps: DeviceCaps(ramGB: 32, arch: "arm64"), in: bundle)
+        XCTAssertEqual(rv.chosenName, "gpt-oss-20b")
+        XCTAssertTrue(rv.draftURL?.path.contains("gpt-oss-7b") ?? false)
+
+        // the 7B fallback has no draft of its own
+        let small = try ModelAutoSelection.resolve(spec: spec, caps: DeviceCaps(ramGB: 12, arch: "arm64"), in: bundle)
+        XCTAssertEqual(small.chosenName, "gpt-oss-7b")
+        XCTAssertNil(small.draftURL)
+    }
+
+    func testDraftSelectorPrefersSameQuantAndRespectsRAM() {
+        let target = BundledCatalogEntry(name: "big", quant: "q4_K_M", path: "big.gguf", minRamGB: 16, arch: nil, draft: "small")
+        let cat: [BundledCatalogEntry] = [
+            target,
+            .init(name: "small", quant: "q8_0", path: "small-q8.gguf", minRamGB: 4, arch: nil),
+            .init(name: "small", quant: "q4_K_M", path: "small-q4.gguf", minRamGB: 2, arch: nil),
+        ]
+        XCTAssertEqual(BundledModelSelector.draft(for: target, catalog: cat, caps: DeviceCaps(ramGB: 32, arch: "arm64"))?.quant, "q4_K_M")
+        XCTAssertNil(BundledModelSelector.draft(for: target, catalog: cat, caps: DeviceCaps(ramGB: 17, arch: "arm64")))
+        XCTAssertNil(BundledModelSelector.draft(for: cat[1], catalog: cat, caps: DeviceCaps(ramGB: 32, arch: "arm64")))
+    }
+
     func testNoMatchReturnsError() {
         let bundle = Bundle.module
         let caps = DeviceCaps(ramGB: 6, arch: "x86_64")
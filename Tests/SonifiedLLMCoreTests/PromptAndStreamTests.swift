@@ -70,6 +70,28 @@ final class SonifiedLLMCoreTests: XCTestCase {
         }
     }
 
+    func testMockEngineReportsUnsupportedCapabilities() async throws {
+        let engine: LLMEngine = MockLLMEngine()
+        try await engine.load(modelURL: URL(fileURLWithPath: "/dev/null"), spec: .init(name: "gpt-oss-20b", quant: .q4_K_M, contextTokens: 4096))
+        func assertUnsupported(_ body: () throws -> Void) {
+            XCTAssertThrowsError(try body()) { error in
+                guard case LLMError.unsupported = error else { return XCTFail("unexpected \(error)") }
+            }
+        }
+        assertUnsupported { _ = try engine.tokenCount(of: "hi") }
+        assertUnsupported { _ = try engine.tokenID(for: "<|user|>") }
+        assertUnsupported { _ = try engine.embeddings(for: ["hi"]) }
+        assertUnsupported { try engine.saveSessionState(to: URL(fileURLWithPath: "/dev/null")) }
+        assertUnsupported { try engine.loadSessionState(from: URL(fileURLWithPath: "/dev/null")) }
+        do {
+            for try await _ in engine.generateBranches(prompt: "hi", count: 2) {}
+            XCTFail("Expected throw for branches")
+        } catch LLMError.unsupported {
+            // expected
+        }
+        await engine.unload()
+    }
+
     func testCancelMidStreamEmitsFinalMetricsThenDone() async throws {
         let engine = MockLLMEngine()
         try await engine.load(modelURL: URL(fileURLWithPath: "/dev/null"), spec: .init(name: "gpt-oss-20b", quant: .q4_K_M, contextTokens: 4096))
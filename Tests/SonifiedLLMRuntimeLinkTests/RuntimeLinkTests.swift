@@ -34,24 +34,324 @@ final class RuntimeLinkTests: XCTestCase {
         llm_free(handle)
     }
 
+    func testSubmitPollStub() throws {
+        let handle = llm_init("stub")
+        XCTAssertNotNil(handle)
+        defer { llm_free(handle) }
+
+        let seq = "hi".withCString { llm_submit(handle, $0, nil) }
+        XCTAssertGreaterThan(seq, 0)
+        var events = [llm_seq_event_t](repeating: llm_seq_event_t(), count: 8)
+        let n = events.withUnsafeMutableBufferPointer { llm_poll(handle, seq, $0.baseAddress, Int32($0.count), 1000) }
+        XCTAssertEqual(n, 2)
+        XCTAssertEqual(events[0].kind, Int32(LLM_SEQ_EVENT_TOKEN.rawValue))
+        XCTAssertEqual(events[1].kind, Int32(LLM_SEQ_EVENT_DONE.rawValue))
+        XCTAssertEqual(events[1].stats.success, 1)
+        // terminal event drained: the sequence is gone
+        XCTAssertEqual(events.withUnsafeMutableBufferPointer { llm_poll(handle, seq, $0.baseAddress, Int32($0.count), 0) }, -1)
+    }
+
+    func testEvalStreamStub() throws {
+        let handle = llm_init("stub")
+        XCTAssertNotNil(handle)
+        defer { llm_free(handle) }
+        let stream = llm_stream_create(0, Int32(LLM_STREAM_BLOCK.rawValue))
+        XCTAssertNotNil(stream)
+        defer { llm_stream_free(stream) }
+
+        XCTAssertEqual("hi".withCString { llm_eval_stream(handle, $0, nil, stream) }, 0)
+        var buffer = [CChar](repeating: 0, count: 64)
+        let n = buffer.withUnsafeMutableBufferPointer { llm_stream_read(stream, $0.baseAddress, Int32($0.count), 0) }
+        XCTAssertEqual(n, 2) // "ok"
+        XCTAssertEqual(buffer.withUnsafeMutableBufferPointer { llm_stream_read(stream, $0.baseAddress, Int32($0.count), 0) }, -1)
+        // one generation per stream
+        XCTAssertNotEqual("hi".withCString { llm_eval_stream(handle, $0, nil, stream) }, 0)
+    }
+
+    func testStateSnapshotsNeedAModel() async throws {
+        try withStubHandle { handle in
+            let path = temporaryPath("state")
+            XCTAssertEqual(path.withCString { llm_state_save(handle, $0) }, -1)
+            XCTAssertEqual(path.withCString { llm_state_load(handle, $0) }, -1)
+            XCTAssertFalse(FileManager.default.fileExists(atPath: path))
+        }
+        let path = temporaryPath("state")
+        XCTAssertThrowsError(try LLMEngineImpl().saveSessionState(to: URL(fileURLWithPath: path))) { error in
+            guard case LLMError.notLoaded = error else { return XCTFail("unexpected \(error)") }
+        }
+        try await withStubEngine { engine in
+            XCTAssertThrowsError(try engine.loadSessionState(from: URL(fileURLWithPath: path))) { error in
+                guard case LLMError.runtimeFailure(let code) = error else { return XCTFail("unexpected \(error)") }
+                XCTAssertEqual(code, -1)
+            }
+        }
+    }
+
+    func testEmbeddingsNeedAModel() async throws {
+        try withStubHandle { handle in
+            XCTAssertEqual(llm_embed_dim(handle), -1)
+            var out = [Float](repeating: 0, count: 8)
+            let rc = "hi".withCString { text -> Int32 in
+                var texts: [UnsafePointer<CChar>?] = [text]
+                return out.withUnsafeMutableBufferPointer { llm_embed(handle, &texts, 1, $0.baseAddress, 8) }
+            }
+            XCTAssertEqual(rc, -1)
+        }
+        try await withStubEngine { engine in
+            XCTAssertEqual(try engine.embeddings(for: []), [])
+            XCTAssertThrowsError(try engine.embeddings(for: ["hi"])) { error in
+                guard case LLMError.runtimeFailure(let code) = error else { return XCTFail("unexpected \(error)") }
+                XCTAssertEqual(code, -1)
+            }
+        }
+    }
+
+    func testConstraintsNeedAModel() async throws {
+        try withStubHandle { handle in
+            XCTAssertEqual(llm_constraint_create(handle, Int32(LLM_CONSTRAINT_JSON.rawValue), "{\"type\":\"object\"}"), -1)
+            XCTAssertEqual(llm_constraint_free(handle, 1), -1)
+        }
+        // the stub runtime generates its fixed text regardless of the constraint
+        try await withStubEngine { engine in
+            var opts = GenerateOptions(maxTokens: 8)
+            opts.constraint = .jsonSchema("{\"type\":\"object\"}")
+            let text = try await generatedText(engine, "hi", opts)
+            XCTAssertFalse(text.isEmpty)
+        }
+    }
+
+    func testTokenIDsNeedAModel() async throws {
+        try withStubHandle { handle in
+            XCTAssertEqual(llm_token_id(handle, "<|user|>"), -1)
+        }
+        // the stub runtime has no tokenizer and ignores the bias
+        try await withStubEngine { engine in
+            XCTAssertThrowsError(try engine.tokenID(for: "<|user|>"))
+            var opts = GenerateOptions(maxTokens: 8)
+            opts.logitBias = [1: -.infinity, 2: 2.5]
+            let text = try await generatedText(engine, "hi", opts)
+            XCTAssertFalse(text.isEmpty)
+        }
+    }
+
+    func testLogprobsStreamTheSameText() async throws {
+        try withStubHandle { handle in
+            XCTAssertEqual(llm_eval_logprobs(handle, "hi", nil, LLM_TOP_LOGPROBS_MAX + 1, { _, _ in }, nil), -1)
+        }
+        // the stub runtime has no logits: the text arrives token by token and onLogprobs is never called
+        try await withStubEngine { engine in
+            let plain = try await generatedText(engine, "hi", GenerateOptions(maxTokens: 8))
+            var opts = GenerateOptions(maxTokens: 8)
+            opts.onLogprobs = { _ in XCTFail("stub runtime reported logprobs") }
+            opts.topLogprobs = 5
+            var text = ""
+            var sawDone = false
+            for try await ev in engine.generate(prompt: "hi", options: opts) {
+                switch ev {
+                case .token(let t): text += t
+                case .metrics: break
+                case .done: sawDone = true
+                }
+            }
+            XCTAssertEqual(text, plain)
+            XCTAssertTrue(sawDone)
+        }
+    }
+
+    func testBranchesShareOnePrompt() async throws {
+        try await withStubEngine { engine in
+            let texts = try await branchTexts(engine, "hi", 3, GenerateOptions(maxTokens: 8))
+            XCTAssertTrue(texts.allSatisfy { !$0.isEmpty })
+
+            // more branches than the runtime's concurrent sequences
+            do {
+                for try await _ in engine.generateBranches(prompt: "hi", count: 64) {}
+                XCTFail("expected a runtime failure")
+            } catch LLMError.runtimeFailure(let code) {
+                XCTAssertEqual(code, -1)
+            }
+        }
+    }
+
     func testChatTemplateStubAvailable() async throws {
         // Use the engine accessor to avoid hard link to the symbol in tests
-        let engine = LLMEngineImpl()
-        try await engine.load(modelURL: URL(fileURLWithPath: "stub"), spec: .init(name: "stub", quant: .q4_K_M, contextTokens: 128))
-        let s = engine.chatTemplate()
-        XCTAssertNotNil(s)
-        XCTAssertTrue(s!.contains("{{content}}"))
-        await engine.unload()
+        try await withStubEngine { engine in
+            let s = engine.chatTemplate()
+            XCTAssertNotNil(s)
+            XCTAssertTrue(s!.contains("{{content}}"))
+        }
     }
 
     func testEngineAccessorReturnsStubTemplate() async throws {
+        try await withStubEngine { engine in
+            let t = engineChatTemplate(engine)
+            XCTAssertNotNil(t)
+            XCTAssertTrue(t!.contains("{{content}}"))
+        }
+    }
+
+    // MARK: - With a model (SONIFIED_TEST_MODEL=/path/to/model.gguf; skipped otherwise)
+
+    func testStateSnapshotRoundTrip() async throws {
+        try await withModelEngine { engine in
+            let opts = GenerateOptions(maxTokens: 4, greedy: true)
+            _ = try await generatedText(engine, "The capital of France is", opts)
+            let url = URL(fileURLWithPath: temporaryPath("state"))
+            defer { try? FileManager.default.removeItem(at: url) }
+            let saved = try engine.saveSessionState(to: url)
+            XCTAssertGreaterThan(saved, 0)
+            XCTAssertEqual(try engine.loadSessionState(from: url), saved)
+            // the restored prefix is reused rather than prefilled again
+            _ = try await generatedText(engine, "The capital of France is", opts)
+            XCTAssertGreaterThan(engine.stats.promptTokensReused, 0)
+        }
+    }
+
+    func testEmbeddingsRankSimilarTexts() async throws {
+        try await withModelEngine { engine in
+            let v = try engine.embeddings(for: ["a cat sat on the mat", "a cat sat on the mat", "quarterly bond yields"])
+            XCTAssertEqual(v.count, 3)
+            XCTAssertTrue(v.allSatisfy { $0.count == v[0].count && !$0.isEmpty })
+            let dot = { (a: [Float], b: [Float]) in zip(a, b).reduce(Float(0)) { $0 + $1.0 * $1.1 } }
+            XCTAssertEqual(dot(v[0], v[0]), 1, accuracy: 1e-3) // normalized
+            XCTAssertEqual(dot(v[0], v[1]), 1, accuracy: 1e-3)
+            XCTAssertLessThan(dot(v[0], v[2]), dot(v[0], v[1]))
+        }
+    }
+
+    func testConstraintHoldsOutputToSchema() async throws {
+        try await withModelEngine { engine in
+            var opts = GenerateOptions(maxTokens: 96, greedy: true)
+            opts.constraint = .jsonSchema("{\"type\":\"object\",\"properties\":{\"city\":{\"type\":\"string\"},\"sunny\":{\"type\":\"boolean\"}},\"required\":[\"city\",\"sunny\"]}")
+            let text = try await generatedText(engine, "Describe the weather in Paris as JSON:", opts)
+            XCTAssertEqual(text.first { !$0.isWhitespace }, "{", text)
+            guard engine.stats.stopReason == .endOfGeneration else { return } // cut off by maxTokens
+            let object = try JSONSerialization.jsonObject(with: Data(text.utf8)) as? [String: Any]
+            XCTAssertTrue(object?["city"] is String, text)
+            XCTAssertNotNil(object?["sunny"] as? Bool, text)
+        }
+    }
+
+    func testTokenIDBansTheGreedyToken() async throws {
+        try await withModelEngine { engine in
+            XCTAssertGreaterThan(try engine.tokenCount(of: "The capital of France is"), 1)
+            XCTAssertNil(try engine.tokenID(for: "a phrase of several different words"))
+            var opts = GenerateOptions(maxTokens: 1, greedy: true)
+            let first = try await generatedText(engine, "The capital of France is", opts)
+            guard let id = try engine.tokenID(for: first) else { throw XCTSkip("first token '\(first)' does not round-trip") }
+            opts.logitBias = [id: -.infinity]
+            let banned = try await generatedText(engine, "The capital of France is", opts)
+            XCTAssertNotEqual(banned, first)
+        }
+    }
+
+    func testBranchesMatchGreedyGeneration() async throws {
+        try await withModelEngine { engine in
+            let opts = GenerateOptions(maxTokens: 12, greedy: true)
+            let single = try await generatedText(engine, "The capital of France is", opts)
+            let texts = try await branchTexts(engine, "The capital of France is", 3, opts)
+            XCTAssertEqual(texts, [single, single, single])
+        }
+    }
+
+    func testLogprobsDescribeTheGreedyTokens() async throws {
+        try await withModelEngine { engine in
+            let plain = try await generatedText(engine, "The capital of France is", GenerateOptions(maxTokens: 8, greedy: true))
+            let seen = LogprobLog()
+            var opts = GenerateOptions(maxTokens: 8, greedy: true)
+            opts.topLogprobs = 3
+            opts.onLogprobs = { seen.append($0) }
+            let text = try await generatedText(engine, "The capital of France is", opts)
+            XCTAssertEqual(text, plain)
+            let all = seen.entries
+            XCTAssertFalse(all.isEmpty)
+            for lp in all {
+                XCTAssertLessThanOrEqual(lp.logprob, 0)
+                XCTAssertEqual(lp.top.count, 3)
+                XCTAssertEqual(lp.top.first?.tokenID, lp.tokenID) // greedy picks the most likely token
+                XCTAssertEqual(lp.top.map(\.logprob), lp.top.map(\.logprob).sorted(by: >))
+            }
+        }
+    }
+
+    // MARK: - Fixtures
+
+    /// A raw stub runtime handle, freed after `body`.
+    private func withStubHandle(_ body: (UnsafeMutableRawPointer) throws -> Void) throws {
+        let handle = try XCTUnwrap(llm_init("stub"))
+        defer { llm_free(handle) }
+        try body(handle)
+    }
+
+    /// An engine loaded on the stub runtime, unloaded after `body`.
+    private func withStubEngine(_ body: (LLMEngineImpl) async throws -> Void) async throws {
+        try await withEngine(URL(fileURLWithPath: "stub"), contextTokens: 128, body)
+    }
+
+    /// An engine loaded with the model named by SONIFIED_TEST_MODEL; skips the test without one.
+    private func withModelEngine(_ body: (LLMEngineImpl) async throws -> Void) async throws {
+        guard let path = ProcessInfo.processInfo.environment["SONIFIED_TEST_MODEL"], !path.isEmpty else {
+            throw XCTSkip("SONIFIED_TEST_MODEL not set")
+        }
+        try await withEngine(URL(fileURLWithPath: path), contextTokens: 2048, body)
+    }
+
+    private func withEngine(_ url: URL, contextTokens: Int, _ body: (LLMEngineImpl) async throws -> Void) async throws {
         let engine = LLMEngineImpl()
-        try await engine.load(modelURL: URL(fileURLWithPath: "stub"), spec: .init(name: "stub", quant: .q4_K_M, contextTokens: 128))
-        let t = engine.chatTemplate()
-        XCTAssertNotNil(t)
-        XCTAssertTrue(t!.contains("{{content}}"))
+        try await engine.load(modelURL: url, spec: .init(name: url.lastPathComponent, quant: .q4_K_M, contextTokens: contextTokens))
+        do {
+            try await body(engine)
+        } catch {
+            await engine.unload()
+            throw error
+        }
         await engine.unload()
     }
+
+    private func generatedText(_ engine: LLMEngine, _ prompt: String, _ options: GenerateOptions) async throws -> String {
+        var text = ""
+        for try await ev in engine.generate(prompt: prompt, options: options) {
+            if case .token(let t) = ev { text += t }
+        }
+        return text
+    }
+
+    /// Text of each branch; every branch must finish.
+    private func branchTexts(_ engine: LLMEngine, _ prompt: String, _ count: Int, _ options: GenerateOptions) async throws -> [String] {
+        var texts = [String](repeating: "", count: count)
+        var done = Set<Int>()
+        for try await ev in engine.generateBranches(prompt: prompt, count: count, options: options) {
+            switch ev.event {
+            case .token(let t): texts[ev.branch] += t
+            case .done: done.insert(ev.branch)
+            case .metrics: break
+            }
+        }
+        XCTAssertEqual(done, Set(0..<count))
+        return texts
+    }
+
+    private func temporaryPath(_ prefix: String) -> String {
+        FileManager.default.temporaryDirectory.appendingPathComponent("\(prefix)-\(UUID().uuidString).bin").path
+    }
+}
+
+/// `TokenLogprobs` collected from the decode thread.
+private final class LogprobLog: @unchecked Sendable {
+    private let lock = NSLock()
+    private var items: [TokenLogprobs] = []
+
+    func append(_ lp: TokenLogprobs) {
+        lock.lock()
+        items.append(lp)
+        lock.unlock()
+    }
+
+    var entries: [TokenLogprobs] {
+        lock.lock()
+        defer { lock.unlock() }
+        return items
+    }
 }
 #endif
 
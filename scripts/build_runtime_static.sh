@@ -20,6 +20,7 @@ DEPLOYMENT_TARGET="${DEPLOYMENT_TARGET:-13.3}"
 CLANG="$(xcrun -f clang)"
 LIBTOOL="$(xcrun -f libtool)"
 HEADERS="RuntimeShim/include"
+SHIM_SOURCES=(RuntimeShim/src/*.c)
 
 if ! command -v cmake >/dev/null 2>&1; then
   echo "error: cmake not found. Install via Xcode command line tools or Homebrew." >&2
@@ -65,10 +66,15 @@ cmake --build "$BUILD_DIR/arm64" --config Release
 # Create per-arch unified static lib for verification
 echo "==> Preparing arm64 unified static lib for verification"
 mkdir -p "$BUILD_DIR/arm64"
-"$CLANG" -arch arm64 -isysroot "$(xcrun --sdk macosx --show-sdk-path)" -mmacosx-version-min="$DEPLOYMENT_TARGET" -I "$HEADERS" -I "vendor/llama.cpp/include" -I "vendor/llama.cpp/ggml/include" -std=c11 -O2 \
-  -c RuntimeShim/src/sonified_llama_stub.c -o "$BUILD_DIR/arm64/sonified_llama_stub.o"
+shim_objs=()
+for src in "${SHIM_SOURCES[@]}"; do
+  obj="$BUILD_DIR/arm64/$(basename "${src%.c}").o"
+  "$CLANG" -arch arm64 -isysroot "$(xcrun --sdk macosx --show-sdk-path)" -mmacosx-version-min="$DEPLOYMENT_TARGET" -I "$HEADERS" -I "vendor/llama.cpp/include" -I "vendor/llama.cpp/ggml/include" -std=c11 -O2 \
+    -c "$src" -o "$obj"
+  shim_objs+=("$obj")
+done
 "$LIBTOOL" -static -o "$BUILD_DIR/arm64/libsonified_llama.a" \
-  "$BUILD_DIR/arm64/sonified_llama_stub.o" \
+  "${shim_objs[@]}" \
   "$BUILD_DIR/arm64/src/libllama.a" \
   "$BUILD_DIR/arm64/ggml/src/libggml.a" \
   "$BUILD_DIR/arm64/ggml/src/libggml-cpu.a" \
@@ -119,10 +125,15 @@ cmake --build "$BUILD_DIR/x86_64" --config Release
 # Create per-arch unified static lib for verification
 echo "==> Preparing x86_64 unified static lib for verification"
 mkdir -p "$BUILD_DIR/x86_64"
-"$CLANG" -arch x86_64 -isysroot "$(xcrun --sdk macosx --show-sdk-path)" -mmacosx-version-min="$DEPLOYMENT_TARGET" -I "$HEADERS" -I "vendor/llama.cpp/include" -I "vendor/llama.cpp/ggml/include" -std=c11 -O2 \
-  -c RuntimeShim/src/sonified_llama_stub.c -o "$BUILD_DIR/x86_64/sonified_llama_stub.o"
+shim_objs=()
+for src in "${SHIM_SOURCES[@]}"; do
+  obj="$BUILD_DIR/x86_64/$(basename "${src%.c}").o"
+  "$CLANG" -arch x86_64 -isysroot "$(xcrun --sdk macosx --show-sdk-path)" -mmacosx-version-min="$DEPLOYMENT_TARGET" -I "$HEADERS" -I "vendor/llama.cpp/include" -I "vendor/llama.cpp/ggml/include" -std=c11 -O2 \
+    -c "$src" -o "$obj"
+  shim_objs+=("$obj")
+done
 "$LIBTOOL" -static -o "$BUILD_DIR/x86_64/libsonified_llama.a" \
-  "$BUILD_DIR/x86_64/sonified_llama_stub.o" \
+  "${shim_objs[@]}" \
   "$BUILD_DIR/x86_64/src/libllama.a" \
   "$BUILD_DIR/x86_64/ggml/src/libggml.a" \
   "$BUILD_DIR/x86_64/ggml/src/libggml-cpu.a" \
@@ -42,11 +42,13 @@ fi
 function compile_stub() {
   local arch="$1"
   local sysroot="$(xcrun --sdk macosx --show-sdk-path)"
-  local out_o="$BUILD_DIR/$arch/sonified_llama_stub.o"
   mkdir -p "$BUILD_DIR/$arch"
-  echo "==> Compiling shim stub ($arch)"
-  "$CLANG" -arch "$arch" -isysroot "$sysroot" -mmacosx-version-min=13.0 -I "$HEADERS" -I "vendor/llama.cpp/include" -I "vendor/llama.cpp/ggml/include" -std=c11 -O2 \
-    -c RuntimeShim/src/sonified_llama_stub.c -o "$out_o"
+  echo "==> Compiling shim sources ($arch)"
+  for src in RuntimeShim/src/*.c; do
+    local out_o="$BUILD_DIR/$arch/$(basename "${src%.c}").o"
+    "$CLANG" -arch "$arch" -isysroot "$sysroot" -mmacosx-version-min=13.0 -I "$HEADERS" -I "vendor/llama.cpp/include" -I "vendor/llama.cpp/ggml/include" -std=c11 -O2 \
+      -c "$src" -o "$out_o"
+  done
 }
 
 function combine() {
@@ -55,8 +57,13 @@ function combine() {
   local root="$BUILD_DIR/$arch"
 
   # Candidate libs to include if present
+  local shim_objs=()
+  for src in RuntimeShim/src/*.c; do
+    shim_objs+=("$root/$(basename "${src%.c}").o")
+  done
+
   local libs=(
-    "$root/sonified_llama_stub.o"
+    "${shim_objs[@]}"
     "$root/src/libllama.a"
     "$root/ggml/src/libggml.a"
     "$root/ggml/src/libggml-cpu.a"